@@ -0,0 +1,3070 @@
+/* adapter.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the CEC Adapter class for Python. Each Adapter owns a
+ * libcec instance, its configuration, callbacks and topology.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+// request the std format macros
+#define __STDC_FORMAT_MACROS
+
+#include "adapter.h"
+#include "args.h"
+#include "command.h"
+#include "config.h"
+#include "detect.h"
+#include "gilcheck.h"
+#include "device.h"
+#include "opcodes.h"
+#include "probes.h"
+#include "remote.h"
+#include "sim.h"
+#include <inttypes.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <new>
+
+using namespace CEC;
+
+int parse_physical_addr(const char * addr) {
+   int a, b, c, d;
+   if( sscanf(addr, "%x.%x.%x.%x", &a, &b, &c, &d) == 4 ) {
+      if( a > 0xF || b > 0xF || c > 0xF || d > 0xF ) return -1;
+      if( a < 0 || b < 0 || c < 0 || d < 0 ) return -1;
+      return (a << 12) | (b << 8) | (c << 4) | d;
+   } else {
+      return -1;
+   }
+}
+
+void parse_test() {
+   assert(parse_physical_addr("0.0.0.0") == 0);
+   assert(parse_physical_addr("F.0.0.0") == 0xF000);
+   assert(parse_physical_addr("0.F.0.0") == 0x0F00);
+   assert(parse_physical_addr("0.0.F.0") == 0x00F0);
+   assert(parse_physical_addr("0.0.0.F") == 0x000F);
+   assert(parse_physical_addr("-1.0.0.0") == -1);
+   assert(parse_physical_addr("0.-1.0.0") == -1);
+   assert(parse_physical_addr("0.0.-1.0") == -1);
+   assert(parse_physical_addr("0.0.0.-1") == -1);
+   assert(parse_physical_addr("foo") == -1);
+   assert(parse_physical_addr("F.F.F.F") == 0xFFFF);
+   assert(parse_physical_addr("f.f.f.f") == 0xFFFF);
+}
+
+PyObject * build_physical_addr(uint16_t pa) {
+   if( pa == PHYSICAL_ADDR_INVALID ) {
+      Py_RETURN_NONE;
+   }
+   char strAddr[8];
+   snprintf(strAddr, 8, "%x.%x.%x.%x",
+         (pa >> 12) & 0xF,
+         (pa >> 8) & 0xF,
+         (pa >> 4) & 0xF,
+         pa & 0xF);
+   return Py_BuildValue("s", strAddr);
+}
+
+static AdapterCache adapter_cache;
+
+std::vector<CEC_ADAPTER_TYPE> get_adapters(Backend * lib, bool full,
+      bool rescan) {
+   std::vector<CEC_ADAPTER_TYPE> res;
+   // release the Global Interpreter lock
+   Py_BEGIN_ALLOW_THREADS
+   // get adapters; this only scans if hotplug reported a change
+   res = adapter_cache.Get(lib, full, rescan);
+   // acquire the GIL before returning to code that uses python objects
+   Py_END_ALLOW_THREADS
+   return res;
+}
+
+PyObject * build_logical_addr(cec_logical_address addr) {
+   if( addr == CECDEVICE_UNKNOWN ) {
+      Py_RETURN_NONE;
+   }
+   return Py_BuildValue("b", addr);
+}
+
+Backend * AdapterLib(Adapter * self) {
+   Backend * lib = self->lib.load(std::memory_order_acquire);
+   if( lib ) {
+      return lib;
+   }
+
+   // libcec may log through our callbacks while it starts up, so neither
+   // wait for nor run the initialization while holding the GIL
+   Py_BEGIN_ALLOW_THREADS
+   {
+      std::lock_guard<std::mutex> guard(*self->lib_lock);
+      lib = self->lib.load(std::memory_order_relaxed);
+      if( !lib ) {
+         lib = GilCheckBackendNew(LibcecBackendNew(self->config));
+         if( lib ) {
+            self->lib.store(lib, std::memory_order_release);
+         }
+      }
+   }
+   Py_END_ALLOW_THREADS
+
+   if( !lib ) {
+      PyErr_SetString(PyExc_IOError, "Failed to initialize libcec");
+   }
+   return lib;
+}
+
+// the kinds of bus an adapter URL can select instead of libcec
+enum UrlBus {
+   URL_SIM,       // sim://, a simulated bus
+   URL_REMOTE,    // unix://, the adapter of a cec server
+};
+
+static bool is_url_bus(Backend * lib, UrlBus bus) {
+#if HAVE_SIM_BACKEND
+   if( bus == URL_SIM ) return dynamic_cast<SimBackend *>(lib) != NULL;
+#endif
+#if HAVE_CEC_SERVER
+   if( bus == URL_REMOTE ) return dynamic_cast<RemoteBackend *>(lib) != NULL;
+#endif
+   return false;
+}
+
+// like AdapterLib, but start the bus an adapter URL selects
+static Backend * AdapterUrlLib(Adapter * self, UrlBus bus) {
+   Backend * lib = NULL;
+   bool running = false;
+   Py_BEGIN_ALLOW_THREADS
+   {
+      std::lock_guard<std::mutex> guard(*self->lib_lock);
+      lib = self->lib.load(std::memory_order_relaxed);
+      if( !lib ) {
+         lib = GilCheckBackendNew(bus == URL_SIM ?
+               SimBackendNew(self->config) : RemoteBackendNew(self->config));
+         if( lib ) {
+            self->lib.store(lib, std::memory_order_release);
+         }
+      } else if( !is_url_bus(lib->Target(), bus) ) {
+         running = true;
+         lib = NULL;
+      }
+   }
+   Py_END_ALLOW_THREADS
+
+   if( running ) {
+      PyErr_SetString(PyExc_IOError, "Another bus is already running on "
+            "this adapter; use a new cec.Adapter for this one");
+   } else if( !lib && bus == URL_SIM ) {
+      PyErr_SetString(PyExc_IOError,
+            "The simulated bus requires libcec 4 or later");
+   } else if( !lib ) {
+      PyErr_SetString(PyExc_IOError,
+            "Connecting to a cec server requires libcec 4 or later and "
+            "UNIX sockets");
+   }
+   return lib;
+}
+
+static bool has_prefix(PyObject * adapter, const char * prefix) {
+   return adapter && PyUnicode_Check(adapter) &&
+      strncmp(PyUnicode_AsUTF8(adapter), prefix, strlen(prefix)) == 0;
+}
+
+// reconnect backoff, in seconds
+#define RECONNECT_INITIAL_DELAY 0.5
+#define RECONNECT_MAX_DELAY     30.0
+
+static PyObject * Adapter_init(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   PyObject * result = NULL;
+   const char * device_name = NULL;
+   int activate_source = -1;
+   int reconnect = 0;
+   const char * device_cache = NULL;
+   const char * dev = NULL;
+   std::vector<CEC_ADAPTER_TYPE> devs;
+   static const char * kwlist[] = {"adapter", "device_types", "device_name",
+      "activate_source", "reconnect", "device_cache", NULL};
+   PyObject * values[ARGS_MAX];
+
+   if( !ArgsParse("init", args, nargs, kwnames, kwlist, 0, values) ||
+         (values[2] && !ArgStringOrNone(values[2], "device_name",
+            &device_name)) ||
+         (values[3] && !ArgBool(values[3], &activate_source)) ||
+         (values[4] && !ArgBool(values[4], &reconnect)) ||
+         (values[5] && !ArgStringOrNone(values[5], "device_cache",
+            &device_cache)) ) {
+      return NULL;
+   }
+   PyObject * adapter = values[0];
+   PyObject * device_types = values[1];
+
+   cec_device_type_list types;
+   if( device_types && device_types != Py_None &&
+         !ConfigParseDeviceTypes(device_types, &types) ) {
+      return NULL;
+   }
+   if( device_name && strlen(device_name) > 12 ) {
+      PyErr_SetString(PyExc_ValueError,
+            "Device name must be at most 12 characters");
+      return NULL;
+   }
+
+   // libcec reads its configuration once, when it is initialized; if that
+   // already happened the new settings are pushed after opening instead
+   bool reconfigure = false;
+   if( (device_types && device_types != Py_None) || device_name ||
+         activate_source >= 0 ) {
+      Py_BEGIN_ALLOW_THREADS
+      {
+         std::lock_guard<std::mutex> guard(*self->lib_lock);
+         if( device_types && device_types != Py_None ) {
+            self->config->deviceTypes = types;
+         }
+         if( device_name ) {
+            snprintf(self->config->strDeviceName, 13, "%s", device_name);
+         }
+         if( activate_source >= 0 ) {
+            self->config->bActivateSource = activate_source;
+         }
+         reconfigure = self->lib.load() != NULL;
+      }
+      Py_END_ALLOW_THREADS
+   }
+
+   // the devices from the last run are known before the bus is asked
+   if( device_cache ) {
+      std::string path(device_cache);
+      Py_BEGIN_ALLOW_THREADS
+      self->device_cache->Stop();
+      self->device_cache->Load(path);
+      for( int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++ ) {
+         DeviceInfo info;
+         if( self->device_cache->Find((cec_logical_address)i, &info) ) {
+            self->topology->SetPhysicalAddress((cec_logical_address)i,
+                  info.physical_address);
+         }
+      }
+      Py_END_ALLOW_THREADS
+   }
+
+   // the bus behind an adapter is fixed when it starts; sim:// selects the
+   // simulator and unix:// a cec server
+   Backend * lib;
+   if( has_prefix(adapter, SIM_URL_PREFIX) ) {
+      lib = AdapterUrlLib(self, URL_SIM);
+   } else if( has_prefix(adapter, REMOTE_URL_PREFIX) ) {
+      lib = AdapterUrlLib(self, URL_REMOTE);
+   } else {
+      lib = AdapterLib(self);
+   }
+   if( lib == NULL ) {
+      return NULL;
+   }
+
+   if( adapter == NULL || adapter == Py_None ) {
+      devs = get_adapters(lib);
+      if( devs.size() > 0 ) {
+#if HAVE_CEC_ADAPTER_DESCRIPTOR
+         dev = devs.front().strComName;
+#else
+         dev = devs.front().comm;
+#endif
+      } else {
+         PyErr_SetString(PyExc_Exception, "No default adapter found");
+      }
+   } else if( PyTuple_Check(adapter) && PyTuple_GET_SIZE(adapter) > 0 &&
+         PyUnicode_Check(PyTuple_GET_ITEM(adapter, 0)) ) {
+      // AdapterDescriptor; the first field is the port name
+      dev = PyUnicode_AsUTF8(PyTuple_GET_ITEM(adapter, 0));
+   } else if( PyUnicode_Check(adapter) ) {
+      dev = PyUnicode_AsUTF8(adapter);
+   } else {
+      PyErr_SetString(PyExc_TypeError,
+            "adapter must be a string or AdapterDescriptor");
+   }
+
+   if( dev ) {
+      bool success = false;
+      Py_BEGIN_ALLOW_THREADS
+      success = lib->Open(dev);
+      if( success && reconfigure ) {
+         std::lock_guard<std::mutex> guard(*self->lib_lock);
+         success = lib->SetConfiguration(self->config);
+      }
+      if( success ) {
+         // if libcec loaded its settings from the adapter, that is what is
+         // stored there now
+         libcec_configuration current;
+         if( lib->GetCurrentConfiguration(&current) ) {
+            std::lock_guard<std::mutex> guard(*self->config_lock);
+            *self->reported_config = current;
+            if( current.bGetSettingsFromROM ) {
+               delete self->persisted_config;
+               self->persisted_config = new libcec_configuration(current);
+            }
+         }
+      }
+      if( success && reconnect ) {
+         self->supervisor->Start(lib, dev, RECONNECT_INITIAL_DELAY,
+               RECONNECT_MAX_DELAY);
+      } else {
+         self->supervisor->Stop();
+      }
+      if( success ) {
+         self->device_cache->Start(lib);
+      }
+      Py_END_ALLOW_THREADS
+      if( success ) {
+         Py_INCREF(Py_None);
+         result = Py_None;
+      } else {
+         // the adapter may have gone away; don't trust the cached list
+         adapter_cache.Invalidate();
+         PyErr_Format(PyExc_IOError, "CEC failed to open %s", dev);
+      }
+   }
+
+   return result;
+}
+
+
+static PyObject * Adapter_close(Adapter * self, PyObject * args) {
+   // nothing to close if libcec was never started
+   Backend * lib = self->lib.load();
+   if( lib ) {
+      Py_BEGIN_ALLOW_THREADS
+      // an explicit close is not a connection loss
+      self->supervisor->Stop();
+      self->server->Stop();
+      self->ring->Close();
+      self->scheduler->Stop();
+      self->device_cache->Stop();
+      self->device_cache->Save();
+      lib->Close();
+      Py_END_ALLOW_THREADS
+   }
+   self->topology->Clear();
+
+   Py_INCREF(Py_None);
+   return Py_None;
+}
+
+static PyObject * Adapter_list_devices(Adapter * self, PyObject * unused) {
+   Backend * lib = AdapterLib(self);
+   if( lib == NULL ) return NULL;
+   cec_logical_addresses devices;
+   Py_BEGIN_ALLOW_THREADS
+   // asking libcec polls every address after a restart; the devices of
+   // the last run are the best answer until they were checked
+   if( !self->device_cache->Warming(&devices) ) {
+      devices = lib->GetActiveDevices();
+   }
+   Py_END_ALLOW_THREADS
+
+   PyObject * result = PyDict_New();
+   if( result == NULL ) return NULL;
+   for( uint8_t i=0; i<16; i++ ) {
+      if( devices[i] ) {
+         PyObject * key = Py_BuildValue("b", i);
+         PyObject * dev = key ? DeviceNew(self, (cec_logical_address)i) :
+            NULL;
+         int err = -1;
+         if( dev ) {
+            err = PyDict_SetItem(result, key, dev);
+         }
+         Py_XDECREF(key);
+         Py_XDECREF(dev);
+         if( err < 0 ) {
+            Py_DECREF(result);
+            return NULL;
+         }
+      }
+   }
+   return result;
+}
+
+static const char * callback_kwlist[] = {"callback", "events", NULL};
+
+static PyObject * Adapter_add_callback(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   PyObject * result = NULL;
+   PyObject * values[ARGS_MAX];
+   long int events = EVENT_ALL; // default to all events
+
+   if( ArgsParse("add_callback", args, nargs, kwnames, callback_kwlist, 1,
+            values) && (!values[1] || ArgLong(values[1], &events)) ) {
+      PyObject * callback = values[0];
+      // check that event is one of the allowed events
+      if( events & ~(EVENT_VALID) ) {
+         PyErr_SetString(PyExc_TypeError, "Invalid event(s) for callback");
+         return NULL;
+      }
+      if( !PyCallable_Check(callback)) {
+         PyErr_SetString(PyExc_TypeError, "parameter must be callable");
+         return NULL;
+      }
+
+      Py_INCREF(callback);
+      Callback new_cb(events, callback);
+
+      debug("Adding callback for event %ld\n", events);
+      std::lock_guard<std::mutex> guard(*self->callbacks_lock);
+      self->callbacks->push_back(new_cb);
+      self->stats->SetCallbacks(self->callbacks->size());
+
+      Py_INCREF(Py_None);
+      result = Py_None;
+   }
+   return result;
+}
+
+static PyObject * Adapter_remove_callback(Adapter * self,
+      PyObject * const * args, Py_ssize_t nargs, PyObject * kwnames) {
+  PyObject * values[ARGS_MAX];
+  long int events = EVENT_ALL; // default to all events
+
+  if( ArgsParse("remove_callback", args, nargs, kwnames, callback_kwlist, 1,
+           values) && (!values[1] || ArgLong(values[1], &events)) ) {
+     PyObject * callback = values[0];
+     std::lock_guard<std::mutex> guard(*self->callbacks_lock);
+     cb_list::iterator itr = self->callbacks->begin();
+     while( itr != self->callbacks->end() ) {
+        if( itr->cb == callback ) {
+           // clear out the given events for this callback
+           itr->event &= ~(events);
+           if( itr->event == 0 ) {
+              // if this callback has no events, remove it
+              itr = self->callbacks->erase(itr);
+              Py_DECREF(callback);
+              continue;
+           }
+        }
+        ++itr;
+     }
+     self->stats->SetCallbacks(self->callbacks->size());
+  } else {
+     return NULL;
+  }
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject * make_bound_method_args(PyObject * self, PyObject * args) {
+   Py_ssize_t count = 0;
+   if( PyTuple_Check(args) ) {
+      count = PyTuple_Size(args);
+   }
+   PyObject * result = PyTuple_New(count+1);
+   if( result == NULL ) {
+      return NULL;
+   }
+   assert(self != NULL);
+   Py_INCREF(self);
+   PyTuple_SetItem(result, 0, self);
+   for( Py_ssize_t i=0; i<count; i++ ) {
+      PyObject * arg = PyTuple_GetItem(args, i);
+      if( arg == NULL ) {
+         Py_DECREF(result);
+         return NULL;
+      }
+      Py_INCREF(arg);
+      PyTuple_SetItem(result, i+1, arg);
+   }
+   return result;
+}
+
+static PyObject * trigger_event(Adapter * self, long int event,
+      PyObject * args) {
+   assert(event & EVENT_ALL);
+
+   //debug("Triggering event %ld\n", event);
+
+   // snapshot the matching callbacks so that the lock isn't held while
+   // python code runs, and handlers may add or remove callbacks
+   std::vector<PyObject *> matched;
+   {
+      std::lock_guard<std::mutex> guard(*self->callbacks_lock);
+      for( cb_list::const_iterator itr = self->callbacks->begin();
+            itr != self->callbacks->end();
+            ++itr ) {
+         if( itr->event & event ) {
+            Py_INCREF(itr->cb);
+            matched.push_back(itr->cb);
+         }
+      }
+   }
+
+   PyObject * result = Py_None;
+   for( size_t i=0; i<matched.size(); i++ ) {
+      PyObject * cb = matched[i];
+      if( result == NULL ) {
+         // an earlier callback failed; just release the rest
+         Py_DECREF(cb);
+         continue;
+      }
+      //debug("Calling callback %d\n", i);
+      PyObject * callback = cb;
+      PyObject * arguments = args;
+      if( PyMethod_Check(cb) ) {
+         callback = PyMethod_Function(cb);
+         PyObject * method_self = PyMethod_Self(cb);
+         if( method_self ) {
+            // bound method, prepend self/cls to argument tuple
+            arguments = make_bound_method_args(method_self, args);
+         }
+      }
+      // see also: PyObject_CallFunction(...) which can take C args
+      PROBE2(handler__start, event, cb);
+      PyObject * temp = PyObject_CallObject(callback, arguments);
+      PROBE2(handler__done, event, temp != NULL);
+      self->stats->Handler(event, temp != NULL);
+      if( arguments != args ) {
+         Py_XDECREF(arguments);
+      }
+      if( temp ) {
+         debug("Callback succeeded\n");
+         Py_DECREF(temp);
+      } else {
+         debug("Callback failed\n");
+         result = NULL;
+      }
+      Py_DECREF(cb);
+   }
+
+   Py_XINCREF(result);
+   return result;
+}
+
+// deliver an event from a libcec callback, consuming args (which may be
+// NULL if building them failed). Exceptions can't propagate into libcec,
+// so they are reported as unraisable instead of being left pending on the
+// callback thread
+static void dispatch_event(Adapter * self, long int event, PyObject * args) {
+   PyObject * result = NULL;
+   if( args ) {
+      result = trigger_event(self, event, args);
+      Py_DECREF(args);
+   }
+   if( result == NULL ) {
+      PyErr_WriteUnraisable((PyObject*)self);
+   }
+   Py_XDECREF(result);
+}
+
+bool transmit_frame(Adapter * self, Backend * lib,
+      const cec_command & cmd, Supervisor::QueueResult * queued) {
+   *queued = self->supervisor->Queue(cmd);
+   if( *queued == Supervisor::NOT_QUEUED ) {
+      return send_frame(self, lib, cmd);
+   }
+   PROBE3(transmit__start, cmd.destination, cmd.opcode, cmd.initiator);
+   if( *queued == Supervisor::QUEUED ) {
+      PROBE3(transmit__done, cmd.destination, cmd.opcode, -1);
+      self->stats->Queued();
+   } else {
+      PROBE3(transmit__done, cmd.destination, cmd.opcode, 0);
+      self->stats->Transmitted(cmd.destination, false);
+   }
+   return false;
+}
+
+static PyObject * Adapter_transmit(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   unsigned char initiator = 'g';
+   unsigned char destination;
+   unsigned char opcode;
+   const char * params = NULL;
+   Py_ssize_t param_count = 0;
+   cec_command data;
+   static const char * kwlist[] = {"destination", "opcode", "parameters",
+      "initiator", NULL};
+   PyObject * values[ARGS_MAX];
+
+   if( !ArgsParse("transmit", args, nargs, kwnames, kwlist, 1, values) ) {
+      return NULL;
+   }
+   // a frame from cec.msg, or its parts
+   if( !values[1] && !values[2] &&
+         PyObject_TypeCheck(values[0], self->command_type) ) {
+      Command * cmd = (Command *)values[0];
+      if( !cmd->valid ) {
+         PyErr_SetString(PyExc_ValueError, "Command has no frame");
+         return NULL;
+      }
+      data = cmd->cmd;
+      destination = data.destination;
+      opcode = data.opcode;
+      if( data.initiator != CECDEVICE_UNKNOWN ) initiator = data.initiator;
+      if( values[3] && !ArgByte(values[3], &initiator) ) return NULL;
+   } else if( !values[1] ) {
+      PyErr_SetString(PyExc_TypeError,
+            "transmit() missing required argument 'opcode' (pos 2)");
+      return NULL;
+   } else if( ArgByte(values[0], &destination) &&
+         ArgByte(values[1], &opcode) &&
+         (!values[2] || ArgBytes(values[2], "parameters", &params,
+            &param_count)) &&
+         (!values[3] || ArgByte(values[3], &initiator)) ) {
+      if( param_count > CEC_MAX_DATA_PACKET_SIZE ) {
+         char errstr[1024];
+         snprintf(errstr, 1024, "Too many parameters, maximum is %d",
+            CEC_MAX_DATA_PACKET_SIZE);
+         PyErr_SetString(PyExc_ValueError, errstr);
+         return NULL;
+      }
+      data.destination = (cec_logical_address)destination;
+      data.opcode = (cec_opcode)opcode;
+      data.opcode_set = 1;
+      for( Py_ssize_t i=0; i<param_count; i++ ) {
+         data.parameters.PushBack(((uint8_t *)params)[i]);
+      }
+   } else {
+      return NULL;
+   }
+
+   Backend * lib = AdapterLib(self);
+   if( lib == NULL ) return NULL;
+   if( destination < 0 || destination > 15 ) {
+      PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
+      return NULL;
+   }
+   if( initiator != 'g' && (initiator < 0 || initiator > 15) ) {
+      PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
+      return NULL;
+   }
+   // don't spend bus time on frames that no device would accept
+   char errstr[1024];
+   if( !OpcodeCheck(data, errstr, sizeof(errstr)) ) {
+      PyErr_SetString(PyExc_ValueError, errstr);
+      return NULL;
+   }
+   // the primary address is filled in as the frame is sent, which for one
+   // queued during an outage is once the adapter is back
+   data.initiator = initiator == 'g' ? CECDEVICE_UNKNOWN :
+      (cec_logical_address)initiator;
+   bool success;
+   Supervisor::QueueResult queued;
+   Py_BEGIN_ALLOW_THREADS
+   success = transmit_frame(self, lib, data, &queued);
+   Py_END_ALLOW_THREADS
+   if( queued == Supervisor::QUEUED ) {
+      Py_RETURN_NONE;
+   }
+   RETURN_BOOL(success);
+}
+
+static PyObject * Adapter_is_active_source(Adapter * self,
+      PyObject * const * args, Py_ssize_t nargs, PyObject * kwnames) {
+   unsigned char addr;
+
+   static const char * kwlist[] = {"addr", NULL};
+   PyObject * values[ARGS_MAX];
+   if( !ArgsParse("is_active_source", args, nargs, kwnames, kwlist, 1,
+            values) || !ArgByte(values[0], &addr) ) {
+      return NULL;
+   }
+   if( addr < 0 || addr > 15 ) {
+      PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
+      return NULL;
+   } else {
+      // answer from the routing state when we have seen the active source
+      cec_logical_address active = self->topology->ActiveSource();
+      if( active != CECDEVICE_UNKNOWN ) {
+         return PyBool_FromLong(active == addr);
+      }
+      Backend * lib = AdapterLib(self);
+      if( lib == NULL ) return NULL;
+      RETURN_BOOL(lib->IsActiveSource((cec_logical_address)addr));
+   }
+}
+
+static PyObject * Adapter_set_active_source(Adapter * self,
+      PyObject * const * args, Py_ssize_t nargs, PyObject * kwnames) {
+   unsigned char devtype = (unsigned char)CEC_DEVICE_TYPE_RESERVED;
+
+   static const char * kwlist[] = {"device_type", NULL};
+   PyObject * values[ARGS_MAX];
+   if( !ArgsParse("set_active_source", args, nargs, kwnames, kwlist, 0,
+            values) || (values[0] && !ArgByte(values[0], &devtype)) ) {
+      return NULL;
+   }
+   if( devtype < 0 || devtype > 5 ) {
+      PyErr_SetString(PyExc_ValueError, "Device type must be between 0 and 5");
+      return NULL;
+   } else {
+      Backend * lib = AdapterLib(self);
+      if( lib == NULL ) return NULL;
+      RETURN_BOOL(lib->SetActiveSource((cec_device_type)devtype));
+   }
+}
+
+static PyObject * Adapter_volume_up(Adapter * self, PyObject * unused) {
+   Backend * lib = AdapterLib(self);
+   if( lib == NULL ) return NULL;
+   RETURN_BOOL(lib->VolumeUp());
+}
+
+static PyObject * Adapter_volume_down(Adapter * self, PyObject * unused) {
+   Backend * lib = AdapterLib(self);
+   if( lib == NULL ) return NULL;
+   RETURN_BOOL(lib->VolumeDown());
+}
+
+#if CEC_LIB_VERSION_MAJOR > 1
+static PyObject * Adapter_toggle_mute(Adapter * self, PyObject * unused) {
+   Backend * lib = AdapterLib(self);
+   if( lib == NULL ) return NULL;
+   RETURN_BOOL(lib->AudioToggleMute());
+}
+#endif
+
+static PyObject * Adapter_set_stream_path(Adapter * self, PyObject * arg) {
+   Backend * lib = AdapterLib(self);
+   if( lib == NULL ) return NULL;
+   Py_INCREF(arg);
+#if PY_MAJOR_VERSION >= 3
+   if(PyLong_Check(arg)) {
+      long arg_l = PyLong_AsLong(arg);
+#else
+   if(PyInt_Check(arg)) {
+      long arg_l = PyInt_AsLong(arg);
+#endif
+      Py_DECREF(arg);
+      if( arg_l < 0 || arg_l > 15 ) {
+         PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
+         return NULL;
+      } else {
+         bool success;
+         Py_BEGIN_ALLOW_THREADS
+         success = lib->SetStreamPath((cec_logical_address)arg_l);
+         Py_END_ALLOW_THREADS
+         if( success ) {
+            self->topology->SetActiveSource((cec_logical_address)arg_l, true);
+         }
+         return PyBool_FromLong(success);
+      }
+#if PY_MAJOR_VERSION >= 3
+   } else if(PyUnicode_Check(arg)) {
+      const char * arg_s = PyUnicode_AsUTF8(arg);
+#else
+   } else if(PyString_Check(arg)) {
+      char * arg_s = PyString_AsString(arg);
+#endif
+      if( arg_s ) {
+         int pa = parse_physical_addr(arg_s);
+         Py_DECREF(arg);
+         if( pa < 0 ) {
+            PyErr_SetString(PyExc_ValueError, "Invalid physical address");
+            return NULL;
+         } else {
+            bool success;
+            Py_BEGIN_ALLOW_THREADS
+            success = lib->SetStreamPath((uint16_t)pa);
+            Py_END_ALLOW_THREADS
+            if( success ) {
+               self->topology->SetRoute((uint16_t)pa);
+            }
+            return PyBool_FromLong(success);
+         }
+      } else {
+         Py_DECREF(arg);
+         return NULL;
+      }
+   } else if(PyUnicode_Check(arg)) {
+      // Convert from Unicode to ASCII
+      PyObject* ascii_arg = PyUnicode_AsASCIIString(arg);
+      if (NULL == ascii_arg) {
+         // Means the string can't be converted to ASCII, the codec failed
+         PyErr_SetString(PyExc_ValueError,
+            "Could not convert address to ASCII");
+         return NULL;
+      }
+
+      // Get the actual bytes as a C string
+      char * arg_s = PyByteArray_AsString(ascii_arg);
+      if( arg_s ) {
+         int pa = parse_physical_addr(arg_s);
+         Py_DECREF(arg);
+         if( pa < 0 ) {
+            PyErr_SetString(PyExc_ValueError, "Invalid physical address");
+            return NULL;
+         } else {
+            bool success;
+            Py_BEGIN_ALLOW_THREADS
+            success = lib->SetStreamPath((uint16_t)pa);
+            Py_END_ALLOW_THREADS
+            if( success ) {
+               self->topology->SetRoute((uint16_t)pa);
+            }
+            return PyBool_FromLong(success);
+         }
+      } else {
+         Py_DECREF(arg);
+         return NULL;
+      }
+   } else {
+      PyErr_SetString(PyExc_TypeError, "parameter must be string or int");
+      return NULL;
+   }
+}
+
+static PyObject * Adapter_active_source(Adapter * self, PyObject * unused) {
+   return build_logical_addr(self->topology->ActiveSource());
+}
+
+static PyObject * Adapter_active_route(Adapter * self, PyObject * unused) {
+   return build_physical_addr(self->topology->Route());
+}
+
+static PyObject * Adapter_topology(Adapter * self, PyObject * unused) {
+   PyObject * result = PyDict_New();
+   if( result == NULL ) return NULL;
+   for( int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++ ) {
+      uint16_t pa = self->topology->PhysicalAddress((cec_logical_address)i);
+      if( pa == PHYSICAL_ADDR_INVALID ) continue;
+      PyObject * key = Py_BuildValue("b", i);
+      PyObject * value = build_physical_addr(pa);
+      int err = -1;
+      if( key && value ) {
+         err = PyDict_SetItem(result, key, value);
+      }
+      Py_XDECREF(key);
+      Py_XDECREF(value);
+      if( err < 0 ) {
+         Py_DECREF(result);
+         return NULL;
+      }
+   }
+   return result;
+}
+
+static PyObject * Adapter_device_at(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   const char * addr_s;
+   static const char * kwlist[] = {"physical_address", NULL};
+   PyObject * values[ARGS_MAX];
+   if( !ArgsParse("device_at", args, nargs, kwnames, kwlist, 1, values) ||
+         !ArgString(values[0], "physical_address", &addr_s) ) {
+      return NULL;
+   }
+   int pa = parse_physical_addr(addr_s);
+   if( pa < 0 ) {
+      PyErr_SetString(PyExc_ValueError, "Invalid physical address");
+      return NULL;
+   }
+   return build_logical_addr(self->topology->DeviceAt((uint16_t)pa));
+}
+
+static PyObject * Adapter_port_device(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   unsigned char port;
+   const char * parent_s = NULL;
+   static const char * kwlist[] = {"port", "parent", NULL};
+   PyObject * values[ARGS_MAX];
+   if( !ArgsParse("port_device", args, nargs, kwnames, kwlist, 1, values) ||
+         !ArgByte(values[0], &port) ||
+         (values[1] && !ArgString(values[1], "parent", &parent_s)) ) {
+      return NULL;
+   }
+   int parent = 0;
+   if( parent_s ) {
+      parent = parse_physical_addr(parent_s);
+      if( parent < 0 ) {
+         PyErr_SetString(PyExc_ValueError, "Invalid physical address");
+         return NULL;
+      }
+   }
+   if( port < 1 || port > 15 ) {
+      PyErr_SetString(PyExc_ValueError, "Invalid port");
+      return NULL;
+   }
+   return build_logical_addr(
+         self->topology->DeviceBehindPort((uint16_t)parent, port));
+}
+
+static PyObject * Adapter_path_to(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   unsigned char addr;
+   static const char * kwlist[] = {"addr", NULL};
+   PyObject * values[ARGS_MAX];
+   if( !ArgsParse("path_to", args, nargs, kwnames, kwlist, 1, values) ||
+         !ArgByte(values[0], &addr) ) {
+      return NULL;
+   }
+   if( addr > 14 ) {
+      PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 14");
+      return NULL;
+   }
+   uint16_t path[TOPOLOGY_MAX_DEPTH];
+   int hops = self->topology->PathTo((cec_logical_address)addr, path);
+   if( hops == 0 ) {
+      Py_RETURN_NONE;
+   }
+   PyObject * result = PyList_New(hops);
+   if( result == NULL ) return NULL;
+   for( int i=0; i<hops; i++ ) {
+      PyObject * hop = Py_BuildValue("(NN)",
+            build_physical_addr(path[i]),
+            build_logical_addr(self->topology->DeviceAt(path[i])));
+      if( hop == NULL ) {
+         Py_DECREF(result);
+         return NULL;
+      }
+      PyList_SET_ITEM(result, i, hop);
+   }
+   return result;
+}
+
+// the logical addresses in addrs, a sequence of ints, as a bit mask.
+// broadcast allows CECDEVICE_BROADCAST. Returns false with an exception set
+static bool parse_addrs(PyObject * addrs, bool broadcast, uint16_t * mask) {
+   PyObject * seq = PySequence_Fast(addrs,
+         "addrs must be a sequence of logical addresses");
+   if( seq == NULL ) return false;
+   int max = broadcast ? CECDEVICE_BROADCAST : CECDEVICE_BROADCAST - 1;
+   *mask = 0;
+   for( Py_ssize_t i=0; i<PySequence_Fast_GET_SIZE(seq); i++ ) {
+      long addr = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+      if( addr == -1 && PyErr_Occurred() ) {
+         Py_DECREF(seq);
+         return false;
+      }
+      if( addr < 0 || addr > max ) {
+         PyErr_Format(PyExc_ValueError,
+               "Logical address must be between 0 and %d", max);
+         Py_DECREF(seq);
+         return false;
+      }
+      *mask |= 1 << addr;
+   }
+   Py_DECREF(seq);
+   return true;
+}
+
+// the devices on the bus other than this host
+static uint16_t remote_devices(Backend * lib) {
+   cec_logical_addresses active = lib->GetActiveDevices();
+   cec_logical_addresses local = lib->GetLogicalAddresses();
+   uint16_t mask = 0;
+   for( int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++ ) {
+      if( active[i] && !local[i] ) mask |= 1 << i;
+   }
+   return mask;
+}
+
+// {addr: result} for each address in mask
+static PyObject * build_results(uint16_t mask, const long int results[16],
+      bool as_bool) {
+   PyObject * result = PyDict_New();
+   for( int i=0; result && i<16; i++ ) {
+      if( !(mask & (1 << i)) ) continue;
+      PyObject * key = PyLong_FromLong(i);
+      PyObject * value = as_bool ? PyBool_FromLong(results[i]) :
+         PyLong_FromLong(results[i]);
+      if( !key || !value || PyDict_SetItem(result, key, value) < 0 ) {
+         Py_CLEAR(result);
+      }
+      Py_XDECREF(key);
+      Py_XDECREF(value);
+   }
+   return result;
+}
+
+bool send_frame(Adapter * self, Backend * lib, const cec_command & frame) {
+   cec_command cmd = frame;
+   if( cmd.initiator == CECDEVICE_UNKNOWN ) {
+      cmd.initiator = lib->GetLogicalAddresses().primary;
+   }
+   PROBE3(transmit__start, cmd.destination, cmd.opcode, cmd.initiator);
+   bool success = lib->Transmit(cmd);
+   PROBE3(transmit__done, cmd.destination, cmd.opcode, (int)success);
+   self->stats->Transmitted(cmd.destination, success);
+   return success;
+}
+
+// send a request with no parameters; call without the GIL
+static bool send_request(Adapter * self, Backend * lib,
+      cec_logical_address initiator, cec_logical_address destination,
+      cec_opcode opcode) {
+   cec_command cmd;
+   cec_command::Format(cmd, initiator, destination, opcode);
+   return send_frame(self, lib, cmd);
+}
+
+static const char * group_kwlist[] = {"addrs", NULL};
+
+// the user control code that turns a device on rather than toggling it
+#define KEY_POWER_ON_FUNCTION 0x6D
+
+static PyObject * Adapter_power_on(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   PyObject * values[ARGS_MAX];
+   uint16_t mask = 0;
+   if( !ArgsParse("power_on", args, nargs, kwnames, group_kwlist, 0,
+            values) ) {
+      return NULL;
+   }
+   // there is no broadcast form of Image View On or the power keys
+   bool all = values[0] == NULL || values[0] == Py_None;
+   if( !all && !parse_addrs(values[0], false, &mask) ) return NULL;
+   Backend * lib = AdapterLib(self);
+   if( lib == NULL ) return NULL;
+
+   long int results[16] = {0};
+   Py_BEGIN_ALLOW_THREADS
+   if( all ) mask = remote_devices(lib);
+   cec_logical_addresses local = lib->GetLogicalAddresses();
+   // libcec's PowerOnDevices asks each device for its vendor and power
+   // status before it sends the toggling power key. Image View On and the
+   // Power On Function key need no such round trips, so every device is
+   // sent its frames straight away
+   for( int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++ ) {
+      if( !(mask & (1 << i)) ) continue;
+      cec_logical_address addr = (cec_logical_address)i;
+      if( local[addr] ) {
+         results[i] = true;
+      } else if( addr == CECDEVICE_TV ) {
+         results[i] = send_request(self, lib, local.primary, addr,
+               CEC_OPCODE_IMAGE_VIEW_ON);
+      } else {
+         cec_command press;
+         cec_command::Format(press, local.primary, addr,
+               CEC_OPCODE_USER_CONTROL_PRESSED);
+         press.parameters.PushBack(KEY_POWER_ON_FUNCTION);
+         results[i] = send_frame(self, lib, press);
+         if( results[i] ) {
+            send_request(self, lib, local.primary, addr,
+                  CEC_OPCODE_USER_CONTROL_RELEASE);
+         }
+      }
+   }
+   Py_END_ALLOW_THREADS
+   return build_results(mask, results, true);
+}
+
+static PyObject * Adapter_standby(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   PyObject * values[ARGS_MAX];
+   uint16_t mask = 0;
+   if( !ArgsParse("standby", args, nargs, kwnames, group_kwlist, 0,
+            values) ) {
+      return NULL;
+   }
+   bool all = values[0] == NULL || values[0] == Py_None;
+   if( !all && !parse_addrs(values[0], true, &mask) ) return NULL;
+   Backend * lib = AdapterLib(self);
+   if( lib == NULL ) return NULL;
+
+   long int results[16] = {0};
+   Py_BEGIN_ALLOW_THREADS
+   // one broadcast Standby does for every device on the bus, so use it
+   // when no device would be left out
+   uint16_t remote = remote_devices(lib);
+   if( all ) mask = remote;
+   cec_logical_address primary = lib->GetLogicalAddresses().primary;
+   bool broadcast = (mask & (1 << CECDEVICE_BROADCAST)) ||
+      ((remote & (remote - 1)) && (remote & ~mask) == 0);
+   if( broadcast ) {
+      bool success = send_request(self, lib, primary, CECDEVICE_BROADCAST,
+            CEC_OPCODE_STANDBY);
+      for( int i=CECDEVICE_TV; i<=CECDEVICE_BROADCAST; i++ ) {
+         if( mask & (1 << i) ) {
+            results[i] = success &&
+               (i == CECDEVICE_BROADCAST || (remote & (1 << i)));
+         }
+      }
+   } else {
+      for( int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++ ) {
+         if( mask & (1 << i) ) {
+            results[i] = send_request(self, lib, primary,
+                  (cec_logical_address)i, CEC_OPCODE_STANDBY);
+         }
+      }
+   }
+   Py_END_ALLOW_THREADS
+   return build_results(mask, results, true);
+}
+
+static Replies::clock::time_point deadline_after(double timeout) {
+   return Replies::clock::now() +
+      std::chrono::duration_cast<Replies::clock::duration>(
+            std::chrono::duration<double>(timeout));
+}
+
+// the steady clock time for a time.time() timestamp
+static Scheduler::clock::time_point steady_from_wall(double when) {
+   double now = std::chrono::duration<double>(
+         std::chrono::system_clock::now().time_since_epoch()).count();
+   return Scheduler::clock::now() +
+      std::chrono::duration_cast<Scheduler::clock::duration>(
+            std::chrono::duration<double>(when - now));
+}
+
+// and back, for reporting
+static double wall_from_steady(Scheduler::clock::time_point when) {
+   return std::chrono::duration<double>(
+         std::chrono::system_clock::now().time_since_epoch()).count() +
+      std::chrono::duration<double>(when - Scheduler::clock::now()).count();
+}
+
+static PyObject * Adapter_power_status(Adapter * self,
+      PyObject * const * args, Py_ssize_t nargs, PyObject * kwnames) {
+   static const char * kwlist[] = {"addrs", "timeout", NULL};
+   PyObject * values[ARGS_MAX];
+   uint16_t mask = 0;
+   double timeout = 1.0;
+   if( !ArgsParse("power_status", args, nargs, kwnames, kwlist, 0,
+            values) || (values[1] && !ArgDouble(values[1], &timeout)) ) {
+      return NULL;
+   }
+   if( !(timeout >= 0) ) {
+      PyErr_SetString(PyExc_ValueError, "timeout must not be negative");
+      return NULL;
+   }
+   bool all = values[0] == NULL || values[0] == Py_None;
+   if( !all && !parse_addrs(values[0], false, &mask) ) return NULL;
+   Backend * lib = AdapterLib(self);
+   if( lib == NULL ) return NULL;
+
+   long int results[16];
+   Py_BEGIN_ALLOW_THREADS
+   if( all ) mask = remote_devices(lib);
+   cec_logical_addresses local = lib->GetLogicalAddresses();
+   // send every request before waiting for any reply
+   uint64_t mark = self->replies->Mark();
+   std::vector<ReplyRequest> requests;
+   for( int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++ ) {
+      if( !(mask & (1 << i)) ) continue;
+      results[i] = CEC_POWER_STATUS_UNKNOWN;
+      if( local[i] ) {
+         results[i] = CEC_POWER_STATUS_ON;
+         continue;
+      }
+      // a device that doesn't acknowledge isn't there to answer
+      if( send_request(self, lib, local.primary, (cec_logical_address)i,
+               CEC_OPCODE_GIVE_DEVICE_POWER_STATUS) ) {
+         requests.push_back(ReplyRequest{(cec_logical_address)i,
+               CEC_OPCODE_GIVE_DEVICE_POWER_STATUS,
+               CEC_OPCODE_REPORT_POWER_STATUS});
+      }
+   }
+   std::vector<Reply> replies;
+   self->replies->Wait(mark, requests, deadline_after(timeout), &replies);
+   for( size_t i=0; i<requests.size(); i++ ) {
+      const cec_command & reply = replies[i].cmd;
+      if( replies[i].found && reply.opcode == CEC_OPCODE_REPORT_POWER_STATUS &&
+            reply.parameters.size >= 1 ) {
+         results[requests[i].addr] = reply.parameters[0];
+      }
+   }
+   Py_END_ALLOW_THREADS
+   return build_results(mask, results, false);
+}
+
+// wait until addr reaches a state, or until deadline. want_power is the
+// cec_power_status to wait for, or -1; want_active is whether addr must be
+// the active source, or -1. The state is learnt from the frames addr sends,
+// and asked for again only when nothing was heard for a period. Call
+// without the GIL
+static bool wait_state(Adapter * self, Backend * lib,
+      cec_logical_address addr, int want_power, int want_active,
+      Replies::clock::time_point deadline, Replies::clock::duration period) {
+   uint64_t start = self->replies->Mark();
+   uint64_t mark = start;
+   uint64_t power_seq = 0;
+   cec_logical_address active = self->topology->ActiveSource();
+   // an active source request went unanswered: no device is active
+   bool none_active = false;
+   bool active_asked = false;
+   Replies::clock::time_point next_probe = Replies::clock::now();
+   while( true ) {
+      Replies::clock::time_point now = Replies::clock::now();
+      Reply report;
+      uint64_t seq = self->replies->Latest(start, addr,
+            CEC_OPCODE_REPORT_POWER_STATUS, &report);
+      cec_logical_address current = self->topology->ActiveSource();
+      // news of the state puts off the next probe
+      if( seq != power_seq || current != active ) {
+         power_seq = seq;
+         active = current;
+         next_probe = now + period;
+      }
+
+      cec_logical_addresses local = lib->GetLogicalAddresses();
+      bool power_ok = want_power < 0;
+      if( local[addr] ) {
+         power_ok = power_ok || want_power == CEC_POWER_STATUS_ON;
+      } else if( report.found && report.cmd.parameters.size >= 1 ) {
+         power_ok = power_ok || report.cmd.parameters[0] == want_power;
+      }
+      bool active_ok = want_active < 0;
+      if( want_active == 1 ) {
+         active_ok = active == addr;
+      } else if( want_active == 0 ) {
+         active_ok = active != addr &&
+            (active != CECDEVICE_UNKNOWN || none_active);
+      }
+      if( power_ok && active_ok ) return true;
+      if( now >= deadline ) return false;
+
+      if( now >= next_probe ) {
+         if( active_asked && active == CECDEVICE_UNKNOWN ) {
+            none_active = true;
+         }
+         if( !power_ok && !local[addr] ) {
+            send_request(self, lib, local.primary, addr,
+                  CEC_OPCODE_GIVE_DEVICE_POWER_STATUS);
+         }
+         if( !active_ok && !none_active ) {
+            send_request(self, lib, local.primary, CECDEVICE_BROADCAST,
+                  CEC_OPCODE_REQUEST_ACTIVE_SOURCE);
+            active_asked = true;
+         }
+         next_probe = now + period;
+      }
+      mark = self->replies->WaitNext(mark, (std::min)(deadline, next_probe));
+   }
+}
+
+static PyObject * Adapter_wait_for(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   static const char * kwlist[] = {"addr", "power", "active_source",
+      "timeout", "interval", NULL};
+   PyObject * values[ARGS_MAX];
+   unsigned char addr;
+   const char * power = NULL;
+   int active_source = -1;
+   double timeout = 30.0;
+   double interval = 2.0;
+   if( !ArgsParse("wait_for", args, nargs, kwnames, kwlist, 1, values) ||
+         !ArgByte(values[0], &addr) ||
+         (values[1] && !ArgStringOrNone(values[1], "power", &power)) ||
+         (values[2] && values[2] != Py_None &&
+          !ArgBool(values[2], &active_source)) ||
+         (values[3] && !ArgDouble(values[3], &timeout)) ||
+         (values[4] && !ArgDouble(values[4], &interval)) ) {
+      return NULL;
+   }
+   if( addr >= CECDEVICE_BROADCAST ) {
+      PyErr_SetString(PyExc_ValueError,
+            "Logical address must be between 0 and 14");
+      return NULL;
+   }
+   int want_power = -1;
+   if( power ) {
+      if( strcmp(power, "on") == 0 ) {
+         want_power = CEC_POWER_STATUS_ON;
+      } else if( strcmp(power, "standby") == 0 ) {
+         want_power = CEC_POWER_STATUS_STANDBY;
+      } else {
+         PyErr_SetString(PyExc_ValueError,
+               "power must be \"on\" or \"standby\"");
+         return NULL;
+      }
+   }
+   if( want_power < 0 && active_source < 0 ) {
+      PyErr_SetString(PyExc_TypeError,
+            "wait_for() needs power or active_source");
+      return NULL;
+   }
+   if( !(timeout >= 0) ) {
+      PyErr_SetString(PyExc_ValueError, "timeout must not be negative");
+      return NULL;
+   }
+   if( !(interval > 0) ) {
+      PyErr_SetString(PyExc_ValueError, "interval must be positive");
+      return NULL;
+   }
+   Backend * lib = AdapterLib(self);
+   if( lib == NULL ) return NULL;
+
+   bool reached;
+   Py_BEGIN_ALLOW_THREADS
+   reached = wait_state(self, lib, (cec_logical_address)addr, want_power,
+         active_source, deadline_after(timeout),
+         std::chrono::duration_cast<Replies::clock::duration>(
+            std::chrono::duration<double>(interval)));
+   Py_END_ALLOW_THREADS
+   RETURN_BOOL(reached);
+}
+
+// poll each device in mask with a frame without an opcode, the least a
+// device can acknowledge. Returns the mask of those that did; this host's
+// addresses are present without asking. Call without the GIL
+static uint16_t poll_devices(Adapter * self, Backend * lib, uint16_t mask) {
+   cec_logical_addresses local = lib->GetLogicalAddresses();
+   uint16_t present = 0;
+   for( int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++ ) {
+      if( !(mask & (1 << i)) ) continue;
+      if( local[i] ) {
+         present |= 1 << i;
+         continue;
+      }
+      cec_command poll;
+      cec_command::Format(poll, local.primary, (cec_logical_address)i,
+            CEC_OPCODE_NONE);
+      if( send_frame(self, lib, poll) ) {
+         present |= 1 << i;
+      }
+   }
+   return present;
+}
+
+static PyObject * Adapter_ping(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   PyObject * values[ARGS_MAX];
+   uint16_t mask = 0;
+   if( !ArgsParse("ping", args, nargs, kwnames, group_kwlist, 1, values) ||
+         !parse_addrs(values[0], false, &mask) ) {
+      return NULL;
+   }
+   Backend * lib = AdapterLib(self);
+   if( lib == NULL ) return NULL;
+
+   uint16_t present;
+   Py_BEGIN_ALLOW_THREADS
+   present = poll_devices(self, lib, mask);
+   Py_END_ALLOW_THREADS
+   return PyLong_FromLong(present);
+}
+
+static PyObject * Adapter_scan(Adapter * self, PyObject * unused) {
+   Backend * lib = AdapterLib(self);
+   if( lib == NULL ) return NULL;
+
+   uint16_t present;
+   Py_BEGIN_ALLOW_THREADS
+   present = poll_devices(self, lib, (1 << CECDEVICE_BROADCAST) - 1);
+   Py_END_ALLOW_THREADS
+   return PyLong_FromLong(present);
+}
+
+// the device attributes cec.query can ask for: the request that asks for
+// one, the reply that carries it, and the parameter bytes the reply needs
+struct QueryField {
+   const char * name;
+   cec_opcode request;
+   cec_opcode reply;
+   uint8_t size;
+};
+
+static const QueryField query_fields[] = {
+   {"vendor", CEC_OPCODE_GIVE_DEVICE_VENDOR_ID,
+      CEC_OPCODE_DEVICE_VENDOR_ID, 3},
+   {"osd_name", CEC_OPCODE_GIVE_OSD_NAME, CEC_OPCODE_SET_OSD_NAME, 0},
+   {"power", CEC_OPCODE_GIVE_DEVICE_POWER_STATUS,
+      CEC_OPCODE_REPORT_POWER_STATUS, 1},
+   {"physical_address", CEC_OPCODE_GIVE_PHYSICAL_ADDRESS,
+      CEC_OPCODE_REPORT_PHYSICAL_ADDRESS, 2},
+   {"cec_version", CEC_OPCODE_GET_CEC_VERSION, CEC_OPCODE_CEC_VERSION, 1},
+   {"language", CEC_OPCODE_GET_MENU_LANGUAGE,
+      CEC_OPCODE_SET_MENU_LANGUAGE, 3},
+};
+
+#define QUERY_FIELDS (int)(sizeof(query_fields) / sizeof(query_fields[0]))
+// fields queried by default: all but the language
+#define QUERY_DEFAULT_FIELDS 5
+
+// the answer for one field of one device
+struct QuerySlot {
+   cec_logical_address addr;
+   int field;
+   int error;
+   Reply reply;
+};
+
+// libcec answers for the addresses this host holds itself; build the reply
+// a remote device would have sent from that. Call without the GIL
+static void query_local(Backend * lib, QuerySlot * slot) {
+   const QueryField & field = query_fields[slot->field];
+   cec_command & cmd = slot->reply.cmd;
+   cec_command::Format(cmd, slot->addr, CECDEVICE_BROADCAST, field.reply);
+   switch( field.reply ) {
+      case CEC_OPCODE_DEVICE_VENDOR_ID: {
+         uint64_t vendor = lib->GetDeviceVendorId(slot->addr);
+         cmd.parameters.PushBack((uint8_t)(vendor >> 16));
+         cmd.parameters.PushBack((uint8_t)(vendor >> 8));
+         cmd.parameters.PushBack((uint8_t)vendor);
+         break;
+      }
+      case CEC_OPCODE_SET_OSD_NAME: {
+         std::string name = lib->GetDeviceOSDName(slot->addr);
+         for( size_t i=0; i<name.size() && i<CEC_MAX_DATA_PACKET_SIZE; i++ ) {
+            cmd.parameters.PushBack((uint8_t)name[i]);
+         }
+         break;
+      }
+      case CEC_OPCODE_REPORT_POWER_STATUS:
+         cmd.parameters.PushBack(CEC_POWER_STATUS_ON);
+         break;
+      case CEC_OPCODE_REPORT_PHYSICAL_ADDRESS: {
+         uint16_t pa = lib->GetDevicePhysicalAddress(slot->addr);
+         cmd.parameters.PushBack((uint8_t)(pa >> 8));
+         cmd.parameters.PushBack((uint8_t)pa);
+         break;
+      }
+      case CEC_OPCODE_CEC_VERSION:
+         cmd.parameters.PushBack(
+               (uint8_t)lib->GetDeviceCecVersion(slot->addr));
+         break;
+      case CEC_OPCODE_SET_MENU_LANGUAGE: {
+         std::string lang = lib->GetDeviceMenuLanguage(slot->addr);
+         for( size_t i=0; i<lang.size() && i<3; i++ ) {
+            cmd.parameters.PushBack((uint8_t)lang[i]);
+         }
+         break;
+      }
+      default:
+         break;
+   }
+   slot->reply.found = true;
+   slot->reply.time = std::chrono::duration<double>(
+         std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// set the error of a slot from its reply
+static void query_check(QuerySlot * slot) {
+   const cec_command & cmd = slot->reply.cmd;
+   if( !slot->reply.found ) {
+      return;
+   } else if( cmd.opcode == CEC_OPCODE_FEATURE_ABORT ) {
+      slot->error = QUERY_ABORTED;
+   } else if( cmd.parameters.size < query_fields[slot->field].size ) {
+      slot->error = QUERY_MALFORMED;
+   } else {
+      slot->error = QUERY_OK;
+   }
+}
+
+// a field's value from its reply, in the form Device reports it
+static PyObject * query_value(const QueryField & field,
+      const cec_command & cmd) {
+   const cec_datapacket & p = cmd.parameters;
+   switch( field.reply ) {
+      case CEC_OPCODE_DEVICE_VENDOR_ID: {
+         char vendor[7];
+         snprintf(vendor, 7, "%02X%02X%02X", p[0], p[1], p[2]);
+         return Py_BuildValue("s", vendor);
+      }
+      case CEC_OPCODE_SET_OSD_NAME:
+         return PyUnicode_DecodeLatin1((const char *)p.data, p.size, NULL);
+      case CEC_OPCODE_REPORT_POWER_STATUS:
+         return PyLong_FromLong(p[0]);
+      case CEC_OPCODE_REPORT_PHYSICAL_ADDRESS:
+         return build_physical_addr((uint16_t)((p[0] << 8) | p[1]));
+      case CEC_OPCODE_CEC_VERSION:
+         return Py_BuildValue("s", cec_version_str((cec_version)p[0]));
+      case CEC_OPCODE_SET_MENU_LANGUAGE:
+         return PyUnicode_DecodeLatin1((const char *)p.data, 3, NULL);
+      default:
+         Py_RETURN_NONE;
+   }
+}
+
+// (value, time, error) for a slot
+static PyObject * query_result(const QuerySlot & slot) {
+   PyObject * value;
+   if( slot.error == QUERY_OK ) {
+      value = query_value(query_fields[slot.field], slot.reply.cmd);
+      if( value == NULL ) return NULL;
+   } else {
+      value = Py_None;
+      Py_INCREF(value);
+   }
+   PyObject * time;
+   if( slot.reply.found ) {
+      time = PyFloat_FromDouble(slot.reply.time);
+   } else {
+      time = Py_None;
+      Py_INCREF(time);
+   }
+   return Py_BuildValue("(NNi)", value, time, slot.error);
+}
+
+// the field names in fields as indexes into query_fields. Returns false
+// with an exception set
+static bool parse_fields(PyObject * fields, std::vector<int> * result) {
+   PyObject * seq = PySequence_Fast(fields,
+         "fields must be a sequence of field names");
+   if( seq == NULL ) return false;
+   for( Py_ssize_t i=0; i<PySequence_Fast_GET_SIZE(seq); i++ ) {
+      const char * name;
+      if( !ArgString(PySequence_Fast_GET_ITEM(seq, i), "field", &name) ) {
+         Py_DECREF(seq);
+         return false;
+      }
+      int field = 0;
+      while( field < QUERY_FIELDS && strcmp(name, query_fields[field].name) ) {
+         field++;
+      }
+      if( field == QUERY_FIELDS ) {
+         PyErr_Format(PyExc_ValueError, "Unknown field '%s'", name);
+         Py_DECREF(seq);
+         return false;
+      }
+      if( std::find(result->begin(), result->end(), field) == result->end() ) {
+         result->push_back(field);
+      }
+   }
+   Py_DECREF(seq);
+   return true;
+}
+
+static PyObject * Adapter_query(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   static const char * kwlist[] = {"addrs", "fields", "timeout", NULL};
+   PyObject * values[ARGS_MAX];
+   uint16_t mask = 0;
+   double timeout = 1.0;
+   if( !ArgsParse("query", args, nargs, kwnames, kwlist, 0, values) ||
+         (values[2] && !ArgDouble(values[2], &timeout)) ) {
+      return NULL;
+   }
+   if( !(timeout >= 0) ) {
+      PyErr_SetString(PyExc_ValueError, "timeout must not be negative");
+      return NULL;
+   }
+   bool all = values[0] == NULL || values[0] == Py_None;
+   if( !all && !parse_addrs(values[0], false, &mask) ) return NULL;
+   std::vector<int> fields;
+   if( values[1] == NULL || values[1] == Py_None ) {
+      for( int i=0; i<QUERY_DEFAULT_FIELDS; i++ ) fields.push_back(i);
+   } else if( !parse_fields(values[1], &fields) ) {
+      return NULL;
+   }
+   Backend * lib = AdapterLib(self);
+   if( lib == NULL ) return NULL;
+
+   std::vector<QuerySlot> slots;
+   Py_BEGIN_ALLOW_THREADS
+   if( all ) mask = remote_devices(lib);
+   cec_logical_addresses local = lib->GetLogicalAddresses();
+   // send every request before waiting for any reply
+   uint64_t mark = self->replies->Mark();
+   std::vector<ReplyRequest> requests;
+   std::vector<size_t> pending;
+   for( int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++ ) {
+      if( !(mask & (1 << i)) ) continue;
+      bool present = true;
+      for( size_t f=0; f<fields.size(); f++ ) {
+         QuerySlot slot = {(cec_logical_address)i, fields[f], QUERY_TIMEOUT,
+            Reply()};
+         const QueryField & field = query_fields[slot.field];
+         if( local[i] ) {
+            query_local(lib, &slot);
+            query_check(&slot);
+         } else if( present && send_request(self, lib, local.primary,
+                  slot.addr, field.request) ) {
+            requests.push_back(ReplyRequest{slot.addr, field.request,
+                  field.reply});
+            pending.push_back(slots.size());
+         } else {
+            // don't ask again once a device has failed to acknowledge
+            present = false;
+            slot.error = QUERY_NO_ACK;
+         }
+         slots.push_back(slot);
+      }
+   }
+   std::vector<Reply> replies;
+   self->replies->Wait(mark, requests, deadline_after(timeout), &replies);
+   for( size_t i=0; i<requests.size(); i++ ) {
+      QuerySlot & slot = slots[pending[i]];
+      slot.reply = replies[i];
+      query_check(&slot);
+   }
+   Py_END_ALLOW_THREADS
+
+   // {addr: {field: (value, time, error)}}
+   PyObject * result = PyDict_New();
+   PyObject * device = NULL;
+   for( size_t i=0; result && i<slots.size(); i++ ) {
+      const QuerySlot & slot = slots[i];
+      if( i % fields.size() == 0 ) {
+         PyObject * key = PyLong_FromLong(slot.addr);
+         device = PyDict_New();
+         if( !key || !device || PyDict_SetItem(result, key, device) < 0 ) {
+            Py_CLEAR(result);
+         }
+         Py_XDECREF(key);
+         Py_XDECREF(device);
+         if( result == NULL ) break;
+      }
+      PyObject * value = query_result(slot);
+      if( !value || PyDict_SetItemString(device,
+               query_fields[slot.field].name, value) < 0 ) {
+         Py_CLEAR(result);
+      }
+      Py_XDECREF(value);
+   }
+   return result;
+}
+
+static PyObject * Adapter_set_physical_addr(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   const char * addr_s;
+   static const char * kwlist[] = {"physical_address", NULL};
+   PyObject * values[ARGS_MAX];
+   if( !ArgsParse("set_physical_addr", args, nargs, kwnames, kwlist, 1,
+            values) ||
+         !ArgString(values[0], "physical_address", &addr_s) ) {
+      return NULL;
+   }
+   int addr = parse_physical_addr(addr_s);
+   if( addr >= 0 ) {
+      Backend * lib = AdapterLib(self);
+      if( lib == NULL ) return NULL;
+      RETURN_BOOL(lib->SetPhysicalAddress((uint16_t)addr));
+   } else {
+      PyErr_SetString(PyExc_ValueError, "Invalid physical address");
+      return NULL;
+   }
+}
+
+static PyObject * Adapter_set_port(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   unsigned char dev, port;
+   static const char * kwlist[] = {"device", "port", NULL};
+   PyObject * values[ARGS_MAX];
+   if( !ArgsParse("set_port", args, nargs, kwnames, kwlist, 2, values) ||
+         !ArgByte(values[0], &dev) || !ArgByte(values[1], &port) ) {
+      return NULL;
+   }
+   if( dev > 15 ) {
+      PyErr_SetString(PyExc_ValueError, "Invalid logical address");
+      return NULL;
+   }
+   if( port > 15 ) {
+      PyErr_SetString(PyExc_ValueError, "Invalid port");
+      return NULL;
+   }
+   Backend * lib = AdapterLib(self);
+   if( lib == NULL ) return NULL;
+   RETURN_BOOL(lib->SetHDMIPort((cec_logical_address)dev, port));
+}
+
+static PyObject * Adapter_can_persist_config(Adapter * self,
+      PyObject * unused) {
+   Backend * lib = AdapterLib(self);
+   if( lib == NULL ) return NULL;
+   RETURN_BOOL(lib->CanPersistConfiguration());
+}
+
+// copy a user supplied configuration into to, keeping the fields that
+// belong to this binding rather than to the user
+static void config_from_user(Adapter * self, const libcec_configuration & from,
+      libcec_configuration * to) {
+   uint32_t client_version = self->config->clientVersion;
+   *to = from;
+   to->clientVersion = client_version;
+   to->callbacks = self->cec_callbacks;
+   to->callbackParam = self;
+}
+
+static PyObject * Adapter_get_config(Adapter * self, PyObject * args) {
+   libcec_configuration config;
+   bool success = true;
+   Backend * lib = self->lib.load();
+   Py_BEGIN_ALLOW_THREADS
+   if( lib ) {
+      success = lib->GetCurrentConfiguration(&config);
+   } else {
+      // not started yet; this is what init() will use
+      std::lock_guard<std::mutex> guard(*self->lib_lock);
+      config = *self->config;
+   }
+   Py_END_ALLOW_THREADS
+   if( !success ) {
+      PyErr_SetString(PyExc_IOError, "Could not get configuration");
+      return NULL;
+   }
+   return ConfigNew(self->config_type, config);
+}
+
+static PyObject * Adapter_set_config(Adapter * self, PyObject * arg) {
+   if( !PyObject_TypeCheck(arg, self->config_type) ) {
+      PyErr_Format(PyExc_TypeError, "set_config() argument must be %.50s, "
+            "not %.50s", self->config_type->tp_name, Py_TYPE(arg)->tp_name);
+      return NULL;
+   }
+   const libcec_configuration & config = ((Config *)arg)->config;
+
+   bool success = true;
+   Backend * lib = self->lib.load();
+   Py_BEGIN_ALLOW_THREADS
+   libcec_configuration current;
+   {
+      std::lock_guard<std::mutex> guard(*self->lib_lock);
+      config_from_user(self, config, self->config);
+      current = *self->config;
+   }
+   if( lib ) {
+      // libcec may write the configuration to the adapter's flash, so
+      // don't call it if nothing changed
+      libcec_configuration running;
+      if( !lib->GetCurrentConfiguration(&running) ||
+            !ConfigEqual(running, current) ) {
+         success = lib->SetConfiguration(&current);
+      }
+   }
+   Py_END_ALLOW_THREADS
+   return PyBool_FromLong(success);
+}
+
+static PyObject * Adapter_persist_config(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   static const char * kwlist[] = {"config", NULL};
+   PyObject * values[ARGS_MAX];
+   if( !ArgsParse("persist_config", args, nargs, kwnames, kwlist, 0,
+            values) ) {
+      return NULL;
+   }
+   PyObject * arg = values[0];
+   if( arg && !PyObject_TypeCheck(arg, self->config_type) ) {
+      PyErr_Format(PyExc_TypeError, "persist_config() argument must be "
+            "%.50s, not %.50s", self->config_type->tp_name,
+            Py_TYPE(arg)->tp_name);
+      return NULL;
+   }
+   Backend * lib = AdapterLib(self);
+   if( lib == NULL ) return NULL;
+
+   bool can_persist;
+   bool have_config = true;
+   bool success = true;
+   Py_BEGIN_ALLOW_THREADS
+   can_persist = lib->CanPersistConfiguration();
+   if( can_persist ) {
+      libcec_configuration config;
+      if( arg ) {
+         config_from_user(self, ((Config *)arg)->config, &config);
+      } else {
+         have_config = lib->GetCurrentConfiguration(&config);
+      }
+      if( have_config ) {
+         // writing the adapter's flash is slow and wears it out; skip it
+         // when the adapter already holds this configuration
+         bool unchanged;
+         {
+            std::lock_guard<std::mutex> guard(*self->config_lock);
+            unchanged = self->persisted_config &&
+               ConfigEqual(*self->persisted_config, config);
+         }
+         if( !unchanged ) {
+            success = lib->PersistConfiguration(&config);
+            if( success ) {
+               std::lock_guard<std::mutex> guard(*self->config_lock);
+               delete self->persisted_config;
+               self->persisted_config = new libcec_configuration(config);
+            }
+         }
+      }
+   }
+   Py_END_ALLOW_THREADS
+
+   if( !can_persist ) {
+      PyErr_SetString(PyExc_NotImplementedError,
+            "Cannot persist configuration");
+      return NULL;
+   }
+   if( !have_config ) {
+      PyErr_SetString(PyExc_IOError, "Could not get configuration");
+      return NULL;
+   }
+   return PyBool_FromLong(success);
+}
+
+// {key: counter} for the non-zero counters, keyed by index or by keys[i]
+static PyObject * stats_dict(const std::atomic<uint64_t> * counters,
+      int count, const long int * keys = NULL) {
+   PyObject * result = PyDict_New();
+   for( int i=0; result && i<count; i++ ) {
+      uint64_t value = counters[i].load(std::memory_order_relaxed);
+      if( !value ) continue;
+      PyObject * key = PyLong_FromLong(keys ? keys[i] : i);
+      PyObject * item = PyLong_FromUnsignedLongLong(value);
+      if( !key || !item || PyDict_SetItem(result, key, item) < 0 ) {
+         Py_CLEAR(result);
+      }
+      Py_XDECREF(key);
+      Py_XDECREF(item);
+   }
+   return result;
+}
+
+static PyObject * Adapter_stats(Adapter * self, PyObject * args) {
+   static const long int events[STATS_EVENTS] = { EVENT_LOG, EVENT_KEYPRESS,
+      EVENT_COMMAND, EVENT_CONFIG_CHANGE, EVENT_ALERT, EVENT_MENU_CHANGED,
+      EVENT_ACTIVATED, EVENT_RECONNECTED };
+   Stats * stats = self->stats;
+   std::atomic<uint64_t> attempted[16];
+   for( int i=0; i<16; i++ ) {
+      attempted[i] = stats->tx_acked[i].load(std::memory_order_relaxed) +
+         stats->tx_failed[i].load(std::memory_order_relaxed);
+   }
+   size_t pending;
+   std::vector<Scheduler::Info> timers;
+   Py_BEGIN_ALLOW_THREADS
+   pending = self->supervisor->Pending();
+   timers = self->scheduler->List();
+   Py_END_ALLOW_THREADS
+   PyObject * schedules = PyDict_New();
+   if( schedules == NULL ) return NULL;
+   for( size_t i=0; i<timers.size(); i++ ) {
+      const Scheduler::Info & info = timers[i];
+      PyObject * last = info.last == Scheduler::clock::time_point() ?
+         Py_BuildValue("") :
+         PyFloat_FromDouble(wall_from_steady(info.last));
+      PyObject * key = PyLong_FromLong(info.id);
+      PyObject * value = last == NULL ? NULL :
+         Py_BuildValue("{sKsNsdsd}",
+               "fired", (unsigned long long)info.fired,
+               "last", last,
+               "next", wall_from_steady(info.next),
+               "late_max_seconds",
+               std::chrono::duration<double>(info.late_max).count());
+      if( key == NULL || value == NULL ||
+            PyDict_SetItem(schedules, key, value) < 0 ) {
+         Py_XDECREF(key);
+         Py_XDECREF(value);
+         Py_DECREF(schedules);
+         return NULL;
+      }
+      Py_DECREF(key);
+      Py_DECREF(value);
+   }
+   return Py_BuildValue("{sNsKsNsNsNsKsNsNsKsdsdsKsdsdsNsnsK}",
+         "rx_frames", stats_dict(stats->rx_frames, 256),
+         "rx_polls", (unsigned long long)stats->rx_polls.load(),
+         "tx_attempted", stats_dict(attempted, 16),
+         "tx_acked", stats_dict(stats->tx_acked, 16),
+         "tx_failed", stats_dict(stats->tx_failed, 16),
+         "tx_queued", (unsigned long long)stats->tx_queued.load(),
+         "handler_calls", stats_dict(stats->handler_calls, STATS_EVENTS,
+            events),
+         "handler_errors", stats_dict(stats->handler_errors, STATS_EVENTS,
+            events),
+         "gil_waits", (unsigned long long)stats->gil_waits.load(),
+         "gil_wait_seconds", stats->gil_wait_ns.load() / 1e9,
+         "gil_wait_max_seconds", stats->gil_wait_max_ns.load() / 1e9,
+         "scheduled", (unsigned long long)stats->scheduled.load(),
+         "scheduled_late_seconds", stats->scheduled_late_ns.load() / 1e9,
+         "scheduled_late_max_seconds",
+         stats->scheduled_late_max_ns.load() / 1e9,
+         "schedules", schedules,
+         "reconnect_queue", (Py_ssize_t)pending,
+         "callbacks", (unsigned long long)stats->callbacks.load());
+}
+
+static PyObject * Adapter_export_stats(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   const char * target = NULL;
+   double interval = 10.0;
+   static const char * kwlist[] = {"target", "interval", NULL};
+   PyObject * values[ARGS_MAX];
+   if( !ArgsParse("export_stats", args, nargs, kwnames, kwlist, 1, values) ||
+         !ArgStringOrNone(values[0], "target", &target) ||
+         (values[1] && !ArgDouble(values[1], &interval)) ) {
+      return NULL;
+   }
+   if( target && !(interval > 0) ) {
+      PyErr_SetString(PyExc_ValueError, "interval must be positive");
+      return NULL;
+   }
+
+   std::string error;
+   Py_BEGIN_ALLOW_THREADS
+   if( target ) {
+      error = self->exporter->Start(target, interval);
+   } else {
+      self->exporter->Stop();
+   }
+   Py_END_ALLOW_THREADS
+   if( !error.empty() ) {
+      char errstr[1024];
+      snprintf(errstr, 1024, "Cannot export stats to %s: %s", target,
+            error.c_str());
+      PyErr_SetString(PyExc_IOError, errstr);
+      return NULL;
+   }
+   Py_RETURN_NONE;
+}
+
+static PyObject * Adapter_serve(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   const char * path = NULL;
+   static const char * kwlist[] = {"path", NULL};
+   PyObject * values[ARGS_MAX];
+   if( !ArgsParse("serve", args, nargs, kwnames, kwlist, 1, values) ||
+         !ArgStringOrNone(values[0], "path", &path) ) {
+      return NULL;
+   }
+   Backend * lib = NULL;
+   if( path ) {
+      lib = AdapterLib(self);
+      if( lib == NULL ) return NULL;
+   }
+
+   bool success = true;
+   std::string error;
+   Py_BEGIN_ALLOW_THREADS
+   if( path ) {
+      success = self->server->Start(lib, self->cec_callbacks, self, path,
+            &error);
+   } else {
+      self->server->Stop();
+   }
+   Py_END_ALLOW_THREADS
+   if( !success ) {
+      PyErr_SetString(PyExc_IOError, error.c_str());
+      return NULL;
+   }
+   Py_RETURN_NONE;
+}
+
+static PyObject * Adapter_publish_shared(Adapter * self,
+      PyObject * const * args, Py_ssize_t nargs, PyObject * kwnames) {
+   const char * name = NULL;
+   long slots = 4096;
+   long mode = 0600;
+   static const char * kwlist[] = {"name", "slots", "mode", NULL};
+   PyObject * values[ARGS_MAX];
+   if( !ArgsParse("publish_shared", args, nargs, kwnames, kwlist, 1, values) ||
+         !ArgStringOrNone(values[0], "name", &name) ||
+         (values[1] && !ArgLong(values[1], &slots)) ||
+         (values[2] && !ArgLong(values[2], &mode)) ) {
+      return NULL;
+   }
+   if( slots < RING_MIN_SLOTS || slots > RING_MAX_SLOTS ||
+         (slots & (slots - 1)) ) {
+      PyErr_Format(PyExc_ValueError,
+            "slots must be a power of two from %d to %d", RING_MIN_SLOTS,
+            RING_MAX_SLOTS);
+      return NULL;
+   }
+   if( mode < 0 || mode > 0777 ) {
+      PyErr_SetString(PyExc_ValueError, "mode must be from 0 to 0o777");
+      return NULL;
+   }
+
+   bool success = true;
+   std::string error;
+   Py_BEGIN_ALLOW_THREADS
+   if( name ) {
+      success = self->ring->Create(name, slots, mode, &error);
+   } else {
+      self->ring->Close();
+   }
+   Py_END_ALLOW_THREADS
+   if( !success ) {
+      PyErr_SetString(PyExc_IOError, error.c_str());
+      return NULL;
+   }
+   Py_RETURN_NONE;
+}
+
+// one logical address, or a sequence of them, as a bit mask. Returns false
+// with an exception set
+static bool parse_addr_or_addrs(PyObject * value, uint16_t * mask) {
+   if( PyLong_Check(value) ) {
+      long addr = PyLong_AsLong(value);
+      if( addr == -1 && PyErr_Occurred() ) return false;
+      if( addr < 0 || addr > 15 ) {
+         PyErr_SetString(PyExc_ValueError,
+               "Logical address must be between 0 and 15");
+         return false;
+      }
+      *mask = 1 << addr;
+      return true;
+   }
+   return parse_addrs(value, true, mask);
+}
+
+// a RuleMatch from a dict with any of opcode, initiator, destination and
+// parameters. Returns false with an exception set
+static bool parse_match(PyObject * match, RuleMatch * result) {
+   if( !PyDict_Check(match) ) {
+      PyErr_SetString(PyExc_TypeError, "match must be a dict");
+      return false;
+   }
+   PyObject * key;
+   PyObject * value;
+   Py_ssize_t pos = 0;
+   while( PyDict_Next(match, &pos, &key, &value) ) {
+      const char * name = PyUnicode_Check(key) ? PyUnicode_AsUTF8(key) : NULL;
+      if( name == NULL ) {
+         PyErr_Clear();
+         PyErr_SetString(PyExc_TypeError, "match keys must be strings");
+         return false;
+      }
+      if( strcmp(name, "opcode") == 0 ) {
+         unsigned char opcode;
+         if( !ArgByte(value, &opcode) ) return false;
+         result->opcode = opcode;
+      } else if( strcmp(name, "initiator") == 0 ) {
+         if( !parse_addr_or_addrs(value, &result->initiators) ) return false;
+      } else if( strcmp(name, "destination") == 0 ) {
+         if( !parse_addr_or_addrs(value, &result->destinations) ) {
+            return false;
+         }
+      } else if( strcmp(name, "parameters") == 0 ) {
+         // bytes, or a sequence of bytes and None for any byte
+         PyObject * seq = PySequence_Fast(value,
+               "parameters must be bytes or a sequence of ints and None");
+         if( seq == NULL ) return false;
+         Py_ssize_t size = PySequence_Fast_GET_SIZE(seq);
+         if( size > CEC_MAX_DATA_PACKET_SIZE ) {
+            PyErr_Format(PyExc_ValueError,
+                  "Too many parameters, maximum is %d",
+                  CEC_MAX_DATA_PACKET_SIZE);
+            Py_DECREF(seq);
+            return false;
+         }
+         result->pattern.assign(size, 0);
+         result->mask.assign(size, false);
+         for( Py_ssize_t i=0; i<size; i++ ) {
+            PyObject * item = PySequence_Fast_GET_ITEM(seq, i);
+            if( item == Py_None ) continue;
+            if( !ArgByte(item, &result->pattern[i]) ) {
+               Py_DECREF(seq);
+               return false;
+            }
+            result->mask[i] = true;
+         }
+         Py_DECREF(seq);
+      } else {
+         PyErr_Format(PyExc_ValueError, "Unknown match key '%s'", name);
+         return false;
+      }
+   }
+   return true;
+}
+
+// a sequence of cec.Command, for frames sent later from a native thread
+static bool parse_frames(Adapter * self, PyObject * obj, const char * name,
+      std::vector<cec_command> * result) {
+   char errstr[1024];
+   snprintf(errstr, sizeof(errstr), "%s must be a sequence of cec.Command",
+         name);
+   PyObject * seq = PySequence_Fast(obj, errstr);
+   if( seq == NULL ) return false;
+   for( Py_ssize_t i=0; i<PySequence_Fast_GET_SIZE(seq); i++ ) {
+      PyObject * item = PySequence_Fast_GET_ITEM(seq, i);
+      if( !PyObject_TypeCheck(item, self->command_type) ||
+            !((Command *)item)->valid ) {
+         PyErr_Format(PyExc_TypeError,
+               "%s must be a sequence of cec.Command, e.g. from cec.msg", name);
+         Py_DECREF(seq);
+         return false;
+      }
+      const cec_command & cmd = ((Command *)item)->cmd;
+      // the checks of transmit(), now rather than on the sending thread
+      if( !OpcodeCheck(cmd, errstr, sizeof(errstr)) ) {
+         PyErr_SetString(PyExc_ValueError, errstr);
+         Py_DECREF(seq);
+         return false;
+      }
+      result->push_back(cmd);
+   }
+   Py_DECREF(seq);
+   return true;
+}
+
+static PyObject * Adapter_add_rule(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   static const char * kwlist[] = {"match", "actions", "debounce",
+      "callback", NULL};
+   PyObject * values[ARGS_MAX];
+   double debounce = 0;
+   if( !ArgsParse("add_rule", args, nargs, kwnames, kwlist, 2, values) ||
+         (values[2] && !ArgDouble(values[2], &debounce)) ) {
+      return NULL;
+   }
+   if( !(debounce >= 0) ) {
+      PyErr_SetString(PyExc_ValueError, "debounce must not be negative");
+      return NULL;
+   }
+   PyObject * callback = values[3] == Py_None ? NULL : values[3];
+   if( callback && !PyCallable_Check(callback) ) {
+      PyErr_SetString(PyExc_TypeError, "callback must be callable");
+      return NULL;
+   }
+
+   Rule rule;
+   if( !parse_match(values[0], &rule.match) ||
+         !parse_frames(self, values[1], "actions", &rule.actions) ) {
+      return NULL;
+   }
+   rule.debounce = std::chrono::duration_cast<
+      std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(debounce));
+   rule.notify = callback != NULL;
+
+   int id;
+   {
+      // hold callbacks_lock so that the rule can't fire before its
+      // callback is registered
+      std::lock_guard<std::mutex> guard(*self->callbacks_lock);
+      id = self->rules->Add(rule);
+      if( callback ) {
+         Py_INCREF(callback);
+         (*self->rule_callbacks)[id] = callback;
+      }
+   }
+   return PyLong_FromLong(id);
+}
+
+static PyObject * Adapter_remove_rule(Adapter * self, PyObject * arg) {
+   long id = PyLong_AsLong(arg);
+   if( id == -1 && PyErr_Occurred() ) return NULL;
+   bool removed = self->rules->Remove(id);
+   PyObject * callback = NULL;
+   {
+      std::lock_guard<std::mutex> guard(*self->callbacks_lock);
+      rule_cb_map::iterator itr = self->rule_callbacks->find(id);
+      if( itr != self->rule_callbacks->end() ) {
+         callback = itr->second;
+         self->rule_callbacks->erase(itr);
+      }
+   }
+   Py_XDECREF(callback);
+   RETURN_BOOL(removed);
+}
+
+// send the actions of the rules a frame fired, or a scheduled sequence, in
+// order; call without the GIL
+static void send_frames(Adapter * self,
+      const std::vector<cec_command> & frames) {
+   Backend * lib = self->lib.load();
+   if( lib == NULL ) return;
+   for( size_t i=0; i<frames.size(); i++ ) {
+      send_frame(self, lib, frames[i]);
+   }
+}
+
+// call the callbacks of the rules in ids, after their actions were sent.
+// Call with the GIL
+static void rule_notify(Adapter * self, const std::vector<int> & ids,
+      PyObject * command) {
+   for( size_t i=0; i<ids.size(); i++ ) {
+      PyObject * callback = NULL;
+      {
+         std::lock_guard<std::mutex> guard(*self->callbacks_lock);
+         rule_cb_map::iterator itr = self->rule_callbacks->find(ids[i]);
+         if( itr != self->rule_callbacks->end() ) {
+            callback = itr->second;
+            Py_INCREF(callback);
+         }
+      }
+      // removed since it fired
+      if( callback == NULL ) continue;
+      PyObject * result = PyObject_CallFunction(callback, "iO", ids[i],
+            command);
+      if( result == NULL ) {
+         PyErr_WriteUnraisable((PyObject*)self);
+      }
+      Py_XDECREF(result);
+      Py_DECREF(callback);
+   }
+}
+
+static PyObject * Adapter_schedule(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   static const char * kwlist[] = {"frames", "at", "every", "jitter", NULL};
+   PyObject * values[ARGS_MAX];
+   double at = 0;
+   double every = 0;
+   double jitter = 0;
+   if( !ArgsParse("schedule", args, nargs, kwnames, kwlist, 1, values) ||
+         (values[1] && values[1] != Py_None && !ArgDouble(values[1], &at)) ||
+         (values[2] && values[2] != Py_None &&
+          !ArgDouble(values[2], &every)) ||
+         (values[3] && !ArgDouble(values[3], &jitter)) ) {
+      return NULL;
+   }
+   bool periodic = values[2] && values[2] != Py_None;
+   if( periodic && !(every > 0) ) {
+      PyErr_SetString(PyExc_ValueError, "every must be positive");
+      return NULL;
+   }
+   if( !(jitter >= 0) ) {
+      PyErr_SetString(PyExc_ValueError, "jitter must not be negative");
+      return NULL;
+   }
+
+   std::vector<cec_command> frames;
+   if( PyObject_TypeCheck(values[0], self->command_type) ) {
+      // a single frame; cec.Command is a dict, not a sequence of them
+      PyObject * single = PyTuple_Pack(1, values[0]);
+      if( single == NULL ) return NULL;
+      bool ok = parse_frames(self, single, "frames", &frames);
+      Py_DECREF(single);
+      if( !ok ) return NULL;
+   } else if( !parse_frames(self, values[0], "frames", &frames) ) {
+      return NULL;
+   }
+   if( frames.empty() ) {
+      PyErr_SetString(PyExc_ValueError, "frames must not be empty");
+      return NULL;
+   }
+
+   Scheduler::clock::time_point when = Scheduler::clock::now();
+   if( values[1] && values[1] != Py_None ) when = steady_from_wall(at);
+   int id;
+   Py_BEGIN_ALLOW_THREADS
+   id = self->scheduler->Add(frames, when,
+         std::chrono::duration_cast<Scheduler::clock::duration>(
+            std::chrono::duration<double>(periodic ? every : 0)),
+         std::chrono::duration_cast<Scheduler::clock::duration>(
+            std::chrono::duration<double>(jitter)));
+   Py_END_ALLOW_THREADS
+   return PyLong_FromLong(id);
+}
+
+static PyObject * Adapter_cancel(Adapter * self, PyObject * arg) {
+   long id = PyLong_AsLong(arg);
+   if( id == -1 && PyErr_Occurred() ) return NULL;
+   bool cancelled;
+   Py_BEGIN_ALLOW_THREADS
+   cancelled = self->scheduler->Cancel(id);
+   Py_END_ALLOW_THREADS
+   RETURN_BOOL(cancelled);
+}
+
+#if HAVE_SIM_BACKEND
+// the simulated bus behind an adapter, or NULL with an exception set
+static SimBackend * sim_backend(Adapter * self) {
+   Backend * lib = self->lib.load();
+   SimBackend * sim = lib ? dynamic_cast<SimBackend *>(lib->Target()) : NULL;
+   if( sim == NULL ) {
+      PyErr_SetString(PyExc_IOError,
+            "Adapter is not on a simulated bus; use init(\"sim://\")");
+   }
+   return sim;
+}
+
+static bool sim_addr(unsigned char addr) {
+   if( addr > 14 ) {
+      PyErr_SetString(PyExc_ValueError,
+            "Logical address must be between 0 and 14");
+      return false;
+   }
+   return true;
+}
+
+// build a frame from an opcode and a parameter string
+static bool sim_frame(cec_command * cmd, unsigned char initiator,
+      unsigned char destination, unsigned char opcode, const char * params,
+      Py_ssize_t param_count) {
+   if( param_count > CEC_MAX_DATA_PACKET_SIZE ) {
+      char errstr[1024];
+      snprintf(errstr, 1024, "Too many parameters, maximum is %d",
+         CEC_MAX_DATA_PACKET_SIZE);
+      PyErr_SetString(PyExc_ValueError, errstr);
+      return false;
+   }
+   cec_command::Format(*cmd, (cec_logical_address)initiator,
+         (cec_logical_address)destination, (cec_opcode)opcode);
+   for( Py_ssize_t i=0; i<param_count; i++ ) {
+      cmd->PushBack(((uint8_t *)params)[i]);
+   }
+   return true;
+}
+
+static PyObject * Adapter_sim_add_device(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+
+   unsigned char addr;
+   const char * physical_address = NULL;
+   unsigned long vendor = 0;
+   const char * osd_name = NULL;
+   int power_on = 1;
+   unsigned char version = CEC_VERSION_1_4;
+   const char * language = "eng";
+   static const char * kwlist[] = {"addr", "physical_address", "vendor",
+      "osd_name", "power_on", "cec_version", "language", NULL};
+   PyObject * values[ARGS_MAX];
+
+   if( !ArgsParse("sim_add_device", args, nargs, kwnames, kwlist, 1,
+            values) || !ArgByte(values[0], &addr) ||
+         (values[1] && !ArgStringOrNone(values[1], "physical_address",
+            &physical_address)) ||
+         (values[2] && !ArgUnsignedLong(values[2], &vendor)) ||
+         (values[3] && !ArgStringOrNone(values[3], "osd_name", &osd_name)) ||
+         (values[4] && !ArgBool(values[4], &power_on)) ||
+         (values[5] && !ArgByte(values[5], &version)) ||
+         (values[6] && !ArgString(values[6], "language", &language)) ) {
+      return NULL;
+   }
+   if( !sim_addr(addr) ) return NULL;
+
+   SimDevice dev;
+   if( physical_address ) {
+      int pa = parse_physical_addr(physical_address);
+      if( pa < 0 ) {
+         PyErr_SetString(PyExc_ValueError, "Invalid physical address");
+         return NULL;
+      }
+      dev.physical_address = pa;
+   }
+   if( vendor > 0xFFFFFF ) {
+      PyErr_SetString(PyExc_ValueError, "Vendor ID must fit in 24 bits");
+      return NULL;
+   }
+   dev.vendor = vendor;
+   if( osd_name ) {
+      if( strlen(osd_name) > 14 ) {
+         PyErr_SetString(PyExc_ValueError,
+               "OSD name must be at most 14 characters");
+         return NULL;
+      }
+      dev.osd_name = osd_name;
+   }
+   if( strlen(language) != 3 ) {
+      PyErr_SetString(PyExc_ValueError,
+            "Language must be a 3 letter ISO 639-2 code");
+      return NULL;
+   }
+   dev.language = language;
+   dev.power = power_on ? CEC_POWER_STATUS_ON : CEC_POWER_STATUS_STANDBY;
+   dev.version = (cec_version)version;
+
+   SimBackend * sim = sim_backend(self);
+   if( sim == NULL ) return NULL;
+   bool success;
+   Py_BEGIN_ALLOW_THREADS
+   success = sim->AddDevice((cec_logical_address)addr, dev);
+   Py_END_ALLOW_THREADS
+   if( !success ) {
+      PyErr_SetString(PyExc_ValueError,
+            "Logical address is claimed by this host");
+      return NULL;
+   }
+   Py_RETURN_NONE;
+}
+
+static PyObject * Adapter_sim_remove_device(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   unsigned char addr;
+   static const char * kwlist[] = {"addr", NULL};
+   PyObject * values[ARGS_MAX];
+   if( !ArgsParse("sim_remove_device", args, nargs, kwnames, kwlist, 1,
+            values) || !ArgByte(values[0], &addr) ) {
+      return NULL;
+   }
+   if( !sim_addr(addr) ) return NULL;
+   SimBackend * sim = sim_backend(self);
+   if( sim == NULL ) return NULL;
+   RETURN_BOOL(sim->RemoveDevice((cec_logical_address)addr));
+}
+
+static PyObject * Adapter_sim_nack(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   unsigned char addr;
+   int nack = 1;
+   static const char * kwlist[] = {"addr", "nack", NULL};
+   PyObject * values[ARGS_MAX];
+   if( !ArgsParse("sim_nack", args, nargs, kwnames, kwlist, 1, values) ||
+         !ArgByte(values[0], &addr) ||
+         (values[1] && !ArgBool(values[1], &nack)) ) {
+      return NULL;
+   }
+   if( !sim_addr(addr) ) return NULL;
+   SimBackend * sim = sim_backend(self);
+   if( sim == NULL ) return NULL;
+   RETURN_BOOL(sim->SetNack((cec_logical_address)addr, nack));
+}
+
+static PyObject * Adapter_sim_respond(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   unsigned char addr;
+   unsigned char opcode;
+   static const char * kwlist[] = {"addr", "opcode", "replies", NULL};
+   PyObject * values[ARGS_MAX];
+   if( !ArgsParse("sim_respond", args, nargs, kwnames, kwlist, 3, values) ||
+         !ArgByte(values[0], &addr) || !ArgByte(values[1], &opcode) ) {
+      return NULL;
+   }
+   PyObject * replies = values[2];
+   if( !sim_addr(addr) ) return NULL;
+
+   // None restores the default behaviour
+   std::vector<cec_command> frames;
+   if( replies != Py_None ) {
+      PyObject * seq = PySequence_Fast(replies,
+            "replies must be a sequence of (opcode, parameters"
+            "[, destination]) tuples or None");
+      if( seq == NULL ) return NULL;
+      for( Py_ssize_t i=0; i<PySequence_Fast_GET_SIZE(seq); i++ ) {
+         unsigned char reply_opcode;
+         const char * params = NULL;
+         Py_ssize_t param_count = 0;
+         unsigned char destination = 0;
+         cec_command frame;
+         PyObject * item = PySequence_Fast_GET_ITEM(seq, i);
+         if( !PyTuple_Check(item) ) {
+            PyErr_SetString(PyExc_TypeError,
+                  "each reply must be an (opcode, parameters"
+                  "[, destination]) tuple");
+            Py_DECREF(seq);
+            return NULL;
+         }
+         if( !PyArg_ParseTuple(item, "bs#|b:sim_respond", &reply_opcode,
+                  &params, &param_count, &destination) ||
+               !sim_frame(&frame, addr, destination, reply_opcode, params,
+                  param_count) ) {
+            Py_DECREF(seq);
+            return NULL;
+         }
+         // without a destination, the reply goes to whoever sent the request
+         if( PyTuple_GET_SIZE(item) < 3 ) {
+            frame.destination = CECDEVICE_UNKNOWN;
+         }
+         frames.push_back(frame);
+      }
+      Py_DECREF(seq);
+   }
+
+   SimBackend * sim = sim_backend(self);
+   if( sim == NULL ) return NULL;
+   RETURN_BOOL(sim->Script((cec_logical_address)addr, opcode,
+            replies == Py_None ? NULL : &frames));
+}
+
+static PyObject * Adapter_sim_send(Adapter * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   unsigned char initiator;
+   unsigned char destination;
+   unsigned char opcode;
+   const char * params = NULL;
+   Py_ssize_t param_count = 0;
+   static const char * kwlist[] = {"initiator", "destination", "opcode",
+      "parameters", NULL};
+   PyObject * values[ARGS_MAX];
+
+   if( !ArgsParse("sim_send", args, nargs, kwnames, kwlist, 3, values) ||
+         !ArgByte(values[0], &initiator) ||
+         !ArgByte(values[1], &destination) || !ArgByte(values[2], &opcode) ||
+         (values[3] && !ArgBytes(values[3], "parameters", &params,
+            &param_count)) ) {
+      return NULL;
+   }
+   if( !sim_addr(initiator) ) return NULL;
+   if( destination > 15 ) {
+      PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
+      return NULL;
+   }
+   cec_command frame;
+   if( !sim_frame(&frame, initiator, destination, opcode, params,
+            param_count) ) {
+      return NULL;
+   }
+   SimBackend * sim = sim_backend(self);
+   if( sim == NULL ) return NULL;
+   RETURN_BOOL(sim->Send(frame));
+}
+#endif
+
+
+// Attach libcec's callback thread to the interpreter that owns the adapter
+// for the lifetime of this object. PyGILState only supports the main
+// interpreter, so adapters created in a subinterpreter get a fresh thread
+// state for each callback instead.
+class CallbackThreadState {
+   public:
+      CallbackThreadState(Adapter * adapter, long int e) : tstate(NULL),
+            event(e) {
+         PROBE1(gil__acquire, event);
+         std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+         if( adapter->interp == PyInterpreterState_Main() ) {
+            gstate = PyGILState_Ensure();
+         } else {
+            tstate = PyThreadState_New(adapter->interp);
+            PyEval_RestoreThread(tstate);
+         }
+         uint64_t wait = std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start).count();
+         adapter->stats->GilWait(wait);
+         PROBE2(gil__acquired, event, wait);
+      }
+
+      ~CallbackThreadState() {
+         PROBE1(gil__release, event);
+         if( tstate ) {
+            PyThreadState_Clear(tstate);
+            PyThreadState_DeleteCurrent();
+         } else {
+            PyGILState_Release(gstate);
+         }
+      }
+
+   private:
+      PyGILState_STATE gstate;
+      PyThreadState * tstate;
+      long int event;
+};
+
+#if CEC_LIB_VERSION_MAJOR >= 4
+static void log_cb(void * cbparam, const cec_log_message* message) {
+#else
+static int log_cb(void * cbparam, const cec_log_message message) {
+#endif
+   debug("got log callback\n");
+   PROBE1(callback__entry, EVENT_LOG);
+   Adapter * self = (Adapter*)cbparam;
+#if CEC_LIB_VERSION_MAJOR >= 4
+   int level = message->level;
+   long int time = message->time;
+   const char* msg = message->message;
+#else
+   int level = message.level;
+   long int time = message.time;
+   const char* msg = message.message;
+#endif
+   self->server->Log(level, time, msg);
+   CallbackThreadState gil(self, EVENT_LOG);
+   // decode message ignoring invalid characters
+   PyObject * umsg = PyUnicode_DecodeASCII(msg, strlen(msg), "ignore");
+   PyObject * args = Py_BuildValue("(iilO)", EVENT_LOG,
+         level,
+         time,
+         umsg);
+   dispatch_event(self, EVENT_LOG, args);
+   Py_XDECREF(umsg);
+#if CEC_LIB_VERSION_MAJOR >= 4
+   return;
+#else
+   return 1;
+#endif
+}
+
+#if CEC_LIB_VERSION_MAJOR >= 4
+static void keypress_cb(void * cbparam, const cec_keypress* key) {
+#else
+static int keypress_cb(void * cbparam, const cec_keypress key) {
+#endif
+   debug("got keypress callback\n");
+   PROBE1(callback__entry, EVENT_KEYPRESS);
+   Adapter * self = (Adapter*)cbparam;
+#if CEC_LIB_VERSION_MAJOR >= 4
+   cec_user_control_code keycode = key->keycode;
+   unsigned int duration = key->duration;
+#else
+   cec_user_control_code keycode = key.keycode;
+   unsigned int duration = key.duration;
+#endif
+   self->server->KeyPress(keycode, duration);
+   self->ring->KeyPress(keycode, duration);
+   CallbackThreadState gil(self, EVENT_KEYPRESS);
+   PyObject * args = Py_BuildValue("(iBI)", EVENT_KEYPRESS,
+         keycode,
+         duration);
+   dispatch_event(self, EVENT_KEYPRESS, args);
+#if CEC_LIB_VERSION_MAJOR >= 4
+   return;
+#else
+   return 1;
+#endif
+}
+
+#if CEC_LIB_VERSION_MAJOR >= 4
+static void command_cb(void * cbparam, const cec_command* command) {
+#else
+static int command_cb(void * cbparam, const cec_command command) {
+#endif
+   debug("got command callback\n");
+   PROBE1(callback__entry, EVENT_COMMAND);
+   Adapter * self = (Adapter*)cbparam;
+#if CEC_LIB_VERSION_MAJOR >= 4
+   const cec_command * cmd = command;
+#else
+   const cec_command * cmd = &command;
+#endif
+   // keep the routing state current before handing off to python
+   self->topology->Update(*cmd);
+   self->replies->Update(*cmd);
+   self->device_cache->Update(*cmd);
+   self->stats->Received(*cmd);
+   // reflexes go out before anything waits for Python
+   std::vector<cec_command> actions;
+   std::vector<int> notify;
+   self->rules->Fire(*cmd, &actions, &notify);
+   if( !actions.empty() ) {
+      send_frames(self, actions);
+   }
+   self->server->Command(*cmd);
+   self->ring->Command(*cmd);
+   CallbackThreadState gil(self, EVENT_COMMAND);
+   PyObject * frame = CommandNew(self->command_type, *cmd);
+   if( frame && !notify.empty() ) {
+      rule_notify(self, notify, frame);
+   }
+   PyObject * args = Py_BuildValue("(iN)", EVENT_COMMAND, frame);
+   dispatch_event(self, EVENT_COMMAND, args);
+#if CEC_LIB_VERSION_MAJOR >= 4
+   return;
+#else
+   return 1;
+#endif
+}
+
+#if CEC_LIB_VERSION_MAJOR >= 4
+static void config_cb(void * cbparam, const libcec_configuration* configuration) {
+#else
+static int config_cb(void * cbparam, const libcec_configuration configuration) {
+#endif
+   debug("got config callback\n");
+   PROBE1(callback__entry, EVENT_CONFIG_CHANGE);
+   Adapter * self = (Adapter*)cbparam;
+#if CEC_LIB_VERSION_MAJOR >= 4
+   const libcec_configuration * config = configuration;
+#else
+   const libcec_configuration * config = &configuration;
+#endif
+   self->server->Configuration(*config);
+   libcec_configuration old;
+   {
+      std::lock_guard<std::mutex> guard(*self->config_lock);
+      old = *self->reported_config;
+      *self->reported_config = *config;
+   }
+   // libcec reports the configuration more often than it changes
+   if( !ConfigEqual(old, *config) ) {
+      CallbackThreadState gil(self, EVENT_CONFIG_CHANGE);
+      PyObject * args = Py_BuildValue("(iNN)", EVENT_CONFIG_CHANGE,
+            ConfigDiff(old, *config),
+            ConfigNew(self->config_type, *config));
+      dispatch_event(self, EVENT_CONFIG_CHANGE, args);
+   }
+#if CEC_LIB_VERSION_MAJOR >= 4
+   return;
+#else
+   return 1;
+#endif
+}
+
+#if CEC_LIB_VERSION_MAJOR >= 4
+static void alert_cb(void * cbparam, const libcec_alert alert, const libcec_parameter p) {
+#else
+static int alert_cb(void * cbparam, const libcec_alert alert, const libcec_parameter p) {
+#endif
+   debug("got alert callback\n");
+   PROBE1(callback__entry, EVENT_ALERT);
+   Adapter * self = (Adapter*)cbparam;
+   if( alert == CEC_ALERT_CONNECTION_LOST ) {
+      self->supervisor->ConnectionLost();
+   }
+   const char * text = p.paramType == CEC_PARAMETER_TYPE_STRING ?
+      (const char *)p.paramData : NULL;
+   self->server->Alert(alert, text);
+   self->ring->Alert(alert, text);
+   CallbackThreadState gil(self, EVENT_ALERT);
+   PyObject * param = Py_None;
+   if( p.paramType == CEC_PARAMETER_TYPE_STRING ) {
+      param = Py_BuildValue("s", p.paramData);
+   } else {
+      Py_INCREF(param);
+   }
+   PyObject * args = Py_BuildValue("(iiN)", EVENT_ALERT, alert, param);
+   dispatch_event(self, EVENT_ALERT, args);
+#if CEC_LIB_VERSION_MAJOR >= 4
+   return;
+#else
+   return 1;
+#endif
+}
+
+static int menu_cb(void * cbparam, const cec_menu_state menu) {
+   debug("got menu callback\n");
+   PROBE1(callback__entry, EVENT_MENU_CHANGED);
+   Adapter * self = (Adapter*)cbparam;
+   self->server->MenuState(menu);
+   CallbackThreadState gil(self, EVENT_MENU_CHANGED);
+   PyObject * args = Py_BuildValue("(ii)", EVENT_MENU_CHANGED, menu);
+   dispatch_event(self, EVENT_MENU_CHANGED, args);
+   return 1;
+}
+
+static void activated_cb(void * cbparam, const cec_logical_address logical_address,
+      const uint8_t state) {
+   debug("got activated callback\n");
+   PROBE1(callback__entry, EVENT_ACTIVATED);
+   Adapter * self = (Adapter*)cbparam;
+   self->topology->SetActiveSource(logical_address, state == 1);
+   self->server->SourceActivated(logical_address, state == 1);
+   CallbackThreadState gil(self, EVENT_ACTIVATED);
+   PyObject * active = (state == 1) ? Py_True : Py_False;
+   PyObject * args = Py_BuildValue("(iOi)", EVENT_ACTIVATED, active,
+      logical_address);
+   dispatch_event(self, EVENT_ACTIVATED, args);
+   return;
+}
+
+static void reconnected_cb(Adapter * self, double outage) {
+   debug("adapter reconnected\n");
+   PROBE1(callback__entry, EVENT_RECONNECTED);
+   CallbackThreadState gil(self, EVENT_RECONNECTED);
+   PyObject * args = Py_BuildValue("(id)", EVENT_RECONNECTED, outage);
+   dispatch_event(self, EVENT_RECONNECTED, args);
+}
+
+
+static PyObject * Adapter_new(PyTypeObject * type, PyObject * args,
+      PyObject * kwds) {
+   Adapter * self;
+
+   if( !PyArg_ParseTuple(args, ":Adapter new") ) {
+      return NULL;
+   }
+
+   ModuleState * state = ModuleStateFromType(type);
+   if( state == NULL ) {
+      return NULL;
+   }
+
+   self = (Adapter*)type->tp_alloc(type, 0);
+   if( self == NULL ) {
+      return NULL;
+   }
+
+   // libcec itself is started lazily, by the first call that needs it
+   new (&self->lib) std::atomic<Backend *>(NULL);
+   self->lib_lock = new std::mutex();
+   self->interp = PyInterpreterState_Get();
+   Py_INCREF(state->device_type);
+   self->device_type = state->device_type;
+   Py_INCREF(state->config_type);
+   self->config_type = state->config_type;
+   Py_INCREF(state->command_type);
+   self->command_type = state->command_type;
+
+   self->callbacks_lock = new std::mutex();
+   self->callbacks = new cb_list();
+   self->rule_callbacks = new rule_cb_map();
+   self->rules = new Rules();
+   self->topology = new Topology();
+   self->replies = new Replies();
+   self->server = new Server();
+   self->ring = new EventRing();
+   self->device_cache = new DeviceCache();
+   self->supervisor = new Supervisor([self](double outage) {
+         reconnected_cb(self, outage);
+      }, [self](const cec_command & cmd) {
+         // counted and probed like any other frame. dealloc takes lib
+         // before it stops the supervisor
+         Backend * lib = self->lib.load();
+         return lib != NULL && send_frame(self, lib, cmd);
+      });
+   self->scheduler = new Scheduler([self](
+            const std::vector<cec_command> & frames,
+            Scheduler::clock::duration late) {
+         self->stats->Scheduled(std::chrono::duration_cast<
+               std::chrono::nanoseconds>(late).count());
+         send_frames(self, frames);
+      });
+
+   // set up libcec
+   //  libcec config
+   self->config = new libcec_configuration();
+   self->config->Clear();
+
+   snprintf(self->config->strDeviceName, 13, "python-cec");
+   // CEC_CLIENT_VERSION_CURRENT was introduced in 2.0.4
+   // just use 2.1.0 because the conditional is simpler
+#if CEC_LIB_VERSION_MAJOR >= 3
+   self->config->clientVersion = LIBCEC_VERSION_CURRENT;
+#elif CEC_LIB_VERSION_MAJOR >= 2 && CEC_LIB_VERSION_MINOR >= 1
+   self->config->clientVersion = CEC_CLIENT_VERSION_CURRENT;
+#else
+   // fall back to 1.6.0 since it's the lowest common denominator shipped with
+   // Ubuntu
+   self->config->clientVersion = CEC_CLIENT_VERSION_1_6_0;
+#endif
+   self->config->bActivateSource = 0;
+   self->config->deviceTypes.Add(CEC_DEVICE_TYPE_RECORDING_DEVICE);
+
+   //  libcec callbacks
+   self->cec_callbacks = new ICECCallbacks();
+#if CEC_LIB_VERSION_MAJOR > 1 || ( CEC_LIB_VERSION_MAJOR == 1 && CEC_LIB_VERSION_MINOR >= 7 )
+   self->cec_callbacks->Clear();
+#endif
+#if CEC_LIB_VERSION_MAJOR >= 4
+   self->cec_callbacks->logMessage = log_cb;
+   self->cec_callbacks->keyPress = keypress_cb;
+   self->cec_callbacks->commandReceived = command_cb;
+   self->cec_callbacks->configurationChanged = config_cb;
+   self->cec_callbacks->alert = alert_cb;
+   self->cec_callbacks->menuStateChanged = menu_cb;
+   self->cec_callbacks->sourceActivated = activated_cb;
+#else
+   self->cec_callbacks->CBCecLogMessage = log_cb;
+   self->cec_callbacks->CBCecKeyPress = keypress_cb;
+   self->cec_callbacks->CBCecCommand = command_cb;
+   self->cec_callbacks->CBCecConfigurationChanged = config_cb;
+   self->cec_callbacks->CBCecAlert = alert_cb;
+   self->cec_callbacks->CBCecMenuStateChanged = menu_cb;
+   self->cec_callbacks->CBCecSourceActivated = activated_cb;
+#endif
+
+   self->config->callbacks = self->cec_callbacks;
+   // route libcec callbacks back to this adapter
+   self->config->callbackParam = self;
+
+   self->config_lock = new std::mutex();
+   self->reported_config = new libcec_configuration(*self->config);
+   self->persisted_config = NULL;
+
+   Stats * stats = self->stats = new Stats();
+   Supervisor * supervisor = self->supervisor;
+   self->exporter = new StatsExporter([stats, supervisor]() {
+         return stats->Prometheus(supervisor->Pending());
+      });
+
+   return (PyObject *)self;
+}
+
+static int Adapter_traverse(Adapter * self, visitproc visit, void * arg) {
+   Py_VISIT(Py_TYPE(self));
+   Py_VISIT(self->device_type);
+   Py_VISIT(self->config_type);
+   Py_VISIT(self->command_type);
+   if( self->callbacks ) {
+      for( cb_list::const_iterator itr = self->callbacks->begin();
+            itr != self->callbacks->end();
+            ++itr ) {
+         Py_VISIT(itr->cb);
+      }
+   }
+   if( self->rule_callbacks ) {
+      for( rule_cb_map::const_iterator itr = self->rule_callbacks->begin();
+            itr != self->rule_callbacks->end();
+            ++itr ) {
+         Py_VISIT(itr->second);
+      }
+   }
+   return 0;
+}
+
+static int Adapter_clear(Adapter * self) {
+   if( self->callbacks ) {
+      cb_list callbacks;
+      {
+         std::lock_guard<std::mutex> guard(*self->callbacks_lock);
+         callbacks.swap(*self->callbacks);
+      }
+      for( cb_list::iterator itr = callbacks.begin();
+            itr != callbacks.end();
+            ++itr ) {
+         Py_DECREF(itr->cb);
+      }
+   }
+   if( self->rule_callbacks ) {
+      rule_cb_map rule_callbacks;
+      {
+         std::lock_guard<std::mutex> guard(*self->callbacks_lock);
+         rule_callbacks.swap(*self->rule_callbacks);
+      }
+      for( rule_cb_map::iterator itr = rule_callbacks.begin();
+            itr != rule_callbacks.end();
+            ++itr ) {
+         Py_DECREF(itr->second);
+      }
+   }
+   // the types stay until dealloc: libcec's callback thread builds
+   // commands and configs with them until lib is deleted
+   return 0;
+}
+
+static void Adapter_dealloc(Adapter * self) {
+   PyTypeObject * type = Py_TYPE(self);
+   PyObject_GC_UnTrack(self);
+   // the exporter reads the stats and supervisor from its own thread
+   Py_BEGIN_ALLOW_THREADS
+   self->exporter->Stop();
+   // clients of the server call into lib from its threads
+   self->server->Stop();
+   self->ring->Close();
+   // as does the scheduler
+   self->scheduler->Stop();
+   Py_END_ALLOW_THREADS
+   Backend * lib = self->lib.exchange(NULL);
+   if( lib ) {
+      // libcec joins its callback thread here, as does the supervisor;
+      // either may be waiting for the GIL
+      Py_BEGIN_ALLOW_THREADS
+      if( self->supervisor ) {
+         self->supervisor->Stop();
+      }
+      self->device_cache->Stop();
+      self->device_cache->Save();
+      delete lib;
+      Py_END_ALLOW_THREADS
+   }
+   Adapter_clear(self);
+   Py_CLEAR(self->device_type);
+   Py_CLEAR(self->config_type);
+   Py_CLEAR(self->command_type);
+   delete self->callbacks;
+   delete self->rule_callbacks;
+   delete self->rules;
+   delete self->callbacks_lock;
+   delete self->lib_lock;
+   delete self->topology;
+   delete self->replies;
+   delete self->server;
+   delete self->ring;
+   delete self->supervisor;
+   delete self->scheduler;
+   delete self->device_cache;
+   delete self->cec_callbacks;
+   delete self->config;
+   delete self->reported_config;
+   delete self->persisted_config;
+   delete self->config_lock;
+   delete self->exporter;
+   delete self->stats;
+   type->tp_free((PyObject*)self);
+   Py_DECREF(type);
+}
+static PyMethodDef Adapter_methods[] = {
+   {"init", (PyCFunction)Adapter_init, METH_FASTCALL | METH_KEYWORDS,
+      "Open an adapter"},
+   {"close", (PyCFunction)Adapter_close, METH_NOARGS, "Close an adapter"},
+   {"list_devices", (PyCFunction)Adapter_list_devices, METH_NOARGS,
+      "List devices"},
+   {"add_callback", (PyCFunction)Adapter_add_callback,
+      METH_FASTCALL | METH_KEYWORDS, "Add a callback"},
+   {"remove_callback", (PyCFunction)Adapter_remove_callback,
+      METH_FASTCALL | METH_KEYWORDS, "Remove a callback"},
+   {"transmit", (PyCFunction)Adapter_transmit, METH_FASTCALL | METH_KEYWORDS,
+      "Transmit a raw CEC command"},
+   {"is_active_source", (PyCFunction)Adapter_is_active_source,
+      METH_FASTCALL | METH_KEYWORDS, "Check active source"},
+   {"set_active_source", (PyCFunction)Adapter_set_active_source,
+      METH_FASTCALL | METH_KEYWORDS, "Set active source"},
+   {"volume_up", (PyCFunction)Adapter_volume_up, METH_NOARGS, "Volume Up"},
+   {"volume_down", (PyCFunction)Adapter_volume_down, METH_NOARGS,
+      "Volume Down"},
+#if CEC_LIB_VERSION_MAJOR > 1
+   {"toggle_mute", (PyCFunction)Adapter_toggle_mute, METH_NOARGS,
+      "Toggle Mute"},
+#endif
+   {"set_stream_path", (PyCFunction)Adapter_set_stream_path, METH_O,
+      "Set HDMI stream path"},
+   {"active_source", (PyCFunction)Adapter_active_source, METH_NOARGS,
+      "Logical address of the active source, from observed routing frames"},
+   {"active_route", (PyCFunction)Adapter_active_route, METH_NOARGS,
+      "Physical address of the active HDMI route"},
+   {"topology", (PyCFunction)Adapter_topology, METH_NOARGS,
+      "Map of logical to physical addresses seen on the bus"},
+   {"device_at", (PyCFunction)Adapter_device_at, METH_FASTCALL | METH_KEYWORDS,
+      "Logical address of the device at a physical address"},
+   {"port_device", (PyCFunction)Adapter_port_device,
+      METH_FASTCALL | METH_KEYWORDS,
+      "Logical address of the device behind an HDMI port"},
+   {"path_to", (PyCFunction)Adapter_path_to, METH_FASTCALL | METH_KEYWORDS,
+      "HDMI path from the TV to a device"},
+   {"set_physical_addr", (PyCFunction)Adapter_set_physical_addr,
+      METH_FASTCALL | METH_KEYWORDS, "Set HDMI physical address"},
+   {"can_persist_config", (PyCFunction)Adapter_can_persist_config,
+      METH_NOARGS,
+      "return true if the current adapter can persist the CEC configuration"},
+   {"get_config", (PyCFunction)Adapter_get_config, METH_NOARGS,
+      "Get the current libcec configuration"},
+   {"set_config", (PyCFunction)Adapter_set_config, METH_O,
+      "Change the libcec configuration"},
+   {"persist_config", (PyCFunction)Adapter_persist_config,
+      METH_FASTCALL | METH_KEYWORDS, "persist CEC configuration to adapter"},
+   {"power_on", (PyCFunction)Adapter_power_on,
+      METH_FASTCALL | METH_KEYWORDS, "Power on a group of devices"},
+   {"standby", (PyCFunction)Adapter_standby, METH_FASTCALL | METH_KEYWORDS,
+      "Put a group of devices into standby"},
+   {"power_status", (PyCFunction)Adapter_power_status,
+      METH_FASTCALL | METH_KEYWORDS, "Power status of a group of devices"},
+   {"ping", (PyCFunction)Adapter_ping, METH_FASTCALL | METH_KEYWORDS,
+      "Poll a group of devices; a bit mask of those that answered"},
+   {"scan", (PyCFunction)Adapter_scan, METH_NOARGS,
+      "Poll every logical address; a bit mask of the devices present"},
+   {"wait_for", (PyCFunction)Adapter_wait_for, METH_FASTCALL | METH_KEYWORDS,
+      "Wait until a device is in a power state and/or is the active source"},
+   {"query", (PyCFunction)Adapter_query, METH_FASTCALL | METH_KEYWORDS,
+      "Query attributes of a group of devices"},
+   {"set_port", (PyCFunction)Adapter_set_port, METH_FASTCALL | METH_KEYWORDS,
+      "Set upstream HDMI port"},
+   {"stats", (PyCFunction)Adapter_stats, METH_NOARGS,
+      "Bus and callback counters"},
+   {"export_stats", (PyCFunction)Adapter_export_stats,
+      METH_FASTCALL | METH_KEYWORDS,
+      "Publish the counters in the Prometheus text format"},
+   {"serve", (PyCFunction)Adapter_serve, METH_FASTCALL | METH_KEYWORDS,
+      "Share this adapter with other processes over a UNIX socket"},
+   {"add_rule", (PyCFunction)Adapter_add_rule, METH_FASTCALL | METH_KEYWORDS,
+      "Send frames in reply to matching frames, without waiting for Python"},
+   {"remove_rule", (PyCFunction)Adapter_remove_rule, METH_O,
+      "Remove a rule added by add_rule"},
+   {"schedule", (PyCFunction)Adapter_schedule, METH_FASTCALL | METH_KEYWORDS,
+      "Send frames at a given time, once or periodically"},
+   {"cancel", (PyCFunction)Adapter_cancel, METH_O,
+      "Cancel a transmit added by schedule"},
+   {"publish_shared", (PyCFunction)Adapter_publish_shared,
+      METH_FASTCALL | METH_KEYWORDS,
+      "Publish commands, key presses and alerts in shared memory for "
+      "cec.attach_shared"},
+#if HAVE_SIM_BACKEND
+   {"sim_add_device", (PyCFunction)Adapter_sim_add_device,
+      METH_FASTCALL | METH_KEYWORDS, "Add a device to the simulated bus"},
+   {"sim_remove_device", (PyCFunction)Adapter_sim_remove_device,
+      METH_FASTCALL | METH_KEYWORDS, "Remove a device from the simulated bus"},
+   {"sim_nack", (PyCFunction)Adapter_sim_nack, METH_FASTCALL | METH_KEYWORDS,
+      "Stop or resume acknowledging frames to a simulated device"},
+   {"sim_respond", (PyCFunction)Adapter_sim_respond,
+      METH_FASTCALL | METH_KEYWORDS,
+      "Script the replies of a simulated device to an opcode"},
+   {"sim_send", (PyCFunction)Adapter_sim_send, METH_FASTCALL | METH_KEYWORDS,
+      "Send a frame from a simulated device"},
+#endif
+   {NULL}
+};
+
+static PyType_Slot Adapter_slots[] = {
+   {Py_tp_new, (void*)Adapter_new},
+   {Py_tp_dealloc, (void*)Adapter_dealloc},
+   {Py_tp_traverse, (void*)Adapter_traverse},
+   {Py_tp_clear, (void*)Adapter_clear},
+   {Py_tp_methods, Adapter_methods},
+   {Py_tp_doc, (void*)"CEC Adapter objects"},
+   {0, NULL}
+};
+
+static PyType_Spec Adapter_spec = {
+   "cec.Adapter",
+   sizeof(Adapter),
+   0,
+   Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+   Adapter_slots
+};
+
+PyTypeObject * AdapterTypeInit(PyObject * module) {
+   return (PyTypeObject*)PyType_FromModuleAndSpec(module, &Adapter_spec,
+         NULL);
+}
@@ -0,0 +1,182 @@
+/* adapter.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * CEC adapter interface for Python
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef ADAPTER_H
+#define ADAPTER_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <libcec/cec.h>
+#include <atomic>
+#include <list>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "backend.h"
+#include "detect.h"
+#include "devcache.h"
+#include "replies.h"
+#include "ring.h"
+#include "rules.h"
+#include "scheduler.h"
+#include "server.h"
+#include "stats.h"
+#include "supervisor.h"
+#include "topology.h"
+
+#define EVENT_LOG           0x0001
+#define EVENT_KEYPRESS      0x0002
+#define EVENT_COMMAND       0x0004
+#define EVENT_CONFIG_CHANGE 0x0008
+#define EVENT_ALERT         0x0010
+#define EVENT_MENU_CHANGED  0x0020
+#define EVENT_ACTIVATED     0x0040
+#define EVENT_RECONNECTED   0x0080
+#define EVENT_VALID         0x00FF
+#define EVENT_ALL           0x00FF
+
+// cec.query results
+#define QUERY_OK        0
+#define QUERY_NO_ACK    1 // the device didn't acknowledge the request
+#define QUERY_ABORTED   2 // the device refused it with a Feature Abort
+#define QUERY_TIMEOUT   3
+#define QUERY_MALFORMED 4 // the reply was too short
+
+//#define DEBUG 1
+
+#ifdef DEBUG
+# define debug(...) printf("CEC DEBUG: " __VA_ARGS__)
+#else
+# define debug(...)
+#endif
+
+#define RETURN_BOOL(arg) do { \
+  bool result; \
+  Py_BEGIN_ALLOW_THREADS \
+  result = (arg); \
+  Py_END_ALLOW_THREADS \
+  PyObject * ret = (result)?Py_True:Py_False; \
+  Py_INCREF(ret); \
+  return ret; \
+} while(0)
+
+struct Callback {
+   public:
+      long int event;
+      PyObject * cb;
+
+      Callback(long int e, PyObject * c) : event(e), cb(c) {
+      }
+};
+
+typedef std::list<Callback> cb_list;
+// the callback of each reflex rule that has one, by rule id
+typedef std::map<int, PyObject *> rule_cb_map;
+
+struct Adapter {
+   PyObject_HEAD
+
+   // libcec, or the simulated bus. Created on first use by AdapterLib() or
+   // by init(); once set it stays valid until the adapter is deallocated.
+   // lib_lock serializes creation and changes to config
+   std::atomic<Backend *>     lib;
+   std::mutex *               lib_lock;
+   CEC::libcec_configuration * config;
+   CEC::ICECCallbacks *       cec_callbacks;
+
+   // the interpreter that libcec callbacks are delivered to
+   PyInterpreterState *       interp;
+   PyTypeObject *             device_type;
+   PyTypeObject *             config_type;
+   PyTypeObject *             command_type;
+
+   // callbacks and rule_callbacks are shared with libcec's callback
+   // thread; hold callbacks_lock to read or modify them
+   std::mutex *               callbacks_lock;
+   cb_list *                  callbacks;
+   rule_cb_map *              rule_callbacks;
+   Rules *                    rules;
+   Topology *                 topology;
+   Replies *                  replies;
+   Supervisor *               supervisor;
+   // the device table kept on disk, if init() was given a device_cache
+   DeviceCache *              device_cache;
+   // shares this adapter with other processes, once serve() is called
+   Server *                   server;
+   // publishes events in shared memory, once publish_shared() is called
+   EventRing *                ring;
+   // frames sent later from its own thread, added by schedule()
+   Scheduler *                scheduler;
+
+   // the configuration libcec last reported, and the one last written to
+   // the adapter (NULL if unknown); guarded by config_lock
+   std::mutex *               config_lock;
+   CEC::libcec_configuration * reported_config;
+   CEC::libcec_configuration * persisted_config;
+
+   Stats *                    stats;
+   StatsExporter *            exporter;
+};
+
+// per-module state; each interpreter that imports cec gets its own
+struct ModuleState {
+   PyTypeObject *             adapter_type;
+   PyTypeObject *             device_type;
+   PyTypeObject *             config_type;
+   PyTypeObject *             command_type;
+   PyTypeObject *             descriptor_type;
+   PyTypeObject *             shared_type;
+   Adapter *                  default_adapter;
+};
+
+ModuleState * ModuleStateFromType(PyTypeObject * type);
+
+PyTypeObject * AdapterTypeInit(PyObject * module);
+
+// the backend for an adapter, initializing libcec if this is the first call
+// that needs it. Returns NULL with an exception set on failure. Call with
+// the GIL held.
+Backend * AdapterLib(Adapter * self);
+
+// send a frame now, without queueing it while the adapter is being
+// reconnected, counting it in the stats and firing the transmit probes. An
+// initiator of CECDEVICE_UNKNOWN is sent from the primary address. Call
+// without the GIL
+bool send_frame(Adapter * self, Backend * lib, const CEC::cec_command & cmd);
+
+// send a frame like send_frame, or queue it while the adapter is being
+// reconnected; queued says which. Call without the GIL
+bool transmit_frame(Adapter * self, Backend * lib,
+      const CEC::cec_command & cmd, Supervisor::QueueResult * queued);
+
+std::vector<CEC::CEC_ADAPTER_TYPE> get_adapters(Backend * lib,
+      bool full = false, bool rescan = false);
+
+int parse_physical_addr(const char * addr);
+PyObject * build_physical_addr(uint16_t pa);
+PyObject * build_logical_addr(CEC::cec_logical_address addr);
+
+#endif
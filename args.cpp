@@ -0,0 +1,159 @@
+/* args.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the fast argument helpers.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "args.h"
+
+#include <limits.h>
+#include <string.h>
+
+bool ArgsParse(const char * fname, PyObject * const * args, Py_ssize_t nargs,
+      PyObject * kwnames, const char * const * kwlist, int required,
+      PyObject ** values) {
+   int count = 0;
+   while( kwlist[count] ) count++;
+
+   if( nargs > count ) {
+      PyErr_Format(PyExc_TypeError,
+            "%s() takes at most %d argument%s (%zd given)", fname, count,
+            count == 1 ? "" : "s", nargs);
+      return false;
+   }
+   for( int i=0; i<count; i++ ) {
+      values[i] = i < nargs ? args[i] : NULL;
+   }
+
+   // keyword values follow the positional ones in args
+   Py_ssize_t nkw = kwnames ? PyTuple_GET_SIZE(kwnames) : 0;
+   for( Py_ssize_t k=0; k<nkw; k++ ) {
+      PyObject * key = PyTuple_GET_ITEM(kwnames, k);
+      int i = 0;
+      while( i < count && PyUnicode_CompareWithASCIIString(key, kwlist[i]) ) {
+         i++;
+      }
+      if( i == count ) {
+         PyErr_Format(PyExc_TypeError,
+               "%s() got an unexpected keyword argument '%U'", fname, key);
+         return false;
+      }
+      if( values[i] ) {
+         PyErr_Format(PyExc_TypeError,
+               "argument for %s() given by name ('%s') and position (%d)",
+               fname, kwlist[i], i + 1);
+         return false;
+      }
+      values[i] = args[nargs + k];
+   }
+
+   for( int i=0; i<required; i++ ) {
+      if( values[i] == NULL ) {
+         PyErr_Format(PyExc_TypeError,
+               "%s() missing required argument '%s' (pos %d)", fname,
+               kwlist[i], i + 1);
+         return false;
+      }
+   }
+   return true;
+}
+
+bool ArgByte(PyObject * arg, unsigned char * value) {
+   long n = PyLong_AsLong(arg);
+   if( n == -1 && PyErr_Occurred() ) return false;
+   if( n < 0 ) {
+      PyErr_SetString(PyExc_OverflowError,
+            "unsigned byte integer is less than minimum");
+      return false;
+   }
+   if( n > UCHAR_MAX ) {
+      PyErr_SetString(PyExc_OverflowError,
+            "unsigned byte integer is greater than maximum");
+      return false;
+   }
+   *value = (unsigned char)n;
+   return true;
+}
+
+bool ArgLong(PyObject * arg, long * value) {
+   *value = PyLong_AsLong(arg);
+   return !(*value == -1 && PyErr_Occurred());
+}
+
+bool ArgUnsignedLong(PyObject * arg, unsigned long * value) {
+   if( !PyLong_Check(arg) ) {
+      PyErr_Format(PyExc_TypeError, "expected int, not %.50s",
+            Py_TYPE(arg)->tp_name);
+      return false;
+   }
+   *value = PyLong_AsUnsignedLongMask(arg);
+   return !(*value == (unsigned long)-1 && PyErr_Occurred());
+}
+
+bool ArgDouble(PyObject * arg, double * value) {
+   *value = PyFloat_AsDouble(arg);
+   return !(*value == -1.0 && PyErr_Occurred());
+}
+
+bool ArgBool(PyObject * arg, int * value) {
+   *value = PyObject_IsTrue(arg);
+   return *value >= 0;
+}
+
+bool ArgString(PyObject * arg, const char * name, const char ** value) {
+   if( !PyUnicode_Check(arg) ) {
+      PyErr_Format(PyExc_TypeError, "%s must be str, not %.50s", name,
+            Py_TYPE(arg)->tp_name);
+      return false;
+   }
+   Py_ssize_t size;
+   *value = PyUnicode_AsUTF8AndSize(arg, &size);
+   if( *value == NULL ) return false;
+   if( (size_t)size != strlen(*value) ) {
+      PyErr_SetString(PyExc_ValueError, "embedded null character");
+      return false;
+   }
+   return true;
+}
+
+bool ArgStringOrNone(PyObject * arg, const char * name, const char ** value) {
+   if( arg == Py_None ) {
+      *value = NULL;
+      return true;
+   }
+   return ArgString(arg, name, value);
+}
+
+bool ArgBytes(PyObject * arg, const char * name, const char ** data,
+      Py_ssize_t * size) {
+   if( PyUnicode_Check(arg) ) {
+      *data = PyUnicode_AsUTF8AndSize(arg, size);
+      return *data != NULL;
+   }
+   if( PyBytes_Check(arg) ) {
+      *data = PyBytes_AS_STRING(arg);
+      *size = PyBytes_GET_SIZE(arg);
+      return true;
+   }
+   PyErr_Format(PyExc_TypeError, "%s must be str or bytes, not %.50s", name,
+         Py_TYPE(arg)->tp_name);
+   return false;
+}
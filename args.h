@@ -0,0 +1,63 @@
+/* args.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Argument unpacking for METH_FASTCALL | METH_KEYWORDS methods and
+ * vectorcall. Arguments are matched to their names once, then each is
+ * converted directly, without building a tuple or interpreting a format
+ * string. The converters behave like the PyArg_Parse format unit they are
+ * named after.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef ARGS_H
+#define ARGS_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+// the most arguments any method takes
+#define ARGS_MAX 8
+
+// match the arguments of a call to the names in kwlist (NULL terminated).
+// values[i] gets a borrowed reference, or NULL if the argument wasn't
+// given; the first required arguments must be. Returns false with
+// TypeError set
+bool ArgsParse(const char * fname, PyObject * const * args, Py_ssize_t nargs,
+      PyObject * kwnames, const char * const * kwlist, int required,
+      PyObject ** values);
+
+// "b": an int from 0 to 255
+bool ArgByte(PyObject * arg, unsigned char * value);
+// "l"
+bool ArgLong(PyObject * arg, long * value);
+// "k": an unsigned long, without overflow checking
+bool ArgUnsignedLong(PyObject * arg, unsigned long * value);
+// "d"
+bool ArgDouble(PyObject * arg, double * value);
+// "p": any object, by its truth value
+bool ArgBool(PyObject * arg, int * value);
+// "s": a str without embedded NULs; "z" also accepts None as NULL
+bool ArgString(PyObject * arg, const char * name, const char ** value);
+bool ArgStringOrNone(PyObject * arg, const char * name, const char ** value);
+// "s#": a str, as UTF-8, or bytes
+bool ArgBytes(PyObject * arg, const char * name, const char ** data,
+      Py_ssize_t * size);
+
+#endif
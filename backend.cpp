@@ -0,0 +1,283 @@
+/* backend.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Backend that forwards to libcec, hiding the differences between libcec
+ * versions from the rest of the module
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "backend.h"
+
+#include <condition_variable>
+#include <mutex>
+
+using namespace CEC;
+
+// enter a call, or fail it with result while the backend is opened or
+// closed
+#define ENTER_OR_RETURN(result) \
+   Call call(this); \
+   if( !call.entered ) return result
+
+class LibcecBackend : public Backend {
+   public:
+      LibcecBackend(ICECAdapter * l) : lib(l), users(0), reopening(false) {
+      }
+
+      ~LibcecBackend() {
+         CECDestroy(lib);
+      }
+
+      // the supervisor reopens libcec from its own thread while others
+      // may be calling it. Open and Close wait for the calls in progress
+      // and fail those made meanwhile; waiting instead could deadlock, as
+      // Close joins libcec's callback thread and callbacks call in here
+      bool Open(const char * port) {
+         Exclusive exclusive(this);
+         return lib->Open(port);
+      }
+
+      void Close() {
+         Exclusive exclusive(this);
+         lib->Close();
+      }
+
+      int DetectAdapters(CEC_ADAPTER_TYPE * list, int size, bool quick) {
+#if HAVE_CEC_ADAPTER_DESCRIPTOR
+         return lib->DetectAdapters(list, size, NULL, quick);
+#else
+         return lib->FindAdapters(list, size);
+#endif
+      }
+
+      bool Transmit(const cec_command & cmd) {
+         ENTER_OR_RETURN(false);
+         return lib->Transmit(cmd);
+      }
+
+      cec_logical_addresses GetLogicalAddresses() {
+         ENTER_OR_RETURN(no_addresses());
+         return lib->GetLogicalAddresses();
+      }
+
+      cec_logical_addresses GetActiveDevices() {
+         ENTER_OR_RETURN(no_addresses());
+         return lib->GetActiveDevices();
+      }
+
+      bool IsActiveSource(cec_logical_address addr) {
+         ENTER_OR_RETURN(false);
+         return lib->IsActiveSource(addr);
+      }
+
+      bool SetActiveSource(cec_device_type type) {
+         ENTER_OR_RETURN(false);
+         return lib->SetActiveSource(type);
+      }
+
+      bool SetStreamPath(cec_logical_address addr) {
+         ENTER_OR_RETURN(false);
+         return lib->SetStreamPath(addr);
+      }
+
+      bool SetStreamPath(uint16_t pa) {
+         ENTER_OR_RETURN(false);
+         return lib->SetStreamPath(pa);
+      }
+
+      bool SetPhysicalAddress(uint16_t pa) {
+         ENTER_OR_RETURN(false);
+         return lib->SetPhysicalAddress(pa);
+      }
+
+      bool SetHDMIPort(cec_logical_address base, uint8_t port) {
+         ENTER_OR_RETURN(false);
+         return lib->SetHDMIPort(base, port);
+      }
+
+      uint8_t VolumeUp() {
+         ENTER_OR_RETURN(0);
+         return lib->VolumeUp();
+      }
+
+      uint8_t VolumeDown() {
+         ENTER_OR_RETURN(0);
+         return lib->VolumeDown();
+      }
+
+      uint8_t AudioToggleMute() {
+         ENTER_OR_RETURN(0);
+#if CEC_LIB_VERSION_MAJOR > 1
+         return lib->AudioToggleMute();
+#else
+         return 0;
+#endif
+      }
+
+      bool GetCurrentConfiguration(libcec_configuration * config) {
+         ENTER_OR_RETURN(false);
+         return lib->GetCurrentConfiguration(config);
+      }
+
+      bool SetConfiguration(const libcec_configuration * config) {
+         ENTER_OR_RETURN(false);
+         return lib->SetConfiguration(config);
+      }
+
+      bool CanPersistConfiguration() {
+         ENTER_OR_RETURN(false);
+#if CEC_LIB_VERSION_MAJOR >= 5
+         return lib->CanSaveConfiguration();
+#else
+         return lib->CanPersistConfiguration();
+#endif
+      }
+
+      bool PersistConfiguration(const libcec_configuration * config) {
+         ENTER_OR_RETURN(false);
+#if CEC_LIB_VERSION_MAJOR >= 5
+         // libcec 5 writes the configuration to the adapter when it is set
+         return lib->SetConfiguration(config);
+#else
+         libcec_configuration copy = *config;
+         return lib->PersistConfiguration(&copy);
+#endif
+      }
+
+      bool PowerOnDevices(cec_logical_address addr) {
+         ENTER_OR_RETURN(false);
+         return lib->PowerOnDevices(addr);
+      }
+
+      bool StandbyDevices(cec_logical_address addr) {
+         ENTER_OR_RETURN(false);
+         return lib->StandbyDevices(addr);
+      }
+
+      cec_power_status GetDevicePowerStatus(cec_logical_address addr) {
+         ENTER_OR_RETURN(CEC_POWER_STATUS_UNKNOWN);
+         return lib->GetDevicePowerStatus(addr);
+      }
+
+      uint64_t GetDeviceVendorId(cec_logical_address addr) {
+         ENTER_OR_RETURN(0);
+         return lib->GetDeviceVendorId(addr);
+      }
+
+      uint16_t GetDevicePhysicalAddress(cec_logical_address addr) {
+         ENTER_OR_RETURN(0xFFFF);
+         return lib->GetDevicePhysicalAddress(addr);
+      }
+
+      cec_version GetDeviceCecVersion(cec_logical_address addr) {
+         ENTER_OR_RETURN(CEC_VERSION_UNKNOWN);
+         return lib->GetDeviceCecVersion(addr);
+      }
+
+      std::string GetDeviceOSDName(cec_logical_address addr) {
+         ENTER_OR_RETURN("");
+#if CEC_LIB_VERSION_MAJOR >= 4
+         return lib->GetDeviceOSDName(addr);
+#else
+         cec_osd_name name = lib->GetDeviceOSDName(addr);
+         return name.name;
+#endif
+      }
+
+      std::string GetDeviceMenuLanguage(cec_logical_address addr) {
+         ENTER_OR_RETURN("");
+#if CEC_LIB_VERSION_MAJOR >= 4
+         return lib->GetDeviceMenuLanguage(addr);
+#else
+         cec_menu_language lang;
+         lib->GetDeviceMenuLanguage(addr, &lang);
+         return lang.language;
+#endif
+      }
+
+   private:
+      class Call {
+         public:
+            Call(LibcecBackend * b) : backend(b) {
+               std::lock_guard<std::mutex> guard(backend->lock);
+               entered = !backend->reopening;
+               if( entered ) backend->users++;
+            }
+
+            ~Call() {
+               if( !entered ) return;
+               std::lock_guard<std::mutex> guard(backend->lock);
+               if( --backend->users == 0 ) backend->cond.notify_all();
+            }
+
+            bool entered;
+
+         private:
+            LibcecBackend * backend;
+      };
+
+      class Exclusive {
+         public:
+            Exclusive(LibcecBackend * b) : backend(b) {
+               std::unique_lock<std::mutex> guard(backend->lock);
+               backend->cond.wait(guard, [this] {
+                     return !backend->reopening;
+                  });
+               backend->reopening = true;
+               backend->cond.wait(guard, [this] {
+                     return backend->users == 0;
+                  });
+            }
+
+            ~Exclusive() {
+               std::lock_guard<std::mutex> guard(backend->lock);
+               backend->reopening = false;
+               backend->cond.notify_all();
+            }
+
+         private:
+            LibcecBackend * backend;
+      };
+
+      static cec_logical_addresses no_addresses() {
+         cec_logical_addresses addresses;
+         addresses.Clear();
+         return addresses;
+      }
+
+      ICECAdapter * lib;
+
+      std::mutex lock;
+      std::condition_variable cond;
+      // calls in progress, and whether Open or Close is running
+      int users;
+      bool reopening;
+};
+
+Backend * LibcecBackendNew(libcec_configuration * config) {
+   ICECAdapter * lib = (ICECAdapter*)CECInitialise(config);
+   if( !lib ) {
+      return NULL;
+   }
+#if CEC_LIB_VERSION_MAJOR > 1 || ( CEC_LIB_VERSION_MAJOR == 1 && CEC_LIB_VERSION_MINOR >= 8 )
+   lib->InitVideoStandalone();
+#endif
+   return new LibcecBackend(lib);
+}
@@ -0,0 +1,100 @@
+/* backend.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The CEC bus operations this module uses. LibcecBackend forwards them to
+ * a libcec instance; SimBackend (sim.h) answers them from a simulated bus,
+ * and RemoteBackend (remote.h) from the adapter of another process.
+ * Every call may block on the bus and must be made without the GIL held.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <stdint.h>
+#include <string>
+
+#include <libcec/cec.h>
+
+// cec_adapter_descriptor and DetectAdapters were introduced in 2.1.0
+#if CEC_LIB_VERSION_MAJOR >= 3 || (CEC_LIB_VERSION_MAJOR >= 2 && CEC_LIB_VERSION_MINOR >= 1)
+#define CEC_ADAPTER_TYPE cec_adapter_descriptor
+#define HAVE_CEC_ADAPTER_DESCRIPTOR 1
+#else
+#define CEC_ADAPTER_TYPE cec_adapter
+#define HAVE_CEC_ADAPTER_DESCRIPTOR 0
+#endif
+
+class Backend {
+   public:
+      virtual ~Backend() {}
+
+      // the backend that does the work, if this one wraps it
+      virtual Backend * Target() { return this; }
+
+      virtual bool Open(const char * port) = 0;
+      virtual void Close() = 0;
+      // fill at most size adapters, returning how many were found
+      virtual int DetectAdapters(CEC::CEC_ADAPTER_TYPE * list, int size,
+            bool quick) = 0;
+
+      virtual bool Transmit(const CEC::cec_command & cmd) = 0;
+      virtual CEC::cec_logical_addresses GetLogicalAddresses() = 0;
+      virtual CEC::cec_logical_addresses GetActiveDevices() = 0;
+
+      virtual bool IsActiveSource(CEC::cec_logical_address addr) = 0;
+      virtual bool SetActiveSource(CEC::cec_device_type type) = 0;
+      virtual bool SetStreamPath(CEC::cec_logical_address addr) = 0;
+      virtual bool SetStreamPath(uint16_t pa) = 0;
+      virtual bool SetPhysicalAddress(uint16_t pa) = 0;
+      virtual bool SetHDMIPort(CEC::cec_logical_address base,
+            uint8_t port) = 0;
+
+      virtual uint8_t VolumeUp() = 0;
+      virtual uint8_t VolumeDown() = 0;
+      virtual uint8_t AudioToggleMute() = 0;
+
+      virtual bool GetCurrentConfiguration(
+            CEC::libcec_configuration * config) = 0;
+      virtual bool SetConfiguration(
+            const CEC::libcec_configuration * config) = 0;
+      virtual bool CanPersistConfiguration() = 0;
+      virtual bool PersistConfiguration(
+            const CEC::libcec_configuration * config) = 0;
+
+      virtual bool PowerOnDevices(CEC::cec_logical_address addr) = 0;
+      virtual bool StandbyDevices(CEC::cec_logical_address addr) = 0;
+      virtual CEC::cec_power_status GetDevicePowerStatus(
+            CEC::cec_logical_address addr) = 0;
+      virtual uint64_t GetDeviceVendorId(CEC::cec_logical_address addr) = 0;
+      virtual uint16_t GetDevicePhysicalAddress(
+            CEC::cec_logical_address addr) = 0;
+      virtual CEC::cec_version GetDeviceCecVersion(
+            CEC::cec_logical_address addr) = 0;
+      virtual std::string GetDeviceOSDName(CEC::cec_logical_address addr) = 0;
+      virtual std::string GetDeviceMenuLanguage(
+            CEC::cec_logical_address addr) = 0;
+};
+
+// a backend driven by a new libcec instance, or NULL if libcec could not
+// be initialized
+Backend * LibcecBackendNew(CEC::libcec_configuration * config);
+
+#endif
@@ -0,0 +1,240 @@
+#!/usr/bin/env python
+"""
+Microbenchmarks for the binding's hot paths. They run against the simulated
+bus (sim://), so no hardware is needed.
+
+Each result is printed as one JSON object per line:
+  {"bench": name, "ops": n, "seconds": best, "median": median,
+   "ns_per_op": best per operation}
+Compare two runs with the same options to catch regressions, e.g.
+  ./bench.py -o baseline.json
+  ./bench.py --compare baseline.json
+which fails if any benchmark got more than 25% slower.
+
+Event dispatch is measured end to end: frames are put on the simulated bus
+by a virtual device and the time runs until the last callback has returned.
+"""
+
+import argparse
+import json
+import platform
+import statistics
+import sys
+import threading
+import time
+
+import cec
+
+LOCAL_PA = b"\x10\x00" # this host on the simulated bus, 1.0.0.0
+
+class Counter:
+   """ a callback that signals when it has been called a number of times """
+   def __init__(self):
+      self.count = 0
+      self.target = 0
+      self.done = threading.Event()
+
+   def expect(self, n):
+      self.count = 0
+      self.target = n
+      self.done.clear()
+
+   def wait(self, timeout=60):
+      if not self.done.wait(timeout):
+         raise RuntimeError("only %d of %d events arrived"%(self.count,
+            self.target))
+
+   def __call__(self, *args):
+      self.count += 1
+      if self.count >= self.target:
+         self.done.set()
+
+def timed(fn, repeat):
+   times = []
+   for i in range(repeat):
+      start = time.perf_counter()
+      fn()
+      times.append(time.perf_counter() - start)
+   return min(times), statistics.median(times)
+
+class Bench:
+   def __init__(self, args):
+      self.args = args
+      self.out = open(args.output, "w") if args.output else sys.stdout
+      self.results = {}
+      self.adapter = cec.Adapter()
+      self.adapter.init("sim://?devices=0,5")
+
+   def ops(self, n, even=False):
+      """ n scaled; even for benchmarks that toggle state, which must end
+      where they started or the next repeat begins with a change that
+      produces no event """
+      n = max(1, int(n * self.args.scale))
+      return n + n % 2 if even else n
+
+   def report(self, name, ops, best, median, **extra):
+      result = {"bench": name, "ops": ops, "seconds": best, "median": median,
+            "ns_per_op": best * 1e9 / ops}
+      result.update(extra)
+      self.results[name] = result
+      self.out.write(json.dumps(result) + "\n")
+      self.out.flush()
+
+   def run(self, name, ops, fn, **extra):
+      if self.args.only and self.args.only not in name:
+         return
+      best, median = timed(fn, self.args.repeat)
+      self.report(name, ops, best, median, **extra)
+
+   def skip(self, name, reason):
+      if self.args.only and self.args.only not in name:
+         return
+      self.out.write(json.dumps({"bench": name, "skipped": reason}) + "\n")
+
+   def dispatch(self, name, events, send, ops, roundtrip=False, **extra):
+      """ time ops events of the given type, produced by send(i). With
+      roundtrip, each event is waited for before the next is sent """
+      a = self.adapter
+      counter = Counter()
+      a.add_callback(counter, events)
+      def fn():
+         if roundtrip:
+            for i in range(ops):
+               counter.expect(1)
+               send(i)
+               counter.wait()
+            return
+         counter.expect(ops)
+         for i in range(ops):
+            send(i)
+         counter.wait()
+      if roundtrip:
+         extra["roundtrip"] = True
+      try:
+         self.run(name, ops, fn, **extra)
+      finally:
+         a.remove_callback(counter, events)
+
+   def all(self):
+      a = self.adapter
+      meta = {"bench": "_meta", "python": platform.python_version(),
+            "implementation": platform.python_implementation(),
+            "machine": platform.machine(), "repeat": self.args.repeat,
+            "scale": self.args.scale}
+      self.out.write(json.dumps(meta) + "\n")
+
+      # event dispatch, per event type
+      n = self.ops(2000)
+      self.dispatch("dispatch_log", cec.EVENT_LOG,
+            lambda i: a.sim_send(0, 1, 0xA0, b"\x00\x00\x00"), n)
+      self.dispatch("dispatch_command", cec.EVENT_COMMAND,
+            lambda i: a.sim_send(0, 1, 0xA0), n, params=0)
+      # the difference to dispatch_command is the cost of CommandNew
+      # copying parameters
+      self.dispatch("dispatch_command_params", cec.EVENT_COMMAND,
+            lambda i: a.sim_send(0, 1, 0xA0, b"\x00" * 14), n, params=14)
+      self.dispatch("dispatch_keypress", cec.EVENT_KEYPRESS,
+            lambda i: a.sim_send(0, 1, 0x44, b"\x01"), n)
+      # alternate between this host and the TV being the active source;
+      # each change depends on the previous one reaching the bus
+      self.dispatch("dispatch_activated", cec.EVENT_ACTIVATED,
+            lambda i: a.sim_send(0, 15, 0x86, LOCAL_PA) if i % 2 == 0 else
+            a.sim_send(0, 15, 0x82, b"\x00\x00"), self.ops(500, even=True),
+            roundtrip=True)
+      names = ("bench-a", "bench-b")
+      config = a.get_config()
+      def change_config(i):
+         config.device_name = names[i % 2]
+         a.set_config(config)
+      self.dispatch("dispatch_config_change", cec.EVENT_CONFIG_CHANGE,
+            change_config, self.ops(500, even=True), roundtrip=True)
+      for name in ("dispatch_alert", "dispatch_menu_changed",
+            "dispatch_reconnected"):
+         self.skip(name, "not produced by the simulated bus")
+
+      # calls into the binding
+      n = self.ops(2000)
+      def transmit():
+         for i in range(n):
+            a.transmit(cec.CECDEVICE_BROADCAST, 0xA0, b"\x00\x00\x00")
+      self.run("transmit", n, transmit)
+
+      n = self.ops(200)
+      def device():
+         for i in range(n):
+            cec.Device(cec.CECDEVICE_TV, a)
+      self.run("device_construction", n, device)
+
+      def list_devices():
+         for i in range(n):
+            a.list_devices()
+      self.run("list_devices", n, list_devices)
+
+      # callback registration and dispatch with many subscribers
+      for subscribers in (1, 10, 100, 1000):
+         handlers = [Counter() for i in range(subscribers)]
+         def add():
+            for h in handlers:
+               a.add_callback(h, cec.EVENT_COMMAND)
+         def remove():
+            for h in handlers:
+               a.remove_callback(h, cec.EVENT_COMMAND)
+         def add_remove():
+            add()
+            remove()
+         self.run("add_remove_callback_%d"%(subscribers), subscribers,
+               add_remove, subscribers=subscribers)
+
+         add()
+         try:
+            self.dispatch("dispatch_subscribers_%d"%(subscribers),
+                  cec.EVENT_COMMAND, lambda i: a.sim_send(0, 1, 0xA0),
+                  self.ops(max(10, 2000 // subscribers)),
+                  subscribers=subscribers)
+         finally:
+            remove()
+
+def compare(results, baseline, threshold):
+   """ list the benchmarks that are slower than in baseline """
+   slower = []
+   with open(baseline) as f:
+      for line in f:
+         old = json.loads(line)
+         new = results.get(old["bench"])
+         if new is None or "ns_per_op" not in old:
+            continue
+         ratio = new["ns_per_op"] / old["ns_per_op"]
+         if ratio > threshold:
+            slower.append((old["bench"], ratio))
+   return slower
+
+def main():
+   parser = argparse.ArgumentParser(description=__doc__,
+         formatter_class=argparse.RawDescriptionHelpFormatter)
+   parser.add_argument("-o", "--output", help="write results to a file")
+   parser.add_argument("-r", "--repeat", type=int, default=5,
+         help="runs of each benchmark; the best is reported")
+   parser.add_argument("-s", "--scale", type=float, default=1.0,
+         help="multiply the number of operations")
+   parser.add_argument("--only", help="run benchmarks containing this name")
+   parser.add_argument("--compare", metavar="BASELINE",
+         help="fail if slower than the results in this file")
+   parser.add_argument("--threshold", type=float, default=1.25,
+         help="slowdown that counts as a regression (default 1.25)")
+   args = parser.parse_args()
+
+   bench = Bench(args)
+   try:
+      bench.all()
+   finally:
+      bench.adapter.close()
+
+   if args.compare:
+      slower = compare(bench.results, args.compare, args.threshold)
+      for name, ratio in slower:
+         sys.stderr.write("%s: %.2fx slower than baseline\n"%(name, ratio))
+      if slower:
+         sys.exit(1)
+
+if __name__ == "__main__":
+   main()
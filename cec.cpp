@@ -33,8 +33,17 @@
 #include <libcec/cec.h>
 #include <algorithm>
 #include <list>
+#include <vector>
 
+#include "adapter.h"
+#include "args.h"
+#include "command.h"
+#include "config.h"
+#include "detect.h"
 #include "device.h"
+#include "gilcheck.h"
+#include "msg.h"
+#include "shared.h"
 
 
 using namespace CEC;
@@ -76,921 +85,252 @@ using namespace CEC;
 //    - source activated
 //
 
-#define EVENT_LOG           0x0001
-#define EVENT_KEYPRESS      0x0002
-#define EVENT_COMMAND       0x0004
-#define EVENT_CONFIG_CHANGE 0x0008
-#define EVENT_ALERT         0x0010
-#define EVENT_MENU_CHANGED  0x0020
-#define EVENT_ACTIVATED     0x0040
-#define EVENT_VALID         0x007F
-#define EVENT_ALL           0x007F
-
-//#define DEBUG 1
-
-#ifdef DEBUG
-# define debug(...) printf("CEC DEBUG: " __VA_ARGS__)
-#else
-# define debug(...)
-#endif
-
-// cec_adapter_descriptor and DetectAdapters were introduced in 2.1.0
-#if CEC_LIB_VERSION_MAJOR >= 3 || (CEC_LIB_VERSION_MAJOR >= 2 && CEC_LIB_VERSION_MINOR >= 1)
-#define CEC_ADAPTER_TYPE cec_adapter_descriptor
-#define CEC_FIND_ADAPTERS DetectAdapters
-#define HAVE_CEC_ADAPTER_DESCRIPTOR 1
-#else
-#define CEC_ADAPTER_TYPE cec_adapter
-#define CEC_FIND_ADAPTERS FindAdapters
-#define HAVE_CEC_ADAPTER_DESCRIPTOR 0
-#endif
-
-int parse_physical_addr(const char * addr) {
-   int a, b, c, d;
-   if( sscanf(addr, "%x.%x.%x.%x", &a, &b, &c, &d) == 4 ) {
-      if( a > 0xF || b > 0xF || c > 0xF || d > 0xF ) return -1;
-      if( a < 0 || b < 0 || c < 0 || d < 0 ) return -1;
-      return (a << 12) | (b << 8) | (c << 4) | d;
-   } else {
-      return -1;
-   }
-}
-
-#define RETURN_BOOL(arg) do { \
-  bool result; \
-  Py_BEGIN_ALLOW_THREADS \
-  result = (arg); \
-  Py_END_ALLOW_THREADS \
-  PyObject * ret = (result)?Py_True:Py_False; \
-  Py_INCREF(ret); \
-  return ret; \
-} while(0)
-
-void parse_test() {
-   assert(parse_physical_addr("0.0.0.0") == 0);
-   assert(parse_physical_addr("F.0.0.0") == 0xF000);
-   assert(parse_physical_addr("0.F.0.0") == 0x0F00);
-   assert(parse_physical_addr("0.0.F.0") == 0x00F0);
-   assert(parse_physical_addr("0.0.0.F") == 0x000F);
-   assert(parse_physical_addr("-1.0.0.0") == -1);
-   assert(parse_physical_addr("0.-1.0.0") == -1);
-   assert(parse_physical_addr("0.0.-1.0") == -1);
-   assert(parse_physical_addr("0.0.0.-1") == -1);
-   assert(parse_physical_addr("foo") == -1);
-   assert(parse_physical_addr("F.F.F.F") == 0xFFFF);
-   assert(parse_physical_addr("f.f.f.f") == 0xFFFF);
-}
-
-ICECAdapter * CEC_adapter;
-PyObject * Device;
-
-std::list<CEC_ADAPTER_TYPE> get_adapters() {
-   std::list<CEC_ADAPTER_TYPE> res;
-   // release the Global Interpreter lock
-   Py_BEGIN_ALLOW_THREADS
-   // get adapters
-   int cec_count = 10;
-   CEC_ADAPTER_TYPE * dev_list = (CEC_ADAPTER_TYPE*)malloc(
-         cec_count * sizeof(CEC_ADAPTER_TYPE));
-   int count = CEC_adapter->CEC_FIND_ADAPTERS(dev_list, cec_count);
-   if( count > cec_count ) {
-      cec_count = count;
-      dev_list = (CEC_ADAPTER_TYPE*)realloc(dev_list, 
-         cec_count * sizeof(CEC_ADAPTER_TYPE));
-      count = CEC_adapter->CEC_FIND_ADAPTERS(dev_list, cec_count);
-      count = (std::min)(count, cec_count);
-   }
-
-   for( int i=0; i<count; i++ ) {
-      res.push_back(dev_list[i]);
-   }
-
-   free(dev_list);
-   // acquire the GIL before returning to code that uses python objects
-   Py_END_ALLOW_THREADS
-   return res;
-}
-
-static PyObject * list_adapters(PyObject * self, PyObject * args) {
-   PyObject * result = NULL;
-
-   if( PyArg_ParseTuple(args, ":list_adapters") ) {
-      std::list<CEC_ADAPTER_TYPE> dev_list = get_adapters();
-      // set up our result list
-      result = PyList_New(0);
-
-      // populate our result list
-      std::list<CEC_ADAPTER_TYPE>::const_iterator itr;
-      for( itr = dev_list.begin(); itr != dev_list.end(); itr++ ) {
-#if HAVE_CEC_ADAPTER_DESCRIPTOR
-         PyList_Append(result, Py_BuildValue("s", itr->strComName));
-         /* Convert all of the fields 
-         PyList_Append(result, Py_BuildValue("sshhhhii", 
-                  itr->strComName,
-                  itr->strComPath,
-                  itr->iVendorId,
-                  itr->iProductId,
-                  itr->iFirmwareVersion,
-                  itr->iPhysicalAddress,
-                  itr->iFirmwareBuildDate,
-                  itr->adapterType
-                  ));
-                  */
-#else
-         PyList_Append(result, Py_BuildValue("s", itr->comm));
-         /* Convert all of the fields 
-         PyList_Append(result, Py_BuildValue("sshhhhii", 
-                  itr->comm,
-                  itr->strComPath,
-                  itr->iVendorId,
-                  itr->iProductId,
-                  itr->iFirmwareVersion,
-                  itr->iPhysicalAddress,
-                  itr->iFirmwareBuildDate,
-                  itr->adapterType
-                  ));
-                  */
-#endif
-      }
-   }
-
-   return result;
-}
+static PyStructSequence_Field adapter_descriptor_fields[] = {
+   {(char*)"name", (char*)"Port name to pass to init()"},
+   {(char*)"path", (char*)"Device path"},
+   {(char*)"vendor_id", (char*)"USB vendor ID"},
+   {(char*)"product_id", (char*)"USB product ID"},
+   {(char*)"firmware_version", (char*)"Firmware version"},
+   {(char*)"physical_address", (char*)"Physical address reported by the adapter"},
+   {(char*)"firmware_build_date", (char*)"Firmware build date (unix time)"},
+   {(char*)"adapter_type", (char*)"Adapter type"},
+   {NULL}
+};
 
-static PyObject * init(PyObject * self, PyObject * args) {
-   PyObject * result = NULL;
-   const char * dev = NULL;
+static PyStructSequence_Desc adapter_descriptor_desc = {
+   (char*)"cec.AdapterDescriptor",
+   (char*)"Description of a detected CEC adapter",
+   adapter_descriptor_fields,
+   8
+};
 
-   if( PyArg_ParseTuple(args, "|s:init", &dev) ) {
-      if( !dev ) {
-         std::list<CEC_ADAPTER_TYPE> devs = get_adapters();
-         if( devs.size() > 0 ) {
+static PyObject * build_adapter_descriptor(ModuleState * state,
+      const CEC_ADAPTER_TYPE & dev) {
+   PyObject * result = PyStructSequence_New(state->descriptor_type);
+   if( result == NULL ) return NULL;
 #if HAVE_CEC_ADAPTER_DESCRIPTOR
-            dev = devs.front().strComName;
+   PyStructSequence_SET_ITEM(result, 0, Py_BuildValue("s", dev.strComName));
+   PyStructSequence_SET_ITEM(result, 1, Py_BuildValue("s", dev.strComPath));
+   PyStructSequence_SET_ITEM(result, 2, Py_BuildValue("H", dev.iVendorId));
+   PyStructSequence_SET_ITEM(result, 3, Py_BuildValue("H", dev.iProductId));
+   PyStructSequence_SET_ITEM(result, 4,
+         Py_BuildValue("H", dev.iFirmwareVersion));
+   PyStructSequence_SET_ITEM(result, 5,
+         build_physical_addr(dev.iPhysicalAddress));
+   PyStructSequence_SET_ITEM(result, 6,
+         Py_BuildValue("I", dev.iFirmwareBuildDate));
+   PyStructSequence_SET_ITEM(result, 7, Py_BuildValue("i", dev.adapterType));
 #else
-            dev = devs.front().comm;
-#endif
-         } else {
-            PyErr_SetString(PyExc_Exception, "No default adapter found");
-         }
-      }
-   }
-
-   if( dev ) {
-      bool success = false;
-      Py_BEGIN_ALLOW_THREADS
-      success = CEC_adapter->Open(dev);
-      Py_END_ALLOW_THREADS
-      if( success ) {
-         Py_INCREF(Py_None);
-         result = Py_None;
-      } else {
-         Py_BEGIN_ALLOW_THREADS
-         CECDestroy(CEC_adapter);
-         CEC_adapter = NULL;
-         Py_END_ALLOW_THREADS
-         char errstr[1024];
-         snprintf(errstr, 1024, "CEC failed to open %s", dev);
-         PyErr_SetString(PyExc_IOError, errstr);
-      }
-   }
-
-   return result;
-}
-
-static PyObject * close(PyObject * self, PyObject * args) {
-
-   if( CEC_adapter != NULL ) {
-      Py_BEGIN_ALLOW_THREADS
-      CEC_adapter->Close();
-      Py_END_ALLOW_THREADS
-   }
-
-   Py_INCREF(Py_None);
-   return Py_None;
-}
-
-static PyObject * list_devices(PyObject * self, PyObject * args) {
-   PyObject * result = NULL;
-
-   if( PyArg_ParseTuple(args, ":list_devices") ) {
-      cec_logical_addresses devices;
-      Py_BEGIN_ALLOW_THREADS
-      devices = CEC_adapter->GetActiveDevices();
-      Py_END_ALLOW_THREADS
-
-      //result = PyList_New(0);
-      result = PyDict_New();
-      for( uint8_t i=0; i<32; i++ ) {
-         if( devices[i] ) {
-            PyObject * ii = Py_BuildValue("(b)", i);
-            PyObject * dev = PyObject_CallObject(Device, ii);
-            Py_DECREF(ii);
-            if( dev ) {
-               //PyList_Append(result, dev); 
-               PyDict_SetItem(result, Py_BuildValue("b", i), dev);
-            } else {
-               Py_DECREF(result);
-               result = NULL;
-               break;
-            }
-         }
-      }
-   }
-
-   return result;
-}
-
-struct Callback {
-   public:
-      long int event;
-      PyObject * cb;
-
-      Callback(long int e, PyObject * c) : event(e), cb(c) {
-      }
-};
-
-
-typedef std::list<Callback> cb_list;
-cb_list callbacks;
-
-static PyObject * add_callback(PyObject * self, PyObject * args) {
-   PyObject * result = NULL;
-   PyObject * callback;
-   long int events = EVENT_ALL; // default to all events
-
-   if( PyArg_ParseTuple(args, "O|i:add_callback", &callback, &events) ) {
-      // check that event is one of the allowed events
-      if( events & ~(EVENT_VALID) ) {
-         PyErr_SetString(PyExc_TypeError, "Invalid event(s) for callback");
-         return NULL;
-      }
-      if( !PyCallable_Check(callback)) {
-         PyErr_SetString(PyExc_TypeError, "parameter must be callable");
-         return NULL;
-      }
-
-      Py_INCREF(callback);
-      Callback new_cb(events, callback);
-
-      debug("Adding callback for event %ld\n", events);
-      callbacks.push_back(new_cb);
-
+   PyStructSequence_SET_ITEM(result, 0, Py_BuildValue("s", dev.comm));
+   PyStructSequence_SET_ITEM(result, 1, Py_BuildValue("s", dev.path));
+   for( int i=2; i<8; i++ ) {
       Py_INCREF(Py_None);
-      result = Py_None;
-   }
-   return result;
-}
-
-static PyObject * remove_callback(PyObject * self, PyObject * args) {
-  PyObject * callback;
-  Py_ssize_t events = EVENT_ALL; // default to all events
-
-  if( PyArg_ParseTuple(args, "O|i:remove_callback", &callback, &events) ) {
-     for( cb_list::iterator itr = callbacks.begin(); 
-           itr != callbacks.end();
-           ++itr ) {
-        if( itr->cb == callback ) {
-           // clear out the given events for this callback
-           itr->event &= ~(events);
-           if( itr->event == 0 ) {
-              // if this callback has no events, remove it
-              itr = callbacks.erase(itr);
-              Py_DECREF(callback);
-           }
-        }
-     }
-     
-  }
-  Py_INCREF(Py_None);
-  return Py_None;
-}
-
-static PyObject * make_bound_method_args(PyObject * self, PyObject * args) {
-   Py_ssize_t count = 0;
-   if( PyTuple_Check(args) ) {
-      count = PyTuple_Size(args);
+      PyStructSequence_SET_ITEM(result, i, Py_None);
    }
-   PyObject * result = PyTuple_New(count+1);
-   if( result == NULL ) {
-      return NULL;
-   }
-   assert(self != NULL);
-   Py_INCREF(self);
-   PyTuple_SetItem(result, 0, self);
-   for( Py_ssize_t i=0; i<count; i++ ) {
-      PyObject * arg = PyTuple_GetItem(args, i);
-      if( arg == NULL ) {
+#endif
+   for( int i=0; i<8; i++ ) {
+      if( PyStructSequence_GET_ITEM(result, i) == NULL ) {
          Py_DECREF(result);
          return NULL;
       }
-      Py_INCREF(arg);
-      PyTuple_SetItem(result, i+1, arg);
    }
    return result;
 }
 
-static PyObject * trigger_event(long int event, PyObject * args) {
-   assert(event & EVENT_ALL);
-   Py_INCREF(Py_None);
-   PyObject * result = Py_None;
-
-   //debug("Triggering event %ld\n", event);
-
-   int i=0;
-   for( cb_list::const_iterator itr = callbacks.begin();
-         itr != callbacks.end();
-         ++itr ) {
-      //debug("Checking callback %d with events %ld\n", i, itr->event);
-      if( itr->event & event ) {
-         //debug("Calling callback %d\n", i);
-         PyObject * callback = itr->cb;
-         PyObject * arguments = args;
-         if( PyMethod_Check(itr->cb) ) {
-            callback = PyMethod_Function(itr->cb);
-            PyObject * self = PyMethod_Self(itr->cb);
-            if( self ) {
-               // bound method, prepend self/cls to argument tuple
-               arguments = make_bound_method_args(self, args);
-            }
-         }
-         // see also: PyObject_CallFunction(...) which can take C args
-         PyObject * temp = PyObject_CallObject(callback, arguments);
-         if( arguments != args ) {
-            Py_XDECREF(arguments);
-         }
-         if( temp ) {
-            debug("Callback succeeded\n");
-            Py_DECREF(temp);
-         } else {
-            debug("Callback failed\n");
-            Py_DECREF(Py_None);
-            return NULL;
-         }
-      }
-      i++;
-   }
-
-   return result;
-}
-
-static PyObject * transmit(PyObject * self, PyObject * args) {
-   unsigned char initiator = 'g';
-   unsigned char destination;
-   unsigned char opcode;
-   const char * params = NULL;
-   Py_ssize_t param_count = 0;
-
-   if( PyArg_ParseTuple(args, "bb|s#b:transmit", &destination, &opcode,
-         &params, &param_count, &initiator) ) {
-      if( destination < 0 || destination > 15 ) {
-         PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
-         return NULL;
-      }
-      if( initiator != 'g' ) {
-         if( initiator < 0 || initiator > 15 ) {
-            PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
-            return NULL;
-         }
-      } else {
-         initiator = CEC_adapter->GetLogicalAddresses().primary;
-      }
-      if( param_count > CEC_MAX_DATA_PACKET_SIZE ) {
-         char errstr[1024];
-         snprintf(errstr, 1024, "Too many parameters, maximum is %d",
-            CEC_MAX_DATA_PACKET_SIZE);
-         PyErr_SetString(PyExc_ValueError, errstr);
-         return NULL;
-      }
-      cec_command data;
-      bool success;
-      Py_BEGIN_ALLOW_THREADS
-      data.initiator = (cec_logical_address)initiator;
-      data.destination = (cec_logical_address)destination;
-      data.opcode = (cec_opcode)opcode;
-      data.opcode_set = 1;
-      if( params ) {
-         for( Py_ssize_t i=0; i<param_count; i++ ) {
-            data.PushBack(((uint8_t *)params)[i]);
-         }
-      }
-      success = CEC_adapter->Transmit(data);
-      Py_END_ALLOW_THREADS
-      RETURN_BOOL(success);
-   }
-
-   return NULL;
-}
-
-static PyObject * is_active_source(PyObject * self, PyObject * args) {
-   unsigned char addr;
-
-   if( PyArg_ParseTuple(args, "b:is_active_source", &addr) ) {
-      if( addr < 0 || addr > 15 ) {
-         PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
-         return NULL;
-      } else {
-         RETURN_BOOL(CEC_adapter->IsActiveSource((cec_logical_address)addr));
-      }
-   }
-   return NULL;
-}
-
-static PyObject * set_active_source(PyObject * self, PyObject * args) {
-   unsigned char devtype = (unsigned char)CEC_DEVICE_TYPE_RESERVED;
-
-   if( PyArg_ParseTuple(args, "|b:set_active_source", &devtype) ) {
-      if( devtype < 0 || devtype > 5 ) {
-         PyErr_SetString(PyExc_ValueError, "Device type must be between 0 and 5");
-         return NULL;
-      } else {
-         RETURN_BOOL(CEC_adapter->SetActiveSource((cec_device_type)devtype));
-      }
-   }
-   return NULL;
-}
-
-static PyObject * volume_up(PyObject * self, PyObject * args) {
-   if( PyArg_ParseTuple(args, ":volume_up") )
-      RETURN_BOOL(CEC_adapter->VolumeUp());
-   return NULL;
-}
-
-static PyObject * volume_down(PyObject * self, PyObject * args) {
-   if( PyArg_ParseTuple(args, ":volume_up") )
-      RETURN_BOOL(CEC_adapter->VolumeDown());
-   return NULL;
-}
-
-#if CEC_LIB_VERSION_MAJOR > 1
-static PyObject * toggle_mute(PyObject * self, PyObject * args) {
-   if( PyArg_ParseTuple(args, ":toggle_mute") )
-      RETURN_BOOL(CEC_adapter->AudioToggleMute());
-   return NULL;
-}
-#endif
-
-static PyObject * set_stream_path(PyObject * self, PyObject * args) {
-   PyObject * arg;
+static PyObject * list_adapters(PyObject * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   ModuleState * state = (ModuleState*)PyModule_GetState(self);
+   PyObject * result = NULL;
+   int detailed = 0;
+   int rescan = 0;
+   static const char * kwlist[] = {"detailed", "rescan", NULL};
+   PyObject * values[ARGS_MAX];
+
+   if( ArgsParse("list_adapters", args, nargs, kwnames, kwlist, 0, values) &&
+         (!values[0] || ArgBool(values[0], &detailed)) &&
+         (!values[1] || ArgBool(values[1], &rescan)) ) {
+      // detection needs a libcec instance; borrow the default adapter's
+      Backend * lib = AdapterLib(state->default_adapter);
+      if( lib == NULL ) return NULL;
+      std::vector<CEC_ADAPTER_TYPE> dev_list = get_adapters(lib,
+            detailed, rescan);
+      // set up our result list
+      result = PyList_New(dev_list.size());
+      if( result == NULL ) return NULL;
 
-   if( PyArg_ParseTuple(args, "O:set_stream_path", &arg) ) {
-      Py_INCREF(arg);
-#if PY_MAJOR_VERSION >= 3
-      if(PyLong_Check(arg)) {
-         long arg_l = PyLong_AsLong(arg);
-#else
-      if(PyInt_Check(arg)) {
-         long arg_l = PyInt_AsLong(arg);
-#endif
-         Py_DECREF(arg);
-         if( arg_l < 0 || arg_l > 15 ) {
-            PyErr_SetString(PyExc_ValueError, "Logical address must be between 0 and 15");
-            return NULL;
+      // populate our result list
+      for( size_t i=0; i<dev_list.size(); i++ ) {
+         PyObject * item;
+         if( detailed ) {
+            item = build_adapter_descriptor(state, dev_list[i]);
          } else {
-            RETURN_BOOL(CEC_adapter->SetStreamPath((cec_logical_address)arg_l));
-         }
-#if PY_MAJOR_VERSION >= 3
-      } else if(PyUnicode_Check(arg)) {
-         const char * arg_s = PyUnicode_AsUTF8(arg);
+#if HAVE_CEC_ADAPTER_DESCRIPTOR
+            item = Py_BuildValue("s", dev_list[i].strComName);
 #else
-      } else if(PyString_Check(arg)) {
-         char * arg_s = PyString_AsString(arg);
+            item = Py_BuildValue("s", dev_list[i].comm);
 #endif
-         if( arg_s ) {
-            int pa = parse_physical_addr(arg_s);
-            Py_DECREF(arg);
-            if( pa < 0 ) {
-               PyErr_SetString(PyExc_ValueError, "Invalid physical address");
-               return NULL;
-            } else {
-               RETURN_BOOL(CEC_adapter->SetStreamPath((uint16_t)pa));
-            }
-         } else {
-            Py_DECREF(arg);
-            return NULL;
          }
-      } else if(PyUnicode_Check(arg)) {
-         // Convert from Unicode to ASCII
-         PyObject* ascii_arg = PyUnicode_AsASCIIString(arg);
-         if (NULL == ascii_arg) {
-            // Means the string can't be converted to ASCII, the codec failed
-            PyErr_SetString(PyExc_ValueError,
-               "Could not convert address to ASCII");
+         if( item == NULL ) {
+            Py_DECREF(result);
             return NULL;
          }
-
-         // Get the actual bytes as a C string
-         char * arg_s = PyByteArray_AsString(ascii_arg);
-         if( arg_s ) {
-            int pa = parse_physical_addr(arg_s);
-            Py_DECREF(arg);
-            if( pa < 0 ) {
-               PyErr_SetString(PyExc_ValueError, "Invalid physical address");
-               return NULL;
-            } else {
-               RETURN_BOOL(CEC_adapter->SetStreamPath((uint16_t)pa));
-            }
-         } else {
-            Py_DECREF(arg);
-            return NULL;
-         }
-      } else {
-         PyErr_SetString(PyExc_TypeError, "parameter must be string or int");
-         return NULL;
+         PyList_SET_ITEM(result, i, item);
       }
    }
 
-   return NULL;
-}
-
-PyObject * set_physical_addr(PyObject * self, PyObject * args) {
-   char * addr_s;
-   if( PyArg_ParseTuple(args, "s:set_physical_addr", &addr_s) ) {
-      int addr = parse_physical_addr(addr_s);
-      if( addr >= 0 ) {
-         RETURN_BOOL(CEC_adapter->SetPhysicalAddress((uint16_t)addr));
-      } else {
-         PyErr_SetString(PyExc_ValueError, "Invalid physical address");
-         return NULL;
-      }
-   }
-   return NULL;
+   return result;
 }
 
-PyObject * set_port(PyObject * self, PyObject * args) {
-   unsigned char dev, port;
-   if( PyArg_ParseTuple(args, "bb", &dev, &port) ) {
-      if( dev > 15 ) {
-         PyErr_SetString(PyExc_ValueError, "Invalid logical address");
-         return NULL;
-      }
-      if( port > 15 ) {
-         PyErr_SetString(PyExc_ValueError, "Invalid port");
+static PyObject * check_gil(PyObject * self, PyObject * arg) {
+   int64_t threshold = -1;
+   if( arg != Py_None ) {
+      double seconds = PyFloat_AsDouble(arg);
+      if( seconds == -1.0 && PyErr_Occurred() ) return NULL;
+      if( !(seconds >= 0) ) {
+         PyErr_SetString(PyExc_ValueError, "threshold must not be negative");
          return NULL;
       }
-      RETURN_BOOL(CEC_adapter->SetHDMIPort((cec_logical_address)dev, port));
+      threshold = (int64_t)(seconds * 1e9);
    }
-   return NULL;
+   GilCheckSetThreshold(threshold);
+   Py_RETURN_NONE;
 }
 
-PyObject * can_persist_config(PyObject * self, PyObject * args) {
-   if( PyArg_ParseTuple(args, ":can_persist_config") ) {
-#if CEC_LIB_VERSION_MAJOR >= 5
-      RETURN_BOOL(CEC_adapter->CanSaveConfiguration());
-#else
-      RETURN_BOOL(CEC_adapter->CanPersistConfiguration());
-#endif
-   }
-   return NULL;
-}
-
-PyObject * persist_config(PyObject * self, PyObject * args) {
-   if( PyArg_ParseTuple(args, ":persist_config") ) {
-#if CEC_LIB_VERSION_MAJOR >= 5
-      if( ! CEC_adapter->CanSaveConfiguration() ) {
-#else
-      if( ! CEC_adapter->CanPersistConfiguration() ) {
-#endif
-         PyErr_SetString(PyExc_NotImplementedError,
-               "Cannot persist configuration");
-         return NULL;
-      }
-      libcec_configuration config;
-      if( ! CEC_adapter->GetCurrentConfiguration(&config) ) {
-         PyErr_SetString(PyExc_IOError, "Could not get configuration");
+static PyObject * gil_reports(PyObject * self, PyObject * unused) {
+   std::vector<GilCheckReport> reports = GilCheckReports();
+   PyObject * result = PyList_New(reports.size());
+   if( result == NULL ) return NULL;
+   for( size_t i=0; i<reports.size(); i++ ) {
+      PyObject * item = Py_BuildValue("(sd)", reports[i].call,
+            reports[i].ns / 1e9);
+      if( item == NULL ) {
+         Py_DECREF(result);
          return NULL;
       }
-#if CEC_LIB_VERSION_MAJOR >= 5
-      RETURN_BOOL(CEC_adapter->SetConfiguration(&config));
-#else
-      RETURN_BOOL(CEC_adapter->PersistConfiguration(&config));
-#endif
+      PyList_SET_ITEM(result, i, item);
    }
-   return NULL;
+   return result;
 }
 
 static PyMethodDef CecMethods[] = {
-   {"list_adapters", list_adapters, METH_VARARGS, "List available adapters"},
-   {"init", init, METH_VARARGS, "Open an adapter"},
-   {"close", close, METH_NOARGS, "Close an adapter"},
-   {"list_devices", list_devices, METH_VARARGS, "List devices"},
-   {"add_callback", add_callback, METH_VARARGS, "Add a callback"},
-   {"remove_callback", remove_callback, METH_VARARGS, "Remove a callback"},
-   {"transmit", transmit, METH_VARARGS, "Transmit a raw CEC command"},
-   {"is_active_source", is_active_source, METH_VARARGS, "Check active source"},
-   {"set_active_source", set_active_source, METH_VARARGS, "Set active source"},
-   {"volume_up",   volume_up,   METH_VARARGS, "Volume Up"},
-   {"volume_down", volume_down, METH_VARARGS, "Volume Down"},
-#if CEC_LIB_VERSION_MAJOR > 1
-   {"toggle_mute", toggle_mute, METH_VARARGS, "Toggle Mute"},
-#endif
-   {"set_stream_path", set_stream_path, METH_VARARGS, "Set HDMI stream path"},
-   {"set_physical_addr", set_physical_addr, METH_VARARGS,
-      "Set HDMI physical address"},
-   {"can_persist_config", can_persist_config, METH_VARARGS,
-      "return true if the current adapter can persist the CEC configuration"},
-   {"persist_config", persist_config, METH_VARARGS,
-      "persist CEC configuration to adapter"},
-   {"set_port", set_port, METH_VARARGS, "Set upstream HDMI port"},
+   {"list_adapters", (PyCFunction)list_adapters,
+      METH_FASTCALL | METH_KEYWORDS,
+      "List available adapters"},
+   {"check_gil", (PyCFunction)check_gil, METH_O,
+      "Report bus calls made with the GIL held that take longer than a "
+      "threshold in seconds; None turns the check off"},
+   {"gil_reports", (PyCFunction)gil_reports, METH_NOARGS,
+      "The (call, seconds) reports of check_gil since the last call"},
+   {"attach_shared", (PyCFunction)SharedAttach,
+      METH_FASTCALL | METH_KEYWORDS,
+      "Read the events another process publishes with "
+      "Adapter.publish_shared(name)"},
    {NULL, NULL, 0, NULL}
 };
 
-libcec_configuration * CEC_config;
-ICECCallbacks * CEC_callbacks; 
-
-#if CEC_LIB_VERSION_MAJOR >= 4
-void log_cb(void * self, const cec_log_message* message) {
-#else
-int log_cb(void * self, const cec_log_message message) {
-#endif
-   debug("got log callback\n");
-   PyGILState_STATE gstate;
-   gstate = PyGILState_Ensure();
-#if CEC_LIB_VERSION_MAJOR >= 4
-   int level = message->level;
-   long int time = message->time;
-   const char* msg = message->message;
-#else
-   int level = message.level;
-   long int time = message.time;
-   const char* msg = message.message;
-#endif
-   // decode message ignoring invalid characters
-   PyObject * umsg = PyUnicode_DecodeASCII(msg, strlen(msg), "ignore");
-   PyObject * args = Py_BuildValue("(iilO)", EVENT_LOG,
-         level,
-         time,
-         umsg);
-   if( args ) {
-      trigger_event(EVENT_LOG, args);
-      Py_DECREF(args);
-   }
-   Py_XDECREF(umsg);
-   PyGILState_Release(gstate);
-#if CEC_LIB_VERSION_MAJOR >= 4
-   return;
-#else
-   return 1;
-#endif
-}
-
-#if CEC_LIB_VERSION_MAJOR >= 4
-void keypress_cb(void * self, const cec_keypress* key) {
-#else
-int keypress_cb(void * self, const cec_keypress key) {
-#endif
-   debug("got keypress callback\n");
-   PyGILState_STATE gstate;
-   gstate = PyGILState_Ensure();
-#if CEC_LIB_VERSION_MAJOR >= 4
-   cec_user_control_code keycode = key->keycode;
-   unsigned int duration = key->duration;
-#else
-   cec_user_control_code keycode = key.keycode;
-   unsigned int duration = key.duration;
-#endif
-   PyObject * args = Py_BuildValue("(iBI)", EVENT_KEYPRESS,
-         keycode,
-         duration);
-   if( args ) {
-      trigger_event(EVENT_KEYPRESS, args);
-      Py_DECREF(args);
-   }
-   PyGILState_Release(gstate);
-#if CEC_LIB_VERSION_MAJOR >= 4
-   return;
-#else
-   return 1;
-#endif
-}
-
-static PyObject * convert_cmd(const cec_command* cmd) {
-#if PY_MAJOR_VERSION >= 3
-   return Py_BuildValue("{sBsBsOsOsBsy#sOsi}",
-#else
-   return Py_BuildValue("{sBsBsOsOsBss#sOsi}",
-#endif
-         "initiator", cmd->initiator,
-         "destination", cmd->destination,
-         "ack", cmd->ack ? Py_True : Py_False,
-         "eom", cmd->eom ? Py_True : Py_False,
-         "opcode", cmd->opcode,
-         "parameters", cmd->parameters.data, cmd->parameters.size,
-         "opcode_set", cmd->opcode_set ? Py_True : Py_False,
-         "transmit_timeout", cmd->transmit_timeout);
-}
-
-#if CEC_LIB_VERSION_MAJOR >= 4
-void command_cb(void * self, const cec_command* command) {
-#else
-int command_cb(void * self, const cec_command command) {
-#endif
-   debug("got command callback\n");
-   PyGILState_STATE gstate;
-   gstate = PyGILState_Ensure();
-#if CEC_LIB_VERSION_MAJOR >= 4
-   const cec_command * cmd = command;
-#else
-   const cec_command * cmd = &command;
-#endif
-   PyObject * args = Py_BuildValue("(iO&)", EVENT_COMMAND, convert_cmd, cmd);
-   if( args ) {
-      trigger_event(EVENT_COMMAND, args);
-      Py_DECREF(args);
-   }
-   PyGILState_Release(gstate);
-#if CEC_LIB_VERSION_MAJOR >= 4
-   return;
-#else
-   return 1;
-#endif
-}
-
-#if CEC_LIB_VERSION_MAJOR >= 4
-void config_cb(void * self, const libcec_configuration*) {
-#else
-int config_cb(void * self, const libcec_configuration) {
-#endif
-   debug("got config callback\n");
-   PyGILState_STATE gstate;
-   gstate = PyGILState_Ensure();
-   // TODO: figure out how to pass these as parameters
-   // yeah... right. 
-   //  we'll probably have to come up with some functions for converting the 
-   //  libcec_configuration class into a python Object
-   //  this will probably be _lots_ of work and should probably wait until
-   //  a later release, or when it becomes necessary.
-   PyObject * args = Py_BuildValue("(i)", EVENT_CONFIG_CHANGE);
-   if( args ) {
-      // don't bother triggering an event until we can actually pass arguments
-      //trigger_event(EVENT_CONFIG_CHANGE, args);
-      Py_DECREF(args);
-   }
-   PyGILState_Release(gstate);
-#if CEC_LIB_VERSION_MAJOR >= 4
-   return;
-#else
-   return 1;
-#endif
-}
+static int cec_exec(PyObject * m);
+static int cec_traverse(PyObject * m, visitproc visit, void * arg);
+static int cec_clear(PyObject * m);
 
-#if CEC_LIB_VERSION_MAJOR >= 4
-void alert_cb(void * self, const libcec_alert alert, const libcec_parameter p) {
-#else
-int alert_cb(void * self, const libcec_alert alert, const libcec_parameter p) {
+static PyModuleDef_Slot cec_slots[] = {
+   {Py_mod_exec, (void*)cec_exec},
+#ifdef Py_mod_multiple_interpreters
+   {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
 #endif
-   debug("got alert callback\n");
-   PyGILState_STATE gstate;
-   gstate = PyGILState_Ensure();
-   PyObject * param = Py_None;
-   if( p.paramType == CEC_PARAMETER_TYPE_STRING ) {
-      param = Py_BuildValue("s", p.paramData);
-   } else {
-      Py_INCREF(param);
-   }
-   PyObject * args = Py_BuildValue("(iiN)", EVENT_ALERT, alert, param);
-   if( args ) {
-      trigger_event(EVENT_ALERT, args);
-      Py_DECREF(args);
-   }
-   PyGILState_Release(gstate);
-#if CEC_LIB_VERSION_MAJOR >= 4
-   return;
-#else
-   return 1;
+#ifdef Py_mod_gil
+   // callbacks and device state are guarded by their own locks
+   {Py_mod_gil, Py_MOD_GIL_NOT_USED},
 #endif
-}
-
-int menu_cb(void * self, const cec_menu_state menu) {
-   debug("got menu callback\n");
-   PyGILState_STATE gstate;
-   gstate = PyGILState_Ensure();
-   PyObject * args = Py_BuildValue("(ii)", EVENT_MENU_CHANGED, menu);
-   if( args ) {
-      trigger_event(EVENT_MENU_CHANGED, args);
-      Py_DECREF(args);
-   }
-   PyGILState_Release(gstate);
-   return 1;
-}
-
-void activated_cb(void * self, const cec_logical_address logical_address,
-      const uint8_t state) {
-   debug("got activated callback\n");
-   PyGILState_STATE gstate;
-   gstate = PyGILState_Ensure();
-   PyObject * active = (state == 1) ? Py_True : Py_False;
-   PyObject * args = Py_BuildValue("(iOi)", EVENT_ACTIVATED, active,
-      logical_address);
-   if( args ) {
-      trigger_event(EVENT_ACTIVATED, args);
-      Py_DECREF(args);
-   }
-   PyGILState_Release(gstate);
-   return;
-}
+   {0, NULL}
+};
 
-#if PY_MAJOR_VERSION >= 3
 static struct PyModuleDef moduledef = {
    PyModuleDef_HEAD_INIT,
    "cec",
    NULL,
-   -1,
+   sizeof(ModuleState),
    CecMethods,
-   NULL,
-   NULL,
-   NULL,
+   cec_slots,
+   cec_traverse,
+   cec_clear,
    NULL
 };
-#endif
-
-#if PY_MAJOR_VERSION >= 3
-#define INITERROR return NULL
-#else
-#define INITERROR return
-#endif
-
-#if PY_MAJOR_VERSION >= 3
-PyMODINIT_FUNC PyInit_cec(void) {
-#else
-PyMODINIT_FUNC initcec(void) {
-#endif
-   // Make sure threads are enabled in the python interpreter
-   // this also acquires the global interpreter lock
-   PyEval_InitThreads();
-
-   // set up libcec
-   //  libcec config
-   CEC_config = new libcec_configuration();
-   CEC_config->Clear();
-
-   snprintf(CEC_config->strDeviceName, 13, "python-cec");
-   // CEC_CLIENT_VERSION_CURRENT was introduced in 2.0.4
-   // just use 2.1.0 because the conditional is simpler
-#if CEC_LIB_VERSION_MAJOR >= 3
-   CEC_config->clientVersion = LIBCEC_VERSION_CURRENT;
-#elif CEC_LIB_VERSION_MAJOR >= 2 && CEC_LIB_VERSION_MINOR >= 1
-   CEC_config->clientVersion = CEC_CLIENT_VERSION_CURRENT;
-#else
-   // fall back to 1.6.0 since it's the lowest common denominator shipped with
-   // Ubuntu
-   CEC_config->clientVersion = CEC_CLIENT_VERSION_1_6_0;
-#endif
-   CEC_config->bActivateSource = 0;
-   CEC_config->deviceTypes.Add(CEC_DEVICE_TYPE_RECORDING_DEVICE);
 
+ModuleState * ModuleStateFromType(PyTypeObject * type) {
+   return (ModuleState*)PyType_GetModuleState(type);
+}
 
-   //  libcec callbacks
-   CEC_callbacks = new ICECCallbacks();
-#if CEC_LIB_VERSION_MAJOR > 1 || ( CEC_LIB_VERSION_MAJOR == 1 && CEC_LIB_VERSION_MINOR >= 7 )
-   CEC_callbacks->Clear();
-#endif
-#if CEC_LIB_VERSION_MAJOR >= 4
-   CEC_callbacks->logMessage = log_cb;
-   CEC_callbacks->keyPress = keypress_cb;
-   CEC_callbacks->commandReceived = command_cb;
-   CEC_callbacks->configurationChanged = config_cb;
-   CEC_callbacks->alert = alert_cb;
-   CEC_callbacks->menuStateChanged = menu_cb;
-   CEC_callbacks->sourceActivated = activated_cb;
-#else
-   CEC_callbacks->CBCecLogMessage = log_cb;
-   CEC_callbacks->CBCecKeyPress = keypress_cb;
-   CEC_callbacks->CBCecCommand = command_cb;
-   CEC_callbacks->CBCecConfigurationChanged = config_cb;
-   CEC_callbacks->CBCecAlert = alert_cb;
-   CEC_callbacks->CBCecMenuStateChanged = menu_cb;
-   CEC_callbacks->CBCecSourceActivated = activated_cb;
-#endif
+static int cec_traverse(PyObject * m, visitproc visit, void * arg) {
+   ModuleState * state = (ModuleState*)PyModule_GetState(m);
+   Py_VISIT(state->adapter_type);
+   Py_VISIT(state->device_type);
+   Py_VISIT(state->config_type);
+   Py_VISIT(state->command_type);
+   Py_VISIT(state->descriptor_type);
+   Py_VISIT(state->shared_type);
+   Py_VISIT(state->default_adapter);
+   return 0;
+}
 
-   CEC_config->callbacks = CEC_callbacks;
+static int cec_clear(PyObject * m) {
+   ModuleState * state = (ModuleState*)PyModule_GetState(m);
+   Py_CLEAR(state->default_adapter);
+   Py_CLEAR(state->adapter_type);
+   Py_CLEAR(state->device_type);
+   Py_CLEAR(state->config_type);
+   Py_CLEAR(state->command_type);
+   Py_CLEAR(state->descriptor_type);
+   Py_CLEAR(state->shared_type);
+   return 0;
+}
 
-   CEC_adapter = (ICECAdapter*)CECInitialise(CEC_config);
+#define INITERROR return -1
 
-   if( !CEC_adapter ) {
-      PyErr_SetString(PyExc_IOError, "Failed to initialize libcec");
-      INITERROR;
-   }
+PyMODINIT_FUNC PyInit_cec(void) {
+   return PyModuleDef_Init(&moduledef);
+}
 
-#if CEC_LIB_VERSION_MAJOR > 1 || ( CEC_LIB_VERSION_MAJOR == 1 && CEC_LIB_VERSION_MINOR >= 8 )
-   CEC_adapter->InitVideoStandalone();
-#endif
+static int cec_exec(PyObject * m) {
+   ModuleState * state = (ModuleState*)PyModule_GetState(m);
 
    // set up python module
-   PyTypeObject * dev = DeviceTypeInit(CEC_adapter);
-   Device = (PyObject*)dev;
-   if(PyType_Ready(dev) < 0 ) INITERROR;
-
-#if PY_MAJOR_VERSION >= 3
-   PyObject * m = PyModule_Create(&moduledef);
-#else
-   PyObject * m = Py_InitModule("cec", CecMethods);
-#endif
-
-   if( m == NULL ) INITERROR;
-
-   Py_INCREF(dev);
-   PyModule_AddObject(m, "Device", (PyObject*)dev);
+   state->adapter_type = AdapterTypeInit(m);
+   if( state->adapter_type == NULL ) INITERROR;
+   state->device_type = DeviceTypeInit(m);
+   if( state->device_type == NULL ) INITERROR;
+   state->config_type = ConfigTypeInit(m);
+   if( state->config_type == NULL ) INITERROR;
+   state->command_type = CommandTypeInit(m);
+   if( state->command_type == NULL ) INITERROR;
+   state->descriptor_type = PyStructSequence_NewType(&adapter_descriptor_desc);
+   if( state->descriptor_type == NULL ) INITERROR;
+   state->shared_type = SharedEventsTypeInit(m);
+   if( state->shared_type == NULL ) INITERROR;
+
+   // the default adapter backs the module-level functions
+   state->default_adapter = (Adapter*)PyObject_CallObject(
+         (PyObject*)state->adapter_type, NULL);
+   if( state->default_adapter == NULL ) INITERROR;
+
+   if( PyModule_AddType(m, state->adapter_type) < 0 ) INITERROR;
+   if( PyModule_AddType(m, state->device_type) < 0 ) INITERROR;
+   if( PyModule_AddType(m, state->config_type) < 0 ) INITERROR;
+   if( PyModule_AddType(m, state->command_type) < 0 ) INITERROR;
+   if( MsgModuleAdd(m, state->command_type) < 0 ) INITERROR;
+   if( PyModule_AddType(m, state->descriptor_type) < 0 ) INITERROR;
+   if( PyModule_AddType(m, state->shared_type) < 0 ) INITERROR;
+
+   // expose the default adapter's methods as module-level functions
+   for( PyMethodDef * def = state->adapter_type->tp_methods;
+         def->ml_name; def++ ) {
+      PyObject * method = PyObject_GetAttrString(
+            (PyObject*)state->default_adapter, def->ml_name);
+      if( method == NULL ) INITERROR;
+      if( PyModule_AddObject(m, def->ml_name, method) < 0 ) {
+         Py_DECREF(method);
+         INITERROR;
+      }
+   }
 
    // constants for event types
    PyModule_AddIntMacro(m, EVENT_LOG);
@@ -1000,8 +340,16 @@ PyMODINIT_FUNC initcec(void) {
    PyModule_AddIntMacro(m, EVENT_ALERT);
    PyModule_AddIntMacro(m, EVENT_MENU_CHANGED);
    PyModule_AddIntMacro(m, EVENT_ACTIVATED);
+   PyModule_AddIntMacro(m, EVENT_RECONNECTED);
    PyModule_AddIntMacro(m, EVENT_ALL);
 
+   // constants for cec.query results
+   PyModule_AddIntMacro(m, QUERY_OK);
+   PyModule_AddIntMacro(m, QUERY_NO_ACK);
+   PyModule_AddIntMacro(m, QUERY_ABORTED);
+   PyModule_AddIntMacro(m, QUERY_TIMEOUT);
+   PyModule_AddIntMacro(m, QUERY_MALFORMED);
+
    // constants for alert types
    PyModule_AddIntConstant(m, "CEC_ALERT_SERVICE_DEVICE",
          CEC_ALERT_SERVICE_DEVICE);
@@ -1016,6 +364,22 @@ PyMODINIT_FUNC initcec(void) {
    PyModule_AddIntConstant(m, "CEC_ALERT_TV_POLL_FAILED",
          CEC_ALERT_TV_POLL_FAILED);
 
+#if CEC_LIB_VERSION_MAJOR >= 4
+   // constants for adapter types
+   PyModule_AddIntConstant(m, "ADAPTERTYPE_UNKNOWN",
+         ADAPTERTYPE_UNKNOWN);
+   PyModule_AddIntConstant(m, "ADAPTERTYPE_P8_EXTERNAL",
+         ADAPTERTYPE_P8_EXTERNAL);
+   PyModule_AddIntConstant(m, "ADAPTERTYPE_P8_DAUGHTERBOARD",
+         ADAPTERTYPE_P8_DAUGHTERBOARD);
+   PyModule_AddIntConstant(m, "ADAPTERTYPE_RPI",
+         ADAPTERTYPE_RPI);
+   PyModule_AddIntConstant(m, "ADAPTERTYPE_TDA995x",
+         ADAPTERTYPE_TDA995x);
+   PyModule_AddIntConstant(m, "ADAPTERTYPE_EXYNOS",
+         ADAPTERTYPE_EXYNOS);
+#endif
+
    // constants for menu events
    PyModule_AddIntConstant(m, "CEC_MENU_STATE_ACTIVATED",
          CEC_MENU_STATE_ACTIVATED);
@@ -1036,6 +400,18 @@ PyMODINIT_FUNC initcec(void) {
    PyModule_AddIntConstant(m, "CEC_DEVICE_TYPE_AUDIO_SYSTEM",
          CEC_DEVICE_TYPE_AUDIO_SYSTEM);
 
+   // constants for power status
+   PyModule_AddIntConstant(m, "CEC_POWER_STATUS_ON",
+         CEC_POWER_STATUS_ON);
+   PyModule_AddIntConstant(m, "CEC_POWER_STATUS_STANDBY",
+         CEC_POWER_STATUS_STANDBY);
+   PyModule_AddIntConstant(m, "CEC_POWER_STATUS_IN_TRANSITION_STANDBY_TO_ON",
+         CEC_POWER_STATUS_IN_TRANSITION_STANDBY_TO_ON);
+   PyModule_AddIntConstant(m, "CEC_POWER_STATUS_IN_TRANSITION_ON_TO_STANDBY",
+         CEC_POWER_STATUS_IN_TRANSITION_ON_TO_STANDBY);
+   PyModule_AddIntConstant(m, "CEC_POWER_STATUS_UNKNOWN",
+         CEC_POWER_STATUS_UNKNOWN);
+
    // constants for logical addresses
    PyModule_AddIntConstant(m, "CECDEVICE_UNKNOWN",
          CECDEVICE_UNKNOWN);
@@ -1221,7 +597,5 @@ PyMODINIT_FUNC initcec(void) {
    // which adapter detection API was used at compile time
    PyModule_AddIntMacro(m, HAVE_CEC_ADAPTER_DESCRIPTOR);
 
-#if PY_MAJOR_VERSION >= 3
-   return m;
-#endif
+   return 0;
 }
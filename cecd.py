@@ -0,0 +1,52 @@
+#!/usr/bin/env python
+"""
+Share one CEC adapter between processes. libcec opens an adapter
+exclusively, so this daemon holds it and serves it on a UNIX socket; other
+processes use it with
+  cec.init("unix:///run/cec.sock")
+and the rest of the API works as on a local adapter. Clients can ask for
+only some events, e.g. unix:///run/cec.sock?events=4&opcodes=0x90,0x84
+
+  ./cecd.py --socket /run/cec.sock --mode 660
+"""
+
+import argparse
+import os
+import signal
+import sys
+
+import cec
+
+def main():
+   parser = argparse.ArgumentParser(description=__doc__,
+         formatter_class=argparse.RawDescriptionHelpFormatter)
+   parser.add_argument("-a", "--adapter", default=None,
+         help="adapter to open (default: the first one found)")
+   parser.add_argument("-s", "--socket", default="/run/cec.sock",
+         help="path of the socket to serve on (default /run/cec.sock)")
+   parser.add_argument("-m", "--mode", type=lambda m: int(m, 8),
+         default=None, help="permissions of the socket, in octal")
+   parser.add_argument("-n", "--device-name", default=None,
+         help="OSD name of this host on the bus")
+   args = parser.parse_args()
+
+   # keep the adapter across USB resets and the like
+   cec.init(args.adapter, device_name=args.device_name, reconnect=True)
+   cec.serve(args.socket)
+   if args.mode is not None:
+      os.chmod(args.socket, args.mode)
+   print("serving %s on %s" % (args.adapter or "the default adapter",
+      args.socket))
+   sys.stdout.flush()
+
+   stop = lambda signum, frame: sys.exit(0)
+   signal.signal(signal.SIGTERM, stop)
+   signal.signal(signal.SIGINT, stop)
+   try:
+      while True:
+         signal.pause()
+   finally:
+      cec.close()
+
+if __name__ == "__main__":
+   main()
@@ -0,0 +1,245 @@
+/* command.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the Command class. Each parameter named in the opcode
+ * table becomes an attribute; reading one decodes the whole payload once
+ * and caches it. An attribute that the command's opcode doesn't carry
+ * raises AttributeError, and one that is missing from a short frame is
+ * None.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "command.h"
+#include "adapter.h"
+#include "opcodes.h"
+
+#include <mutex>
+#include <new>
+#include <string.h>
+#include <vector>
+
+using namespace CEC;
+
+static PyObject * decode_param(const cec_datapacket & data,
+      const OpcodeParam & param) {
+   size_t size = OpcodeParamSize(param.kind);
+   if( data.size < param.offset + size ) {
+      Py_RETURN_NONE;
+   }
+   const uint8_t * p = data.data + param.offset;
+   switch( param.kind ) {
+      case PARAM_BYTE:
+         return PyLong_FromLong(p[0]);
+      case PARAM_BOOL:
+         return PyBool_FromLong(p[0]);
+      case PARAM_PHYSICAL_ADDR:
+         return build_physical_addr((uint16_t)((p[0] << 8) | p[1]));
+      case PARAM_VENDOR_ID:
+         return PyLong_FromLong((p[0] << 16) | (p[1] << 8) | p[2]);
+      case PARAM_VOLUME:
+         return PyLong_FromLong(p[0] & 0x7F);
+      case PARAM_MUTED:
+         return PyBool_FromLong(p[0] & 0x80);
+      case PARAM_STRING:
+         return PyUnicode_DecodeASCII((const char *)p,
+               data.size - param.offset, "replace");
+      case PARAM_LANGUAGE:
+         return PyUnicode_DecodeASCII((const char *)p, 3, "replace");
+   }
+   Py_RETURN_NONE;
+}
+
+// the decoded parameters, or NULL with an exception set
+static PyObject * Command_decode(Command * self) {
+   if( self->fields ) return self->fields;
+
+   PyObject * fields = PyDict_New();
+   if( fields == NULL ) return NULL;
+   const OpcodeSpec * spec = self->valid ?
+      OpcodeLookup(self->cmd.opcode) : NULL;
+   for( int i=0; spec && i<OPCODE_MAX_PARAMS && spec->params[i].name; i++ ) {
+      PyObject * value = decode_param(self->cmd.parameters, spec->params[i]);
+      if( value == NULL ||
+            PyDict_SetItemString(fields, spec->params[i].name, value) < 0 ) {
+         Py_XDECREF(value);
+         Py_DECREF(fields);
+         return NULL;
+      }
+      Py_DECREF(value);
+   }
+   self->fields = fields;
+   return fields;
+}
+
+static PyObject * Command_get_param(Command * self, void * closure) {
+   const char * name = (const char *)closure;
+   PyObject * fields = Command_decode(self);
+   if( fields == NULL ) return NULL;
+   PyObject * value = PyDict_GetItemString(fields, name);
+   if( value == NULL ) {
+      const OpcodeSpec * spec = self->valid ?
+         OpcodeLookup(self->cmd.opcode) : NULL;
+      if( spec ) {
+         PyErr_Format(PyExc_AttributeError, "%s has no %s", spec->name,
+               name);
+      } else {
+         PyErr_Format(PyExc_AttributeError, "opcode 0x%02x has no %s",
+               self->cmd.opcode, name);
+      }
+      return NULL;
+   }
+   Py_INCREF(value);
+   return value;
+}
+
+static PyObject * Command_get_fields(Command * self, void * closure) {
+   PyObject * fields = Command_decode(self);
+   if( fields == NULL ) return NULL;
+   return PyDict_Copy(fields);
+}
+
+static PyObject * Command_get_name(Command * self, void * closure) {
+   const OpcodeSpec * spec = self->valid ?
+      OpcodeLookup(self->cmd.opcode) : NULL;
+   if( spec == NULL ) {
+      Py_RETURN_NONE;
+   }
+   return PyUnicode_FromString(spec->name);
+}
+
+static int Command_traverse(Command * self, visitproc visit, void * arg) {
+   Py_VISIT(Py_TYPE(self));
+   Py_VISIT(self->fields);
+   return PyDict_Type.tp_traverse((PyObject *)self, visit, arg);
+}
+
+static int Command_clear(Command * self) {
+   Py_CLEAR(self->fields);
+   return PyDict_Type.tp_clear((PyObject *)self);
+}
+
+static void Command_dealloc(Command * self) {
+   PyTypeObject * type = Py_TYPE(self);
+   PyObject_GC_UnTrack(self);
+   Py_CLEAR(self->fields);
+   // frees the dict's storage and the object itself
+   PyDict_Type.tp_dealloc((PyObject *)self);
+   Py_DECREF(type);
+}
+
+// filled from the opcode table the first time the type is created: one
+// attribute per distinct parameter name, then name and fields
+static std::vector<PyGetSetDef> Command_getset;
+static std::once_flag Command_getset_once;
+
+static void Command_getset_init() {
+   size_t count;
+   const OpcodeSpec * specs = OpcodeSpecs(&count);
+   for( size_t i=0; i<count; i++ ) {
+      for( int j=0; j<OPCODE_MAX_PARAMS && specs[i].params[j].name; j++ ) {
+         const char * name = specs[i].params[j].name;
+         bool seen = false;
+         for( const PyGetSetDef & def : Command_getset ) {
+            seen = seen || strcmp(def.name, name) == 0;
+         }
+         if( seen ) continue;
+         PyGetSetDef def = { name, (getter)Command_get_param, NULL,
+            NULL, (void *)name };
+         Command_getset.push_back(def);
+      }
+   }
+   PyGetSetDef name = { "name", (getter)Command_get_name, NULL,
+      "Name of the opcode, e.g. REPORT_POWER_STATUS, or None", NULL };
+   PyGetSetDef fields = { "fields", (getter)Command_get_fields, NULL,
+      "The decoded parameters as a dict", NULL };
+   PyGetSetDef end = { NULL };
+   Command_getset.push_back(name);
+   Command_getset.push_back(fields);
+   Command_getset.push_back(end);
+}
+
+static PyType_Slot Command_slots[] = {
+   {Py_tp_dealloc, (void*)Command_dealloc},
+   {Py_tp_traverse, (void*)Command_traverse},
+   {Py_tp_clear, (void*)Command_clear},
+   {Py_tp_getset, NULL},
+   {Py_tp_doc, (void*)"A received CEC command"},
+   {0, NULL}
+};
+
+static PyType_Spec Command_spec = {
+   "cec.Command",
+   sizeof(Command),
+   0,
+   Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+   Command_slots
+};
+
+PyTypeObject * CommandTypeInit(PyObject * module) {
+   std::call_once(Command_getset_once, [] {
+      Command_getset_init();
+      for( PyType_Slot * slot = Command_slots; slot->slot; slot++ ) {
+         if( slot->slot == Py_tp_getset ) slot->pfunc = Command_getset.data();
+      }
+   });
+   return (PyTypeObject*)PyType_FromModuleAndSpec(module, &Command_spec,
+         (PyObject *)&PyDict_Type);
+}
+
+static int set_item(PyObject * dict, const char * key, PyObject * value) {
+   if( value == NULL ) return -1;
+   int result = PyDict_SetItemString(dict, key, value);
+   Py_DECREF(value);
+   return result;
+}
+
+PyObject * CommandNew(PyTypeObject * type, const cec_command & cmd) {
+   PyObject * args = PyTuple_New(0);
+   if( args == NULL ) return NULL;
+   Command * self = (Command *)type->tp_new(type, args, NULL);
+   Py_DECREF(args);
+   if( self == NULL ) return NULL;
+   new (&self->cmd) cec_command(cmd);
+   self->valid = true;
+
+   PyObject * dict = (PyObject *)self;
+   // frames built by cec.msg are sent from this host's address
+   PyObject * initiator;
+   if( cmd.initiator == CECDEVICE_UNKNOWN ) {
+      Py_INCREF(Py_None);
+      initiator = Py_None;
+   } else {
+      initiator = PyLong_FromLong(cmd.initiator);
+   }
+   if( set_item(dict, "initiator", initiator) < 0 ||
+         set_item(dict, "destination", PyLong_FromLong(cmd.destination)) < 0 ||
+         set_item(dict, "ack", PyBool_FromLong(cmd.ack)) < 0 ||
+         set_item(dict, "eom", PyBool_FromLong(cmd.eom)) < 0 ||
+         set_item(dict, "opcode", PyLong_FromLong(cmd.opcode)) < 0 ||
+         set_item(dict, "parameters", PyBytes_FromStringAndSize(
+               (const char *)cmd.parameters.data, cmd.parameters.size)) < 0 ||
+         set_item(dict, "opcode_set", PyBool_FromLong(cmd.opcode_set)) < 0 ||
+         set_item(dict, "transmit_timeout",
+            PyLong_FromLong(cmd.transmit_timeout)) < 0 ) {
+      Py_DECREF(self);
+      return NULL;
+   }
+   return dict;
+}
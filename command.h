@@ -0,0 +1,50 @@
+/* command.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Python view of a received cec_command. It is the dict that EVENT_COMMAND
+ * handlers have always received, with the payload decoded on first access
+ * into typed attributes such as .physical_address or .volume.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <libcec/cec.h>
+
+struct Command {
+   PyDictObject dict;
+
+   CEC::cec_command cmd;
+   // false for instances not made by CommandNew, e.g. by copy.copy()
+   bool valid;
+   // the decoded parameters, built on first access
+   PyObject * fields;
+};
+
+PyTypeObject * CommandTypeInit(PyObject * module);
+
+// a new Command for cmd
+PyObject * CommandNew(PyTypeObject * type, const CEC::cec_command & cmd);
+
+#endif
@@ -0,0 +1,529 @@
+/* config.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the Config class. Each field of libcec_configuration
+ * that is exposed to python is described once in config_fields; the
+ * attributes, bulk updates, comparisons and diffs are all driven from that
+ * table.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "config.h"
+#include "adapter.h"
+
+#include <mutex>
+#include <new>
+#include <stddef.h>
+
+using namespace CEC;
+
+enum FieldKind {
+   FIELD_BOOL,
+   FIELD_UINT,             // unsigned integer of 1, 2 or 4 bytes
+   FIELD_ENUM,
+   FIELD_PHYSICAL_ADDR,
+   FIELD_STRING,           // NUL-terminated, at most size-1 characters
+   FIELD_LANGUAGE,         // exactly 3 characters, not terminated
+   FIELD_DEVICE_TYPES,
+   FIELD_LOGICAL_ADDRS,
+};
+
+struct ConfigField {
+   const char * name;
+   FieldKind kind;
+   size_t offset;
+   size_t size;
+   bool readonly;
+   const char * doc;
+};
+
+#define FIELD(name, kind, member, readonly, doc) \
+   { name, kind, offsetof(libcec_configuration, member), \
+      sizeof(((libcec_configuration*)0)->member), readonly, doc }
+
+static const ConfigField config_fields[] = {
+   // libcec accepts longer names, but the OSD name on the bus is limited
+   { "device_name", FIELD_STRING,
+      offsetof(libcec_configuration, strDeviceName), 13, false,
+      "OSD name of this device" },
+   FIELD("device_types", FIELD_DEVICE_TYPES, deviceTypes, false,
+      "Device types to register as"),
+   FIELD("autodetect_address", FIELD_BOOL, bAutodetectAddress, false,
+      "Detect the physical address automatically"),
+   FIELD("physical_address", FIELD_PHYSICAL_ADDR, iPhysicalAddress, false,
+      "Physical address of the adapter"),
+   FIELD("base_device", FIELD_ENUM, baseDevice, false,
+      "Logical address of the device the adapter is connected to"),
+   FIELD("hdmi_port", FIELD_UINT, iHDMIPort, false,
+      "HDMI port of the base device the adapter is connected to"),
+   FIELD("tv_vendor", FIELD_UINT, tvVendor, false,
+      "Vendor ID of the TV"),
+   FIELD("wake_devices", FIELD_LOGICAL_ADDRS, wakeDevices, false,
+      "Devices to power on when opening the adapter"),
+   FIELD("power_off_devices", FIELD_LOGICAL_ADDRS, powerOffDevices, false,
+      "Devices to put in standby when closing the adapter"),
+   FIELD("get_settings_from_rom", FIELD_BOOL, bGetSettingsFromROM, false,
+      "Load the configuration stored in the adapter when opening it"),
+   FIELD("activate_source", FIELD_BOOL, bActivateSource, false,
+      "Make this device the active source when opening the adapter"),
+   FIELD("power_off_on_standby", FIELD_BOOL, bPowerOffOnStandby, false,
+      "Put the host in standby when the TV goes to standby"),
+   FIELD("logical_addresses", FIELD_LOGICAL_ADDRS, logicalAddresses, true,
+      "Logical addresses claimed by this device"),
+   FIELD("server_version", FIELD_UINT, serverVersion, true,
+      "libcec version"),
+   FIELD("firmware_version", FIELD_UINT, iFirmwareVersion, true,
+      "Adapter firmware version"),
+   FIELD("device_language", FIELD_LANGUAGE, strDeviceLanguage, false,
+      "Menu language, as an ISO 639-2 code"),
+#if CEC_LIB_VERSION_MAJOR >= 2
+   FIELD("firmware_build_date", FIELD_UINT, iFirmwareBuildDate, true,
+      "Adapter firmware build date, in seconds since the epoch"),
+   FIELD("monitor_only", FIELD_BOOL, bMonitorOnly, false,
+      "Only monitor the bus, don't claim a logical address"),
+   FIELD("cec_version", FIELD_ENUM, cecVersion, false,
+      "CEC version to report"),
+   FIELD("adapter_type", FIELD_ENUM, adapterType, true,
+      "Type of the adapter"),
+#endif
+#if CEC_LIB_VERSION_MAJOR >= 4
+   FIELD("combo_key", FIELD_ENUM, comboKey, false,
+      "Key that starts a key combination"),
+   FIELD("combo_key_timeout_ms", FIELD_UINT, iComboKeyTimeoutMs, false,
+      "Timeout for key combinations, in milliseconds"),
+   FIELD("button_repeat_rate_ms", FIELD_UINT, iButtonRepeatRateMs, false,
+      "Rate at which held buttons repeat, in milliseconds"),
+   FIELD("button_release_delay_ms", FIELD_UINT, iButtonReleaseDelayMs, false,
+      "Delay before a held button is released, in milliseconds"),
+   FIELD("double_tap_timeout_ms", FIELD_UINT, iDoubleTapTimeoutMs, false,
+      "Window for double taps, in milliseconds"),
+   FIELD("auto_wake_avr", FIELD_BOOL, bAutoWakeAVR, false,
+      "Power on the AV receiver when this device becomes active"),
+#endif
+};
+
+#define CONFIG_FIELD_COUNT (sizeof(config_fields) / sizeof(config_fields[0]))
+
+static void * field_ptr(const libcec_configuration & config,
+      const ConfigField * field) {
+   return (char *)&config + field->offset;
+}
+
+static bool field_equal(const libcec_configuration & a,
+      const libcec_configuration & b, const ConfigField * field) {
+   const char * pa = (const char *)field_ptr(a, field);
+   const char * pb = (const char *)field_ptr(b, field);
+   if( field->kind == FIELD_STRING ) {
+      return strncmp(pa, pb, field->size) == 0;
+   }
+   return memcmp(pa, pb, field->size) == 0;
+}
+
+static PyObject * field_get(const libcec_configuration & config,
+      const ConfigField * field) {
+   void * ptr = field_ptr(config, field);
+   switch( field->kind ) {
+      case FIELD_BOOL:
+         return PyBool_FromLong(*(uint8_t *)ptr);
+      case FIELD_UINT:
+         switch( field->size ) {
+            case 1: return PyLong_FromUnsignedLong(*(uint8_t *)ptr);
+            case 2: return PyLong_FromUnsignedLong(*(uint16_t *)ptr);
+            default: return PyLong_FromUnsignedLong(*(uint32_t *)ptr);
+         }
+      case FIELD_ENUM:
+         return PyLong_FromLong(*(int *)ptr);
+      case FIELD_PHYSICAL_ADDR:
+         return build_physical_addr(*(uint16_t *)ptr);
+      case FIELD_STRING:
+         return PyUnicode_DecodeASCII((const char *)ptr,
+               strnlen((const char *)ptr, field->size), "ignore");
+      case FIELD_LANGUAGE:
+         return PyUnicode_DecodeASCII((const char *)ptr,
+               strnlen((const char *)ptr, 3), "ignore");
+      case FIELD_DEVICE_TYPES: {
+         cec_device_type_list * types = (cec_device_type_list *)ptr;
+         PyObject * result = PyTuple_New(0);
+         for( int i=0; result && i<5; i++ ) {
+            if( types->types[i] == CEC_DEVICE_TYPE_RESERVED ) continue;
+            PyObject * type = PyLong_FromLong(types->types[i]);
+            if( type == NULL || _PyTuple_Resize(&result,
+                     PyTuple_GET_SIZE(result) + 1) < 0 ) {
+               Py_XDECREF(type);
+               Py_XDECREF(result);
+               return NULL;
+            }
+            PyTuple_SET_ITEM(result, PyTuple_GET_SIZE(result) - 1, type);
+         }
+         return result;
+      }
+      case FIELD_LOGICAL_ADDRS: {
+         cec_logical_addresses * addrs = (cec_logical_addresses *)ptr;
+         PyObject * result = PyList_New(0);
+         for( int i=0; result && i<16; i++ ) {
+            if( !addrs->addresses[i] ) continue;
+            PyObject * addr = PyLong_FromLong(i);
+            if( addr == NULL || PyList_Append(result, addr) < 0 ) {
+               Py_XDECREF(addr);
+               Py_CLEAR(result);
+               break;
+            }
+            Py_DECREF(addr);
+         }
+         if( result == NULL ) return NULL;
+         PyObject * tuple = PyList_AsTuple(result);
+         Py_DECREF(result);
+         return tuple;
+      }
+   }
+   Py_RETURN_NONE;
+}
+
+bool ConfigParseDeviceTypes(PyObject * arg, cec_device_type_list * types) {
+   types->Clear();
+   PyObject * seq;
+   if( PyLong_Check(arg) ) {
+      seq = PyTuple_Pack(1, arg);
+   } else {
+      seq = PySequence_Fast(arg,
+            "device_types must be a device type or a sequence of them");
+   }
+   if( seq == NULL ) {
+      return false;
+   }
+
+   bool ok = true;
+   Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+   if( count < 1 || count > 5 ) {
+      PyErr_SetString(PyExc_ValueError,
+            "Between 1 and 5 device types must be given");
+      ok = false;
+   }
+   for( Py_ssize_t i=0; ok && i<count; i++ ) {
+      long type = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+      if( type == -1 && PyErr_Occurred() ) {
+         ok = false;
+      } else if( type < 0 || type > 5 ) {
+         PyErr_SetString(PyExc_ValueError,
+               "Device type must be between 0 and 5");
+         ok = false;
+      } else {
+         types->Add((cec_device_type)type);
+      }
+   }
+   Py_DECREF(seq);
+   return ok;
+}
+
+static bool parse_logical_addrs(PyObject * arg, cec_logical_addresses * addrs) {
+   PyObject * seq = PySequence_Fast(arg,
+         "expected a sequence of logical addresses");
+   if( seq == NULL ) {
+      return false;
+   }
+   bool ok = true;
+   addrs->Clear();
+   for( Py_ssize_t i=0; ok && i<PySequence_Fast_GET_SIZE(seq); i++ ) {
+      long addr = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+      if( addr == -1 && PyErr_Occurred() ) {
+         ok = false;
+      } else if( addr < 0 || addr > 15 ) {
+         PyErr_SetString(PyExc_ValueError,
+               "Logical address must be between 0 and 15");
+         ok = false;
+      } else {
+         addrs->Set((cec_logical_address)addr);
+      }
+   }
+   Py_DECREF(seq);
+   return ok;
+}
+
+static int field_set(libcec_configuration & config,
+      const ConfigField * field, PyObject * value) {
+   if( value == NULL ) {
+      PyErr_Format(PyExc_AttributeError, "can't delete %s", field->name);
+      return -1;
+   }
+   void * ptr = field_ptr(config, field);
+   switch( field->kind ) {
+      case FIELD_BOOL: {
+         int b = PyObject_IsTrue(value);
+         if( b < 0 ) return -1;
+         *(uint8_t *)ptr = b;
+         return 0;
+      }
+      case FIELD_UINT: {
+         unsigned long v = PyLong_AsUnsignedLong(value);
+         if( v == (unsigned long)-1 && PyErr_Occurred() ) return -1;
+         unsigned long max = (field->size >= 4) ? 0xFFFFFFFFUL :
+            (1UL << (field->size * 8)) - 1;
+         if( v > max ) {
+            PyErr_Format(PyExc_ValueError, "%s must be at most %lu",
+                  field->name, max);
+            return -1;
+         }
+         switch( field->size ) {
+            case 1: *(uint8_t *)ptr = (uint8_t)v; break;
+            case 2: *(uint16_t *)ptr = (uint16_t)v; break;
+            default: *(uint32_t *)ptr = (uint32_t)v; break;
+         }
+         return 0;
+      }
+      case FIELD_ENUM: {
+         long v = PyLong_AsLong(value);
+         if( v == -1 && PyErr_Occurred() ) return -1;
+         *(int *)ptr = (int)v;
+         return 0;
+      }
+      case FIELD_PHYSICAL_ADDR: {
+         if( value == Py_None ) {
+            *(uint16_t *)ptr = PHYSICAL_ADDR_INVALID;
+            return 0;
+         }
+         const char * s = PyUnicode_AsUTF8(value);
+         if( s == NULL ) return -1;
+         int pa = parse_physical_addr(s);
+         if( pa < 0 ) {
+            PyErr_SetString(PyExc_ValueError, "Invalid physical address");
+            return -1;
+         }
+         *(uint16_t *)ptr = (uint16_t)pa;
+         return 0;
+      }
+      case FIELD_STRING:
+      case FIELD_LANGUAGE: {
+         Py_ssize_t len;
+         const char * s = PyUnicode_AsUTF8AndSize(value, &len);
+         if( s == NULL ) return -1;
+         if( field->kind == FIELD_LANGUAGE && len != 3 ) {
+            PyErr_Format(PyExc_ValueError, "%s must be 3 characters",
+                  field->name);
+            return -1;
+         }
+         if( field->kind == FIELD_STRING && (size_t)len >= field->size ) {
+            PyErr_Format(PyExc_ValueError,
+                  "%s must be at most %d characters", field->name,
+                  (int)field->size - 1);
+            return -1;
+         }
+         if( field->kind == FIELD_STRING ) {
+            memset(ptr, 0, field->size);
+         }
+         memcpy(ptr, s, len);
+         return 0;
+      }
+      case FIELD_DEVICE_TYPES: {
+         cec_device_type_list types;
+         if( !ConfigParseDeviceTypes(value, &types) ) return -1;
+         *(cec_device_type_list *)ptr = types;
+         return 0;
+      }
+      case FIELD_LOGICAL_ADDRS: {
+         cec_logical_addresses addrs;
+         if( !parse_logical_addrs(value, &addrs) ) return -1;
+         *(cec_logical_addresses *)ptr = addrs;
+         return 0;
+      }
+   }
+   return 0;
+}
+
+bool ConfigEqual(const libcec_configuration & a,
+      const libcec_configuration & b) {
+   for( size_t i=0; i<CONFIG_FIELD_COUNT; i++ ) {
+      if( !field_equal(a, b, &config_fields[i]) ) return false;
+   }
+   return true;
+}
+
+PyObject * ConfigDiff(const libcec_configuration & old_config,
+      const libcec_configuration & new_config) {
+   PyObject * result = PyDict_New();
+   if( result == NULL ) return NULL;
+   for( size_t i=0; i<CONFIG_FIELD_COUNT; i++ ) {
+      const ConfigField * field = &config_fields[i];
+      if( field_equal(old_config, new_config, field) ) continue;
+      PyObject * change = Py_BuildValue("(NN)",
+            field_get(old_config, field), field_get(new_config, field));
+      if( change == NULL ||
+            PyDict_SetItemString(result, field->name, change) < 0 ) {
+         Py_XDECREF(change);
+         Py_DECREF(result);
+         return NULL;
+      }
+      Py_DECREF(change);
+   }
+   return result;
+}
+
+static PyObject * Config_get(Config * self, void * closure) {
+   return field_get(self->config, (const ConfigField *)closure);
+}
+
+static int Config_set(Config * self, PyObject * value, void * closure) {
+   return field_set(self->config, (const ConfigField *)closure, value);
+}
+
+static PyObject * Config_as_dict(Config * self, PyObject * args) {
+   PyObject * result = PyDict_New();
+   if( result == NULL ) return NULL;
+   for( size_t i=0; i<CONFIG_FIELD_COUNT; i++ ) {
+      PyObject * value = field_get(self->config, &config_fields[i]);
+      if( value == NULL ||
+            PyDict_SetItemString(result, config_fields[i].name, value) < 0 ) {
+         Py_XDECREF(value);
+         Py_DECREF(result);
+         return NULL;
+      }
+      Py_DECREF(value);
+   }
+   return result;
+}
+
+static int Config_update_from(Config * self, PyObject * fields) {
+   PyObject * key;
+   PyObject * value;
+   Py_ssize_t pos = 0;
+   while( PyDict_Next(fields, &pos, &key, &value) ) {
+      if( PyObject_SetAttr((PyObject *)self, key, value) < 0 ) return -1;
+   }
+   return 0;
+}
+
+// set several fields at once; if any of them is invalid, none are changed
+static PyObject * Config_update(Config * self, PyObject * args,
+      PyObject * kwds) {
+   PyObject * mapping = NULL;
+   if( !PyArg_ParseTuple(args, "|O!:update", &PyDict_Type, &mapping) ) {
+      return NULL;
+   }
+
+   libcec_configuration saved = self->config;
+   if( (mapping && Config_update_from(self, mapping) < 0) ||
+         (kwds && Config_update_from(self, kwds) < 0) ) {
+      self->config = saved;
+      return NULL;
+   }
+   Py_RETURN_NONE;
+}
+
+static PyObject * Config_diff(Config * self, PyObject * args) {
+   PyObject * other;
+   if( !PyArg_ParseTuple(args, "O!:diff", Py_TYPE(self), &other) ) {
+      return NULL;
+   }
+   return ConfigDiff(self->config, ((Config *)other)->config);
+}
+
+static PyObject * Config_richcompare(Config * self, PyObject * other, int op) {
+   if( Py_TYPE(other) != Py_TYPE(self) || (op != Py_EQ && op != Py_NE) ) {
+      Py_RETURN_NOTIMPLEMENTED;
+   }
+   bool equal = ConfigEqual(self->config, ((Config *)other)->config);
+   return PyBool_FromLong((op == Py_EQ) == equal);
+}
+
+static PyObject * Config_repr(Config * self) {
+   PyObject * fields = Config_as_dict(self, NULL);
+   if( fields == NULL ) return NULL;
+   PyObject * result = PyUnicode_FromFormat("cec.Config(%R)", fields);
+   Py_DECREF(fields);
+   return result;
+}
+
+static PyObject * Config_new(PyTypeObject * type, PyObject * args,
+      PyObject * kwds) {
+   libcec_configuration config;
+   config.Clear();
+   Config * self = (Config *)ConfigNew(type, config);
+   if( self == NULL ) return NULL;
+   PyObject * result = Config_update(self, args, kwds);
+   if( result == NULL ) {
+      Py_DECREF(self);
+      return NULL;
+   }
+   Py_DECREF(result);
+   return (PyObject *)self;
+}
+
+static void Config_dealloc(Config * self) {
+   PyTypeObject * type = Py_TYPE(self);
+   type->tp_free((PyObject*)self);
+   Py_DECREF(type);
+}
+
+static PyMethodDef Config_methods[] = {
+   {"update", (PyCFunction)Config_update, METH_VARARGS | METH_KEYWORDS,
+      "Set several fields at once, from a dict and/or keywords"},
+   {"as_dict", (PyCFunction)Config_as_dict, METH_NOARGS,
+      "All fields as a dict"},
+   {"diff", (PyCFunction)Config_diff, METH_VARARGS,
+      "{field: (this value, other value)} for each field that differs"},
+   {NULL}
+};
+
+// filled from config_fields the first time the type is created
+static PyGetSetDef Config_getset[CONFIG_FIELD_COUNT + 1];
+static std::once_flag Config_getset_once;
+
+static PyType_Slot Config_slots[] = {
+   {Py_tp_new, (void*)Config_new},
+   {Py_tp_dealloc, (void*)Config_dealloc},
+   {Py_tp_repr, (void*)Config_repr},
+   {Py_tp_richcompare, (void*)Config_richcompare},
+   {Py_tp_methods, Config_methods},
+   {Py_tp_getset, Config_getset},
+   {Py_tp_doc, (void*)"libcec configuration"},
+   {0, NULL}
+};
+
+static PyType_Spec Config_spec = {
+   "cec.Config",
+   sizeof(Config),
+   0,
+   Py_TPFLAGS_DEFAULT,
+   Config_slots
+};
+
+PyTypeObject * ConfigTypeInit(PyObject * module) {
+   std::call_once(Config_getset_once, [] {
+      for( size_t i=0; i<CONFIG_FIELD_COUNT; i++ ) {
+         const ConfigField * field = &config_fields[i];
+         Config_getset[i].name = field->name;
+         Config_getset[i].get = (getter)Config_get;
+         Config_getset[i].set = field->readonly ? NULL : (setter)Config_set;
+         Config_getset[i].doc = field->doc;
+         Config_getset[i].closure = (void *)field;
+      }
+   });
+   return (PyTypeObject*)PyType_FromModuleAndSpec(module, &Config_spec,
+         NULL);
+}
+
+PyObject * ConfigNew(PyTypeObject * type, const libcec_configuration & config) {
+   Config * self = (Config *)type->tp_alloc(type, 0);
+   if( self == NULL ) return NULL;
+   new (&self->config) libcec_configuration(config);
+   // libcec's internal pointers are meaningless to python
+   self->config.callbacks = NULL;
+   self->config.callbackParam = NULL;
+   return (PyObject *)self;
+}
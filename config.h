@@ -0,0 +1,55 @@
+/* config.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Python view of libcec_configuration
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <libcec/cec.h>
+
+struct Config {
+   PyObject_HEAD
+
+   CEC::libcec_configuration  config;
+};
+
+PyTypeObject * ConfigTypeInit(PyObject * module);
+
+// a new Config holding a copy of config
+PyObject * ConfigNew(PyTypeObject * type, const CEC::libcec_configuration & config);
+
+// parse a device type or a sequence of device types into types
+bool ConfigParseDeviceTypes(PyObject * arg, CEC::cec_device_type_list * types);
+
+// true if every field that Config exposes is the same in a and b
+bool ConfigEqual(const CEC::libcec_configuration & a,
+      const CEC::libcec_configuration & b);
+
+// {field: (old value, new value)} for each field that differs
+PyObject * ConfigDiff(const CEC::libcec_configuration & old_config,
+      const CEC::libcec_configuration & new_config);
+
+#endif
@@ -0,0 +1,136 @@
+/* detect.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of cached adapter detection
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "detect.h"
+
+#include <string.h>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace CEC;
+
+#ifdef __linux__
+// device nodes that CEC adapters show up as: Pulse-Eight USB adapters are
+// CDC-ACM serial ports, kernel CEC drivers are /dev/cecN and the Raspberry
+// Pi firmware interface is vchiq
+static const char * watched_prefixes[] = {
+   "ttyACM", "ttyUSB", "cec", "vchiq", "serial", NULL
+};
+
+static bool watched_name(const char * name) {
+   for( const char ** p = watched_prefixes; *p; p++ ) {
+      if( strncmp(name, *p, strlen(*p)) == 0 ) return true;
+   }
+   return false;
+}
+#endif
+
+AdapterCache::AdapterCache() : watch_fd(-1), scanned(false),
+      scanned_full(false) {
+#ifdef __linux__
+   watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+   if( watch_fd >= 0 ) {
+      if( inotify_add_watch(watch_fd, "/dev",
+               IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_TO |
+               IN_MOVED_FROM) < 0 ) {
+         close(watch_fd);
+         watch_fd = -1;
+      }
+   }
+#endif
+}
+
+AdapterCache::~AdapterCache() {
+#ifdef __linux__
+   if( watch_fd >= 0 ) close(watch_fd);
+#endif
+}
+
+void AdapterCache::Invalidate() {
+   std::lock_guard<std::mutex> guard(lock);
+   scanned = false;
+   scanned_full = false;
+}
+
+// drain pending hotplug notifications; true if any adapter node changed
+bool AdapterCache::Changed() {
+#ifdef __linux__
+   if( watch_fd < 0 ) return true;
+
+   bool changed = false;
+   char buf[4096]
+      __attribute__ ((aligned(__alignof__(struct inotify_event))));
+   ssize_t len;
+   while( (len = read(watch_fd, buf, sizeof(buf))) > 0 ) {
+      for( char * p = buf; p < buf + len; ) {
+         struct inotify_event * event = (struct inotify_event *)p;
+         if( event->mask & IN_Q_OVERFLOW ) {
+            changed = true;
+         } else if( event->len > 0 && watched_name(event->name) ) {
+            changed = true;
+         }
+         p += sizeof(struct inotify_event) + event->len;
+      }
+   }
+   return changed;
+#else
+   // no hotplug notifications on this platform; always rescan
+   return true;
+#endif
+}
+
+std::vector<CEC_ADAPTER_TYPE> AdapterCache::Scan(Backend * lib,
+      bool full) {
+   std::vector<CEC_ADAPTER_TYPE> res;
+   int cec_count = 10;
+   res.resize(cec_count);
+   int count = lib->DetectAdapters(res.data(), cec_count, !full);
+   if( count > cec_count ) {
+      cec_count = (std::min)(count, 255);
+      res.resize(cec_count);
+      count = lib->DetectAdapters(res.data(), cec_count, !full);
+      count = (std::min)(count, cec_count);
+   }
+   res.resize((std::max)(count, 0));
+   return res;
+}
+
+std::vector<CEC_ADAPTER_TYPE> AdapterCache::Get(Backend * lib,
+      bool full, bool rescan) {
+   std::lock_guard<std::mutex> guard(lock);
+   if( Changed() || rescan ) {
+      scanned = false;
+      scanned_full = false;
+   }
+   if( !scanned || (full && !scanned_full) ) {
+      adapters = Scan(lib, full);
+      scanned = true;
+      scanned_full = full;
+   }
+   return adapters;
+}
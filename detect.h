@@ -0,0 +1,64 @@
+/* detect.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Cached adapter detection. The adapter list is scanned once and only
+ * rescanned when a device node appears or disappears.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef DETECT_H
+#define DETECT_H
+
+#include <mutex>
+#include <vector>
+
+#include <libcec/cec.h>
+
+#include "backend.h"
+
+class AdapterCache {
+   public:
+      AdapterCache();
+      ~AdapterCache();
+
+      // Return the detected adapters. A full scan reads firmware details
+      // from each adapter, a quick scan only lists them. The list is
+      // rescanned only if it was never scanned, hotplug reported a change,
+      // or rescan is set. Must be called without the GIL held.
+      std::vector<CEC::CEC_ADAPTER_TYPE> Get(Backend * lib,
+            bool full, bool rescan);
+
+      void Invalidate();
+
+   private:
+      bool Changed();
+      std::vector<CEC::CEC_ADAPTER_TYPE> Scan(Backend * lib,
+            bool full);
+
+      std::mutex lock;
+      // inotify descriptor watching /dev, or -1 if unavailable
+      int watch_fd;
+
+      bool scanned;
+      bool scanned_full;
+      std::vector<CEC::CEC_ADAPTER_TYPE> adapters;
+};
+
+#endif
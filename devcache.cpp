@@ -0,0 +1,262 @@
+/* devcache.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The device table kept on disk
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "devcache.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+#include <sstream>
+
+using namespace CEC;
+
+DeviceInfo::DeviceInfo() : vendor(0), physical_address(0xFFFF),
+   cec_version(CEC_VERSION_UNKNOWN), stale(false) {
+}
+
+DeviceInfo DeviceInfoQuery(Backend * lib, cec_logical_address addr) {
+   DeviceInfo info;
+   info.vendor = lib->GetDeviceVendorId(addr);
+   info.physical_address = lib->GetDevicePhysicalAddress(addr);
+   info.cec_version = lib->GetDeviceCecVersion(addr);
+   info.osd_name = lib->GetDeviceOSDName(addr);
+   info.language = lib->GetDeviceMenuLanguage(addr);
+   return info;
+}
+
+DeviceCache::DeviceCache() : dirty(false), warming(false), stopping(false) {
+   memset(present, 0, sizeof(present));
+}
+
+DeviceCache::~DeviceCache() {
+   Stop();
+}
+
+// one device per line:
+//  addr vendor physical_address cec_version language osd_name
+// with the language "-" if there is none, and the name to the end of line
+void DeviceCache::Load(const std::string & file) {
+   std::lock_guard<std::mutex> guard(lock);
+   path = file;
+   memset(present, 0, sizeof(present));
+   dirty = false;
+   warming = false;
+
+   std::ifstream in(path.c_str());
+   std::string line;
+   int version = 0;
+   if( !std::getline(in, line) ||
+         sscanf(line.c_str(), "# python-cec device cache %d", &version) != 1 ||
+         version != DEVCACHE_VERSION ) {
+      return;
+   }
+   while( std::getline(in, line) ) {
+      std::istringstream fields(line);
+      int addr;
+      std::string vendor;
+      std::string pa;
+      int ver;
+      std::string language;
+      if( !(fields >> addr >> vendor >> pa >> ver >> language) ||
+            addr < CECDEVICE_TV || addr >= CECDEVICE_BROADCAST ) {
+         continue;
+      }
+      DeviceInfo info;
+      info.vendor = strtoull(vendor.c_str(), NULL, 16);
+      info.physical_address = (uint16_t)strtoul(pa.c_str(), NULL, 16);
+      info.cec_version = (cec_version)ver;
+      info.language = language == "-" ? "" : language;
+      std::getline(fields, info.osd_name);
+      if( !info.osd_name.empty() && info.osd_name[0] == ' ' ) {
+         info.osd_name.erase(0, 1);
+      }
+      info.stale = true;
+      entries[addr] = info;
+      present[addr] = true;
+      warming = true;
+   }
+}
+
+bool DeviceCache::Enabled() {
+   std::lock_guard<std::mutex> guard(lock);
+   return !path.empty();
+}
+
+bool DeviceCache::Find(cec_logical_address addr, DeviceInfo * info) {
+   std::lock_guard<std::mutex> guard(lock);
+   if( path.empty() || addr < CECDEVICE_TV || addr >= CECDEVICE_BROADCAST ||
+         !present[addr] ) {
+      return false;
+   }
+   *info = entries[addr];
+   return true;
+}
+
+void DeviceCache::Store(cec_logical_address addr, const DeviceInfo & info) {
+   std::lock_guard<std::mutex> guard(lock);
+   if( path.empty() || addr < CECDEVICE_TV || addr >= CECDEVICE_BROADCAST ) {
+      return;
+   }
+   entries[addr] = info;
+   entries[addr].stale = false;
+   present[addr] = true;
+   dirty = true;
+}
+
+void DeviceCache::Update(const cec_command & cmd) {
+   if( !cmd.opcode_set || cmd.initiator >= CECDEVICE_BROADCAST ) return;
+   const cec_datapacket & p = cmd.parameters;
+   std::lock_guard<std::mutex> guard(lock);
+   if( path.empty() || !present[cmd.initiator] ) return;
+   DeviceInfo & info = entries[cmd.initiator];
+   switch( cmd.opcode ) {
+      case CEC_OPCODE_REPORT_PHYSICAL_ADDRESS:
+         if( p.size < 2 ) return;
+         info.physical_address = (p[0] << 8) | p[1];
+         break;
+      case CEC_OPCODE_DEVICE_VENDOR_ID:
+         if( p.size < 3 ) return;
+         info.vendor = (p[0] << 16) | (p[1] << 8) | p[2];
+         break;
+      case CEC_OPCODE_SET_OSD_NAME:
+         info.osd_name.assign((const char *)p.data, p.size);
+         break;
+      case CEC_OPCODE_CEC_VERSION:
+         if( p.size < 1 ) return;
+         info.cec_version = (cec_version)p[0];
+         break;
+      case CEC_OPCODE_SET_MENU_LANGUAGE:
+         if( p.size < 3 ) return;
+         info.language.assign((const char *)p.data, 3);
+         break;
+      default:
+         return;
+   }
+   dirty = true;
+}
+
+bool DeviceCache::Warming(cec_logical_addresses * addrs) {
+   std::lock_guard<std::mutex> guard(lock);
+   if( path.empty() || !warming ) return false;
+   addrs->Clear();
+   for( int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++ ) {
+      if( present[i] ) addrs->Set((cec_logical_address)i);
+   }
+   return true;
+}
+
+void DeviceCache::Start(Backend * lib) {
+   Stop();
+   if( !Enabled() ) return;
+   stopping.store(false);
+   thread = std::thread(&DeviceCache::Run, this, lib);
+}
+
+void DeviceCache::Stop() {
+   stopping.store(true);
+   if( thread.joinable() ) {
+      thread.join();
+   }
+}
+
+void DeviceCache::Run(Backend * lib) {
+   cec_logical_addresses active = lib->GetActiveDevices();
+   for( int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++ ) {
+      if( stopping.load() ) return;
+      cec_logical_address addr = (cec_logical_address)i;
+      bool stale;
+      {
+         std::lock_guard<std::mutex> guard(lock);
+         if( !active[i] ) {
+            // gone since the table was saved
+            if( present[i] ) dirty = true;
+            present[i] = false;
+            continue;
+         }
+         stale = !present[i] || entries[i].stale;
+      }
+      if( stale ) {
+         Store(addr, DeviceInfoQuery(lib, addr));
+      }
+   }
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      warming = false;
+   }
+   Save();
+}
+
+bool DeviceCache::Save() {
+   std::string file;
+   std::ostringstream out;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if( path.empty() || !dirty ) return true;
+      file = path;
+      out << "# python-cec device cache " << DEVCACHE_VERSION << "\n";
+      for( int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++ ) {
+         if( !present[i] ) continue;
+         const DeviceInfo & info = entries[i];
+         char fields[64];
+         snprintf(fields, sizeof(fields), "%d %06" PRIX64 " %04X %d ", i,
+               info.vendor, info.physical_address, (int)info.cec_version);
+         std::string name = info.osd_name;
+         for( size_t j=0; j<name.size(); j++ ) {
+            if( name[j] == '\n' || name[j] == '\r' ) name[j] = ' ';
+         }
+         std::string language = info.language;
+         if( language.empty() || language.find_first_of(" \t\r\n") !=
+               std::string::npos ) {
+            language = "-";
+         }
+         out << fields << language << " " << name << "\n";
+      }
+      dirty = false;
+   }
+
+   // replace the file in one step, so a crash can't leave half of it
+   std::string temp = file + ".tmp";
+   {
+      std::ofstream f(temp.c_str(), std::ios::trunc);
+      f << out.str();
+      f.close();
+      if( !f ) {
+         remove(temp.c_str());
+         std::lock_guard<std::mutex> guard(lock);
+         dirty = true;
+         return false;
+      }
+   }
+#ifdef _WIN32
+   // rename doesn't replace files here
+   remove(file.c_str());
+#endif
+   if( rename(temp.c_str(), file.c_str()) != 0 ) {
+      remove(temp.c_str());
+      return false;
+   }
+   return true;
+}
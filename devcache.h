@@ -0,0 +1,100 @@
+/* devcache.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The device table kept on disk between runs, so that Device and
+ * list_devices can answer right after a restart instead of asking every
+ * device on the bus again. Entries loaded from disk are stale until a
+ * background thread has asked the device again; frames seen on the bus
+ * keep the fields current in the meantime.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef DEVCACHE_H
+#define DEVCACHE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <libcec/cec.h>
+
+#include "backend.h"
+
+#define DEVCACHE_VERSION 1
+
+// what Device reports about a device
+struct DeviceInfo {
+   DeviceInfo();
+
+   uint64_t vendor;
+   uint16_t physical_address;
+   CEC::cec_version cec_version;
+   std::string osd_name;
+   std::string language;
+   // loaded from disk and not asked for again yet
+   bool stale;
+};
+
+// ask the device for each field; call without the GIL
+DeviceInfo DeviceInfoQuery(Backend * lib, CEC::cec_logical_address addr);
+
+class DeviceCache {
+   public:
+      DeviceCache();
+      ~DeviceCache();
+
+      // keep the table in path, loading what is there as stale entries.
+      // A missing or unreadable file is an empty table
+      void Load(const std::string & path);
+      bool Enabled();
+
+      // the entry for addr, or false if there is none or no cache
+      bool Find(CEC::cec_logical_address addr, DeviceInfo * info);
+      void Store(CEC::cec_logical_address addr, const DeviceInfo & info);
+      // keep the entries current from a frame seen on the bus
+      void Update(const CEC::cec_command & cmd);
+      // the devices in the table while stale entries are being checked;
+      // false once they all were, or without a cache
+      bool Warming(CEC::cec_logical_addresses * addrs);
+
+      // check the stale entries and look for new devices in the
+      // background, then save the table. Call without the GIL
+      void Start(Backend * lib);
+      void Stop();
+      // write the table if it changed; false if that failed
+      bool Save();
+
+   private:
+      void Run(Backend * lib);
+
+      std::mutex lock;
+      std::string path;
+      bool present[16];
+      DeviceInfo entries[16];
+      bool dirty;
+      bool warming;
+
+      std::thread thread;
+      std::atomic<bool> stopping;
+};
+
+#endif
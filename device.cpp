@@ -25,12 +25,13 @@
 // request the std format macros
 #define __STDC_FORMAT_MACROS
 
+#include "args.h"
 #include "device.h"
+#include "opcodes.h"
 #include <inttypes.h>
 
 using namespace CEC;
 
-static ICECAdapter * adapter;
 
 static PyObject * Device_getAddr(Device * self, void * closure) {
    return Py_BuildValue("b", self->addr);
@@ -81,9 +82,10 @@ static PyGetSetDef Device_getset[] = {
 };
 
 static PyObject * Device_is_on(Device * self) {
+   Backend * lib = self->adapter->lib;
    cec_power_status power;
    Py_BEGIN_ALLOW_THREADS
-   power = adapter->GetDevicePowerStatus(self->addr);
+   power = lib->GetDevicePowerStatus(self->addr);
    Py_END_ALLOW_THREADS
    PyObject * ret;
    switch(power) {
@@ -105,9 +107,10 @@ static PyObject * Device_is_on(Device * self) {
 }
 
 static PyObject * Device_power_on(Device * self) {
+   Backend * lib = self->adapter->lib;
    bool success;
    Py_BEGIN_ALLOW_THREADS
-   success = adapter->PowerOnDevices(self->addr);
+   success = lib->PowerOnDevices(self->addr);
    Py_END_ALLOW_THREADS
    if( success ) {
       Py_RETURN_TRUE;
@@ -117,9 +120,10 @@ static PyObject * Device_power_on(Device * self) {
 }
 
 static PyObject * Device_standby(Device * self) {
+   Backend * lib = self->adapter->lib;
    bool success;
    Py_BEGIN_ALLOW_THREADS
-   success = adapter->StandbyDevices(self->addr);
+   success = lib->StandbyDevices(self->addr);
    Py_END_ALLOW_THREADS
    if( success ) {
       Py_RETURN_TRUE;
@@ -129,9 +133,10 @@ static PyObject * Device_standby(Device * self) {
 }
 
 static PyObject * Device_is_active(Device * self) {
+   Backend * lib = self->adapter->lib;
    bool success;
    Py_BEGIN_ALLOW_THREADS
-   success = adapter->IsActiveSource(self->addr);
+   success = lib->IsActiveSource(self->addr);
    Py_END_ALLOW_THREADS
    if( success ) {
       Py_RETURN_TRUE;
@@ -140,20 +145,30 @@ static PyObject * Device_is_active(Device * self) {
    }
 }
 
-static PyObject * Device_av_input(Device * self, PyObject * args) {
+static const char * input_kwlist[] = {"input", NULL};
+
+static PyObject * Device_av_input(Device * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
    unsigned char input;
-   if( PyArg_ParseTuple(args, "b:set_av_input", &input) ) {
+   PyObject * values[ARGS_MAX];
+   if( ArgsParse("set_av_input", args, nargs, kwnames, input_kwlist, 1, values) &&
+         ArgByte(values[0], &input) ) {
+      Backend * lib = self->adapter->lib;
       cec_command data;
       bool success;
+      Supervisor::QueueResult queued;
       Py_BEGIN_ALLOW_THREADS
-      data.initiator = adapter->GetLogicalAddresses().primary;
+      data.initiator = CECDEVICE_UNKNOWN;
       data.destination = self->addr;
       data.opcode = CEC_OPCODE_USER_CONTROL_PRESSED;
       data.opcode_set = 1;
       data.PushBack(0x69);
       data.PushBack(input);
-      success = adapter->Transmit(data);
+      success = transmit_frame(self->adapter, lib, data, &queued);
       Py_END_ALLOW_THREADS
+      if( queued == Supervisor::QUEUED ) {
+         Py_RETURN_NONE;
+      }
       if( success ) {
          Py_RETURN_TRUE;
       } else {
@@ -164,20 +179,28 @@ static PyObject * Device_av_input(Device * self, PyObject * args) {
    }
 }
 
-static PyObject * Device_audio_input(Device * self, PyObject * args) {
+static PyObject * Device_audio_input(Device * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
    unsigned char input;
-   if( PyArg_ParseTuple(args, "b:set_audio_input", &input) ) {
+   PyObject * values[ARGS_MAX];
+   if( ArgsParse("set_audio_input", args, nargs, kwnames, input_kwlist, 1, values) &&
+         ArgByte(values[0], &input) ) {
+      Backend * lib = self->adapter->lib;
       cec_command data;
       bool success;
+      Supervisor::QueueResult queued;
       Py_BEGIN_ALLOW_THREADS
-      data.initiator = adapter->GetLogicalAddresses().primary;
+      data.initiator = CECDEVICE_UNKNOWN;
       data.destination = self->addr;
       data.opcode = CEC_OPCODE_USER_CONTROL_PRESSED;
       data.opcode_set = 1;
       data.PushBack(0x6a);
       data.PushBack(input);
-      success = adapter->Transmit(data);
+      success = transmit_frame(self->adapter, lib, data, &queued);
       Py_END_ALLOW_THREADS
+      if( queued == Supervisor::QUEUED ) {
+         Py_RETURN_NONE;
+      }
       if( success ) {
          Py_RETURN_TRUE;
       } else {
@@ -188,12 +211,18 @@ static PyObject * Device_audio_input(Device * self, PyObject * args) {
    }
 }
 
-static PyObject * Device_transmit(Device * self, PyObject * args) {
+static PyObject * Device_transmit(Device * self, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
    unsigned char opcode;
    const char * params = NULL;
    Py_ssize_t param_count = 0;
-   if( PyArg_ParseTuple(args, "b|s#:transmit", &opcode,
-         &params, &param_count) ) {
+   static const char * kwlist[] = {"opcode", "parameters", NULL};
+   PyObject * values[ARGS_MAX];
+   if( ArgsParse("transmit", args, nargs, kwnames, kwlist, 1, values) &&
+         ArgByte(values[0], &opcode) &&
+         (!values[1] || ArgBytes(values[1], "parameters", &params,
+            &param_count)) ) {
+      Backend * lib = self->adapter->lib;
       if( param_count > CEC_MAX_DATA_PACKET_SIZE ) {
          char errstr[1024];
          snprintf(errstr, 1024, "Too many parameters, maximum is %d",
@@ -202,19 +231,28 @@ static PyObject * Device_transmit(Device * self, PyObject * args) {
          return NULL;
       }
       cec_command data;
-      bool success;
-      Py_BEGIN_ALLOW_THREADS
-      data.initiator = adapter->GetLogicalAddresses().primary;
       data.destination = self->addr;
       data.opcode = (cec_opcode)opcode;
       data.opcode_set = 1;
-      if( params ) {
-         for( Py_ssize_t i=0; i<param_count; i++ ) {
-            data.PushBack(((uint8_t *)params)[i]);
-         }
+      for( Py_ssize_t i=0; i<param_count; i++ ) {
+         data.parameters.PushBack(((uint8_t *)params)[i]);
       }
-      success = adapter->Transmit(data);
+      char errstr[1024];
+      if( !OpcodeCheck(data, errstr, sizeof(errstr)) ) {
+         PyErr_SetString(PyExc_ValueError, errstr);
+         return NULL;
+      }
+      // sent from the primary address
+      data.initiator = CECDEVICE_UNKNOWN;
+      bool success;
+      Supervisor::QueueResult queued;
+      Py_BEGIN_ALLOW_THREADS
+      success = transmit_frame(self->adapter, lib, data, &queued);
       Py_END_ALLOW_THREADS
+      // like Adapter.transmit, None while the adapter is being reconnected
+      if( queued == Supervisor::QUEUED ) {
+         Py_RETURN_NONE;
+      }
       if( success ) {
          Py_RETURN_TRUE;
       } else {
@@ -225,113 +263,167 @@ static PyObject * Device_transmit(Device * self, PyObject * args) {
    }
 }
 
-static PyObject * Device_new(PyTypeObject * type, PyObject * args, 
-      PyObject * kwds) {
-   Device * self;
+const char * cec_version_str(cec_version ver) {
+   switch(ver) {
+      case CEC_VERSION_1_2:
+         return "1.2";
+      case CEC_VERSION_1_2A:
+         return "1.2a";
+      case CEC_VERSION_1_3:
+         return "1.3";
+      case CEC_VERSION_1_3A:
+         return "1.3a";
+      case CEC_VERSION_1_4:
+         return "1.4";
+      case CEC_VERSION_UNKNOWN:
+      default:
+         return "Unknown";
+   }
+}
 
-   unsigned char addr;
+static PyObject * Device_create(PyTypeObject * type, Adapter * adapter,
+      unsigned char addr) {
+   Device * self;
 
-   if( !PyArg_ParseTuple(args, "b:Device new", &addr) ) {
-      return NULL;
-   }
-   if( addr < 0 ) {
-      PyErr_SetString(PyExc_ValueError, "Logical address should be >= 0");
-      return NULL;
-   }
-   if( addr > 15 ) {
-      PyErr_SetString(PyExc_ValueError, "Logical address should be < 16");
+   // the first device on an adapter starts libcec
+   Backend * lib = AdapterLib(adapter);
+   if( lib == NULL ) {
       return NULL;
    }
 
    self = (Device*)type->tp_alloc(type, 0);
    if( self != NULL ) {
+      Py_INCREF(adapter);
+      self->adapter = adapter;
       self->addr = (cec_logical_address)addr;
-      uint64_t vendor;
+
+      // a device from the on-disk table is served without asking the bus;
+      // the table checks it in the background
+      DeviceInfo info;
       Py_BEGIN_ALLOW_THREADS
-      vendor = adapter->GetDeviceVendorId(self->addr);
+      if( !adapter->device_cache->Find(self->addr, &info) ) {
+         info = DeviceInfoQuery(lib, self->addr);
+         // one that didn't answer isn't worth remembering
+         if( info.physical_address != PHYSICAL_ADDR_INVALID ) {
+            adapter->device_cache->Store(self->addr, info);
+         }
+      }
+      adapter->topology->SetPhysicalAddress(self->addr,
+            info.physical_address);
       Py_END_ALLOW_THREADS
+
       char vendor_str[7];
-      snprintf(vendor_str, 7, "%06" PRIX64, vendor);
-      if( ! (self->vendorId = Py_BuildValue("s", vendor_str)) ) return NULL;
+      snprintf(vendor_str, 7, "%06" PRIX64, info.vendor);
+      if( ! (self->vendorId = Py_BuildValue("s", vendor_str)) ) {
+         Py_DECREF(self);
+         return NULL;
+      }
 
       char strAddr[8];
-      Py_BEGIN_ALLOW_THREADS
-      uint16_t physicalAddress = adapter->GetDevicePhysicalAddress(self->addr);
+      uint16_t physicalAddress = info.physical_address;
       snprintf(strAddr, 8, "%x.%x.%x.%x", 
             (physicalAddress >> 12) & 0xF,
             (physicalAddress >> 8) & 0xF,
             (physicalAddress >> 4) & 0xF,
             physicalAddress & 0xF);
-      Py_END_ALLOW_THREADS
       self->physicalAddress = Py_BuildValue("s", strAddr);
 
-      const char * ver_str;
-      Py_BEGIN_ALLOW_THREADS
-      cec_version ver = adapter->GetDeviceCecVersion(self->addr);
-      switch(ver) {
-         case CEC_VERSION_1_2:
-            ver_str = "1.2";
-            break;
-         case CEC_VERSION_1_2A:
-            ver_str = "1.2a";
-            break;
-         case CEC_VERSION_1_3:
-            ver_str = "1.3";
-            break;
-         case CEC_VERSION_1_3A:
-            ver_str = "1.3a";
-            break;
-         case CEC_VERSION_1_4:
-            ver_str = "1.4";
-            break;
-         case CEC_VERSION_UNKNOWN:
-         default:
-            ver_str = "Unknown";
-            break;
+      const char * ver_str = cec_version_str(info.cec_version);
+      if( !(self->cecVersion = Py_BuildValue("s", ver_str)) ) {
+         Py_DECREF(self);
+         return NULL;
       }
-      Py_END_ALLOW_THREADS
 
-      if( !(self->cecVersion = Py_BuildValue("s", ver_str)) ) return NULL;
-
-#if CEC_LIB_VERSION_MAJOR >= 4
-      std::string name;
-      Py_BEGIN_ALLOW_THREADS
-      name = adapter->GetDeviceOSDName(self->addr);
-      Py_END_ALLOW_THREADS
-      if( !(self->osdName = Py_BuildValue("s#", name.c_str(), name.length())) ) return NULL;
-#else
-      cec_osd_name name;
-      Py_BEGIN_ALLOW_THREADS
-      name = adapter->GetDeviceOSDName(self->addr);
-      Py_END_ALLOW_THREADS
-      if( !(self->osdName = Py_BuildValue("s", name.name)) ) return NULL;
-#endif
+      const std::string & name = info.osd_name;
+      if( !(self->osdName = Py_BuildValue("s#", name.c_str(), name.length())) ) {
+         Py_DECREF(self);
+         return NULL;
+      }
 
-#if CEC_LIB_VERSION_MAJOR >= 4
-      std::string lang;
-      Py_BEGIN_ALLOW_THREADS
-      lang = adapter->GetDeviceMenuLanguage(self->addr);
-      Py_END_ALLOW_THREADS
-      if( !(self->lang = Py_BuildValue("s#", lang.c_str(), lang.length())) ) return NULL;
-#else
-      cec_menu_language lang;
-      Py_BEGIN_ALLOW_THREADS
-      adapter->GetDeviceMenuLanguage(self->addr, &lang);
-      Py_END_ALLOW_THREADS
-      if( !(self->lang = Py_BuildValue("s", lang.language)) ) return NULL;
-#endif
+      const std::string & lang = info.language;
+      if( !(self->lang = Py_BuildValue("s#", lang.c_str(), lang.length())) ) {
+         Py_DECREF(self);
+         return NULL;
+      }
    }
 
    return (PyObject *)self;
 }
 
+static const char * Device_kwlist[] = {"addr", "adapter", NULL};
+
+// the checks shared by both constructors
+static PyObject * Device_checked(PyTypeObject * type, ModuleState * state,
+      unsigned char addr, PyObject * adapter) {
+   if( adapter == NULL ) {
+      adapter = (PyObject *)state->default_adapter;
+   } else if( !PyObject_TypeCheck(adapter, state->adapter_type) ) {
+      PyErr_Format(PyExc_TypeError, "adapter must be %.50s, not %.50s",
+            state->adapter_type->tp_name, Py_TYPE(adapter)->tp_name);
+      return NULL;
+   }
+   if( addr < 0 ) {
+      PyErr_SetString(PyExc_ValueError, "Logical address should be >= 0");
+      return NULL;
+   }
+   if( addr > 15 ) {
+      PyErr_SetString(PyExc_ValueError, "Logical address should be < 16");
+      return NULL;
+   }
+
+   return Device_create(type, (Adapter *)adapter, addr);
+}
+
+static PyObject * Device_new(PyTypeObject * type, PyObject * args,
+      PyObject * kwds) {
+   unsigned char addr;
+   PyObject * adapter = NULL;
+   ModuleState * state = ModuleStateFromType(type);
+   if( state == NULL ) {
+      return NULL;
+   }
+   if( !PyArg_ParseTupleAndKeywords(args, kwds, "b|O:Device new",
+            (char**)Device_kwlist, &addr, &adapter) ) {
+      return NULL;
+   }
+   return Device_checked(type, state, addr, adapter);
+}
+
+// cec.Device(addr) without building an argument tuple
+static PyObject * Device_vectorcall(PyObject * type, PyObject * const * args,
+      size_t nargsf, PyObject * kwnames) {
+   unsigned char addr;
+   PyObject * values[ARGS_MAX];
+   ModuleState * state = ModuleStateFromType((PyTypeObject *)type);
+   if( state == NULL ) {
+      return NULL;
+   }
+   if( !ArgsParse("Device", args, PyVectorcall_NARGS(nargsf), kwnames,
+            Device_kwlist, 1, values) || !ArgByte(values[0], &addr) ) {
+      return NULL;
+   }
+   return Device_checked((PyTypeObject *)type, state, addr, values[1]);
+}
+
 static void Device_dealloc(Device * self) {
-   Py_DECREF(self->vendorId);
-   Py_DECREF(self->physicalAddress);
-   Py_DECREF(self->cecVersion);
-   Py_DECREF(self->osdName);
-   Py_DECREF(self->lang);
-   Py_TYPE(self)->tp_free((PyObject*)self);
+   PyTypeObject * type = Py_TYPE(self);
+   PyObject_GC_UnTrack(self);
+   Py_XDECREF(self->vendorId);
+   Py_XDECREF(self->physicalAddress);
+   Py_XDECREF(self->cecVersion);
+   Py_XDECREF(self->osdName);
+   Py_XDECREF(self->lang);
+   Py_XDECREF(self->adapter);
+   type->tp_free((PyObject*)self);
+   Py_DECREF(type);
+}
+
+// devices are kept alive by callbacks and keep their adapter alive, so
+// the collector needs to see the reference to break that cycle
+static int Device_traverse(Device * self, visitproc visit, void * arg) {
+   Py_VISIT(Py_TYPE(self));
+   Py_VISIT(self->adapter);
+   return 0;
 }
 
 static PyObject * Device_str(Device * self) {
@@ -353,45 +445,45 @@ static PyMethodDef Device_methods[] = {
       "Power on this device"},
    {"standby", (PyCFunction)Device_standby, METH_NOARGS, 
       "Put this device into standby"},
-   {"is_active", (PyCFunction)Device_is_active, METH_VARARGS,
+   {"is_active", (PyCFunction)Device_is_active, METH_NOARGS,
       "Check if this device is the active source on the bus"},
-   {"set_av_input", (PyCFunction)Device_av_input, METH_VARARGS,
-      "Select AV Input"},
-   {"set_audio_input", (PyCFunction)Device_audio_input, METH_VARARGS,
-      "Select Audio Input"},
-   {"transmit", (PyCFunction)Device_transmit, METH_VARARGS,
+   {"set_av_input", (PyCFunction)Device_av_input,
+      METH_FASTCALL | METH_KEYWORDS, "Select AV Input"},
+   {"set_audio_input", (PyCFunction)Device_audio_input,
+      METH_FASTCALL | METH_KEYWORDS, "Select Audio Input"},
+   {"transmit", (PyCFunction)Device_transmit, METH_FASTCALL | METH_KEYWORDS,
       "Transmit a raw CEC command to this device"},
    {NULL}
 };
 
-static PyTypeObject DeviceType = {
-   PyVarObject_HEAD_INIT(NULL, 0)
-   "cec.Device",              /*tp_name*/
-   sizeof(Device),            /*tp_basicsize*/
-   0,                         /*tp_itemsize*/
-   (destructor)Device_dealloc, /*tp_dealloc*/
-   0,                         /*tp_print*/
-   0,                         /*tp_getattr*/
-   0,                         /*tp_setattr*/
-   0,                         /*tp_compare*/
-   (reprfunc)Device_repr,     /*tp_repr*/
-   0,                         /*tp_as_number*/
-   0,                         /*tp_as_sequence*/
-   0,                         /*tp_as_mapping*/
-   0,                         /*tp_hash */
-   0,                         /*tp_call*/
-   (reprfunc)Device_str,      /*tp_str*/
-   0,                         /*tp_getattro*/
-   0,                         /*tp_setattro*/
-   0,                         /*tp_as_buffer*/
-   Py_TPFLAGS_DEFAULT,        /*tp_flags*/
-   "CEC Device objects",      /* tp_doc */
+static PyType_Slot Device_slots[] = {
+   {Py_tp_new, (void*)Device_new},
+   {Py_tp_dealloc, (void*)Device_dealloc},
+   {Py_tp_traverse, (void*)Device_traverse},
+   {Py_tp_repr, (void*)Device_repr},
+   {Py_tp_str, (void*)Device_str},
+   {Py_tp_methods, Device_methods},
+   {Py_tp_getset, Device_getset},
+   {Py_tp_doc, (void*)"CEC Device objects"},
+   {0, NULL}
+};
+
+static PyType_Spec Device_spec = {
+   "cec.Device",
+   sizeof(Device),
+   0,
+   Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+   Device_slots
 };
 
-PyTypeObject * DeviceTypeInit(ICECAdapter * a) {
-   adapter = a;
-   DeviceType.tp_new = Device_new;
-   DeviceType.tp_methods = Device_methods;
-   DeviceType.tp_getset = Device_getset;
-   return & DeviceType;
+PyTypeObject * DeviceTypeInit(PyObject * module) {
+   PyTypeObject * type = (PyTypeObject*)PyType_FromModuleAndSpec(module,
+         &Device_spec, NULL);
+   // there is no slot for this before Python 3.14
+   if( type ) type->tp_vectorcall = Device_vectorcall;
+   return type;
+}
+
+PyObject * DeviceNew(Adapter * adapter, cec_logical_address addr) {
+   return Device_create(adapter->device_type, adapter, (unsigned char)addr);
 }
@@ -27,9 +27,12 @@
 
 #include <libcec/cec.h>
 
+#include "adapter.h"
+
 struct Device {
    PyObject_HEAD
 
+   Adapter *                  adapter;
    CEC::cec_logical_address   addr;
 
    PyObject *                 vendorId;
@@ -39,7 +42,12 @@ struct Device {
    PyObject *                 lang;
 };
 
-PyTypeObject * DeviceTypeInit(CEC::ICECAdapter * adapter);
+PyTypeObject * DeviceTypeInit(PyObject * module);
+
+PyObject * DeviceNew(Adapter * adapter, CEC::cec_logical_address addr);
+
+// the version as Device.cec_version reports it, e.g. "1.4"
+const char * cec_version_str(CEC::cec_version ver);
 
 /*
  * Compat for libcec 3.x
@@ -0,0 +1,254 @@
+/* gilcheck.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Backend wrapper that catches calls made with the GIL held
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "gilcheck.h"
+#include "probes.h"
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+using namespace CEC;
+
+static std::atomic<int64_t> threshold(-1);
+static std::mutex reports_lock;
+static std::vector<GilCheckReport> reports;
+
+void GilCheckSetThreshold(int64_t threshold_ns) {
+   threshold.store(threshold_ns, std::memory_order_relaxed);
+}
+
+std::vector<GilCheckReport> GilCheckReports() {
+   std::vector<GilCheckReport> result;
+   std::lock_guard<std::mutex> guard(reports_lock);
+   result.swap(reports);
+   return result;
+}
+
+// whether this thread has a Python thread state attached, which on builds
+// with a GIL means it holds it, and on free-threaded builds that it holds
+// up every stop-the-world pause
+static bool holds_gil() {
+#if PY_VERSION_HEX >= 0x030D0000
+   return PyThreadState_GetUnchecked() != NULL;
+#elif PY_VERSION_HEX >= 0x030C0000
+   return _PyThreadState_UncheckedGet() != NULL;
+#else
+   // before 3.12 _PyThreadState_UncheckedGet() is whichever thread holds
+   // the GIL, not this one
+   return PyGILState_Check();
+#endif
+}
+
+// times one backend call, if the check is enabled and the GIL is held
+class CallTimer {
+   public:
+      CallTimer(const char * call) : call(call),
+            limit(threshold.load(std::memory_order_relaxed)),
+            timing(limit >= 0 && holds_gil()) {
+         if( timing ) {
+            start = std::chrono::steady_clock::now();
+         }
+      }
+
+      ~CallTimer() {
+         if( !timing ) return;
+         uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start).count();
+         if( (int64_t)ns < limit ) return;
+         PROBE2(gil__held, call, ns);
+         fprintf(stderr, "cec: %s took %.3f ms with the GIL held\n", call,
+               ns / 1e6);
+         std::lock_guard<std::mutex> guard(reports_lock);
+         if( reports.size() < GILCHECK_REPORTS ) {
+            reports.push_back(GilCheckReport{call, ns});
+         }
+      }
+
+   private:
+      const char * call;
+      int64_t limit;
+      bool timing;
+      std::chrono::steady_clock::time_point start;
+};
+
+class GilCheckBackend : public Backend {
+   public:
+      GilCheckBackend(Backend * b) : backend(b) {
+      }
+
+      ~GilCheckBackend() {
+         delete backend;
+      }
+
+      Backend * Target() {
+         return backend;
+      }
+
+      bool Open(const char * port) {
+         CallTimer timer("Open");
+         return backend->Open(port);
+      }
+
+      void Close() {
+         CallTimer timer("Close");
+         backend->Close();
+      }
+
+      int DetectAdapters(CEC_ADAPTER_TYPE * list, int size, bool quick) {
+         CallTimer timer("DetectAdapters");
+         return backend->DetectAdapters(list, size, quick);
+      }
+
+      bool Transmit(const cec_command & cmd) {
+         CallTimer timer("Transmit");
+         return backend->Transmit(cmd);
+      }
+
+      cec_logical_addresses GetLogicalAddresses() {
+         CallTimer timer("GetLogicalAddresses");
+         return backend->GetLogicalAddresses();
+      }
+
+      cec_logical_addresses GetActiveDevices() {
+         CallTimer timer("GetActiveDevices");
+         return backend->GetActiveDevices();
+      }
+
+      bool IsActiveSource(cec_logical_address addr) {
+         CallTimer timer("IsActiveSource");
+         return backend->IsActiveSource(addr);
+      }
+
+      bool SetActiveSource(cec_device_type type) {
+         CallTimer timer("SetActiveSource");
+         return backend->SetActiveSource(type);
+      }
+
+      bool SetStreamPath(cec_logical_address addr) {
+         CallTimer timer("SetStreamPath");
+         return backend->SetStreamPath(addr);
+      }
+
+      bool SetStreamPath(uint16_t pa) {
+         CallTimer timer("SetStreamPath");
+         return backend->SetStreamPath(pa);
+      }
+
+      bool SetPhysicalAddress(uint16_t pa) {
+         CallTimer timer("SetPhysicalAddress");
+         return backend->SetPhysicalAddress(pa);
+      }
+
+      bool SetHDMIPort(cec_logical_address base, uint8_t port) {
+         CallTimer timer("SetHDMIPort");
+         return backend->SetHDMIPort(base, port);
+      }
+
+      uint8_t VolumeUp() {
+         CallTimer timer("VolumeUp");
+         return backend->VolumeUp();
+      }
+
+      uint8_t VolumeDown() {
+         CallTimer timer("VolumeDown");
+         return backend->VolumeDown();
+      }
+
+      uint8_t AudioToggleMute() {
+         CallTimer timer("AudioToggleMute");
+         return backend->AudioToggleMute();
+      }
+
+      bool GetCurrentConfiguration(libcec_configuration * config) {
+         CallTimer timer("GetCurrentConfiguration");
+         return backend->GetCurrentConfiguration(config);
+      }
+
+      bool SetConfiguration(const libcec_configuration * config) {
+         CallTimer timer("SetConfiguration");
+         return backend->SetConfiguration(config);
+      }
+
+      bool CanPersistConfiguration() {
+         CallTimer timer("CanPersistConfiguration");
+         return backend->CanPersistConfiguration();
+      }
+
+      bool PersistConfiguration(const libcec_configuration * config) {
+         CallTimer timer("PersistConfiguration");
+         return backend->PersistConfiguration(config);
+      }
+
+      bool PowerOnDevices(cec_logical_address addr) {
+         CallTimer timer("PowerOnDevices");
+         return backend->PowerOnDevices(addr);
+      }
+
+      bool StandbyDevices(cec_logical_address addr) {
+         CallTimer timer("StandbyDevices");
+         return backend->StandbyDevices(addr);
+      }
+
+      cec_power_status GetDevicePowerStatus(cec_logical_address addr) {
+         CallTimer timer("GetDevicePowerStatus");
+         return backend->GetDevicePowerStatus(addr);
+      }
+
+      uint64_t GetDeviceVendorId(cec_logical_address addr) {
+         CallTimer timer("GetDeviceVendorId");
+         return backend->GetDeviceVendorId(addr);
+      }
+
+      uint16_t GetDevicePhysicalAddress(cec_logical_address addr) {
+         CallTimer timer("GetDevicePhysicalAddress");
+         return backend->GetDevicePhysicalAddress(addr);
+      }
+
+      cec_version GetDeviceCecVersion(cec_logical_address addr) {
+         CallTimer timer("GetDeviceCecVersion");
+         return backend->GetDeviceCecVersion(addr);
+      }
+
+      std::string GetDeviceOSDName(cec_logical_address addr) {
+         CallTimer timer("GetDeviceOSDName");
+         return backend->GetDeviceOSDName(addr);
+      }
+
+      std::string GetDeviceMenuLanguage(cec_logical_address addr) {
+         CallTimer timer("GetDeviceMenuLanguage");
+         return backend->GetDeviceMenuLanguage(addr);
+      }
+
+   private:
+      Backend * backend;
+};
+
+Backend * GilCheckBackendNew(Backend * backend) {
+   return backend ? new GilCheckBackend(backend) : NULL;
+}
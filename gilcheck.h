@@ -0,0 +1,54 @@
+/* gilcheck.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A debug check that the bus is never driven while the GIL is held. Every
+ * backend is wrapped in one that, once enabled with GilCheckSetThreshold,
+ * times the calls made from a thread that holds the GIL and reports those
+ * slower than the threshold on stderr and through GilCheckReports. While
+ * disabled it costs an atomic load per call.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef GILCHECK_H
+#define GILCHECK_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "backend.h"
+
+struct GilCheckReport {
+   const char * call;
+   uint64_t ns;
+};
+
+// report calls made with the GIL held that take longer than threshold_ns;
+// a negative threshold disables the check
+void GilCheckSetThreshold(int64_t threshold_ns);
+
+// the reports since the last call, oldest first. At most GILCHECK_REPORTS
+// are kept
+#define GILCHECK_REPORTS 256
+std::vector<GilCheckReport> GilCheckReports();
+
+// wrap backend, which is deleted with the wrapper
+Backend * GilCheckBackendNew(Backend * backend);
+
+#endif
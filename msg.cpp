@@ -0,0 +1,342 @@
+/* msg.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of cec.msg. The builders are generated from the opcode
+ * table: one per standard opcode, named after it in lower case. A builder
+ * takes the destination (unless the opcode is broadcast only), then the
+ * opcode's named parameters, then optionally raw bytes to append as
+ * parameters=. The frame is checked against the table before it is
+ * returned.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "msg.h"
+#include "adapter.h"
+#include "command.h"
+#include "opcodes.h"
+
+#include <ctype.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace CEC;
+
+// destination, the named parameters and parameters=
+#define MSG_MAX_ARGS (OPCODE_MAX_PARAMS + 2)
+
+static bool push_byte(cec_command & cmd, long value) {
+   if( cmd.parameters.size >= CEC_MAX_DATA_PACKET_SIZE ) {
+      PyErr_Format(PyExc_ValueError, "Too many parameters, maximum is %d",
+            CEC_MAX_DATA_PACKET_SIZE);
+      return false;
+   }
+   // cec_command::PushBack would take the first bytes as the header while
+   // the initiator is unknown
+   cmd.parameters.PushBack((uint8_t)value);
+   return true;
+}
+
+static bool push_bytes(cec_command & cmd, const char * data, Py_ssize_t size) {
+   for( Py_ssize_t i=0; i<size; i++ ) {
+      if( !push_byte(cmd, (uint8_t)data[i]) ) return false;
+   }
+   return true;
+}
+
+static bool encode_int(PyObject * value, const char * name, long max,
+      long * result) {
+   *result = PyLong_AsLong(value);
+   if( *result == -1 && PyErr_Occurred() ) return false;
+   if( *result < 0 || *result > max ) {
+      PyErr_Format(PyExc_ValueError, "%s must be between 0 and %ld", name,
+            max);
+      return false;
+   }
+   return true;
+}
+
+static bool encode_param(cec_command & cmd, const OpcodeParam & param,
+      PyObject * value) {
+   long n;
+   switch( param.kind ) {
+      case PARAM_BYTE:
+         return encode_int(value, param.name, 0xFF, &n) && push_byte(cmd, n);
+      case PARAM_BOOL: {
+         int truth = PyObject_IsTrue(value);
+         return truth >= 0 && push_byte(cmd, truth);
+      }
+      case PARAM_PHYSICAL_ADDR:
+         if( PyUnicode_Check(value) ) {
+            const char * str = PyUnicode_AsUTF8(value);
+            if( str == NULL ) return false;
+            n = parse_physical_addr(str);
+            if( n < 0 ) {
+               PyErr_Format(PyExc_ValueError, "Invalid physical address: %s",
+                     str);
+               return false;
+            }
+         } else if( !encode_int(value, param.name, 0xFFFF, &n) ) {
+            return false;
+         }
+         return push_byte(cmd, n >> 8) && push_byte(cmd, n & 0xFF);
+      case PARAM_VENDOR_ID:
+         return encode_int(value, param.name, 0xFFFFFF, &n) &&
+            push_byte(cmd, n >> 16) && push_byte(cmd, (n >> 8) & 0xFF) &&
+            push_byte(cmd, n & 0xFF);
+      case PARAM_VOLUME:
+         return encode_int(value, param.name, 0x7F, &n) && push_byte(cmd, n);
+      case PARAM_MUTED: {
+         int truth = PyObject_IsTrue(value);
+         if( truth < 0 ) return false;
+         // shares its byte with the volume
+         if( cmd.parameters.size > param.offset ) {
+            if( truth ) cmd.parameters.data[param.offset] |= 0x80;
+            return true;
+         }
+         return push_byte(cmd, truth ? 0x80 : 0);
+      }
+      case PARAM_STRING:
+      case PARAM_LANGUAGE: {
+         PyObject * ascii = PyUnicode_AsASCIIString(value);
+         if( ascii == NULL ) return false;
+         Py_ssize_t size = PyBytes_GET_SIZE(ascii);
+         if( param.kind == PARAM_LANGUAGE && size != 3 ) {
+            PyErr_Format(PyExc_ValueError, "%s must be 3 characters",
+                  param.name);
+            Py_DECREF(ascii);
+            return false;
+         }
+         bool ok = push_bytes(cmd, PyBytes_AS_STRING(ascii), size);
+         Py_DECREF(ascii);
+         return ok;
+      }
+   }
+   return false;
+}
+
+// self is (opcode, command type, builder name)
+static PyObject * msg_build(PyObject * self, PyObject * args, PyObject * kwds) {
+   const OpcodeSpec * spec = OpcodeLookup(
+         (uint8_t)PyLong_AsLong(PyTuple_GET_ITEM(self, 0)));
+   PyTypeObject * type = (PyTypeObject *)PyTuple_GET_ITEM(self, 1);
+   const char * name = PyUnicode_AsUTF8(PyTuple_GET_ITEM(self, 2));
+   if( name == NULL ) return NULL;
+
+   // the argument list comes from the table
+   const char * kwlist[MSG_MAX_ARGS + 1];
+   std::string format;
+   size_t n = 0;
+   bool directed = spec->addressing & OPCODE_DIRECT;
+   if( directed ) {
+      kwlist[n++] = "destination";
+      format += 'O';
+   }
+   size_t first_param = n;
+   bool optional = false;
+   for( int i=0; i<OPCODE_MAX_PARAMS && spec->params[i].name; i++ ) {
+      const OpcodeParam & param = spec->params[i];
+      size_t size = OpcodeParamSize(param.kind);
+      // muted shares the volume's byte and defaults to false
+      if( !optional && (param.kind == PARAM_MUTED ||
+               param.offset + (size ? size : 1) > spec->min_size) ) {
+         format += '|';
+         optional = true;
+      }
+      kwlist[n++] = param.name;
+      format += 'O';
+   }
+   if( !optional ) format += '|';
+   kwlist[n++] = "parameters";
+   format += 'O';
+   kwlist[n] = NULL;
+   format += ':';
+   format += name;
+
+   PyObject * values[MSG_MAX_ARGS] = { NULL };
+   if( !PyArg_ParseTupleAndKeywords(args, kwds, format.c_str(),
+            (char **)kwlist, &values[0], &values[1], &values[2],
+            &values[3]) ) {
+      return NULL;
+   }
+
+   cec_command cmd;
+   cmd.initiator = CECDEVICE_UNKNOWN;
+   cmd.destination = CECDEVICE_BROADCAST;
+   cmd.opcode = spec->opcode;
+   cmd.opcode_set = 1;
+   if( directed ) {
+      long destination;
+      if( !encode_int(values[0], "destination", 15, &destination) ) {
+         return NULL;
+      }
+      cmd.destination = (cec_logical_address)destination;
+   }
+
+   const char * omitted = NULL;
+   for( size_t i=first_param; i<n-1; i++ ) {
+      const OpcodeParam & param = spec->params[i - first_param];
+      if( values[i] == NULL || values[i] == Py_None ) {
+         omitted = param.name;
+         continue;
+      }
+      if( omitted ) {
+         PyErr_Format(PyExc_ValueError, "%s needs %s", param.name, omitted);
+         return NULL;
+      }
+      if( !encode_param(cmd, param, values[i]) ) return NULL;
+   }
+
+   PyObject * raw = values[n-1];
+   if( raw && raw != Py_None ) {
+      Py_buffer view;
+      if( PyObject_GetBuffer(raw, &view, PyBUF_SIMPLE) < 0 ) return NULL;
+      bool ok = push_bytes(cmd, (const char *)view.buf, view.len);
+      PyBuffer_Release(&view);
+      if( !ok ) return NULL;
+   }
+
+   char errstr[1024];
+   if( !OpcodeCheck(cmd, errstr, sizeof(errstr)) ) {
+      PyErr_SetString(PyExc_ValueError, errstr);
+      return NULL;
+   }
+   return CommandNew(type, cmd);
+}
+
+static PyObject * msg_info(PyObject * self, PyObject * args) {
+   unsigned char opcode;
+   if( !PyArg_ParseTuple(args, "b:info", &opcode) ) return NULL;
+   const OpcodeSpec * spec = OpcodeLookup(opcode);
+   if( spec == NULL ) {
+      Py_RETURN_NONE;
+   }
+
+   int count = 0;
+   while( count < OPCODE_MAX_PARAMS && spec->params[count].name ) count++;
+   PyObject * params = PyTuple_New(count);
+   if( params == NULL ) return NULL;
+   for( int i=0; i<count; i++ ) {
+      PyObject * name = PyUnicode_FromString(spec->params[i].name);
+      if( name == NULL ) {
+         Py_DECREF(params);
+         return NULL;
+      }
+      PyTuple_SET_ITEM(params, i, name);
+   }
+   PyObject * reply;
+   if( spec->reply == CEC_OPCODE_NONE ) {
+      Py_INCREF(Py_None);
+      reply = Py_None;
+   } else {
+      reply = PyLong_FromLong(spec->reply);
+   }
+   return Py_BuildValue("{sssOsOsBsBsNsN}",
+         "name", spec->name,
+         "direct", (spec->addressing & OPCODE_DIRECT) ? Py_True : Py_False,
+         "broadcast", (spec->addressing & OPCODE_BROADCAST) ? Py_True :
+            Py_False,
+         "min_size", spec->min_size,
+         "max_size", spec->max_size,
+         "reply", reply,
+         "parameters", params);
+}
+
+static PyMethodDef msg_methods[] = {
+   {"info", (PyCFunction)msg_info, METH_VARARGS,
+      "What the opcode table says about an opcode: name, direct, broadcast, "
+      "min_size, max_size, reply and parameters, or None if it isn't "
+      "standard"},
+   {NULL, NULL, 0, NULL}
+};
+
+// filled from the opcode table the first time the module is created
+static std::vector<std::string> msg_names;
+static std::vector<std::string> msg_docs;
+static std::vector<PyMethodDef> msg_builders;
+static std::once_flag msg_builders_once;
+
+static void msg_builders_init() {
+   size_t count;
+   const OpcodeSpec * specs = OpcodeSpecs(&count);
+   // the strings must not move once the method defs point at them
+   msg_names.reserve(count);
+   msg_docs.reserve(count);
+   for( size_t i=0; i<count; i++ ) {
+      const OpcodeSpec & spec = specs[i];
+      std::string name;
+      for( const char * c = spec.name; *c; c++ ) name += (char)tolower(*c);
+
+      std::string doc = name + "(";
+      const char * sep = "";
+      if( spec.addressing & OPCODE_DIRECT ) {
+         doc += "destination";
+         sep = ", ";
+      }
+      for( int j=0; j<OPCODE_MAX_PARAMS && spec.params[j].name; j++ ) {
+         doc = doc + sep + spec.params[j].name;
+         sep = ", ";
+      }
+      doc = doc + sep + "parameters=b\"\")\n\nA " + spec.name + " frame";
+      if( spec.addressing == OPCODE_BROADCAST ) doc += ", broadcast";
+      if( spec.reply != CEC_OPCODE_NONE ) {
+         doc += ", answered with ";
+         doc += OpcodeLookup(spec.reply)->name;
+      }
+
+      msg_names.push_back(name);
+      msg_docs.push_back(doc);
+      PyMethodDef def = { msg_names.back().c_str(), (PyCFunction)msg_build,
+         METH_VARARGS | METH_KEYWORDS, msg_docs.back().c_str() };
+      msg_builders.push_back(def);
+   }
+}
+
+int MsgModuleAdd(PyObject * module, PyTypeObject * command_type) {
+   std::call_once(msg_builders_once, msg_builders_init);
+
+   size_t count;
+   const OpcodeSpec * specs = OpcodeSpecs(&count);
+   PyObject * msg = PyModule_New("cec.msg");
+   if( msg == NULL ) return -1;
+   if( PyModule_AddFunctions(msg, msg_methods) < 0 ) goto error;
+   for( size_t i=0; i<count; i++ ) {
+      PyMethodDef * def = &msg_builders[i];
+      PyObject * self = Py_BuildValue("(iOs)", specs[i].opcode, command_type,
+            def->ml_name);
+      if( self == NULL ) goto error;
+      PyObject * fn = PyCFunction_NewEx(def, self, NULL);
+      Py_DECREF(self);
+      if( fn == NULL || PyModule_AddObject(msg, def->ml_name, fn) < 0 ) {
+         Py_XDECREF(fn);
+         goto error;
+      }
+   }
+   // so that "import cec.msg" works too
+   if( PyDict_SetItemString(PyImport_GetModuleDict(), "cec.msg", msg) < 0 ) {
+      goto error;
+   }
+   if( PyModule_AddObject(module, "msg", msg) < 0 ) goto error;
+   return 0;
+
+error:
+   Py_DECREF(msg);
+   return -1;
+}
@@ -0,0 +1,36 @@
+/* msg.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The cec.msg module: a builder for each standard opcode, e.g.
+ * cec.msg.set_stream_path("1.0.0.0"), that returns a validated Command
+ * ready for transmit().
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef MSG_H
+#define MSG_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+// create cec.msg and add it to module; builders return command_type
+int MsgModuleAdd(PyObject * module, PyTypeObject * command_type);
+
+#endif
@@ -0,0 +1,247 @@
+/* opcodes.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The opcode table. Opcodes whose operands are variable or rarely useful
+ * in decoded form (timers, tuner services, vendor commands) are listed
+ * without named parameters; their raw bytes are still in "parameters".
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "opcodes.h"
+
+#include <stdio.h>
+
+using namespace CEC;
+
+#define OP(op) CEC_OPCODE_##op, #op
+#define REPLY(op) CEC_OPCODE_##op
+#define NO_REPLY CEC_OPCODE_NONE
+#define DIRECT OPCODE_DIRECT
+#define BROADCAST OPCODE_BROADCAST
+#define EITHER OPCODE_EITHER
+
+// opcode, addressing, parameter bytes (min, max), reply, parameters; the
+// lengths and addressing are those of HDMI-CEC 1.4, with the broadcasts
+// that 2.0 allows
+static constexpr OpcodeSpec opcode_specs[] = {
+   // one touch play and routing
+   { OP(ACTIVE_SOURCE), BROADCAST, 2, 2, NO_REPLY,
+      {{"physical_address", 0, PARAM_PHYSICAL_ADDR}} },
+   { OP(IMAGE_VIEW_ON), DIRECT, 0, 0, NO_REPLY, {} },
+   { OP(TEXT_VIEW_ON), DIRECT, 0, 0, NO_REPLY, {} },
+   { OP(INACTIVE_SOURCE), DIRECT, 2, 2, NO_REPLY,
+      {{"physical_address", 0, PARAM_PHYSICAL_ADDR}} },
+   { OP(REQUEST_ACTIVE_SOURCE), BROADCAST, 0, 0, REPLY(ACTIVE_SOURCE), {} },
+   { OP(ROUTING_CHANGE), BROADCAST, 4, 4, NO_REPLY,
+      {{"original_address", 0, PARAM_PHYSICAL_ADDR},
+      {"new_address", 2, PARAM_PHYSICAL_ADDR}} },
+   { OP(ROUTING_INFORMATION), BROADCAST, 2, 2, NO_REPLY,
+      {{"physical_address", 0, PARAM_PHYSICAL_ADDR}} },
+   { OP(SET_STREAM_PATH), BROADCAST, 2, 2, NO_REPLY,
+      {{"physical_address", 0, PARAM_PHYSICAL_ADDR}} },
+   { OP(STANDBY), EITHER, 0, 0, NO_REPLY, {} },
+
+   // recording and timers
+   { OP(RECORD_OFF), DIRECT, 0, 0, NO_REPLY, {} },
+   { OP(RECORD_ON), DIRECT, 1, 8, REPLY(RECORD_STATUS), {} },
+   { OP(RECORD_STATUS), DIRECT, 1, 1, NO_REPLY,
+      {{"record_status", 0, PARAM_BYTE}} },
+   { OP(RECORD_TV_SCREEN), DIRECT, 0, 0, REPLY(RECORD_ON), {} },
+   { OP(CLEAR_ANALOGUE_TIMER), DIRECT, 11, 11, REPLY(TIMER_CLEARED_STATUS),
+      {} },
+   { OP(CLEAR_DIGITAL_TIMER), DIRECT, 14, 14, REPLY(TIMER_CLEARED_STATUS),
+      {} },
+   { OP(CLEAR_EXTERNAL_TIMER), DIRECT, 9, 10, REPLY(TIMER_CLEARED_STATUS),
+      {} },
+   { OP(SET_ANALOGUE_TIMER), DIRECT, 11, 11, REPLY(TIMER_STATUS), {} },
+   { OP(SET_DIGITAL_TIMER), DIRECT, 14, 14, REPLY(TIMER_STATUS), {} },
+   { OP(SET_EXTERNAL_TIMER), DIRECT, 9, 10, REPLY(TIMER_STATUS), {} },
+   { OP(SET_TIMER_PROGRAM_TITLE), DIRECT, 1, 14, NO_REPLY,
+      {{"program_title", 0, PARAM_STRING}} },
+   { OP(TIMER_CLEARED_STATUS), DIRECT, 1, 1, NO_REPLY,
+      {{"timer_cleared_status", 0, PARAM_BYTE}} },
+   { OP(TIMER_STATUS), DIRECT, 1, 3, NO_REPLY,
+      {{"timer_status", 0, PARAM_BYTE}} },
+
+   // system information
+   { OP(CEC_VERSION), DIRECT, 1, 1, NO_REPLY,
+      {{"cec_version", 0, PARAM_BYTE}} },
+   { OP(GET_CEC_VERSION), DIRECT, 0, 0, REPLY(CEC_VERSION), {} },
+   { OP(GIVE_PHYSICAL_ADDRESS), DIRECT, 0, 0, REPLY(REPORT_PHYSICAL_ADDRESS),
+      {} },
+   { OP(GET_MENU_LANGUAGE), DIRECT, 0, 0, REPLY(SET_MENU_LANGUAGE), {} },
+   { OP(REPORT_PHYSICAL_ADDRESS), BROADCAST, 3, 3, NO_REPLY,
+      {{"physical_address", 0, PARAM_PHYSICAL_ADDR},
+      {"device_type", 2, PARAM_BYTE}} },
+   { OP(SET_MENU_LANGUAGE), BROADCAST, 3, 3, NO_REPLY,
+      {{"language", 0, PARAM_LANGUAGE}} },
+
+   // deck and tuner control
+   { OP(DECK_CONTROL), DIRECT, 1, 1, NO_REPLY,
+      {{"deck_control", 0, PARAM_BYTE}} },
+   { OP(DECK_STATUS), DIRECT, 1, 1, NO_REPLY,
+      {{"deck_status", 0, PARAM_BYTE}} },
+   { OP(GIVE_DECK_STATUS), DIRECT, 1, 1, REPLY(DECK_STATUS),
+      {{"status_request", 0, PARAM_BYTE}} },
+   { OP(PLAY), DIRECT, 1, 1, NO_REPLY, {{"play_mode", 0, PARAM_BYTE}} },
+   { OP(GIVE_TUNER_DEVICE_STATUS), DIRECT, 1, 1, REPLY(TUNER_DEVICE_STATUS),
+      {{"status_request", 0, PARAM_BYTE}} },
+   { OP(SELECT_ANALOGUE_SERVICE), DIRECT, 4, 4, NO_REPLY, {} },
+   { OP(SELECT_DIGITAL_SERVICE), DIRECT, 7, 7, NO_REPLY, {} },
+   { OP(TUNER_DEVICE_STATUS), DIRECT, 5, 8, NO_REPLY, {} },
+   { OP(TUNER_STEP_DECREMENT), DIRECT, 0, 0, NO_REPLY, {} },
+   { OP(TUNER_STEP_INCREMENT), DIRECT, 0, 0, NO_REPLY, {} },
+
+   // vendor specific
+   { OP(DEVICE_VENDOR_ID), BROADCAST, 3, 3, NO_REPLY,
+      {{"vendor_id", 0, PARAM_VENDOR_ID}} },
+   { OP(GIVE_DEVICE_VENDOR_ID), DIRECT, 0, 0, REPLY(DEVICE_VENDOR_ID), {} },
+   { OP(VENDOR_COMMAND), DIRECT, 0, 14, NO_REPLY, {} },
+   { OP(VENDOR_COMMAND_WITH_ID), EITHER, 3, 14, NO_REPLY,
+      {{"vendor_id", 0, PARAM_VENDOR_ID}} },
+   { OP(VENDOR_REMOTE_BUTTON_DOWN), EITHER, 0, 14, NO_REPLY, {} },
+   { OP(VENDOR_REMOTE_BUTTON_UP), EITHER, 0, 0, NO_REPLY, {} },
+
+   // OSD and menus
+   { OP(SET_OSD_STRING), DIRECT, 1, 14, NO_REPLY,
+      {{"display_control", 0, PARAM_BYTE},
+      {"osd_string", 1, PARAM_STRING}} },
+   { OP(GIVE_OSD_NAME), DIRECT, 0, 0, REPLY(SET_OSD_NAME), {} },
+   { OP(SET_OSD_NAME), DIRECT, 1, 14, NO_REPLY,
+      {{"osd_name", 0, PARAM_STRING}} },
+   { OP(MENU_REQUEST), DIRECT, 1, 1, REPLY(MENU_STATUS),
+      {{"menu_request", 0, PARAM_BYTE}} },
+   { OP(MENU_STATUS), DIRECT, 1, 1, NO_REPLY,
+      {{"menu_state", 0, PARAM_BYTE}} },
+   // some keys carry an operand, e.g. the channel for tune functions
+   { OP(USER_CONTROL_PRESSED), DIRECT, 1, 5, NO_REPLY,
+      {{"key", 0, PARAM_BYTE}} },
+   { OP(USER_CONTROL_RELEASE), DIRECT, 0, 0, NO_REPLY, {} },
+
+   // power
+   { OP(GIVE_DEVICE_POWER_STATUS), DIRECT, 0, 0, REPLY(REPORT_POWER_STATUS),
+      {} },
+   { OP(REPORT_POWER_STATUS), EITHER, 1, 1, NO_REPLY,
+      {{"power_status", 0, PARAM_BYTE}} },
+
+   // general
+   { OP(FEATURE_ABORT), DIRECT, 2, 2, NO_REPLY,
+      {{"aborted_opcode", 0, PARAM_BYTE},
+      {"abort_reason", 1, PARAM_BYTE}} },
+   { OP(ABORT), DIRECT, 0, 0, REPLY(FEATURE_ABORT), {} },
+
+   // audio
+   { OP(GIVE_AUDIO_STATUS), DIRECT, 0, 0, REPLY(REPORT_AUDIO_STATUS), {} },
+   { OP(GIVE_SYSTEM_AUDIO_MODE_STATUS), DIRECT, 0, 0,
+      REPLY(SYSTEM_AUDIO_MODE_STATUS), {} },
+   { OP(REPORT_AUDIO_STATUS), DIRECT, 1, 1, NO_REPLY,
+      {{"volume", 0, PARAM_VOLUME}, {"muted", 0, PARAM_MUTED}} },
+   { OP(SET_SYSTEM_AUDIO_MODE), EITHER, 1, 1, NO_REPLY,
+      {{"system_audio", 0, PARAM_BOOL}} },
+   // without a physical address, a request to turn system audio off
+   { OP(SYSTEM_AUDIO_MODE_REQUEST), DIRECT, 0, 2, REPLY(SET_SYSTEM_AUDIO_MODE),
+      {{"physical_address", 0, PARAM_PHYSICAL_ADDR}} },
+   { OP(SYSTEM_AUDIO_MODE_STATUS), DIRECT, 1, 1, NO_REPLY,
+      {{"system_audio", 0, PARAM_BOOL}} },
+   { OP(SET_AUDIO_RATE), DIRECT, 1, 1, NO_REPLY,
+      {{"audio_rate", 0, PARAM_BYTE}} },
+
+   // audio return channel
+   { OP(START_ARC), DIRECT, 0, 0, REPLY(REPORT_ARC_STARTED), {} },
+   { OP(REPORT_ARC_STARTED), DIRECT, 0, 0, NO_REPLY, {} },
+   { OP(REPORT_ARC_ENDED), DIRECT, 0, 0, NO_REPLY, {} },
+   { OP(REQUEST_ARC_START), DIRECT, 0, 0, REPLY(START_ARC), {} },
+   { OP(REQUEST_ARC_END), DIRECT, 0, 0, REPLY(END_ARC), {} },
+   { OP(END_ARC), DIRECT, 0, 0, REPLY(REPORT_ARC_ENDED), {} },
+
+   // the initiator's physical address, then a CDC opcode and its operands
+   { OP(CDC), BROADCAST, 3, 14, NO_REPLY, {} },
+};
+
+#define OPCODE_SPEC_COUNT (sizeof(opcode_specs) / sizeof(opcode_specs[0]))
+
+// opcode -> position in opcode_specs plus one, or 0 for unknown opcodes
+struct OpcodeIndex {
+   uint8_t slot[256];
+
+   constexpr OpcodeIndex() : slot() {
+      for( size_t i=0; i<OPCODE_SPEC_COUNT; i++ ) {
+         slot[opcode_specs[i].opcode & 0xFF] = (uint8_t)(i + 1);
+      }
+   }
+};
+
+static constexpr OpcodeIndex opcode_index;
+
+static_assert(OPCODE_SPEC_COUNT < 256, "opcode index slots are one byte");
+
+const OpcodeSpec * OpcodeLookup(uint8_t opcode) {
+   uint8_t slot = opcode_index.slot[opcode];
+   return slot ? &opcode_specs[slot - 1] : NULL;
+}
+
+const OpcodeSpec * OpcodeSpecs(size_t * count) {
+   *count = OPCODE_SPEC_COUNT;
+   return opcode_specs;
+}
+
+size_t OpcodeParamSize(ParamKind kind) {
+   switch( kind ) {
+      case PARAM_PHYSICAL_ADDR:
+         return 2;
+      case PARAM_VENDOR_ID:
+      case PARAM_LANGUAGE:
+         return 3;
+      case PARAM_STRING:
+         return 0;
+      default:
+         return 1;
+   }
+}
+
+bool OpcodeCheck(const cec_command & cmd, char * error, size_t size) {
+   const OpcodeSpec * spec = OpcodeLookup(cmd.opcode);
+   if( spec == NULL ) return true;
+
+   bool broadcast = cmd.destination == CECDEVICE_BROADCAST;
+   if( broadcast && !(spec->addressing & OPCODE_BROADCAST) ) {
+      snprintf(error, size, "%s can't be broadcast", spec->name);
+      return false;
+   }
+   if( !broadcast && !(spec->addressing & OPCODE_DIRECT) ) {
+      snprintf(error, size, "%s must be broadcast", spec->name);
+      return false;
+   }
+   if( cmd.parameters.size < spec->min_size ||
+         cmd.parameters.size > spec->max_size ) {
+      if( spec->min_size == spec->max_size ) {
+         snprintf(error, size, "%s takes %d parameter byte%s, not %d",
+               spec->name, spec->min_size, spec->min_size == 1 ? "" : "s",
+               cmd.parameters.size);
+      } else {
+         snprintf(error, size,
+               "%s takes %d to %d parameter bytes, not %d",
+               spec->name, spec->min_size, spec->max_size,
+               cmd.parameters.size);
+      }
+      return false;
+   }
+   return true;
+}
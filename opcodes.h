@@ -0,0 +1,88 @@
+/* opcodes.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The standard CEC opcodes, in a table that is built at compile time and
+ * indexed by opcode: the layout and length of their parameters, how they
+ * are addressed, and the reply they ask for.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef OPCODES_H
+#define OPCODES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libcec/cec.h>
+
+enum ParamKind {
+   PARAM_BYTE,             // one byte, as an int
+   PARAM_BOOL,             // one byte, 0 or 1
+   PARAM_PHYSICAL_ADDR,    // two bytes, as "a.b.c.d"
+   PARAM_VENDOR_ID,        // three bytes, big-endian
+   PARAM_VOLUME,           // the low 7 bits of a byte
+   PARAM_MUTED,            // the high bit of a byte
+   PARAM_STRING,           // ASCII, up to the end of the frame
+   PARAM_LANGUAGE,         // three characters, ISO 639-2
+};
+
+struct OpcodeParam {
+   const char * name;
+   uint8_t offset;
+   ParamKind kind;
+};
+
+#define OPCODE_MAX_PARAMS 2
+
+// how an opcode may be addressed
+enum OpcodeAddressing {
+   OPCODE_DIRECT = 1,
+   OPCODE_BROADCAST = 2,
+   OPCODE_EITHER = OPCODE_DIRECT | OPCODE_BROADCAST,
+};
+
+struct OpcodeSpec {
+   CEC::cec_opcode opcode;
+   // the CEC_OPCODE_ constant without its prefix
+   const char * name;
+   OpcodeAddressing addressing;
+   // the number of parameter bytes a valid frame carries
+   uint8_t min_size;
+   uint8_t max_size;
+   // the opcode a follower answers with, or CEC_OPCODE_NONE
+   CEC::cec_opcode reply;
+   // the parameters that are decoded; name is NULL after the last one
+   OpcodeParam params[OPCODE_MAX_PARAMS];
+};
+
+// the spec for a standard opcode, or NULL
+const OpcodeSpec * OpcodeLookup(uint8_t opcode);
+
+// every standard opcode, in no particular order
+const OpcodeSpec * OpcodeSpecs(size_t * count);
+
+// the bytes a parameter takes; 0 for a string
+size_t OpcodeParamSize(ParamKind kind);
+
+// false if cmd can't be a valid frame, because of its length or its
+// destination, with the reason in error. Non-standard opcodes always pass
+bool OpcodeCheck(const CEC::cec_command & cmd, char * error, size_t size);
+
+#endif
@@ -0,0 +1,66 @@
+/* probes.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * USDT (SystemTap SDT) tracepoints for profiling live systems with
+ * bpftrace, perf or SystemTap, e.g.
+ *   bpftrace -e 'usdt:./cec*.so:cec:transmit__done { @[arg1] = count(); }'
+ * A disabled probe is a single nop. They are compiled in when <sys/sdt.h>
+ * is available (systemtap-sdt-dev, systemtap-sdt-devel) unless
+ * CEC_NO_PROBES is defined.
+ *
+ * Probes, all in the "cec" provider:
+ *   transmit__start(destination, opcode, initiator)
+ *   transmit__done(destination, opcode, result)   result 1 acked, 0 failed,
+ *                                                  -1 queued
+ *   callback__entry(event)           a libcec callback, EVENT_* bit
+ *   gil__acquire(event)              a callback starts waiting for the GIL
+ *   gil__acquired(event, wait_ns)
+ *   gil__release(event)
+ *   handler__start(event, callable)  a Python handler; callable is the
+ *   handler__done(event, ok)         address of the handler object
+ *   gil__held(call, ns)              a bus call made with the GIL held that
+ *                                    took longer than the check_gil()
+ *                                    threshold; call is its name
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#if !defined(CEC_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef HAVE_PROBES
+#define PROBE1(name, a) DTRACE_PROBE1(cec, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(cec, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(cec, name, a, b, c)
+#else
+// the arguments are still type checked, but never evaluated
+#define PROBE1(name, a) do { (void)sizeof(a); } while(0)
+#define PROBE2(name, a, b) do { (void)sizeof(a); (void)sizeof(b); } while(0)
+#define PROBE3(name, a, b, c) \
+   do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while(0)
+#endif
+
+#endif
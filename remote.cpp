@@ -0,0 +1,532 @@
+/* remote.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A Backend that forwards to a cec server over a UNIX socket
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "remote.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#if HAVE_CEC_SERVER
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace CEC;
+
+#if HAVE_CEC_SERVER
+
+RemoteBackend::RemoteBackend(const libcec_configuration * config) :
+      callbacks(config->callbacks), param(config->callbackParam), fd(-1),
+      connected(false), closing(false), next_id(0), stopping(false) {
+   dispatcher = std::thread(&RemoteBackend::Dispatch, this);
+}
+
+RemoteBackend::~RemoteBackend() {
+   Close();
+   {
+      std::lock_guard<std::mutex> guard(event_lock);
+      stopping = true;
+   }
+   event_cond.notify_all();
+   dispatcher.join();
+}
+
+// comma separated numbers from 0 to max
+static bool parse_list(const std::string & value, long max,
+      std::vector<int> * result) {
+   const char * p = value.c_str();
+   while( *p ) {
+      char * rest;
+      long n = strtol(p, &rest, 0);
+      if( rest == p || n < 0 || n > max ) return false;
+      if( *rest && *rest != ',' ) return false;
+      result->push_back((int)n);
+      p = (*rest == ',') ? rest + 1 : rest;
+   }
+   return true;
+}
+
+bool RemoteBackend::Open(const char * port) {
+   size_t prefix = strlen(REMOTE_URL_PREFIX);
+   if( strncmp(port, REMOTE_URL_PREFIX, prefix) != 0 ) return false;
+
+   // parse the options before connecting
+   const char * start = port + prefix;
+   const char * query = start + strcspn(start, "?");
+   std::string path(start, query - start);
+   WireFilter filter;
+   if( *query == '?' ) query++;
+   while( *query ) {
+      const char * end = query + strcspn(query, "&");
+      const char * eq = (const char *)memchr(query, '=', end - query);
+      if( eq == NULL ) return false;
+      std::string name(query, eq - query);
+      std::string value(eq + 1, end - eq - 1);
+      std::vector<int> list;
+      if( name == "events" ) {
+         char * rest;
+         unsigned long events = strtoul(value.c_str(), &rest, 0);
+         if( value.empty() || *rest ) return false;
+         filter.events = events & WIRE_EVENTS_ALL;
+      } else if( name == "opcodes" ) {
+         if( !parse_list(value, 0xFF, &list) ) return false;
+         memset(filter.opcodes, 0, sizeof(filter.opcodes));
+         for( size_t i=0; i<list.size(); i++ ) {
+            filter.opcodes[list[i] >> 3] |= 1 << (list[i] & 7);
+         }
+      } else if( name == "initiators" ) {
+         if( !parse_list(value, CECDEVICE_BROADCAST, &list) ) return false;
+         filter.initiators = 0;
+         for( size_t i=0; i<list.size(); i++ ) {
+            filter.initiators |= 1 << list[i];
+         }
+      } else {
+         return false;
+      }
+      query = *end ? end + 1 : end;
+   }
+
+   struct sockaddr_un addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   if( path.empty() || path.size() >= sizeof(addr.sun_path) ) return false;
+   memcpy(addr.sun_path, path.c_str(), path.size());
+
+   Close();
+   int s = socket(AF_UNIX, SOCK_STREAM, 0);
+   if( s < 0 ) return false;
+   if( connect(s, (struct sockaddr *)&addr, sizeof(addr)) < 0 ) {
+      close(s);
+      return false;
+   }
+   fcntl(s, F_SETFD, fcntl(s, F_GETFD) | FD_CLOEXEC);
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      fd = s;
+      connected = true;
+   }
+   reader = std::thread(&RemoteBackend::Read, this);
+
+   // the server refuses clients it can't exchange structures with
+   WireWriter hello;
+   hello.Put16(WIRE_VERSION);
+   hello.Put32(sizeof(libcec_configuration));
+   hello.Put32(sizeof(CEC_ADAPTER_TYPE));
+   hello.PutFilter(filter);
+   if( !RequestByte(WIRE_HELLO, hello) ) {
+      Close();
+      return false;
+   }
+   return true;
+}
+
+void RemoteBackend::Close() {
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if( fd < 0 || closing ) return;
+      closing = true;
+      shutdown(fd, SHUT_RDWR);
+   }
+   reader.join();
+   // nothing is writing to fd once write_lock is held and the reader has
+   // marked the connection down
+   std::lock_guard<std::mutex> write_guard(write_lock);
+   std::lock_guard<std::mutex> guard(lock);
+   close(fd);
+   fd = -1;
+   closing = false;
+}
+
+bool RemoteBackend::Request(uint16_t type, const WireWriter & args,
+      std::string * reply) {
+   Call call;
+   call.done = false;
+   uint32_t id;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if( !connected ) return false;
+      // id 0 is for events
+      id = ++next_id;
+      if( id == 0 ) id = ++next_id;
+      calls[id] = &call;
+   }
+   bool written = false;
+   {
+      std::lock_guard<std::mutex> write_guard(write_lock);
+      int s = -1;
+      {
+         std::lock_guard<std::mutex> guard(lock);
+         if( connected ) s = fd;
+      }
+      if( s >= 0 ) written = WireWrite(s, WireFrame(type, id, args.data));
+   }
+   std::unique_lock<std::mutex> guard(lock);
+   while( written && !call.done && connected ) {
+      cond.wait(guard);
+   }
+   calls.erase(id);
+   reply->clear();
+   if( !call.done ) return false;
+   reply->swap(call.reply);
+   return true;
+}
+
+uint8_t RemoteBackend::RequestByte(uint16_t type, const WireWriter & args) {
+   std::string reply;
+   if( !Request(type, args, &reply) ) return 0;
+   WireReader result(reply);
+   return result.Get8();
+}
+
+uint8_t RemoteBackend::RequestByte(uint16_t type, cec_logical_address addr) {
+   WireWriter args;
+   args.Put8((uint8_t)addr);
+   return RequestByte(type, args);
+}
+
+// the reader thread: hand replies to the calls waiting for them, and
+// events to the dispatch thread
+void RemoteBackend::Read() {
+   WireHeader header;
+   std::string payload;
+   while( WireRead(fd, &header, &payload) ) {
+      if( header.id == 0 ) {
+         {
+            std::lock_guard<std::mutex> guard(event_lock);
+            events.push_back(std::make_pair(header.type, std::string()));
+            events.back().second.swap(payload);
+         }
+         event_cond.notify_one();
+         continue;
+      }
+      std::lock_guard<std::mutex> guard(lock);
+      std::map<uint32_t, Call *>::iterator it = calls.find(header.id);
+      if( it != calls.end() ) {
+         it->second->reply.swap(payload);
+         it->second->done = true;
+         cond.notify_all();
+      }
+   }
+
+   bool lost;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      connected = false;
+      lost = !closing;
+      cond.notify_all();
+   }
+   // the server went away; report it like libcec reports a lost adapter,
+   // so that init(..., reconnect=True) brings the connection back
+   if( lost ) {
+      WireWriter alert;
+      alert.Put32(CEC_ALERT_CONNECTION_LOST);
+      alert.Put8(0);
+      alert.PutString("");
+      {
+         std::lock_guard<std::mutex> guard(event_lock);
+         events.push_back(std::make_pair((uint16_t)WIRE_EVENT_ALERT,
+                  alert.data));
+      }
+      event_cond.notify_one();
+   }
+}
+
+void RemoteBackend::Dispatch() {
+   std::unique_lock<std::mutex> guard(event_lock);
+   while( true ) {
+      while( !stopping && events.empty() ) {
+         event_cond.wait(guard);
+      }
+      if( stopping ) break;
+      std::pair<uint16_t, std::string> event;
+      event.swap(events.front());
+      events.pop_front();
+      guard.unlock();
+      if( callbacks ) {
+         Deliver(event.first, event.second);
+      }
+      guard.lock();
+   }
+}
+
+void RemoteBackend::Deliver(uint16_t type, const std::string & payload) {
+   WireReader event(payload);
+   switch( type ) {
+      case WIRE_EVENT_LOG: {
+         cec_log_message message;
+         message.level = (cec_log_level)event.Get32();
+         message.time = (int64_t)event.Get64();
+         std::string text = event.GetString();
+         message.message = text.c_str();
+         if( event.ok && callbacks->logMessage ) {
+            callbacks->logMessage(param, &message);
+         }
+         break;
+      }
+      case WIRE_EVENT_KEYPRESS: {
+         cec_keypress key;
+         key.keycode = (cec_user_control_code)event.Get8();
+         key.duration = event.Get32();
+         if( event.ok && callbacks->keyPress ) {
+            callbacks->keyPress(param, &key);
+         }
+         break;
+      }
+      case WIRE_EVENT_COMMAND: {
+         cec_command cmd = event.GetCommand();
+         if( event.ok && callbacks->commandReceived ) {
+            callbacks->commandReceived(param, &cmd);
+         }
+         break;
+      }
+      case WIRE_EVENT_CONFIG: {
+         libcec_configuration config;
+         event.Get(&config, sizeof(config));
+         config.callbacks = callbacks;
+         config.callbackParam = param;
+         if( event.ok && callbacks->configurationChanged ) {
+            callbacks->configurationChanged(param, &config);
+         }
+         break;
+      }
+      case WIRE_EVENT_ALERT: {
+         libcec_alert alert = (libcec_alert)event.Get32();
+         bool has_param = event.Get8();
+         std::string text = event.GetString();
+         libcec_parameter p;
+         p.paramType = has_param ? CEC_PARAMETER_TYPE_STRING :
+            CEC_PARAMETER_TYPE_UNKOWN;
+         p.paramData = has_param ? (void *)text.c_str() : NULL;
+         if( event.ok && callbacks->alert ) {
+            callbacks->alert(param, alert, p);
+         }
+         break;
+      }
+      case WIRE_EVENT_MENU: {
+         cec_menu_state state = (cec_menu_state)event.Get32();
+         if( event.ok && callbacks->menuStateChanged ) {
+            callbacks->menuStateChanged(param, state);
+         }
+         break;
+      }
+      case WIRE_EVENT_ACTIVATED: {
+         cec_logical_address addr = (cec_logical_address)event.Get8();
+         uint8_t active = event.Get8();
+         if( event.ok && callbacks->sourceActivated ) {
+            callbacks->sourceActivated(param, addr, active);
+         }
+         break;
+      }
+      default:
+         break;
+   }
+}
+
+int RemoteBackend::DetectAdapters(CEC_ADAPTER_TYPE * list, int size,
+      bool quick) {
+   WireWriter args;
+   args.Put32(size > 0 ? size : 0);
+   args.Put8(quick);
+   std::string reply;
+   if( !Request(WIRE_DETECT_ADAPTERS, args, &reply) ) return 0;
+   WireReader result(reply);
+   int found = (int)result.Get32();
+   int count = found < size ? found : size;
+   if( count > 16 ) count = 16;
+   if( count > 0 ) result.Get(list, sizeof(list[0]) * count);
+   return result.ok ? found : 0;
+}
+
+bool RemoteBackend::Transmit(const cec_command & cmd) {
+   WireWriter args;
+   args.PutCommand(cmd);
+   return RequestByte(WIRE_TRANSMIT, args);
+}
+
+cec_logical_addresses RemoteBackend::Addresses(uint16_t type) {
+   cec_logical_addresses addrs;
+   addrs.Clear();
+   std::string reply;
+   if( !Request(type, WireWriter(), &reply) ) return addrs;
+   WireReader result(reply);
+   cec_logical_address primary = (cec_logical_address)result.Get8();
+   uint16_t mask = result.Get16();
+   for( int i=0; i<16; i++ ) {
+      if( mask & (1 << i) ) addrs.Set((cec_logical_address)i);
+   }
+   addrs.primary = primary;
+   return addrs;
+}
+
+cec_logical_addresses RemoteBackend::GetLogicalAddresses() {
+   return Addresses(WIRE_LOGICAL_ADDRESSES);
+}
+
+cec_logical_addresses RemoteBackend::GetActiveDevices() {
+   return Addresses(WIRE_ACTIVE_DEVICES);
+}
+
+bool RemoteBackend::IsActiveSource(cec_logical_address addr) {
+   return RequestByte(WIRE_IS_ACTIVE_SOURCE, addr);
+}
+
+bool RemoteBackend::SetActiveSource(cec_device_type type) {
+   WireWriter args;
+   args.Put8((uint8_t)type);
+   return RequestByte(WIRE_SET_ACTIVE_SOURCE, args);
+}
+
+bool RemoteBackend::SetStreamPath(cec_logical_address addr) {
+   return RequestByte(WIRE_STREAM_PATH_ADDR, addr);
+}
+
+bool RemoteBackend::SetStreamPath(uint16_t pa) {
+   WireWriter args;
+   args.Put16(pa);
+   return RequestByte(WIRE_STREAM_PATH_PA, args);
+}
+
+bool RemoteBackend::SetPhysicalAddress(uint16_t pa) {
+   WireWriter args;
+   args.Put16(pa);
+   return RequestByte(WIRE_SET_PHYSICAL_ADDRESS, args);
+}
+
+bool RemoteBackend::SetHDMIPort(cec_logical_address base, uint8_t port) {
+   WireWriter args;
+   args.Put8((uint8_t)base);
+   args.Put8(port);
+   return RequestByte(WIRE_SET_HDMI_PORT, args);
+}
+
+uint8_t RemoteBackend::VolumeUp() {
+   return RequestByte(WIRE_VOLUME_UP, WireWriter());
+}
+
+uint8_t RemoteBackend::VolumeDown() {
+   return RequestByte(WIRE_VOLUME_DOWN, WireWriter());
+}
+
+uint8_t RemoteBackend::AudioToggleMute() {
+   return RequestByte(WIRE_TOGGLE_MUTE, WireWriter());
+}
+
+bool RemoteBackend::GetCurrentConfiguration(libcec_configuration * config) {
+   std::string reply;
+   if( !Request(WIRE_GET_CONFIGURATION, WireWriter(), &reply) ) return false;
+   WireReader result(reply);
+   bool success = result.Get8();
+   libcec_configuration current;
+   result.Get(&current, sizeof(current));
+   if( !success || !result.ok ) return false;
+   // the callbacks the server reports are its own
+   current.callbacks = callbacks;
+   current.callbackParam = param;
+   *config = current;
+   return true;
+}
+
+bool RemoteBackend::SetConfiguration(const libcec_configuration * config) {
+   WireWriter args;
+   args.Put(config, sizeof(*config));
+   return RequestByte(WIRE_SET_CONFIGURATION, args);
+}
+
+bool RemoteBackend::CanPersistConfiguration() {
+   return RequestByte(WIRE_CAN_PERSIST, WireWriter());
+}
+
+bool RemoteBackend::PersistConfiguration(const libcec_configuration * config) {
+   WireWriter args;
+   args.Put(config, sizeof(*config));
+   return RequestByte(WIRE_PERSIST, args);
+}
+
+bool RemoteBackend::PowerOnDevices(cec_logical_address addr) {
+   return RequestByte(WIRE_POWER_ON, addr);
+}
+
+bool RemoteBackend::StandbyDevices(cec_logical_address addr) {
+   return RequestByte(WIRE_STANDBY, addr);
+}
+
+cec_power_status RemoteBackend::GetDevicePowerStatus(
+      cec_logical_address addr) {
+   WireWriter args;
+   args.Put8((uint8_t)addr);
+   std::string reply;
+   if( !Request(WIRE_POWER_STATUS, args, &reply) ) {
+      return CEC_POWER_STATUS_UNKNOWN;
+   }
+   return (cec_power_status)WireReader(reply).Get8();
+}
+
+uint64_t RemoteBackend::GetDeviceVendorId(cec_logical_address addr) {
+   WireWriter args;
+   args.Put8((uint8_t)addr);
+   std::string reply;
+   if( !Request(WIRE_VENDOR_ID, args, &reply) ) return 0;
+   return WireReader(reply).Get64();
+}
+
+uint16_t RemoteBackend::GetDevicePhysicalAddress(cec_logical_address addr) {
+   WireWriter args;
+   args.Put8((uint8_t)addr);
+   std::string reply;
+   if( !Request(WIRE_PHYSICAL_ADDRESS, args, &reply) ) return 0xFFFF;
+   return WireReader(reply).Get16();
+}
+
+cec_version RemoteBackend::GetDeviceCecVersion(cec_logical_address addr) {
+   return (cec_version)RequestByte(WIRE_CEC_VERSION, addr);
+}
+
+std::string RemoteBackend::GetDeviceOSDName(cec_logical_address addr) {
+   WireWriter args;
+   args.Put8((uint8_t)addr);
+   std::string reply;
+   if( !Request(WIRE_OSD_NAME, args, &reply) ) return std::string();
+   return WireReader(reply).GetString();
+}
+
+std::string RemoteBackend::GetDeviceMenuLanguage(cec_logical_address addr) {
+   WireWriter args;
+   args.Put8((uint8_t)addr);
+   std::string reply;
+   if( !Request(WIRE_MENU_LANGUAGE, args, &reply) ) return std::string();
+   return WireReader(reply).GetString();
+}
+
+#endif
+
+Backend * RemoteBackendNew(const libcec_configuration * config) {
+#if HAVE_CEC_SERVER
+   return new RemoteBackend(config);
+#else
+   return NULL;
+#endif
+}
@@ -0,0 +1,137 @@
+/* remote.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The bus of an adapter served by another process (see server.h),
+ * selected with init("unix:///path/to/socket"). Every Backend call is a
+ * request to the server, and the events it sends are delivered through the
+ * same libcec callbacks as on a local adapter, from a thread of their own.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <libcec/cec.h>
+
+#include "backend.h"
+#include "wire.h"
+
+#define REMOTE_URL_PREFIX "unix://"
+
+#if HAVE_CEC_SERVER
+
+class RemoteBackend : public Backend {
+   public:
+      RemoteBackend(const CEC::libcec_configuration * config);
+      ~RemoteBackend();
+
+      // port is unix://path[?key=value&...]; the keys filter the events the
+      // server sends: events (a mask of cec.EVENT_*), opcodes and
+      // initiators (comma separated numbers) for commands
+      bool Open(const char * port);
+      void Close();
+      int DetectAdapters(CEC::CEC_ADAPTER_TYPE * list, int size, bool quick);
+
+      bool Transmit(const CEC::cec_command & cmd);
+      CEC::cec_logical_addresses GetLogicalAddresses();
+      CEC::cec_logical_addresses GetActiveDevices();
+
+      bool IsActiveSource(CEC::cec_logical_address addr);
+      bool SetActiveSource(CEC::cec_device_type type);
+      bool SetStreamPath(CEC::cec_logical_address addr);
+      bool SetStreamPath(uint16_t pa);
+      bool SetPhysicalAddress(uint16_t pa);
+      bool SetHDMIPort(CEC::cec_logical_address base, uint8_t port);
+
+      uint8_t VolumeUp();
+      uint8_t VolumeDown();
+      uint8_t AudioToggleMute();
+
+      bool GetCurrentConfiguration(CEC::libcec_configuration * config);
+      bool SetConfiguration(const CEC::libcec_configuration * config);
+      bool CanPersistConfiguration();
+      bool PersistConfiguration(const CEC::libcec_configuration * config);
+
+      bool PowerOnDevices(CEC::cec_logical_address addr);
+      bool StandbyDevices(CEC::cec_logical_address addr);
+      CEC::cec_power_status GetDevicePowerStatus(CEC::cec_logical_address addr);
+      uint64_t GetDeviceVendorId(CEC::cec_logical_address addr);
+      uint16_t GetDevicePhysicalAddress(CEC::cec_logical_address addr);
+      CEC::cec_version GetDeviceCecVersion(CEC::cec_logical_address addr);
+      std::string GetDeviceOSDName(CEC::cec_logical_address addr);
+      std::string GetDeviceMenuLanguage(CEC::cec_logical_address addr);
+
+   private:
+      struct Call {
+         bool done;
+         std::string reply;
+      };
+
+      // send a request and wait for the reply. Returns false, leaving reply
+      // empty, if the server can't be reached
+      bool Request(uint16_t type, const WireWriter & args,
+            std::string * reply);
+      // a request whose reply is a single byte
+      uint8_t RequestByte(uint16_t type, const WireWriter & args);
+      uint8_t RequestByte(uint16_t type, CEC::cec_logical_address addr);
+
+      void Read();
+      void Dispatch();
+      void Deliver(uint16_t type, const std::string & payload);
+      CEC::cec_logical_addresses Addresses(uint16_t type);
+
+      // fixed when the backend is created, like libcec's
+      CEC::ICECCallbacks * callbacks;
+      void * param;
+
+      // guards the connection state and the calls waiting for replies
+      std::mutex lock;
+      std::condition_variable cond;
+      int fd;
+      bool connected;
+      bool closing;
+      uint32_t next_id;
+      std::map<uint32_t, Call *> calls;
+      // one request is written at a time
+      std::mutex write_lock;
+      std::thread reader;
+
+      // events waiting for the dispatch thread
+      std::mutex event_lock;
+      std::condition_variable event_cond;
+      std::deque<std::pair<uint16_t, std::string> > events;
+      bool stopping;
+      std::thread dispatcher;
+};
+
+#endif
+
+// a backend for a cec server, or NULL if this build can't connect to one
+Backend * RemoteBackendNew(const CEC::libcec_configuration * config);
+
+#endif
@@ -0,0 +1,120 @@
+/* replies.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Collects the replies to batches of requests
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "replies.h"
+
+using namespace CEC;
+
+Replies::Replies() : seq(0) {
+}
+
+uint32_t Replies::Key(cec_logical_address addr, uint8_t opcode,
+      bool abort) {
+   return ((uint32_t)abort << 12) | ((uint32_t)(addr & 0xF) << 8) | opcode;
+}
+
+void Replies::Update(const cec_command & cmd) {
+   if( !cmd.opcode_set || cmd.initiator > CECDEVICE_BROADCAST ) return;
+   uint32_t key;
+   if( cmd.opcode == CEC_OPCODE_FEATURE_ABORT ) {
+      if( cmd.parameters.size < 1 ) return;
+      key = Key(cmd.initiator, cmd.parameters[0], true);
+   } else {
+      key = Key(cmd.initiator, cmd.opcode, false);
+   }
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      Entry & entry = latest[key];
+      entry.seq = ++seq;
+      entry.cmd = cmd;
+      entry.time = std::chrono::duration<double>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+   }
+   cond.notify_all();
+}
+
+uint64_t Replies::Mark() {
+   std::lock_guard<std::mutex> guard(lock);
+   return seq;
+}
+
+const Replies::Entry * Replies::Find(uint64_t mark,
+      const ReplyRequest & request) const {
+   std::unordered_map<uint32_t, Entry>::const_iterator it =
+      latest.find(Key(request.addr, request.opcode, false));
+   if( it != latest.end() && it->second.seq > mark ) {
+      return &it->second;
+   }
+   it = latest.find(Key(request.addr, request.request, true));
+   if( it != latest.end() && it->second.seq > mark ) {
+      return &it->second;
+   }
+   return NULL;
+}
+
+size_t Replies::Wait(uint64_t mark, const std::vector<ReplyRequest> & requests,
+      clock::time_point deadline, std::vector<Reply> * replies) {
+   replies->assign(requests.size(), Reply());
+   size_t count = 0;
+   std::unique_lock<std::mutex> guard(lock);
+   while( true ) {
+      for( size_t i=0; i<requests.size(); i++ ) {
+         Reply & reply = (*replies)[i];
+         if( reply.found ) continue;
+         const Entry * entry = Find(mark, requests[i]);
+         if( entry ) {
+            reply.found = true;
+            reply.cmd = entry->cmd;
+            reply.time = entry->time;
+            count++;
+         }
+      }
+      if( count == requests.size() || clock::now() >= deadline ) break;
+      cond.wait_until(guard, deadline);
+   }
+   return count;
+}
+
+uint64_t Replies::Latest(uint64_t mark, cec_logical_address addr,
+      cec_opcode opcode, Reply * reply) {
+   std::lock_guard<std::mutex> guard(lock);
+   std::unordered_map<uint32_t, Entry>::const_iterator it =
+      latest.find(Key(addr, opcode, false));
+   if( it == latest.end() || it->second.seq <= mark ) {
+      reply->found = false;
+      return 0;
+   }
+   reply->found = true;
+   reply->cmd = it->second.cmd;
+   reply->time = it->second.time;
+   return it->second.seq;
+}
+
+uint64_t Replies::WaitNext(uint64_t mark, clock::time_point deadline) {
+   std::unique_lock<std::mutex> guard(lock);
+   while( seq == mark && clock::now() < deadline ) {
+      cond.wait_until(guard, deadline);
+   }
+   return seq;
+}
@@ -0,0 +1,103 @@
+/* replies.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The latest frame of each opcode received from each device, so that a
+ * batch of requests can be sent back to back and the replies collected as
+ * they arrive, instead of waiting for each reply before sending the next
+ * request.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef REPLIES_H
+#define REPLIES_H
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <libcec/cec.h>
+
+// a reply to wait for: a frame with opcode from addr. A Feature Abort of
+// request from addr answers it too, with the abort as the reply
+struct ReplyRequest {
+   CEC::cec_logical_address addr;
+   CEC::cec_opcode request;
+   CEC::cec_opcode opcode;
+};
+
+// the answer to a ReplyRequest
+struct Reply {
+   bool found;
+   CEC::cec_command cmd;
+   // when it was received, in seconds since the epoch
+   double time;
+};
+
+class Replies {
+   public:
+      typedef std::chrono::steady_clock clock;
+
+      Replies();
+
+      // record a frame received from the bus
+      void Update(const CEC::cec_command & cmd);
+
+      // the point after which Wait counts a frame as a reply; take it
+      // before sending the requests
+      uint64_t Mark();
+
+      // wait until every request has an answer received after mark, or
+      // until deadline. replies[i] is set to the answer to requests[i].
+      // Returns the number answered
+      size_t Wait(uint64_t mark, const std::vector<ReplyRequest> & requests,
+            clock::time_point deadline, std::vector<Reply> * replies);
+
+      // the latest frame with opcode from addr received after mark.
+      // Returns its sequence number, or 0 if there is none
+      uint64_t Latest(uint64_t mark, CEC::cec_logical_address addr,
+            CEC::cec_opcode opcode, Reply * reply);
+
+      // wait until any frame is received after mark, or until deadline.
+      // Returns the new mark
+      uint64_t WaitNext(uint64_t mark, clock::time_point deadline);
+
+   private:
+      struct Entry {
+         uint64_t seq;
+         CEC::cec_command cmd;
+         double time;
+      };
+
+      // (addr, opcode), or (addr, aborted opcode) for Feature Abort
+      static uint32_t Key(CEC::cec_logical_address addr, uint8_t opcode,
+            bool abort);
+      // the answer to request after mark, or NULL; call with lock held
+      const Entry * Find(uint64_t mark, const ReplyRequest & request) const;
+
+      std::mutex lock;
+      std::condition_variable cond;
+      uint64_t seq;
+      std::unordered_map<uint32_t, Entry> latest;
+};
+
+#endif
@@ -0,0 +1,377 @@
+/* ring.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Publishing bus events in shared memory
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "ring.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <chrono>
+#include <thread>
+
+#if HAVE_SHARED_RING
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+using namespace CEC;
+
+static_assert(sizeof(RingHeader) == 64, "RingHeader is shared between builds");
+static_assert(sizeof(RingSlot) == RING_SLOT_SIZE,
+      "RingSlot is shared between builds");
+
+// the longest alert parameter kept in a slot
+#define RING_ALERT_TEXT 100
+
+EventRing::EventRing() : open(false), header(NULL), slots(NULL), size(0),
+   count(0) {
+}
+
+EventRing::~EventRing() {
+   Close();
+}
+
+void EventRing::KeyPress(int key, unsigned int duration) {
+   if( !open.load() ) return;
+   WireWriter event;
+   event.Put8((uint8_t)key);
+   event.Put32(duration);
+   Publish(WIRE_EVENT_KEYPRESS, event);
+}
+
+void EventRing::Command(const cec_command & cmd) {
+   if( !open.load() ) return;
+   WireWriter event;
+   event.PutCommand(cmd);
+   Publish(WIRE_EVENT_COMMAND, event);
+}
+
+void EventRing::Alert(int alert, const char * param) {
+   if( !open.load() ) return;
+   WireWriter event;
+   event.Put32(alert);
+   event.Put8(param != NULL);
+   std::string text(param ? param : "");
+   event.PutString(text.substr(0, RING_ALERT_TEXT));
+   Publish(WIRE_EVENT_ALERT, event);
+}
+
+#if HAVE_SHARED_RING
+
+static void ring_wake(RingHeader * header) {
+#ifdef __linux__
+   syscall(SYS_futex, &header->wake, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+   (void)header;
+#endif
+}
+
+// sleep until header->wake changes from value, or for timeout seconds
+static void ring_wait(RingHeader * header, uint32_t value, double timeout) {
+#ifdef __linux__
+   struct timespec ts;
+   struct timespec * tsp = NULL;
+   if( timeout >= 0 ) {
+      ts.tv_sec = (time_t)timeout;
+      ts.tv_nsec = (long)((timeout - ts.tv_sec) * 1e9);
+      tsp = &ts;
+   }
+   syscall(SYS_futex, &header->wake, FUTEX_WAIT, value, tsp, NULL, 0);
+#else
+   (void)header;
+   (void)value;
+   // no futex to wait on; poll
+   if( timeout < 0 || timeout > 0.001 ) timeout = 0.001;
+   std::this_thread::sleep_for(std::chrono::duration<double>(timeout));
+#endif
+}
+
+bool EventRing::Create(const std::string & ring_name, uint32_t n,
+      int mode, std::string * error) {
+   std::lock_guard<std::mutex> guard(lock);
+   Unmap();
+
+   // one left behind by an owner that exited without closing it
+   shm_unlink(ring_name.c_str());
+   int fd = shm_open(ring_name.c_str(), O_CREAT | O_EXCL | O_RDWR, mode);
+   if( fd < 0 ) {
+      *error = ring_name + ": " + strerror(errno);
+      return false;
+   }
+   // shm_open applies the umask
+   fchmod(fd, mode);
+   size_t map_size = sizeof(RingHeader) + n * sizeof(RingSlot);
+   if( ftruncate(fd, map_size) != 0 ) {
+      *error = ring_name + ": " + strerror(errno);
+      close(fd);
+      shm_unlink(ring_name.c_str());
+      return false;
+   }
+   void * map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+         fd, 0);
+   close(fd);
+   if( map == MAP_FAILED ) {
+      *error = ring_name + ": " + strerror(errno);
+      shm_unlink(ring_name.c_str());
+      return false;
+   }
+
+   header = (RingHeader *)map;
+   slots = (RingSlot *)(header + 1);
+   size = map_size;
+   name = ring_name;
+   count = n;
+   for( uint32_t i=0; i<n; i++ ) {
+      slots[i].seq.store(RING_WRITING, std::memory_order_relaxed);
+   }
+   header->version = RING_VERSION;
+   header->slots = n;
+   header->slot_size = sizeof(RingSlot);
+   header->head.store(0);
+   header->wake.store(0);
+   header->waiters.store(0);
+   header->closed.store(0);
+   // readers check the magic last
+   std::atomic_thread_fence(std::memory_order_release);
+   header->magic = RING_MAGIC;
+   open.store(true);
+   return true;
+}
+
+void EventRing::Close() {
+   std::lock_guard<std::mutex> guard(lock);
+   Unmap();
+}
+
+void EventRing::Unmap() {
+   if( header == NULL ) return;
+   open.store(false);
+   header->closed.store(1);
+   header->wake.fetch_add(1);
+   ring_wake(header);
+   munmap(header, size);
+   shm_unlink(name.c_str());
+   header = NULL;
+   slots = NULL;
+   size = 0;
+}
+
+void EventRing::Publish(uint16_t type, const WireWriter & event) {
+   std::lock_guard<std::mutex> guard(lock);
+   if( header == NULL ) return;
+   if( event.data.size() > sizeof(slots[0].data) ) return;
+
+   uint64_t seq = header->head.load(std::memory_order_relaxed);
+   RingSlot & slot = slots[seq & (count - 1)];
+   // readers that see this, before or after copying, drop the slot
+   slot.seq.store(RING_WRITING, std::memory_order_relaxed);
+   std::atomic_thread_fence(std::memory_order_release);
+   slot.type = type;
+   slot.size = (uint16_t)event.data.size();
+   memcpy(slot.data, event.data.data(), event.data.size());
+   slot.seq.store(seq, std::memory_order_release);
+
+   header->head.store(seq + 1);
+   header->wake.store((uint32_t)(seq + 1));
+   if( header->waiters.load() ) {
+      ring_wake(header);
+   }
+}
+
+RingReader::RingReader() : position(0), lost(0), header(NULL), slots(NULL),
+   size(0), count(0) {
+}
+
+RingReader::~RingReader() {
+   Detach();
+}
+
+bool RingReader::Attach(const std::string & name, std::string * error) {
+   Detach();
+   int fd = shm_open(name.c_str(), O_RDWR, 0);
+   if( fd < 0 ) {
+      *error = name + ": " + strerror(errno);
+      return false;
+   }
+   struct stat st;
+   if( fstat(fd, &st) != 0 ) {
+      *error = name + ": " + strerror(errno);
+      close(fd);
+      return false;
+   }
+   if( (size_t)st.st_size < sizeof(RingHeader) ) {
+      *error = name + ": not an event ring";
+      close(fd);
+      return false;
+   }
+   void * map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+         fd, 0);
+   close(fd);
+   if( map == MAP_FAILED ) {
+      *error = name + ": " + strerror(errno);
+      return false;
+   }
+
+   RingHeader * h = (RingHeader *)map;
+   uint32_t n = h->slots;
+   std::atomic_thread_fence(std::memory_order_acquire);
+   if( h->magic != RING_MAGIC || h->version != RING_VERSION ||
+         h->slot_size != sizeof(RingSlot) || n < RING_MIN_SLOTS ||
+         n > RING_MAX_SLOTS || (n & (n - 1)) ||
+         (size_t)st.st_size < sizeof(RingHeader) + n * sizeof(RingSlot) ) {
+      *error = name + ": not an event ring";
+      munmap(map, st.st_size);
+      return false;
+   }
+
+   header = h;
+   slots = (RingSlot *)(header + 1);
+   size = st.st_size;
+   count = n;
+   position = header->head.load();
+   lost = 0;
+   return true;
+}
+
+void RingReader::Detach() {
+   if( header == NULL ) return;
+   munmap(header, size);
+   header = NULL;
+   slots = NULL;
+   size = 0;
+}
+
+bool RingReader::Done() const {
+   return header == NULL || (header->closed.load() &&
+         header->head.load() == position);
+}
+
+bool RingReader::Copy(RingEvent * event) {
+   RingSlot & slot = slots[position & (count - 1)];
+   if( slot.seq.load(std::memory_order_acquire) != position ) return false;
+   uint16_t type = slot.type;
+   uint16_t length = slot.size;
+   if( length > sizeof(slot.data) ) return false;
+   event->type = type;
+   event->payload.assign((const char *)slot.data, length);
+   // if the writer started on the slot while we copied it, the copy is torn
+   std::atomic_thread_fence(std::memory_order_acquire);
+   return slot.seq.load(std::memory_order_relaxed) == position;
+}
+
+void RingReader::Read(std::vector<RingEvent> * events, size_t max,
+      double timeout) {
+   events->clear();
+   if( header == NULL ) return;
+   std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(timeout < 0 ? 0 : timeout));
+
+   while( true ) {
+      uint64_t head = header->head.load();
+      if( head - position > count ) {
+         // lapped; the oldest events still in the ring start at head - count
+         lost += head - count - position;
+         position = head - count;
+      }
+      while( position < head && events->size() < max ) {
+         RingEvent event;
+         if( Copy(&event) ) {
+            events->push_back(event);
+         } else {
+            lost++;
+         }
+         position++;
+      }
+      if( !events->empty() || timeout == 0 ) return;
+      if( header->closed.load() ) return;
+
+      double remaining = -1;
+      if( timeout > 0 ) {
+         remaining = std::chrono::duration<double>(
+               deadline - std::chrono::steady_clock::now()).count();
+         if( remaining <= 0 ) return;
+      }
+      header->waiters.fetch_add(1);
+      uint32_t value = header->wake.load();
+      if( header->head.load() == position && !header->closed.load() ) {
+         ring_wait(header, value, remaining);
+      }
+      header->waiters.fetch_sub(1);
+   }
+}
+
+#else
+
+bool EventRing::Create(const std::string &, uint32_t, int,
+      std::string * error) {
+   *error = "shared memory events are not supported on this platform";
+   return false;
+}
+
+void EventRing::Close() {
+}
+
+void EventRing::Unmap() {
+}
+
+void EventRing::Publish(uint16_t, const WireWriter &) {
+}
+
+RingReader::RingReader() : position(0), lost(0), header(NULL), slots(NULL),
+   size(0), count(0) {
+}
+
+RingReader::~RingReader() {
+}
+
+bool RingReader::Attach(const std::string &, std::string * error) {
+   *error = "shared memory events are not supported on this platform";
+   return false;
+}
+
+void RingReader::Detach() {
+}
+
+bool RingReader::Done() const {
+   return true;
+}
+
+bool RingReader::Copy(RingEvent *) {
+   return false;
+}
+
+void RingReader::Read(std::vector<RingEvent> * events, size_t, double) {
+   events->clear();
+}
+
+#endif
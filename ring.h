@@ -0,0 +1,153 @@
+/* ring.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Events from the bus published in POSIX shared memory, for any number of
+ * observers in other processes (cec.attach_shared). The owner of the
+ * adapter writes each event into the next slot of a ring and never waits
+ * for the readers; each reader keeps its own position and finds out
+ * from the sequence numbers when the writer has lapped it. Readers waiting
+ * for events sleep on a futex (on Linux; elsewhere they poll), which the
+ * writer only wakes when someone is waiting.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <libcec/cec.h>
+
+#include "wire.h"
+
+#ifndef _WIN32
+#define HAVE_SHARED_RING 1
+#else
+#define HAVE_SHARED_RING 0
+#endif
+
+#define RING_MAGIC     0x52434543 // "CECR"
+#define RING_VERSION   1
+#define RING_SLOT_SIZE 128
+#define RING_MIN_SLOTS 16
+#define RING_MAX_SLOTS (1 << 20)
+
+// at the start of the shared memory; the slots follow. The atomics must be
+// lock free to work between processes
+struct RingHeader {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t slots;      // a power of two
+   uint32_t slot_size;
+   // the sequence number of the next event
+   std::atomic<uint64_t> head;
+   // the low 32 bits of head, for the futex
+   std::atomic<uint32_t> wake;
+   std::atomic<uint32_t> waiters;
+   std::atomic<uint32_t> closed;
+   uint8_t pad[64 - 36];
+};
+
+struct RingSlot {
+   // the sequence number of the event in the slot, or RING_WRITING
+   std::atomic<uint64_t> seq;
+   uint16_t type;       // WIRE_EVENT_*, with the wire.h encoding
+   uint16_t size;
+   uint8_t data[RING_SLOT_SIZE - 12];
+};
+
+#define RING_WRITING UINT64_MAX
+
+// an event copied out of the ring
+struct RingEvent {
+   uint16_t type;
+   std::string payload;
+};
+
+class EventRing {
+   public:
+      EventRing();
+      ~EventRing();
+
+      // publish to the shared memory object name, replacing one left
+      // behind with that name. Returns false with error set
+      bool Create(const std::string & name, uint32_t slots, int mode,
+            std::string * error);
+      // tell the readers and remove the shared memory
+      void Close();
+
+      // events from the bus, called from libcec's callbacks
+      void KeyPress(int key, unsigned int duration);
+      void Command(const CEC::cec_command & cmd);
+      // param is NULL if the alert has none
+      void Alert(int alert, const char * param);
+
+   private:
+      void Publish(uint16_t type, const WireWriter & event);
+      void Unmap();
+
+      // lets the callbacks skip the lock when nothing is published
+      std::atomic<bool> open;
+      std::mutex lock;
+      std::string name;
+      RingHeader * header;
+      RingSlot * slots;
+      size_t size;
+      // not read back from header->slots, which readers can write
+      uint32_t count;
+};
+
+class RingReader {
+   public:
+      RingReader();
+      ~RingReader();
+
+      // start reading new events from name. Returns false with error set
+      bool Attach(const std::string & name, std::string * error);
+      void Detach();
+
+      // copy up to max events into events, waiting up to timeout seconds
+      // (forever if negative) for the first one. Events the writer
+      // overwrote before they were read are counted in lost
+      void Read(std::vector<RingEvent> * events, size_t max, double timeout);
+
+      bool Attached() const { return header != NULL; }
+      // whether the writer has stopped and every event was read
+      bool Done() const;
+
+      uint64_t position;
+      uint64_t lost;
+
+   private:
+      // the event at position, or false if it was overwritten
+      bool Copy(RingEvent * event);
+
+      RingHeader * header;
+      RingSlot * slots;
+      size_t size;
+      // header->slots, checked when attaching
+      uint32_t count;
+};
+
+#endif
@@ -0,0 +1,93 @@
+/* rules.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reflex rules
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "rules.h"
+
+using namespace CEC;
+
+RuleMatch::RuleMatch() : opcode(-1), initiators(0xFFFF),
+   destinations(0xFFFF) {
+}
+
+bool RuleMatch::Matches(const cec_command & cmd) const {
+   if( opcode >= 0 && (!cmd.opcode_set || (int)cmd.opcode != opcode) ) {
+      return false;
+   }
+   if( !(initiators & (1 << (cmd.initiator & 0xF))) ) return false;
+   if( !(destinations & (1 << (cmd.destination & 0xF))) ) return false;
+   if( pattern.size() > cmd.parameters.size ) return false;
+   for( size_t i=0; i<pattern.size(); i++ ) {
+      if( mask[i] && cmd.parameters.data[i] != pattern[i] ) return false;
+   }
+   return true;
+}
+
+Rule::Rule() : debounce(0), notify(false) {
+}
+
+Rules::Rules() : count(0), next_id(1) {
+}
+
+int Rules::Add(const Rule & rule) {
+   std::lock_guard<std::mutex> guard(lock);
+   Entry entry;
+   entry.id = next_id++;
+   entry.rule = rule;
+   entry.fired = false;
+   rules.push_back(entry);
+   count.store(rules.size());
+   return entry.id;
+}
+
+bool Rules::Remove(int id) {
+   std::lock_guard<std::mutex> guard(lock);
+   for( size_t i=0; i<rules.size(); i++ ) {
+      if( rules[i].id == id ) {
+         rules.erase(rules.begin() + i);
+         count.store(rules.size());
+         return true;
+      }
+   }
+   return false;
+}
+
+void Rules::Fire(const cec_command & cmd, std::vector<cec_command> * actions,
+      std::vector<int> * notify) {
+   if( count.load() == 0 ) return;
+   std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+   std::lock_guard<std::mutex> guard(lock);
+   for( size_t i=0; i<rules.size(); i++ ) {
+      Entry & entry = rules[i];
+      if( !entry.rule.match.Matches(cmd) ) continue;
+      if( entry.fired && now - entry.last < entry.rule.debounce ) continue;
+      entry.fired = true;
+      entry.last = now;
+      actions->insert(actions->end(), entry.rule.actions.begin(),
+            entry.rule.actions.end());
+      if( entry.rule.notify ) {
+         notify->push_back(entry.id);
+      }
+   }
+}
@@ -0,0 +1,94 @@
+/* rules.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reflex rules: frames sent in reply to frames received, matched and sent
+ * from libcec's callback thread without waiting for Python
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef RULES_H
+#define RULES_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include <libcec/cec.h>
+
+struct RuleMatch {
+   RuleMatch();
+
+   // -1 matches any opcode
+   int opcode;
+   // a bit for each logical address the frame may come from or go to
+   uint16_t initiators;
+   uint16_t destinations;
+   // parameters[i] must equal pattern[i] where mask[i] is set; frames with
+   // fewer parameters than the pattern don't match
+   std::vector<uint8_t> pattern;
+   std::vector<bool> mask;
+
+   bool Matches(const CEC::cec_command & cmd) const;
+};
+
+struct Rule {
+   Rule();
+
+   RuleMatch match;
+   // sent in order; an initiator of CECDEVICE_UNKNOWN is sent from the
+   // primary logical address
+   std::vector<CEC::cec_command> actions;
+   // the rule fires at most once in this long
+   std::chrono::steady_clock::duration debounce;
+   // whether Python wants to hear when it fires
+   bool notify;
+};
+
+class Rules {
+   public:
+      Rules();
+
+      // returns the id of the new rule
+      int Add(const Rule & rule);
+      bool Remove(int id);
+
+      // the rules cmd fires: their actions are appended to actions, and
+      // the ids of those that notify to notify
+      void Fire(const CEC::cec_command & cmd,
+            std::vector<CEC::cec_command> * actions, std::vector<int> * notify);
+
+   private:
+      struct Entry {
+         int id;
+         Rule rule;
+         bool fired;
+         std::chrono::steady_clock::time_point last;
+      };
+
+      // lets Fire skip the lock when there are no rules
+      std::atomic<size_t> count;
+      std::mutex lock;
+      int next_id;
+      std::vector<Entry> rules;
+};
+
+#endif
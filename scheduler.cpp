@@ -0,0 +1,193 @@
+/* scheduler.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Scheduled transmits
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "scheduler.h"
+#include <algorithm>
+
+using namespace CEC;
+
+static const Scheduler::clock::duration tick_length =
+   std::chrono::milliseconds(SCHEDULER_TICK_MS);
+
+Scheduler::Scheduler(Send send) : send(send), stopping(false), next_id(1),
+   wheel(SCHEDULER_SLOTS), epoch(clock::now()), current(0),
+   random((unsigned)epoch.time_since_epoch().count()) {
+}
+
+Scheduler::~Scheduler() {
+   Stop();
+}
+
+uint64_t Scheduler::TickOf(clock::time_point time) const {
+   if( time <= epoch ) return 0;
+   return (time - epoch) / tick_length;
+}
+
+void Scheduler::Place(int id, Timer & timer) {
+   clock::duration offset = timer.due - epoch;
+   timer.tick = 0;
+   if( offset > clock::duration::zero() ) {
+      timer.tick = (offset + tick_length - clock::duration(1)) / tick_length;
+   }
+   // already due; the wheel fires it as it passes the next tick
+   if( timer.tick <= current ) timer.tick = current + 1;
+   wheel[timer.tick % SCHEDULER_SLOTS].push_back(id);
+}
+
+int Scheduler::Add(const std::vector<cec_command> & frames,
+      clock::time_point at, clock::duration period, clock::duration jitter) {
+   std::lock_guard<std::mutex> guard(lock);
+   // the wheel stands still while it is empty; start it again from now
+   if( timers.empty() ) current = TickOf(clock::now());
+   int id = next_id++;
+   Timer & timer = timers[id];
+   timer.frames = frames;
+   timer.period = period;
+   timer.jitter = jitter;
+   timer.nominal = at;
+   timer.due = at;
+   if( jitter > clock::duration::zero() ) {
+      timer.due += clock::duration(std::uniform_int_distribution<
+            clock::rep>(0, jitter.count())(random));
+   }
+   timer.fired = 0;
+   timer.late_max = clock::duration::zero();
+   Place(id, timer);
+   if( !thread.joinable() && !stopping ) {
+      thread = std::thread(&Scheduler::Run, this);
+   }
+   cond.notify_all();
+   return id;
+}
+
+bool Scheduler::Cancel(int id) {
+   std::lock_guard<std::mutex> guard(lock);
+   return timers.erase(id) > 0;
+}
+
+std::vector<Scheduler::Info> Scheduler::List() {
+   std::lock_guard<std::mutex> guard(lock);
+   std::vector<Info> result;
+   for( std::map<int, Timer>::iterator itr = timers.begin();
+         itr != timers.end(); ++itr ) {
+      Info info;
+      info.id = itr->first;
+      info.fired = itr->second.fired;
+      info.last = itr->second.last;
+      info.next = itr->second.due;
+      info.late_max = itr->second.late_max;
+      result.push_back(info);
+   }
+   return result;
+}
+
+void Scheduler::Stop() {
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+      cond.notify_all();
+   }
+   if( thread.joinable() ) thread.join();
+   std::lock_guard<std::mutex> guard(lock);
+   timers.clear();
+   for( size_t i=0; i<wheel.size(); i++ ) {
+      wheel[i].clear();
+   }
+   // the next Add starts the thread again
+   stopping = false;
+}
+
+void Scheduler::Run() {
+   struct Firing {
+      std::vector<cec_command> frames;
+      clock::duration late;
+   };
+   std::unique_lock<std::mutex> guard(lock);
+   while( !stopping ) {
+      if( timers.empty() ) {
+         cond.wait(guard);
+         continue;
+      }
+      clock::time_point now = clock::now();
+      uint64_t tick = TickOf(now);
+      if( tick <= current ) {
+         cond.wait_until(guard, epoch + tick_length * (current + 1));
+         continue;
+      }
+
+      // after a long stall one turn of the wheel visits every timer
+      uint64_t passed = current;
+      current = tick;
+      uint64_t last = (std::min)(tick, passed + SCHEDULER_SLOTS);
+      std::vector<Firing> firings;
+      for( uint64_t t = passed + 1; t <= last; t++ ) {
+         std::vector<int> ids;
+         ids.swap(wheel[t % SCHEDULER_SLOTS]);
+         for( size_t i=0; i<ids.size(); i++ ) {
+            std::map<int, Timer>::iterator itr = timers.find(ids[i]);
+            // cancelled
+            if( itr == timers.end() ) continue;
+            Timer & timer = itr->second;
+            if( timer.tick > tick ) {
+               // due on a later turn
+               wheel[t % SCHEDULER_SLOTS].push_back(ids[i]);
+               continue;
+            }
+            Firing firing;
+            firing.frames = timer.frames;
+            firing.late = (std::max)(now - timer.due,
+                  clock::duration::zero());
+            firings.push_back(firing);
+            timer.fired++;
+            timer.last = now;
+            timer.late_max = (std::max)(timer.late_max, firing.late);
+            if( timer.period == clock::duration::zero() ) {
+               timers.erase(itr);
+               continue;
+            }
+            // keep to the period from the first due time, and skip the
+            // firings a stall made us miss rather than sending them in a
+            // burst
+            timer.nominal += timer.period;
+            if( timer.nominal <= now ) {
+               timer.nominal += timer.period *
+                  ((now - timer.nominal) / timer.period + 1);
+            }
+            timer.due = timer.nominal;
+            if( timer.jitter > clock::duration::zero() ) {
+               timer.due += clock::duration(std::uniform_int_distribution<
+                     clock::rep>(0, timer.jitter.count())(random));
+            }
+            Place(ids[i], timer);
+         }
+      }
+
+      if( firings.empty() ) continue;
+      guard.unlock();
+      for( size_t i=0; i<firings.size(); i++ ) {
+         send(firings[i].frames, firings[i].late);
+      }
+      guard.lock();
+   }
+}
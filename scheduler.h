@@ -0,0 +1,116 @@
+/* scheduler.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Scheduled transmits: frames sent at a given time, once or periodically,
+ * from a timer wheel on a native thread so that they go out on time
+ * whatever the interpreter is doing
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <libcec/cec.h>
+
+// the wheel turns one slot per tick; timers further out than a turn wait
+// in their slot for the turns in between
+#define SCHEDULER_TICK_MS 10
+#define SCHEDULER_SLOTS 256
+
+class Scheduler {
+   public:
+      typedef std::chrono::steady_clock clock;
+      // sends the frames of a timer that fired late after its due time.
+      // Called on the scheduler's thread, without the GIL
+      typedef std::function<void(const std::vector<CEC::cec_command> &,
+            clock::duration late)> Send;
+
+      struct Info {
+         int id;
+         uint64_t fired;
+         // time_point() if the timer hasn't fired yet
+         clock::time_point last;
+         clock::time_point next;
+         clock::duration late_max;
+      };
+
+      Scheduler(Send send);
+      ~Scheduler();
+
+      // returns the id of the new timer. A period of zero fires once; a
+      // nonzero jitter delays each firing by a random part of it
+      int Add(const std::vector<CEC::cec_command> & frames,
+            clock::time_point at, clock::duration period,
+            clock::duration jitter);
+      bool Cancel(int id);
+      std::vector<Info> List();
+
+      // cancels every timer and waits for any send in progress. Must be
+      // called without the GIL held.
+      void Stop();
+
+   private:
+      struct Timer {
+         std::vector<CEC::cec_command> frames;
+         clock::duration period;
+         clock::duration jitter;
+         // when the timer is due before jitter, and after it
+         clock::time_point nominal;
+         clock::time_point due;
+         uint64_t tick;
+         uint64_t fired;
+         clock::time_point last;
+         clock::duration late_max;
+      };
+
+      void Run();
+      // puts timer in the slot of the first tick at or after its due time
+      void Place(int id, Timer & timer);
+      uint64_t TickOf(clock::time_point time) const;
+
+      Send send;
+
+      std::mutex lock;
+      std::condition_variable cond;
+      std::thread thread;
+      bool stopping;
+
+      int next_id;
+      std::map<int, Timer> timers;
+      // ids of the timers in each slot; cancelled ones are dropped as the
+      // wheel passes them
+      std::vector<std::vector<int> > wheel;
+      clock::time_point epoch;
+      // the last tick the wheel has passed
+      uint64_t current;
+      std::minstd_rand random;
+};
+
+#endif
@@ -0,0 +1,526 @@
+/* server.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Serves an adapter to other processes over a UNIX socket
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "server.h"
+
+#include <string.h>
+#include <condition_variable>
+#include <deque>
+
+#if HAVE_CEC_SERVER
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace CEC;
+
+struct ServerClient {
+   int fd;
+   std::thread reader;
+   std::thread writer;
+
+   // guards the rest; the writer thread waits on cond for messages
+   std::mutex lock;
+   std::condition_variable cond;
+   std::deque<std::string> queue;
+   WireFilter filter;
+   // whether the client introduced itself with a compatible version; no
+   // events are sent before that
+   bool hello;
+   bool closed;
+
+   ServerClient(int f) : fd(f), hello(false), closed(false) {}
+};
+
+Server::Server() : lib(NULL), callbacks(NULL), param(NULL), listen_fd(-1),
+      count(0) {
+   wake_fd[0] = wake_fd[1] = -1;
+}
+
+Server::~Server() {
+   Stop();
+}
+
+#if HAVE_CEC_SERVER
+
+// queue a message for a client; events are dropped once it falls too far
+// behind, replies never are
+static void client_send(ServerClient * client, const std::string & frame,
+      bool event) {
+   std::lock_guard<std::mutex> guard(client->lock);
+   if( client->closed ) return;
+   if( event && client->queue.size() >= SERVER_MAX_QUEUE ) return;
+   client->queue.push_back(frame);
+   client->cond.notify_one();
+}
+
+// the writer thread of a client
+static void client_write(ServerClient * client) {
+   std::unique_lock<std::mutex> guard(client->lock);
+   while( true ) {
+      while( !client->closed && client->queue.empty() ) {
+         client->cond.wait(guard);
+      }
+      if( client->closed ) break;
+      std::string frame;
+      frame.swap(client->queue.front());
+      client->queue.pop_front();
+      guard.unlock();
+      bool written = WireWrite(client->fd, frame);
+      guard.lock();
+      if( !written ) {
+         // wake the reader too
+         client->closed = true;
+         shutdown(client->fd, SHUT_RDWR);
+      }
+   }
+}
+
+static void close_on_exec(int fd) {
+   fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+}
+
+// a listening socket at path, or -1 with error set
+static int listen_at(const std::string & path, std::string * error) {
+   struct sockaddr_un addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   if( path.empty() || path.size() >= sizeof(addr.sun_path) ) {
+      *error = "Invalid socket path: " + path;
+      return -1;
+   }
+   memcpy(addr.sun_path, path.c_str(), path.size());
+
+   // a socket left behind by a server that has gone away is replaced; one
+   // that still accepts connections is not
+   struct stat st;
+   if( stat(path.c_str(), &st) == 0 ) {
+      if( !S_ISSOCK(st.st_mode) ) {
+         *error = path + " exists and is not a socket";
+         return -1;
+      }
+      int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+      bool live = probe >= 0 &&
+         connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+      if( probe >= 0 ) close(probe);
+      if( live ) {
+         *error = path + " is in use by another server";
+         return -1;
+      }
+      unlink(path.c_str());
+   }
+
+   int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if( fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+         listen(fd, 16) < 0 ) {
+      *error = "Failed to listen on " + path + ": " + strerror(errno);
+      if( fd >= 0 ) close(fd);
+      return -1;
+   }
+   close_on_exec(fd);
+   return fd;
+}
+
+bool Server::Start(Backend * l, ICECCallbacks * c, void * p,
+      const std::string & socket_path, std::string * error) {
+   std::lock_guard<std::mutex> guard(control);
+   // keep serving at the old path if the new one can't be used
+   if( socket_path == path ) Shutdown();
+   int fd = listen_at(socket_path, error);
+   if( fd < 0 ) return false;
+   Shutdown();
+   if( pipe(wake_fd) < 0 ) {
+      *error = std::string("Failed to start the server: ") + strerror(errno);
+      close(fd);
+      unlink(socket_path.c_str());
+      wake_fd[0] = wake_fd[1] = -1;
+      return false;
+   }
+   close_on_exec(wake_fd[0]);
+   close_on_exec(wake_fd[1]);
+
+   lib = l;
+   callbacks = c;
+   param = p;
+   path = socket_path;
+   listen_fd = fd;
+   acceptor = std::thread(&Server::Accept, this);
+   return true;
+}
+
+void Server::Stop() {
+   std::lock_guard<std::mutex> guard(control);
+   Shutdown();
+}
+
+void Server::Shutdown() {
+   if( listen_fd < 0 ) return;
+   char wake = 0;
+   while( write(wake_fd[1], &wake, 1) < 0 && errno == EINTR );
+   acceptor.join();
+   close(listen_fd);
+   close(wake_fd[0]);
+   close(wake_fd[1]);
+   listen_fd = wake_fd[0] = wake_fd[1] = -1;
+   unlink(path.c_str());
+   path.clear();
+   Reap(true);
+}
+
+void Server::Accept() {
+   while( true ) {
+      struct pollfd fds[2];
+      fds[0].fd = listen_fd;
+      fds[0].events = POLLIN;
+      fds[1].fd = wake_fd[0];
+      fds[1].events = POLLIN;
+      // wake up now and then to clean up after clients that have left
+      int n = poll(fds, 2, 1000);
+      if( n < 0 && errno != EINTR ) break;
+      if( n > 0 && fds[1].revents ) break;
+      Reap(false);
+      if( n <= 0 || !(fds[0].revents & POLLIN) ) continue;
+
+      int fd = accept(listen_fd, NULL, NULL);
+      if( fd < 0 ) continue;
+      close_on_exec(fd);
+      ServerClient * client = new ServerClient(fd);
+      client->writer = std::thread(client_write, client);
+      client->reader = std::thread(&Server::Serve, this, client);
+      std::lock_guard<std::mutex> guard(lock);
+      clients.push_back(client);
+      count++;
+   }
+}
+
+// clean up after the clients that have disconnected, or all of them
+void Server::Reap(bool all) {
+   std::vector<ServerClient *> done;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      std::vector<ServerClient *>::iterator it = clients.begin();
+      while( it != clients.end() ) {
+         ServerClient * client = *it;
+         std::lock_guard<std::mutex> client_guard(client->lock);
+         if( all && !client->closed ) {
+            client->closed = true;
+            shutdown(client->fd, SHUT_RDWR);
+            client->cond.notify_all();
+         }
+         if( client->closed ) {
+            done.push_back(client);
+            it = clients.erase(it);
+            count--;
+         } else {
+            ++it;
+         }
+      }
+   }
+   for( size_t i=0; i<done.size(); i++ ) {
+      done[i]->reader.join();
+      done[i]->writer.join();
+      close(done[i]->fd);
+      delete done[i];
+   }
+}
+
+// the reader thread of a client: run its requests in order until it
+// disconnects or breaks the protocol
+void Server::Serve(ServerClient * client) {
+   WireHeader header;
+   std::string payload;
+   while( WireRead(client->fd, &header, &payload) &&
+         Handle(client, header, payload) );
+   std::lock_guard<std::mutex> guard(client->lock);
+   client->closed = true;
+   shutdown(client->fd, SHUT_RDWR);
+   client->cond.notify_all();
+}
+
+bool Server::Handle(ServerClient * client, const WireHeader & header,
+      const std::string & payload) {
+   WireReader args(payload);
+   WireWriter reply;
+   if( header.type != WIRE_HELLO && !client->hello ) return false;
+
+   switch( header.type ) {
+      case WIRE_HELLO: {
+         uint16_t version = args.Get16();
+         uint32_t config_size = args.Get32();
+         uint32_t adapter_size = args.Get32();
+         WireFilter filter = args.GetFilter();
+         bool accepted = args.ok && version == WIRE_VERSION &&
+            config_size == sizeof(libcec_configuration) &&
+            adapter_size == sizeof(CEC_ADAPTER_TYPE);
+         std::lock_guard<std::mutex> guard(client->lock);
+         client->filter = filter;
+         client->hello = accepted;
+         reply.Put8(accepted);
+         break;
+      }
+      case WIRE_TRANSMIT: {
+         cec_command cmd = args.GetCommand();
+         if( !args.ok ) return false;
+         reply.Put8(lib->Transmit(cmd));
+         break;
+      }
+      case WIRE_LOGICAL_ADDRESSES:
+      case WIRE_ACTIVE_DEVICES: {
+         cec_logical_addresses addrs = header.type == WIRE_ACTIVE_DEVICES ?
+            lib->GetActiveDevices() : lib->GetLogicalAddresses();
+         reply.Put8((uint8_t)addrs.primary);
+         uint16_t mask = 0;
+         for( int i=0; i<16; i++ ) {
+            if( addrs[i] ) mask |= 1 << i;
+         }
+         reply.Put16(mask);
+         break;
+      }
+      case WIRE_IS_ACTIVE_SOURCE:
+      case WIRE_STREAM_PATH_ADDR:
+      case WIRE_POWER_ON:
+      case WIRE_STANDBY: {
+         cec_logical_address addr = (cec_logical_address)args.Get8();
+         if( !args.ok ) return false;
+         bool result;
+         if( header.type == WIRE_IS_ACTIVE_SOURCE ) {
+            result = lib->IsActiveSource(addr);
+         } else if( header.type == WIRE_STREAM_PATH_ADDR ) {
+            result = lib->SetStreamPath(addr);
+         } else if( header.type == WIRE_POWER_ON ) {
+            result = lib->PowerOnDevices(addr);
+         } else {
+            result = lib->StandbyDevices(addr);
+         }
+         reply.Put8(result);
+         break;
+      }
+      case WIRE_SET_ACTIVE_SOURCE: {
+         cec_device_type type = (cec_device_type)args.Get8();
+         if( !args.ok ) return false;
+         reply.Put8(lib->SetActiveSource(type));
+         break;
+      }
+      case WIRE_STREAM_PATH_PA:
+      case WIRE_SET_PHYSICAL_ADDRESS: {
+         uint16_t pa = args.Get16();
+         if( !args.ok ) return false;
+         reply.Put8(header.type == WIRE_STREAM_PATH_PA ?
+               lib->SetStreamPath(pa) : lib->SetPhysicalAddress(pa));
+         break;
+      }
+      case WIRE_SET_HDMI_PORT: {
+         cec_logical_address base = (cec_logical_address)args.Get8();
+         uint8_t port = args.Get8();
+         if( !args.ok ) return false;
+         reply.Put8(lib->SetHDMIPort(base, port));
+         break;
+      }
+      case WIRE_VOLUME_UP:
+         reply.Put8(lib->VolumeUp());
+         break;
+      case WIRE_VOLUME_DOWN:
+         reply.Put8(lib->VolumeDown());
+         break;
+      case WIRE_TOGGLE_MUTE:
+         reply.Put8(lib->AudioToggleMute());
+         break;
+      case WIRE_GET_CONFIGURATION: {
+         libcec_configuration config;
+         reply.Put8(lib->GetCurrentConfiguration(&config));
+         reply.Put(&config, sizeof(config));
+         break;
+      }
+      case WIRE_SET_CONFIGURATION:
+      case WIRE_PERSIST: {
+         libcec_configuration config;
+         args.Get(&config, sizeof(config));
+         if( !args.ok ) return false;
+         // the callbacks and client version belong to this process
+         libcec_configuration current;
+         if( lib->GetCurrentConfiguration(&current) ) {
+            config.clientVersion = current.clientVersion;
+         }
+         config.callbacks = callbacks;
+         config.callbackParam = param;
+         reply.Put8(header.type == WIRE_PERSIST ?
+               lib->PersistConfiguration(&config) :
+               lib->SetConfiguration(&config));
+         break;
+      }
+      case WIRE_CAN_PERSIST:
+         reply.Put8(lib->CanPersistConfiguration());
+         break;
+      case WIRE_POWER_STATUS:
+      case WIRE_VENDOR_ID:
+      case WIRE_PHYSICAL_ADDRESS:
+      case WIRE_CEC_VERSION:
+      case WIRE_OSD_NAME:
+      case WIRE_MENU_LANGUAGE: {
+         cec_logical_address addr = (cec_logical_address)args.Get8();
+         if( !args.ok ) return false;
+         if( header.type == WIRE_POWER_STATUS ) {
+            reply.Put8((uint8_t)lib->GetDevicePowerStatus(addr));
+         } else if( header.type == WIRE_VENDOR_ID ) {
+            reply.Put64(lib->GetDeviceVendorId(addr));
+         } else if( header.type == WIRE_PHYSICAL_ADDRESS ) {
+            reply.Put16(lib->GetDevicePhysicalAddress(addr));
+         } else if( header.type == WIRE_CEC_VERSION ) {
+            reply.Put8((uint8_t)lib->GetDeviceCecVersion(addr));
+         } else if( header.type == WIRE_OSD_NAME ) {
+            reply.PutString(lib->GetDeviceOSDName(addr));
+         } else {
+            reply.PutString(lib->GetDeviceMenuLanguage(addr));
+         }
+         break;
+      }
+      case WIRE_DETECT_ADAPTERS: {
+         CEC_ADAPTER_TYPE list[16];
+         uint32_t size = args.Get32();
+         bool quick = args.Get8();
+         if( !args.ok ) return false;
+         if( size > 16 ) size = 16;
+         int found = lib->DetectAdapters(list, size, quick);
+         if( found < 0 ) found = 0;
+         reply.Put32(found);
+         reply.Put(list, sizeof(list[0]) *
+               ((uint32_t)found < size ? found : size));
+         break;
+      }
+      default:
+         return false;
+   }
+   client_send(client, WireFrame(header.type, header.id, reply.data), false);
+   return true;
+}
+
+void Server::Publish(uint16_t type, const WireWriter & event,
+      const cec_command * cmd) {
+   std::string frame = WireFrame(type, 0, event.data);
+   std::lock_guard<std::mutex> guard(lock);
+   for( size_t i=0; i<clients.size(); i++ ) {
+      ServerClient * client = clients[i];
+      bool wanted;
+      {
+         std::lock_guard<std::mutex> client_guard(client->lock);
+         wanted = client->hello && (cmd ? client->filter.Passes(*cmd) :
+               (client->filter.events & WIRE_EVENT_BIT(type)) != 0);
+      }
+      if( wanted ) client_send(client, frame, true);
+   }
+}
+
+void Server::Log(int level, int64_t time, const char * message) {
+   if( count.load() == 0 ) return;
+   WireWriter event;
+   event.Put32(level);
+   event.Put64(time);
+   event.PutString(message);
+   Publish(WIRE_EVENT_LOG, event, NULL);
+}
+
+void Server::KeyPress(int key, unsigned int duration) {
+   if( count.load() == 0 ) return;
+   WireWriter event;
+   event.Put8((uint8_t)key);
+   event.Put32(duration);
+   Publish(WIRE_EVENT_KEYPRESS, event, NULL);
+}
+
+void Server::Command(const cec_command & cmd) {
+   if( count.load() == 0 ) return;
+   WireWriter event;
+   event.PutCommand(cmd);
+   Publish(WIRE_EVENT_COMMAND, event, &cmd);
+}
+
+void Server::Configuration(const libcec_configuration & config) {
+   if( count.load() == 0 ) return;
+   WireWriter event;
+   event.Put(&config, sizeof(config));
+   Publish(WIRE_EVENT_CONFIG, event, NULL);
+}
+
+void Server::Alert(int alert, const char * alert_param) {
+   if( count.load() == 0 ) return;
+   WireWriter event;
+   event.Put32(alert);
+   event.Put8(alert_param != NULL);
+   event.PutString(alert_param ? alert_param : "");
+   Publish(WIRE_EVENT_ALERT, event, NULL);
+}
+
+void Server::MenuState(int state) {
+   if( count.load() == 0 ) return;
+   WireWriter event;
+   event.Put32(state);
+   Publish(WIRE_EVENT_MENU, event, NULL);
+}
+
+void Server::SourceActivated(cec_logical_address addr, bool active) {
+   if( count.load() == 0 ) return;
+   WireWriter event;
+   event.Put8((uint8_t)addr);
+   event.Put8(active);
+   Publish(WIRE_EVENT_ACTIVATED, event, NULL);
+}
+
+#else
+
+bool Server::Start(Backend * l, ICECCallbacks * c, void * p,
+      const std::string & socket_path, std::string * error) {
+   *error = "Serving an adapter requires libcec 4 or later and UNIX sockets";
+   return false;
+}
+
+void Server::Stop() {
+}
+
+void Server::Log(int level, int64_t time, const char * message) {
+}
+
+void Server::KeyPress(int key, unsigned int duration) {
+}
+
+void Server::Command(const cec_command & cmd) {
+}
+
+void Server::Configuration(const libcec_configuration & config) {
+}
+
+void Server::Alert(int alert, const char * alert_param) {
+}
+
+void Server::MenuState(int state) {
+}
+
+void Server::SourceActivated(cec_logical_address addr, bool active) {
+}
+
+#endif
@@ -0,0 +1,102 @@
+/* server.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Shares one adapter between processes. Adapter.serve() listens on a UNIX
+ * socket and runs the Backend calls of each client (init("unix://...")),
+ * and passes the events from the bus on to the clients that subscribed to
+ * them. Each client has a thread that runs its requests in order and one
+ * that writes to it, so a slow client doesn't hold up the bus or the
+ * others; a client that falls more than SERVER_MAX_QUEUE messages behind
+ * loses events.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libcec/cec.h>
+
+#include "backend.h"
+#include "wire.h"
+
+#define SERVER_MAX_QUEUE 1024
+
+struct ServerClient;
+
+class Server {
+   public:
+      Server();
+      ~Server();
+
+      // serve lib at path, replacing any server already running. Changes
+      // clients make to the configuration keep callbacks and param. Must be
+      // called without the GIL held. Returns false with error set
+      bool Start(Backend * lib, CEC::ICECCallbacks * callbacks, void * param,
+            const std::string & path, std::string * error);
+      // disconnect every client and remove the socket. Must be called
+      // without the GIL held
+      void Stop();
+
+      // events from the bus, called from libcec's callbacks
+      void Log(int level, int64_t time, const char * message);
+      void KeyPress(int key, unsigned int duration);
+      void Command(const CEC::cec_command & cmd);
+      void Configuration(const CEC::libcec_configuration & config);
+      // param is NULL if the alert has none
+      void Alert(int alert, const char * param);
+      void MenuState(int state);
+      void SourceActivated(CEC::cec_logical_address addr, bool active);
+
+   private:
+      void Shutdown();
+      void Accept();
+      void Reap(bool all);
+      void Publish(uint16_t type, const WireWriter & event,
+            const CEC::cec_command * cmd);
+      void Serve(ServerClient * client);
+      bool Handle(ServerClient * client, const WireHeader & header,
+            const std::string & payload);
+
+      Backend * lib;
+      CEC::ICECCallbacks * callbacks;
+      void * param;
+      // serializes Start and Stop
+      std::mutex control;
+      std::string path;
+      int listen_fd;
+      // written to wake the accept thread when stopping
+      int wake_fd[2];
+      std::thread acceptor;
+
+      // clients is shared with libcec's callback thread; count lets the
+      // callbacks skip encoding events when nobody listens
+      std::mutex lock;
+      std::vector<ServerClient *> clients;
+      std::atomic<int> count;
+};
+
+#endif
@@ -10,7 +10,18 @@ if "CFLAGS" in cfg_vars:
 if "OPT" in cfg_vars:
     cfg_vars["OPT"] = cfg_vars["OPT"].replace("-Wstrict-prototypes", "")
 
-python_cec = Extension('cec', sources = [ 'cec.cpp', 'device.cpp' ], 
+python_cec = Extension('cec', sources = [ 'cec.cpp', 'device.cpp',
+                                          'adapter.cpp', 'topology.cpp',
+                                          'detect.cpp', 'supervisor.cpp',
+                                          'config.cpp', 'backend.cpp',
+                                          'sim.cpp', 'stats.cpp',
+                                          'opcodes.cpp', 'command.cpp',
+                                          'msg.cpp', 'args.cpp',
+                                          'gilcheck.cpp', 'replies.cpp',
+                                          'wire.cpp', 'server.cpp',
+                                          'remote.cpp', 'ring.cpp',
+                                          'shared.cpp', 'rules.cpp',
+                                          'devcache.cpp', 'scheduler.cpp' ],
                         include_dirs=['include'],
                         libraries = [ 'cec' ])
 
@@ -26,4 +37,5 @@ setup(name='cec', version='0.2.8',
       author="Austin Hendrix",
       author_email="namniart@gmail.com",
       data_files=['COPYING'],
+      python_requires='>=3.9',
       ext_modules=[python_cec])
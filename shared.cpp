@@ -0,0 +1,260 @@
+/* shared.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reading events published in shared memory
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "shared.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "adapter.h"
+#include "args.h"
+#include "command.h"
+#include "wire.h"
+
+using namespace CEC;
+
+// read() waits in slices this long, to notice signals and close()
+#define SHARED_WAIT_SLICE 0.5
+
+// the callback arguments for an event, or NULL without an exception if it
+// can't be decoded
+static PyObject * event_args(ModuleState * state, const RingEvent & event) {
+   WireReader reader(event.payload);
+   switch( event.type ) {
+      case WIRE_EVENT_KEYPRESS: {
+         uint8_t key = reader.Get8();
+         uint32_t duration = reader.Get32();
+         if( !reader.ok ) return NULL;
+         return Py_BuildValue("(iBI)", EVENT_KEYPRESS, key, duration);
+      }
+      case WIRE_EVENT_COMMAND: {
+         cec_command cmd = reader.GetCommand();
+         if( !reader.ok ) return NULL;
+         return Py_BuildValue("(iN)", EVENT_COMMAND,
+               CommandNew(state->command_type, cmd));
+      }
+      case WIRE_EVENT_ALERT: {
+         int alert = (int)reader.Get32();
+         bool has_param = reader.Get8();
+         std::string text = reader.GetString();
+         if( !reader.ok ) return NULL;
+         PyObject * param = Py_None;
+         if( has_param ) {
+            // the publisher may have cut the text mid-character
+            param = PyUnicode_DecodeUTF8(text.data(), text.size(), "replace");
+         } else {
+            Py_INCREF(param);
+         }
+         return Py_BuildValue("(iiN)", EVENT_ALERT, alert, param);
+      }
+   }
+   return NULL;
+}
+
+static PyObject * SharedEvents_read(SharedEvents * self,
+      PyObject * const * args, Py_ssize_t nargs, PyObject * kwnames) {
+   static const char * kwlist[] = {"timeout", NULL};
+   PyObject * values[ARGS_MAX];
+   double timeout = -1;
+
+   if( !ArgsParse("read", args, nargs, kwnames, kwlist, 0, values) ) {
+      return NULL;
+   }
+   if( values[0] && values[0] != Py_None ) {
+      if( !ArgDouble(values[0], &timeout) ) return NULL;
+      if( !(timeout >= 0) ) {
+         PyErr_SetString(PyExc_ValueError, "timeout must not be negative");
+         return NULL;
+      }
+   }
+   if( !self->reader->Attached() ) {
+      PyErr_SetString(PyExc_ValueError, "SharedEvents is closed");
+      return NULL;
+   }
+
+   std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(timeout < 0 ? 0 : timeout));
+   std::vector<RingEvent> events;
+   bool done = false;
+   while( true ) {
+      double slice = SHARED_WAIT_SLICE;
+      if( timeout >= 0 ) {
+         double remaining = std::chrono::duration<double>(
+               deadline - std::chrono::steady_clock::now()).count();
+         slice = (std::min)(slice, (std::max)(remaining, 0.0));
+      }
+      Py_BEGIN_ALLOW_THREADS
+      {
+         std::lock_guard<std::mutex> guard(*self->lock);
+         if( self->closing->load() ) {
+            done = true;
+         } else {
+            self->reader->Read(&events, SIZE_MAX, slice);
+            done = self->reader->Done();
+         }
+      }
+      Py_END_ALLOW_THREADS
+      if( !events.empty() || done ) break;
+      if( timeout >= 0 && std::chrono::steady_clock::now() >= deadline ) {
+         break;
+      }
+      if( PyErr_CheckSignals() < 0 ) return NULL;
+   }
+   if( events.empty() && done ) {
+      Py_RETURN_NONE;
+   }
+
+   ModuleState * state = ModuleStateFromType(Py_TYPE(self));
+   PyObject * result = PyList_New(0);
+   if( result == NULL ) return NULL;
+   for( size_t i=0; i<events.size(); i++ ) {
+      PyObject * item = event_args(state, events[i]);
+      if( item == NULL ) {
+         if( PyErr_Occurred() ) {
+            Py_DECREF(result);
+            return NULL;
+         }
+         self->reader->lost++;
+         continue;
+      }
+      int err = PyList_Append(result, item);
+      Py_DECREF(item);
+      if( err < 0 ) {
+         Py_DECREF(result);
+         return NULL;
+      }
+   }
+   return result;
+}
+
+static PyObject * SharedEvents_close(SharedEvents * self, PyObject * unused) {
+   self->closing->store(true);
+   // a read() in another thread lets go within a slice
+   Py_BEGIN_ALLOW_THREADS
+   {
+      std::lock_guard<std::mutex> guard(*self->lock);
+      self->reader->Detach();
+   }
+   Py_END_ALLOW_THREADS
+   Py_RETURN_NONE;
+}
+
+static PyObject * SharedEvents_getLost(SharedEvents * self, void * closure) {
+   return PyLong_FromUnsignedLongLong(self->reader->lost);
+}
+
+static PyObject * SharedEvents_getClosed(SharedEvents * self,
+      void * closure) {
+   std::unique_lock<std::mutex> guard(*self->lock, std::try_to_lock);
+   // a read() is in progress, so neither side has closed yet
+   if( !guard.owns_lock() ) Py_RETURN_FALSE;
+   return PyBool_FromLong(self->reader->Done());
+}
+
+static void SharedEvents_dealloc(SharedEvents * self) {
+   PyTypeObject * type = Py_TYPE(self);
+   delete self->reader;
+   delete self->lock;
+   delete self->closing;
+   type->tp_free((PyObject*)self);
+   Py_DECREF(type);
+}
+
+#pragma GCC diagnostic ignored "-Wwrite-strings"
+static PyGetSetDef SharedEvents_getset[] = {
+   {"lost", (getter)SharedEvents_getLost, (setter)NULL,
+      "Events overwritten by the publisher before they were read"},
+   {"closed", (getter)SharedEvents_getClosed, (setter)NULL,
+      "Whether the publisher stopped and every event was read, or close() "
+      "was called"},
+   {NULL}
+};
+
+static PyMethodDef SharedEvents_methods[] = {
+   {"read", (PyCFunction)SharedEvents_read, METH_FASTCALL | METH_KEYWORDS,
+      "The events since the last read, as (event, ...) callback arguments, "
+      "waiting up to timeout seconds for one; None once the publisher stops"},
+   {"close", (PyCFunction)SharedEvents_close, METH_NOARGS,
+      "Stop reading and unmap the shared memory"},
+   {NULL, NULL, 0, NULL}
+};
+
+static PyType_Slot SharedEvents_slots[] = {
+   {Py_tp_dealloc, (void*)SharedEvents_dealloc},
+   {Py_tp_methods, SharedEvents_methods},
+   {Py_tp_getset, SharedEvents_getset},
+   {Py_tp_doc, (void*)"Events published by another process with "
+      "Adapter.publish_shared"},
+   {0, NULL}
+};
+
+static PyType_Spec SharedEvents_spec = {
+   "cec.SharedEvents",
+   sizeof(SharedEvents),
+   0,
+   Py_TPFLAGS_DEFAULT,
+   SharedEvents_slots
+};
+
+PyTypeObject * SharedEventsTypeInit(PyObject * module) {
+   return (PyTypeObject*)PyType_FromModuleAndSpec(module, &SharedEvents_spec,
+         NULL);
+}
+
+PyObject * SharedAttach(PyObject * module, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames) {
+   ModuleState * state = (ModuleState*)PyModule_GetState(module);
+   static const char * kwlist[] = {"name", NULL};
+   PyObject * values[ARGS_MAX];
+   const char * name;
+
+   if( !ArgsParse("attach_shared", args, nargs, kwnames, kwlist, 1, values) ||
+         !ArgString(values[0], "name", &name) ) {
+      return NULL;
+   }
+
+   RingReader * reader = new RingReader();
+   std::string error;
+   if( !reader->Attach(name, &error) ) {
+      delete reader;
+      PyErr_SetString(PyExc_IOError, error.c_str());
+      return NULL;
+   }
+   PyTypeObject * type = state->shared_type;
+   SharedEvents * self = (SharedEvents *)type->tp_alloc(type, 0);
+   if( self == NULL ) {
+      delete reader;
+      return NULL;
+   }
+   self->reader = reader;
+   self->lock = new std::mutex();
+   self->closing = new std::atomic<bool>(false);
+   return (PyObject *)self;
+}
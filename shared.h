@@ -0,0 +1,52 @@
+/* shared.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * cec.SharedEvents: a reader of the events another process publishes with
+ * Adapter.publish_shared, returned by cec.attach_shared
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef SHARED_H
+#define SHARED_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <atomic>
+#include <mutex>
+
+#include "ring.h"
+
+struct SharedEvents {
+   PyObject_HEAD
+
+   RingReader * reader;
+   // held by read() while it waits without the GIL
+   std::mutex * lock;
+   std::atomic<bool> * closing;
+};
+
+PyTypeObject * SharedEventsTypeInit(PyObject * module);
+
+// cec.attach_shared(name)
+PyObject * SharedAttach(PyObject * module, PyObject * const * args,
+      Py_ssize_t nargs, PyObject * kwnames);
+
+#endif
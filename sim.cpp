@@ -0,0 +1,1061 @@
+/* sim.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the simulated CEC bus
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+using namespace CEC;
+
+SimDevice::SimDevice() : present(false), nack(false),
+      physical_address(0xFFFF), vendor(0), language("eng"),
+      power(CEC_POWER_STATUS_ON), version(CEC_VERSION_1_4), volume(50),
+      muted(false) {
+}
+
+#if HAVE_SIM_BACKEND
+
+// user control codes the virtual devices understand
+#define KEY_POWER               0x40
+#define KEY_VOLUME_UP           0x41
+#define KEY_VOLUME_DOWN         0x42
+#define KEY_MUTE                0x43
+#define KEY_POWER_OFF_FUNCTION  0x6C
+#define KEY_POWER_ON_FUNCTION   0x6D
+
+// <Feature Abort> reason
+#define ABORT_UNRECOGNIZED_OPCODE 0x00
+
+static cec_device_type device_type(cec_logical_address addr) {
+   switch( addr ) {
+      case CECDEVICE_TV:
+         return CEC_DEVICE_TYPE_TV;
+      case CECDEVICE_RECORDINGDEVICE1:
+      case CECDEVICE_RECORDINGDEVICE2:
+      case CECDEVICE_RECORDINGDEVICE3:
+         return CEC_DEVICE_TYPE_RECORDING_DEVICE;
+      case CECDEVICE_TUNER1:
+      case CECDEVICE_TUNER2:
+      case CECDEVICE_TUNER3:
+      case CECDEVICE_TUNER4:
+         return CEC_DEVICE_TYPE_TUNER;
+      case CECDEVICE_PLAYBACKDEVICE1:
+      case CECDEVICE_PLAYBACKDEVICE2:
+      case CECDEVICE_PLAYBACKDEVICE3:
+         return CEC_DEVICE_TYPE_PLAYBACK_DEVICE;
+      case CECDEVICE_AUDIOSYSTEM:
+         return CEC_DEVICE_TYPE_AUDIO_SYSTEM;
+      default:
+         return CEC_DEVICE_TYPE_RESERVED;
+   }
+}
+
+// logical addresses a device of each type may claim, in order
+static const cec_logical_address * type_addresses(cec_device_type type) {
+   static const cec_logical_address tv[] = { CECDEVICE_TV,
+      CECDEVICE_UNKNOWN };
+   static const cec_logical_address recorder[] = {
+      CECDEVICE_RECORDINGDEVICE1, CECDEVICE_RECORDINGDEVICE2,
+      CECDEVICE_RECORDINGDEVICE3, CECDEVICE_UNKNOWN };
+   static const cec_logical_address tuner[] = { CECDEVICE_TUNER1,
+      CECDEVICE_TUNER2, CECDEVICE_TUNER3, CECDEVICE_TUNER4,
+      CECDEVICE_UNKNOWN };
+   static const cec_logical_address player[] = { CECDEVICE_PLAYBACKDEVICE1,
+      CECDEVICE_PLAYBACKDEVICE2, CECDEVICE_PLAYBACKDEVICE3,
+      CECDEVICE_UNKNOWN };
+   static const cec_logical_address audio[] = { CECDEVICE_AUDIOSYSTEM,
+      CECDEVICE_UNKNOWN };
+   switch( type ) {
+      case CEC_DEVICE_TYPE_TV: return tv;
+      case CEC_DEVICE_TYPE_TUNER: return tuner;
+      case CEC_DEVICE_TYPE_PLAYBACK_DEVICE: return player;
+      case CEC_DEVICE_TYPE_AUDIO_SYSTEM: return audio;
+      default: return recorder;
+   }
+}
+
+static const char * default_name(cec_device_type type) {
+   switch( type ) {
+      case CEC_DEVICE_TYPE_TV: return "TV";
+      case CEC_DEVICE_TYPE_RECORDING_DEVICE: return "Recorder";
+      case CEC_DEVICE_TYPE_TUNER: return "Tuner";
+      case CEC_DEVICE_TYPE_PLAYBACK_DEVICE: return "Player";
+      case CEC_DEVICE_TYPE_AUDIO_SYSTEM: return "Audio";
+      default: return "Device";
+   }
+}
+
+static uint16_t param_physical_addr(const cec_command & cmd, uint8_t pos) {
+   if( cmd.parameters.size < pos + 2 ) return 0xFFFF;
+   return (cmd.parameters[pos] << 8) | cmd.parameters[pos + 1];
+}
+
+static void push_physical_addr(cec_command & cmd, uint16_t pa) {
+   cmd.parameters.PushBack(pa >> 8);
+   cmd.parameters.PushBack(pa & 0xFF);
+}
+
+SimBackend::SimBackend(const libcec_configuration * c) : open(false),
+      config(*c), persisted(*c), local_pa(0x1000), active(CECDEVICE_UNKNOWN),
+      local_active(false), latency(0), spacing(0),
+      key(CEC_USER_CONTROL_CODE_UNKNOWN) {
+   local.Clear();
+   started = clock::now();
+}
+
+SimBackend::~SimBackend() {
+   Close();
+}
+
+bool SimBackend::Open(const char * port) {
+   size_t prefix = strlen(SIM_URL_PREFIX);
+   if( strncmp(port, SIM_URL_PREFIX, prefix) != 0 ) return false;
+
+   // parse the options before touching the bus
+   std::vector<int> addrs(1, CECDEVICE_TV);
+   double latency_ms = 0;
+   double rate = 0;
+   const char * query = port + prefix;
+   if( *query == '?' ) query++;
+   else if( *query ) return false;
+   while( *query ) {
+      const char * end = query + strcspn(query, "&");
+      const char * eq = (const char *)memchr(query, '=', end - query);
+      if( eq == NULL ) return false;
+      std::string name(query, eq - query);
+      std::string value(eq + 1, end - eq - 1);
+      char * rest;
+      if( name == "devices" ) {
+         addrs.clear();
+         const char * p = value.c_str();
+         while( *p ) {
+            long addr = strtol(p, &rest, 10);
+            if( rest == p || addr < 0 || addr > 14 ) return false;
+            addrs.push_back((int)addr);
+            p = (*rest == ',') ? rest + 1 : rest;
+            if( *rest && *rest != ',' ) return false;
+         }
+      } else if( name == "latency" ) {
+         latency_ms = strtod(value.c_str(), &rest);
+         if( *rest || latency_ms < 0 ) return false;
+      } else if( name == "rate" ) {
+         rate = strtod(value.c_str(), &rest);
+         if( *rest || rate < 0 ) return false;
+      } else {
+         return false;
+      }
+      query = *end ? end + 1 : end;
+   }
+
+   Close();
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if( config.bGetSettingsFromROM ) {
+         ICECCallbacks * callbacks = config.callbacks;
+         void * param = config.callbackParam;
+         config = persisted;
+         config.callbacks = callbacks;
+         config.callbackParam = param;
+      }
+      for( int i=0; i<16; i++ ) {
+         devices[i] = SimDevice();
+      }
+      uint8_t next_port = 2;
+      for( size_t i=0; i<addrs.size(); i++ ) {
+         cec_logical_address addr = (cec_logical_address)addrs[i];
+         SimDevice & dev = devices[addr];
+         cec_device_type type = device_type(addr);
+         dev.present = true;
+         dev.osd_name = default_name(type);
+         if( type == CEC_DEVICE_TYPE_TV ) {
+            dev.physical_address = 0x0000;
+         } else if( next_port <= 15 ) {
+            dev.physical_address = next_port++ << 12;
+         }
+      }
+      active = CECDEVICE_UNKNOWN;
+      local_active = false;
+      latency = std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double, std::milli>(latency_ms));
+      spacing = std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(rate > 0 ? 1.0 / rate : 0));
+      bus_free = clock::now();
+      ClaimAddresses();
+      open = true;
+      thread = std::thread(&SimBackend::Run, this);
+   }
+
+   if( config.bActivateSource ) {
+      SetActiveSource(CEC_DEVICE_TYPE_RESERVED);
+   }
+   return true;
+}
+
+void SimBackend::Close() {
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if( !open ) return;
+      open = false;
+      events.clear();
+   }
+   cond.notify_all();
+   if( thread.get_id() == std::this_thread::get_id() ) {
+      // closed from a callback; the bus thread exits when it returns
+      thread.detach();
+   } else {
+      thread.join();
+   }
+}
+
+int SimBackend::DetectAdapters(CEC_ADAPTER_TYPE * list, int size,
+      bool quick) {
+   // the simulator is never detected, only opened by name
+   return 0;
+}
+
+// claim a logical address for each configured device type, avoiding the
+// virtual devices; call with the lock held
+void SimBackend::ClaimAddresses() {
+   local.Clear();
+   for( int i=0; i<5; i++ ) {
+      cec_device_type type = config.deviceTypes.types[i];
+      if( type == CEC_DEVICE_TYPE_RESERVED ) continue;
+      for( const cec_logical_address * addr = type_addresses(type);
+            *addr != CECDEVICE_UNKNOWN; addr++ ) {
+         if( !devices[*addr].present && !local.IsSet(*addr) ) {
+            local.Set(*addr);
+            break;
+         }
+      }
+   }
+   if( local.IsEmpty() ) {
+      local.Set(CECDEVICE_FREEUSE);
+   }
+
+   if( config.iPhysicalAddress != 0 && config.iPhysicalAddress != 0xFFFF ) {
+      local_pa = config.iPhysicalAddress;
+   } else if( config.iHDMIPort >= 1 && config.iHDMIPort <= 15 ) {
+      local_pa = config.iHDMIPort << 12;
+   }
+   config.logicalAddresses = local;
+   config.iPhysicalAddress = local_pa;
+}
+
+// reserve the bus for one frame and return when it will have been sent;
+// call with the lock held
+SimBackend::clock::time_point SimBackend::Reserve() {
+   clock::time_point start = std::max(clock::now(), bus_free);
+   bus_free = start + spacing;
+   return start + latency;
+}
+
+void SimBackend::Queue(clock::time_point due, const Event & event) {
+   events.insert(std::make_pair(due, event));
+   cond.notify_all();
+}
+
+SimBackend::clock::time_point SimBackend::QueueFrame(const cec_command & cmd) {
+   Event event;
+   event.type = BUS_FRAME;
+   event.cmd = cmd;
+   clock::time_point due = Reserve();
+   Queue(due, event);
+   return due;
+}
+
+// a frame as libcec logs it, e.g. "<< 10:36"
+static std::string format_frame(const char * direction,
+      const cec_command & cmd) {
+   char text[8 + 3 * (CEC_MAX_DATA_PACKET_SIZE + 2)];
+   int len = snprintf(text, sizeof(text), "%s %X%X", direction,
+         cmd.initiator & 0xF, cmd.destination & 0xF);
+   if( cmd.opcode_set ) {
+      len += snprintf(text + len, sizeof(text) - len, ":%02X", cmd.opcode);
+   }
+   for( uint8_t i=0; i<cmd.parameters.size; i++ ) {
+      len += snprintf(text + len, sizeof(text) - len, ":%02X",
+            cmd.parameters[i]);
+   }
+   return text;
+}
+
+void SimBackend::QueueLog(const char * direction, const cec_command & cmd) {
+   Event event;
+   event.type = BUS_LOG;
+   event.text = format_frame(direction, cmd);
+   Queue(clock::now(), event);
+}
+
+bool SimBackend::Local(cec_logical_address addr) const {
+   return addr >= CECDEVICE_TV && addr < CECDEVICE_BROADCAST &&
+      local.IsSet(addr);
+}
+
+bool SimBackend::Acked(cec_logical_address addr) const {
+   if( addr == CECDEVICE_BROADCAST || Local(addr) ) return true;
+   if( addr < CECDEVICE_TV || addr > CECDEVICE_BROADCAST ) return false;
+   return devices[addr].present && !devices[addr].nack;
+}
+
+// a frame from this host is on the bus: let the virtual devices act on it
+// and queue their replies. If reply is not CEC_OPCODE_NONE, the first
+// reply with that opcode from the destination is returned in params and
+// its delivery time in reply_due. Call with the lock held.
+bool SimBackend::SendLocked(const cec_command & cmd, cec_opcode reply,
+      cec_datapacket * params, clock::time_point * reply_due) {
+   QueueLog("<<", cmd);
+   if( !Acked(cmd.destination) ) return false;
+   Observe(cmd);
+   std::vector<cec_command> replies;
+   Route(cmd, &replies);
+   for( size_t i=0; i<replies.size(); i++ ) {
+      clock::time_point due = QueueFrame(replies[i]);
+      if( reply != CEC_OPCODE_NONE && replies[i].opcode == reply &&
+            replies[i].initiator == cmd.destination ) {
+         *params = replies[i].parameters;
+         *reply_due = due;
+         reply = CEC_OPCODE_NONE;
+      }
+   }
+   return true;
+}
+
+// hand a frame to each virtual device that receives it; call with the
+// lock held
+void SimBackend::Route(const cec_command & cmd,
+      std::vector<cec_command> * replies) {
+   if( cmd.destination == CECDEVICE_BROADCAST ) {
+      for( int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++ ) {
+         if( devices[i].present && i != cmd.initiator ) {
+            Handle((cec_logical_address)i, cmd, replies);
+         }
+      }
+      // like libcec, announce ourselves when routed to
+      uint16_t pa = 0xFFFF;
+      if( cmd.opcode == CEC_OPCODE_SET_STREAM_PATH ) {
+         pa = param_physical_addr(cmd, 0);
+      } else if( cmd.opcode == CEC_OPCODE_ROUTING_CHANGE ) {
+         pa = param_physical_addr(cmd, 2);
+      }
+      if( pa == local_pa && !Local(cmd.initiator) ) {
+         cec_command announce;
+         cec_command::Format(announce, local.primary, CECDEVICE_BROADCAST,
+               CEC_OPCODE_ACTIVE_SOURCE);
+         push_physical_addr(announce, local_pa);
+         replies->push_back(announce);
+      }
+   } else if( cmd.destination >= CECDEVICE_TV &&
+         devices[cmd.destination].present ) {
+      Handle(cmd.destination, cmd, replies);
+   }
+}
+
+// the behaviour of a virtual device; call with the lock held
+void SimBackend::Handle(cec_logical_address addr, const cec_command & cmd,
+      std::vector<cec_command> * replies) {
+   SimDevice & dev = devices[addr];
+   if( !cmd.opcode_set ) return;
+
+   std::map<uint8_t, std::vector<cec_command> >::const_iterator script =
+      dev.script.find(cmd.opcode);
+   if( script != dev.script.end() ) {
+      for( size_t i=0; i<script->second.size(); i++ ) {
+         cec_command reply = script->second[i];
+         reply.initiator = addr;
+         if( reply.destination == CECDEVICE_UNKNOWN ) {
+            reply.destination = cmd.initiator;
+         }
+         replies->push_back(reply);
+      }
+      return;
+   }
+
+   bool broadcast = cmd.destination == CECDEVICE_BROADCAST;
+   cec_command reply;
+   cec_command::Format(reply, addr, cmd.initiator, CEC_OPCODE_NONE);
+   switch( cmd.opcode ) {
+      case CEC_OPCODE_GIVE_DEVICE_POWER_STATUS:
+         cec_command::Format(reply, addr, cmd.initiator,
+               CEC_OPCODE_REPORT_POWER_STATUS);
+         reply.parameters.PushBack(dev.power);
+         break;
+      case CEC_OPCODE_GIVE_PHYSICAL_ADDRESS:
+         cec_command::Format(reply, addr, CECDEVICE_BROADCAST,
+               CEC_OPCODE_REPORT_PHYSICAL_ADDRESS);
+         push_physical_addr(reply, dev.physical_address);
+         reply.parameters.PushBack(device_type(addr));
+         break;
+      case CEC_OPCODE_GIVE_OSD_NAME:
+         cec_command::Format(reply, addr, cmd.initiator,
+               CEC_OPCODE_SET_OSD_NAME);
+         for( size_t i=0; i<dev.osd_name.size() && i<14; i++ ) {
+            reply.parameters.PushBack(dev.osd_name[i]);
+         }
+         break;
+      case CEC_OPCODE_GIVE_DEVICE_VENDOR_ID:
+         cec_command::Format(reply, addr, CECDEVICE_BROADCAST,
+               CEC_OPCODE_DEVICE_VENDOR_ID);
+         reply.parameters.PushBack((dev.vendor >> 16) & 0xFF);
+         reply.parameters.PushBack((dev.vendor >> 8) & 0xFF);
+         reply.parameters.PushBack(dev.vendor & 0xFF);
+         break;
+      case CEC_OPCODE_GET_CEC_VERSION:
+         cec_command::Format(reply, addr, cmd.initiator,
+               CEC_OPCODE_CEC_VERSION);
+         reply.parameters.PushBack(dev.version);
+         break;
+      case CEC_OPCODE_GET_MENU_LANGUAGE:
+         cec_command::Format(reply, addr, CECDEVICE_BROADCAST,
+               CEC_OPCODE_SET_MENU_LANGUAGE);
+         for( size_t i=0; i<3; i++ ) {
+            reply.parameters.PushBack(i < dev.language.size() ?
+                  dev.language[i] : ' ');
+         }
+         break;
+      case CEC_OPCODE_IMAGE_VIEW_ON:
+      case CEC_OPCODE_TEXT_VIEW_ON:
+         dev.power = CEC_POWER_STATUS_ON;
+         break;
+      case CEC_OPCODE_STANDBY:
+         dev.power = CEC_POWER_STATUS_STANDBY;
+         break;
+      case CEC_OPCODE_USER_CONTROL_PRESSED:
+         switch( cmd.parameters[0] ) {
+            case KEY_POWER:
+               dev.power = (dev.power == CEC_POWER_STATUS_ON) ?
+                  CEC_POWER_STATUS_STANDBY : CEC_POWER_STATUS_ON;
+               break;
+            case KEY_POWER_ON_FUNCTION:
+               dev.power = CEC_POWER_STATUS_ON;
+               break;
+            case KEY_POWER_OFF_FUNCTION:
+               dev.power = CEC_POWER_STATUS_STANDBY;
+               break;
+            case KEY_VOLUME_UP:
+            case KEY_VOLUME_DOWN:
+            case KEY_MUTE:
+               if( cmd.parameters[0] == KEY_MUTE ) {
+                  dev.muted = !dev.muted;
+               } else {
+                  dev.muted = false;
+                  if( cmd.parameters[0] == KEY_VOLUME_UP ) {
+                     dev.volume = std::min(dev.volume + 1, 100);
+                  } else {
+                     dev.volume = std::max(dev.volume - 1, 0);
+                  }
+               }
+               cec_command::Format(reply, addr, cmd.initiator,
+                     CEC_OPCODE_REPORT_AUDIO_STATUS);
+               reply.parameters.PushBack((dev.muted ? 0x80 : 0) | dev.volume);
+               break;
+         }
+         break;
+      case CEC_OPCODE_GIVE_AUDIO_STATUS:
+         cec_command::Format(reply, addr, cmd.initiator,
+               CEC_OPCODE_REPORT_AUDIO_STATUS);
+         reply.parameters.PushBack((dev.muted ? 0x80 : 0) | dev.volume);
+         break;
+      case CEC_OPCODE_SET_STREAM_PATH:
+      case CEC_OPCODE_ROUTING_CHANGE:
+         if( param_physical_addr(cmd,
+                  cmd.opcode == CEC_OPCODE_ROUTING_CHANGE ? 2 : 0) ==
+               dev.physical_address ) {
+            dev.power = CEC_POWER_STATUS_ON;
+            cec_command::Format(reply, addr, CECDEVICE_BROADCAST,
+                  CEC_OPCODE_ACTIVE_SOURCE);
+            push_physical_addr(reply, dev.physical_address);
+         }
+         break;
+      case CEC_OPCODE_REQUEST_ACTIVE_SOURCE:
+         if( active == addr ) {
+            cec_command::Format(reply, addr, CECDEVICE_BROADCAST,
+                  CEC_OPCODE_ACTIVE_SOURCE);
+            push_physical_addr(reply, dev.physical_address);
+         }
+         break;
+      // replies and announcements need no answer
+      case CEC_OPCODE_FEATURE_ABORT:
+      case CEC_OPCODE_USER_CONTROL_RELEASE:
+      case CEC_OPCODE_REPORT_POWER_STATUS:
+      case CEC_OPCODE_REPORT_PHYSICAL_ADDRESS:
+      case CEC_OPCODE_SET_OSD_NAME:
+      case CEC_OPCODE_DEVICE_VENDOR_ID:
+      case CEC_OPCODE_CEC_VERSION:
+      case CEC_OPCODE_SET_MENU_LANGUAGE:
+      case CEC_OPCODE_REPORT_AUDIO_STATUS:
+      case CEC_OPCODE_ACTIVE_SOURCE:
+      case CEC_OPCODE_INACTIVE_SOURCE:
+      case CEC_OPCODE_ROUTING_INFORMATION:
+         break;
+      default:
+         if( !broadcast ) {
+            cec_command::Format(reply, addr, cmd.initiator,
+                  CEC_OPCODE_FEATURE_ABORT);
+            reply.parameters.PushBack(cmd.opcode);
+            reply.parameters.PushBack(ABORT_UNRECOGNIZED_OPCODE);
+         }
+         break;
+   }
+   if( reply.opcode_set ) {
+      replies->push_back(reply);
+   }
+}
+
+// track the active source from a frame on the bus; call with the lock held
+void SimBackend::Observe(const cec_command & cmd) {
+   if( !cmd.opcode_set ) return;
+   cec_logical_address previous = active;
+   switch( cmd.opcode ) {
+      case CEC_OPCODE_ACTIVE_SOURCE:
+         active = cmd.initiator;
+         break;
+      case CEC_OPCODE_INACTIVE_SOURCE:
+         if( active == cmd.initiator ) active = CECDEVICE_UNKNOWN;
+         break;
+      case CEC_OPCODE_STANDBY:
+         if( cmd.destination == CECDEVICE_BROADCAST ||
+               cmd.destination == active ) {
+            active = CECDEVICE_UNKNOWN;
+         }
+         break;
+      default:
+         break;
+   }
+   bool now_local = Local(active);
+   if( now_local != local_active ) {
+      local_active = now_local;
+      Event event;
+      event.type = BUS_ACTIVATED;
+      event.addr = now_local ? active : previous;
+      event.active = now_local;
+      Queue(clock::now(), event);
+   }
+}
+
+void SimBackend::Run() {
+   std::unique_lock<std::mutex> guard(lock);
+   while( open ) {
+      if( events.empty() ) {
+         cond.wait(guard);
+         continue;
+      }
+      std::multimap<clock::time_point, Event>::iterator next = events.begin();
+      if( next->first > clock::now() ) {
+         cond.wait_until(guard, next->first);
+         continue;
+      }
+      Event event = next->second;
+      events.erase(next);
+
+      if( event.type == BUS_FRAME ) {
+         // a frame from a virtual device reaches the rest of the bus
+         const cec_command & cmd = event.cmd;
+         if( !Acked(cmd.destination) ) continue;
+         Observe(cmd);
+         std::vector<cec_command> replies;
+         Route(cmd, &replies);
+         for( size_t i=0; i<replies.size(); i++ ) {
+            QueueFrame(replies[i]);
+         }
+         if( !Local(cmd.destination) &&
+               cmd.destination != CECDEVICE_BROADCAST ) {
+            continue;
+         }
+      }
+
+      ICECCallbacks * callbacks = config.callbacks;
+      void * param = config.callbackParam;
+      libcec_configuration current;
+      if( event.type == BUS_CONFIG ) {
+         current = config;
+      }
+      guard.unlock();
+      if( callbacks ) {
+         Deliver(event, callbacks, param, current);
+      }
+      guard.lock();
+   }
+}
+
+// run the libcec callbacks for an event; called on the bus thread without
+// the lock
+void SimBackend::Deliver(const Event & event, ICECCallbacks * callbacks,
+      void * param, const libcec_configuration & current) {
+   cec_log_message message;
+   message.level = CEC_LOG_TRAFFIC;
+   message.time = std::chrono::duration_cast<std::chrono::milliseconds>(
+         clock::now() - started).count();
+   switch( event.type ) {
+      case BUS_LOG:
+         if( callbacks->logMessage ) {
+            message.message = event.text.c_str();
+            callbacks->logMessage(param, &message);
+         }
+         break;
+      case BUS_FRAME: {
+         const cec_command & cmd = event.cmd;
+         if( callbacks->logMessage ) {
+            std::string text = format_frame(">>", cmd);
+            message.message = text.c_str();
+            callbacks->logMessage(param, &message);
+         }
+         if( cmd.opcode_set && callbacks->keyPress &&
+               cmd.destination != CECDEVICE_BROADCAST ) {
+            cec_keypress keypress;
+            if( cmd.opcode == CEC_OPCODE_USER_CONTROL_PRESSED ) {
+               key = (cec_user_control_code)cmd.parameters[0];
+               key_time = clock::now();
+               keypress.keycode = key;
+               keypress.duration = 0;
+               callbacks->keyPress(param, &keypress);
+            } else if( cmd.opcode == CEC_OPCODE_USER_CONTROL_RELEASE &&
+                  key != CEC_USER_CONTROL_CODE_UNKNOWN ) {
+               keypress.keycode = key;
+               keypress.duration = std::chrono::duration_cast<
+                  std::chrono::milliseconds>(clock::now() - key_time).count();
+               key = CEC_USER_CONTROL_CODE_UNKNOWN;
+               callbacks->keyPress(param, &keypress);
+            }
+         }
+         if( callbacks->commandReceived ) {
+            callbacks->commandReceived(param, &cmd);
+         }
+         break;
+      }
+      case BUS_ACTIVATED:
+         if( callbacks->sourceActivated ) {
+            callbacks->sourceActivated(param, event.addr, event.active);
+         }
+         break;
+      case BUS_CONFIG:
+         if( callbacks->configurationChanged ) {
+            callbacks->configurationChanged(param, &current);
+         }
+         break;
+   }
+}
+
+// put a frame from this host on the bus once it is free
+bool SimBackend::Request(const cec_command & cmd, cec_opcode reply,
+      cec_datapacket * params) {
+   clock::time_point due;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if( !open ) return false;
+      due = Reserve();
+   }
+   std::this_thread::sleep_until(due);
+
+   clock::time_point reply_due;
+   bool ack;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if( !open ) return false;
+      ack = SendLocked(cmd, reply, params, &reply_due);
+   }
+   if( reply == CEC_OPCODE_NONE ) return ack;
+
+   // wait for the reply to cross the bus, like libcec does
+   if( !ack || reply_due == clock::time_point() ) return false;
+   std::this_thread::sleep_until(reply_due);
+   return true;
+}
+
+bool SimBackend::Query(cec_logical_address addr, cec_opcode opcode,
+      cec_opcode reply, cec_datapacket * params) {
+   cec_command cmd;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      cec_command::Format(cmd, local.primary, addr, opcode);
+   }
+   return Request(cmd, reply, params);
+}
+
+bool SimBackend::Press(cec_logical_address addr, uint8_t code) {
+   cec_command press;
+   cec_command release;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      cec_command::Format(press, local.primary, addr,
+            CEC_OPCODE_USER_CONTROL_PRESSED);
+      cec_command::Format(release, local.primary, addr,
+            CEC_OPCODE_USER_CONTROL_RELEASE);
+   }
+   press.parameters.PushBack(code);
+   bool ack = Request(press);
+   Request(release);
+   return ack;
+}
+
+bool SimBackend::Transmit(const cec_command & cmd) {
+   return Request(cmd);
+}
+
+cec_logical_addresses SimBackend::GetLogicalAddresses() {
+   std::lock_guard<std::mutex> guard(lock);
+   return local;
+}
+
+cec_logical_addresses SimBackend::GetActiveDevices() {
+   std::lock_guard<std::mutex> guard(lock);
+   cec_logical_addresses result = local;
+   for( int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++ ) {
+      if( devices[i].present && !devices[i].nack ) {
+         result.Set((cec_logical_address)i);
+      }
+   }
+   return result;
+}
+
+bool SimBackend::IsActiveSource(cec_logical_address addr) {
+   std::lock_guard<std::mutex> guard(lock);
+   return active == addr;
+}
+
+bool SimBackend::SetActiveSource(cec_device_type type) {
+   cec_command cmd;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      cec_command::Format(cmd, local.primary, CECDEVICE_BROADCAST,
+            CEC_OPCODE_ACTIVE_SOURCE);
+      push_physical_addr(cmd, local_pa);
+   }
+   return Request(cmd);
+}
+
+bool SimBackend::SetStreamPath(cec_logical_address addr) {
+   uint16_t pa;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if( Local(addr) ) {
+         pa = local_pa;
+      } else if( addr >= CECDEVICE_TV && addr < CECDEVICE_BROADCAST &&
+            devices[addr].present ) {
+         pa = devices[addr].physical_address;
+      } else {
+         return false;
+      }
+   }
+   return SetStreamPath(pa);
+}
+
+bool SimBackend::SetStreamPath(uint16_t pa) {
+   cec_command cmd;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      cec_command::Format(cmd, local.primary, CECDEVICE_BROADCAST,
+            CEC_OPCODE_SET_STREAM_PATH);
+   }
+   push_physical_addr(cmd, pa);
+   return Request(cmd);
+}
+
+bool SimBackend::SetPhysicalAddress(uint16_t pa) {
+   cec_command cmd;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      local_pa = pa;
+      config.iPhysicalAddress = pa;
+      cec_command::Format(cmd, local.primary, CECDEVICE_BROADCAST,
+            CEC_OPCODE_REPORT_PHYSICAL_ADDRESS);
+      push_physical_addr(cmd, pa);
+      cmd.parameters.PushBack(device_type(local.primary));
+   }
+   return Request(cmd);
+}
+
+bool SimBackend::SetHDMIPort(cec_logical_address base, uint8_t port) {
+   if( port < 1 || port > 15 ) return false;
+   uint16_t parent;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if( base == CECDEVICE_TV ) {
+         parent = 0x0000;
+      } else if( base > CECDEVICE_TV && base < CECDEVICE_BROADCAST &&
+            devices[base].present ) {
+         parent = devices[base].physical_address;
+      } else {
+         return false;
+      }
+   }
+   // the child address replaces the first zero nibble of the parent
+   for( int shift = 12; shift >= 0; shift -= 4 ) {
+      if( ((parent >> shift) & 0xF) == 0 ) {
+         return SetPhysicalAddress(parent | (port << shift));
+      }
+   }
+   return false;
+}
+
+uint8_t SimBackend::AudioStatus() {
+   std::lock_guard<std::mutex> guard(lock);
+   const SimDevice & dev = devices[CECDEVICE_AUDIOSYSTEM].present ?
+      devices[CECDEVICE_AUDIOSYSTEM] : devices[CECDEVICE_TV];
+   return (dev.muted ? 0x80 : 0) | dev.volume;
+}
+
+static cec_logical_address audio_target(const SimDevice * devices) {
+   return devices[CECDEVICE_AUDIOSYSTEM].present ? CECDEVICE_AUDIOSYSTEM :
+      CECDEVICE_TV;
+}
+
+uint8_t SimBackend::VolumeUp() {
+   Press(audio_target(devices), KEY_VOLUME_UP);
+   return AudioStatus();
+}
+
+uint8_t SimBackend::VolumeDown() {
+   Press(audio_target(devices), KEY_VOLUME_DOWN);
+   return AudioStatus();
+}
+
+uint8_t SimBackend::AudioToggleMute() {
+   Press(audio_target(devices), KEY_MUTE);
+   return AudioStatus();
+}
+
+bool SimBackend::GetCurrentConfiguration(libcec_configuration * c) {
+   std::lock_guard<std::mutex> guard(lock);
+   *c = config;
+   return true;
+}
+
+bool SimBackend::SetConfiguration(const libcec_configuration * c) {
+   std::lock_guard<std::mutex> guard(lock);
+   ICECCallbacks * callbacks = config.callbacks;
+   void * param = config.callbackParam;
+   config = *c;
+   config.callbacks = callbacks;
+   config.callbackParam = param;
+   if( open ) {
+      ClaimAddresses();
+      Event event;
+      event.type = BUS_CONFIG;
+      Queue(clock::now(), event);
+   }
+   return true;
+}
+
+bool SimBackend::CanPersistConfiguration() {
+   return true;
+}
+
+bool SimBackend::PersistConfiguration(const libcec_configuration * c) {
+   std::lock_guard<std::mutex> guard(lock);
+   persisted = *c;
+   return true;
+}
+
+bool SimBackend::PowerOnDevices(cec_logical_address addr) {
+   if( addr != CECDEVICE_TV ) {
+      return Press(addr, KEY_POWER_ON_FUNCTION);
+   }
+   cec_command cmd;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      cec_command::Format(cmd, local.primary, addr,
+            CEC_OPCODE_IMAGE_VIEW_ON);
+   }
+   return Request(cmd);
+}
+
+bool SimBackend::StandbyDevices(cec_logical_address addr) {
+   cec_command cmd;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      cec_command::Format(cmd, local.primary, addr, CEC_OPCODE_STANDBY);
+   }
+   return Request(cmd);
+}
+
+cec_power_status SimBackend::GetDevicePowerStatus(cec_logical_address addr) {
+   cec_datapacket params;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if( Local(addr) ) return CEC_POWER_STATUS_ON;
+   }
+   if( !Query(addr, CEC_OPCODE_GIVE_DEVICE_POWER_STATUS,
+            CEC_OPCODE_REPORT_POWER_STATUS, &params) ||
+         params.size < 1 ) {
+      return CEC_POWER_STATUS_UNKNOWN;
+   }
+   return (cec_power_status)params[0];
+}
+
+uint64_t SimBackend::GetDeviceVendorId(cec_logical_address addr) {
+   cec_datapacket params;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if( Local(addr) ) return 0;
+   }
+   if( !Query(addr, CEC_OPCODE_GIVE_DEVICE_VENDOR_ID,
+            CEC_OPCODE_DEVICE_VENDOR_ID, &params) || params.size < 3 ) {
+      return 0;
+   }
+   return (params[0] << 16) | (params[1] << 8) | params[2];
+}
+
+uint16_t SimBackend::GetDevicePhysicalAddress(cec_logical_address addr) {
+   cec_datapacket params;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if( Local(addr) ) return local_pa;
+   }
+   if( !Query(addr, CEC_OPCODE_GIVE_PHYSICAL_ADDRESS,
+            CEC_OPCODE_REPORT_PHYSICAL_ADDRESS, &params) ||
+         params.size < 2 ) {
+      return 0xFFFF;
+   }
+   return (params[0] << 8) | params[1];
+}
+
+cec_version SimBackend::GetDeviceCecVersion(cec_logical_address addr) {
+   cec_datapacket params;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if( Local(addr) ) return config.cecVersion;
+   }
+   if( !Query(addr, CEC_OPCODE_GET_CEC_VERSION, CEC_OPCODE_CEC_VERSION,
+            &params) || params.size < 1 ) {
+      return CEC_VERSION_UNKNOWN;
+   }
+   return (cec_version)params[0];
+}
+
+std::string SimBackend::GetDeviceOSDName(cec_logical_address addr) {
+   cec_datapacket params;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if( Local(addr) ) return config.strDeviceName;
+   }
+   if( !Query(addr, CEC_OPCODE_GIVE_OSD_NAME, CEC_OPCODE_SET_OSD_NAME,
+            &params) ) {
+      return "";
+   }
+   return std::string((const char *)params.data, params.size);
+}
+
+std::string SimBackend::GetDeviceMenuLanguage(cec_logical_address addr) {
+   cec_datapacket params;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if( Local(addr) ) {
+         return std::string(config.strDeviceLanguage,
+               strnlen(config.strDeviceLanguage, 3));
+      }
+   }
+   if( !Query(addr, CEC_OPCODE_GET_MENU_LANGUAGE,
+            CEC_OPCODE_SET_MENU_LANGUAGE, &params) || params.size < 3 ) {
+      return "???";
+   }
+   return std::string((const char *)params.data, 3);
+}
+
+bool SimBackend::AddDevice(cec_logical_address addr, const SimDevice & dev) {
+   std::lock_guard<std::mutex> guard(lock);
+   if( addr < CECDEVICE_TV || addr >= CECDEVICE_BROADCAST || Local(addr) ) {
+      return false;
+   }
+   devices[addr] = dev;
+   devices[addr].present = true;
+   if( dev.osd_name.empty() ) {
+      devices[addr].osd_name = default_name(device_type(addr));
+   }
+   if( dev.physical_address == 0xFFFF ) {
+      // the first free input of the TV
+      if( addr == CECDEVICE_TV ) {
+         devices[addr].physical_address = 0x0000;
+      }
+      for( uint16_t port = 1; port <= 15 &&
+            devices[addr].physical_address == 0xFFFF; port++ ) {
+         uint16_t pa = port << 12;
+         bool used = (pa == local_pa);
+         for( int i=CECDEVICE_TV; i<CECDEVICE_BROADCAST; i++ ) {
+            used = used || (i != addr && devices[i].present &&
+                  devices[i].physical_address == pa);
+         }
+         if( !used ) devices[addr].physical_address = pa;
+      }
+   }
+   return true;
+}
+
+bool SimBackend::RemoveDevice(cec_logical_address addr) {
+   std::lock_guard<std::mutex> guard(lock);
+   if( addr < CECDEVICE_TV || addr >= CECDEVICE_BROADCAST ||
+         !devices[addr].present ) {
+      return false;
+   }
+   devices[addr] = SimDevice();
+   return true;
+}
+
+bool SimBackend::SetNack(cec_logical_address addr, bool nack) {
+   std::lock_guard<std::mutex> guard(lock);
+   if( addr < CECDEVICE_TV || addr >= CECDEVICE_BROADCAST ||
+         !devices[addr].present ) {
+      return false;
+   }
+   devices[addr].nack = nack;
+   return true;
+}
+
+bool SimBackend::Script(cec_logical_address addr, uint8_t opcode,
+      const std::vector<cec_command> * replies) {
+   std::lock_guard<std::mutex> guard(lock);
+   if( addr < CECDEVICE_TV || addr >= CECDEVICE_BROADCAST ||
+         !devices[addr].present ) {
+      return false;
+   }
+   if( replies ) {
+      devices[addr].script[opcode] = *replies;
+   } else {
+      devices[addr].script.erase(opcode);
+   }
+   return true;
+}
+
+bool SimBackend::Send(const cec_command & cmd) {
+   std::lock_guard<std::mutex> guard(lock);
+   if( !open || cmd.initiator < CECDEVICE_TV ||
+         cmd.initiator >= CECDEVICE_BROADCAST ||
+         !devices[cmd.initiator].present ) {
+      return false;
+   }
+   QueueFrame(cmd);
+   return Acked(cmd.destination);
+}
+
+#endif
+
+Backend * SimBackendNew(const libcec_configuration * config) {
+#if HAVE_SIM_BACKEND
+   return new SimBackend(config);
+#else
+   return NULL;
+#endif
+}
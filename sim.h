@@ -0,0 +1,199 @@
+/* sim.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A simulated CEC bus, selected with init("sim://..."). Virtual devices
+ * answer the standard queries, follow power and routing commands, and can
+ * be scripted to reply to any opcode. Frames take bus time according to
+ * the configured latency and rate, and everything received is delivered
+ * through the same libcec callbacks as on a real bus, from a bus thread.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libcec/cec.h>
+
+#include "backend.h"
+
+#define SIM_URL_PREFIX "sim://"
+
+// the callbacks the simulator drives have this shape since libcec 4
+#if CEC_LIB_VERSION_MAJOR >= 4
+#define HAVE_SIM_BACKEND 1
+#else
+#define HAVE_SIM_BACKEND 0
+#endif
+
+struct SimDevice {
+   bool present;
+   // frames to this device are not acknowledged
+   bool nack;
+   uint16_t physical_address;
+   uint32_t vendor;
+   std::string osd_name;
+   std::string language;
+   CEC::cec_power_status power;
+   CEC::cec_version version;
+   uint8_t volume;
+   bool muted;
+   // replies to send when a frame with this opcode arrives, replacing the
+   // default behaviour; an empty list ignores the frame. A reply with
+   // destination CECDEVICE_UNKNOWN goes back to the sender
+   std::map<uint8_t, std::vector<CEC::cec_command> > script;
+
+   SimDevice();
+};
+
+#if HAVE_SIM_BACKEND
+
+class SimBackend : public Backend {
+   public:
+      SimBackend(const CEC::libcec_configuration * config);
+      ~SimBackend();
+
+      // port is sim://[?key=value&...]; keys are devices (comma separated
+      // logical addresses of default devices, default 0), latency
+      // (milliseconds per frame) and rate (frames per second, 0 for no
+      // limit)
+      bool Open(const char * port);
+      void Close();
+      int DetectAdapters(CEC::CEC_ADAPTER_TYPE * list, int size, bool quick);
+
+      bool Transmit(const CEC::cec_command & cmd);
+      CEC::cec_logical_addresses GetLogicalAddresses();
+      CEC::cec_logical_addresses GetActiveDevices();
+
+      bool IsActiveSource(CEC::cec_logical_address addr);
+      bool SetActiveSource(CEC::cec_device_type type);
+      bool SetStreamPath(CEC::cec_logical_address addr);
+      bool SetStreamPath(uint16_t pa);
+      bool SetPhysicalAddress(uint16_t pa);
+      bool SetHDMIPort(CEC::cec_logical_address base, uint8_t port);
+
+      uint8_t VolumeUp();
+      uint8_t VolumeDown();
+      uint8_t AudioToggleMute();
+
+      bool GetCurrentConfiguration(CEC::libcec_configuration * config);
+      bool SetConfiguration(const CEC::libcec_configuration * config);
+      bool CanPersistConfiguration();
+      bool PersistConfiguration(const CEC::libcec_configuration * config);
+
+      bool PowerOnDevices(CEC::cec_logical_address addr);
+      bool StandbyDevices(CEC::cec_logical_address addr);
+      CEC::cec_power_status GetDevicePowerStatus(CEC::cec_logical_address addr);
+      uint64_t GetDeviceVendorId(CEC::cec_logical_address addr);
+      uint16_t GetDevicePhysicalAddress(CEC::cec_logical_address addr);
+      CEC::cec_version GetDeviceCecVersion(CEC::cec_logical_address addr);
+      std::string GetDeviceOSDName(CEC::cec_logical_address addr);
+      std::string GetDeviceMenuLanguage(CEC::cec_logical_address addr);
+
+      // control of the virtual devices; addresses claimed by this host
+      // can't be used. AddDevice fills in a default name, and puts a device
+      // without a physical address on the first free input of the TV
+      bool AddDevice(CEC::cec_logical_address addr, const SimDevice & dev);
+      bool RemoveDevice(CEC::cec_logical_address addr);
+      bool SetNack(CEC::cec_logical_address addr, bool nack);
+      bool Script(CEC::cec_logical_address addr, uint8_t opcode,
+            const std::vector<CEC::cec_command> * replies);
+      // put a frame from a virtual device on the bus; true if acknowledged
+      bool Send(const CEC::cec_command & cmd);
+
+   private:
+      typedef std::chrono::steady_clock clock;
+
+      enum EventType { BUS_FRAME, BUS_LOG, BUS_ACTIVATED, BUS_CONFIG };
+      struct Event {
+         EventType type;
+         CEC::cec_command cmd;
+         std::string text;
+         CEC::cec_logical_address addr;
+         bool active;
+      };
+
+      void Run();
+      void Deliver(const Event & event, CEC::ICECCallbacks * callbacks,
+            void * param, const CEC::libcec_configuration & current);
+
+      clock::time_point Reserve();
+      void Queue(clock::time_point due, const Event & event);
+      clock::time_point QueueFrame(const CEC::cec_command & cmd);
+      void QueueLog(const char * direction, const CEC::cec_command & cmd);
+
+      bool Local(CEC::cec_logical_address addr) const;
+      bool Acked(CEC::cec_logical_address addr) const;
+      bool SendLocked(const CEC::cec_command & cmd, CEC::cec_opcode reply,
+            CEC::cec_datapacket * params, clock::time_point * reply_due);
+      void Route(const CEC::cec_command & cmd,
+            std::vector<CEC::cec_command> * replies);
+      void Handle(CEC::cec_logical_address addr, const CEC::cec_command & cmd,
+            std::vector<CEC::cec_command> * replies);
+      void Observe(const CEC::cec_command & cmd);
+      void ClaimAddresses();
+
+      bool Request(const CEC::cec_command & cmd,
+            CEC::cec_opcode reply = CEC::CEC_OPCODE_NONE,
+            CEC::cec_datapacket * params = NULL);
+      bool Query(CEC::cec_logical_address addr, CEC::cec_opcode opcode,
+            CEC::cec_opcode reply, CEC::cec_datapacket * params);
+      bool Press(CEC::cec_logical_address addr, uint8_t key);
+      uint8_t AudioStatus();
+
+      std::mutex lock;
+      std::condition_variable cond;
+      std::thread thread;
+      bool open;
+
+      CEC::libcec_configuration config;
+      CEC::libcec_configuration persisted;
+      CEC::cec_logical_addresses local;
+      uint16_t local_pa;
+
+      SimDevice devices[16];
+      CEC::cec_logical_address active;
+      bool local_active;
+
+      clock::duration latency;
+      clock::duration spacing;
+      clock::time_point bus_free;
+      clock::time_point started;
+      std::multimap<clock::time_point, Event> events;
+
+      // the key held down on this host, for keypress durations
+      CEC::cec_user_control_code key;
+      clock::time_point key_time;
+};
+
+#endif
+
+// a simulated bus using config, or NULL if this libcec is too old
+Backend * SimBackendNew(const CEC::libcec_configuration * config);
+
+#endif
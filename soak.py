@@ -0,0 +1,305 @@
+#!/usr/bin/env python
+"""
+Soak test: flood the binding's callback paths on the simulated bus (sim://)
+for a long time and fail if memory or object counts grow, or if events are
+dropped or fall behind.
+
+Virtual devices send numbered frames and keypresses to this host, toggle
+the active source and the configuration, while the main thread keeps
+calling list_devices, Device(), topology, transmit and list_adapters. Every
+interval a sample is taken of RSS, allocated blocks, the total refcount (on
+debug builds of Python), the number of live objects of each type, and the
+events sent, received, lost and their delay. Bus calls made while holding
+the GIL are reported by cec.check_gil and fail the run.
+
+Samples are printed as JSON lines. After the warmup, growth between the
+first and last sample is compared with the limits, e.g.
+  ./soak.py --duration 4h --rate 500
+"""
+
+import argparse
+import collections
+import gc
+import json
+import os
+import resource
+import struct
+import sys
+import threading
+import time
+
+import cec
+
+LOCAL = 1              # this host's logical address on the simulated bus
+LOCAL_PA = b"\x10\x00" # and its physical address, 1.0.0.0
+TV = 0
+VENDOR_COMMAND = 0xA0
+
+def duration(text):
+   """ seconds, or a number with an s, m, h or d suffix """
+   units = {"s": 1, "m": 60, "h": 3600, "d": 86400}
+   if text[-1:] in units:
+      return float(text[:-1]) * units[text[-1]]
+   return float(text)
+
+def rss():
+   """ resident set size in bytes """
+   try:
+      with open("/proc/self/statm") as f:
+         return int(f.read().split()[1]) * os.sysconf("SC_PAGE_SIZE")
+   except (IOError, OSError):
+      # peak instead of current; kilobytes on Linux, bytes on macOS
+      rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+      return rss if sys.platform == "darwin" else rss * 1024
+
+def object_counts():
+   gc.collect()
+   return collections.Counter(type(o).__name__ for o in gc.get_objects())
+
+class Tracker:
+   """ the numbered frames sent and received, for loss and delay """
+   def __init__(self):
+      self.lock = threading.Lock()
+      self.sent = {}
+      self.next = 0
+      self.received = 0
+      self.duplicates = 0
+      self.delays = []
+      self.events = collections.Counter()
+
+   def send(self):
+      with self.lock:
+         seq = self.next
+         self.next += 1
+         self.sent[seq] = time.monotonic()
+      return struct.pack(">I", seq)
+
+   def receive(self, params):
+      if len(params) < 4:
+         return
+      seq, = struct.unpack(">I", params[:4])
+      now = time.monotonic()
+      with self.lock:
+         sent = self.sent.pop(seq, None)
+         if sent is None:
+            self.duplicates += 1
+            return
+         self.received += 1
+         self.delays.append(now - sent)
+
+   def lost(self, older_than):
+      """ frames still missing after older_than seconds """
+      limit = time.monotonic() - older_than
+      with self.lock:
+         return sum(1 for t in self.sent.values() if t < limit)
+
+   def interval(self):
+      """ the delays since the last call """
+      with self.lock:
+         delays, self.delays = self.delays, []
+      return delays
+
+class Soak:
+   def __init__(self, args):
+      self.args = args
+      self.out = open(args.output, "w") if args.output else sys.stdout
+      self.tracker = Tracker()
+      self.stop = threading.Event()
+      self.errors = []
+      cec.check_gil(args.gil_threshold)
+      self.adapter = cec.Adapter()
+      self.adapter.add_callback(self.callback, cec.EVENT_ALL)
+      self.adapter.init("sim://?devices=0,5,4")
+
+   def callback(self, event, *args):
+      self.tracker.events[event] += 1
+      if event == cec.EVENT_COMMAND:
+         cmd = args[0]
+         if cmd["opcode"] == VENDOR_COMMAND and cmd["initiator"] == TV:
+            self.tracker.receive(cmd["parameters"])
+
+   def flood(self):
+      """ send frames from the virtual devices at the configured rate """
+      a = self.adapter
+      rate = self.args.rate
+      tick = 0.01
+      start = time.monotonic()
+      sent = 0
+      names = ("soak-a", "soak-b")
+      config = a.get_config()
+      try:
+         while not self.stop.is_set():
+            due = int((time.monotonic() - start) * rate)
+            while sent < due:
+               kind = sent % 100
+               if kind < 80:
+                  a.sim_send(TV, LOCAL, VENDOR_COMMAND, self.tracker.send())
+               elif kind < 95:
+                  a.sim_send(TV, LOCAL, 0x44, b"\x01")
+                  a.sim_send(TV, LOCAL, 0x45)
+               elif kind < 98:
+                  if (sent // 100) % 2 == 0:
+                     a.sim_send(TV, cec.CECDEVICE_BROADCAST, 0x86, LOCAL_PA)
+                  else:
+                     a.sim_send(TV, cec.CECDEVICE_BROADCAST, 0x82,
+                           b"\x00\x00")
+               else:
+                  config.device_name = names[(sent // 100) % 2]
+                  a.set_config(config)
+               sent += 1
+            time.sleep(tick)
+      except Exception as e:
+         self.errors.append("flood: %r"%(e,))
+         self.stop.set()
+
+   def exercise(self):
+      """ the calls that return new objects """
+      a = self.adapter
+      a.list_devices()
+      cec.Device(TV, a)
+      a.topology()
+      a.active_source()
+      a.transmit(cec.CECDEVICE_BROADCAST, VENDOR_COMMAND, b"\x00\x00\x00")
+      a.get_config().as_dict()
+      cec.list_adapters()
+
+   def sample(self, started, previous):
+      delays = sorted(self.tracker.interval())
+      counts = object_counts()
+      sample = {
+         "t": round(time.monotonic() - started, 3),
+         "rss": rss(),
+         "blocks": sys.getallocatedblocks(),
+         "objects": sum(counts.values()),
+         "sent": self.tracker.next,
+         "received": self.tracker.received,
+         "lost": self.tracker.lost(self.args.max_delay),
+         "duplicates": self.tracker.duplicates,
+         "events": dict(self.tracker.events),
+      }
+      if hasattr(sys, "gettotalrefcount"):
+         sample["refcount"] = sys.gettotalrefcount()
+      if delays:
+         sample["delay_p50"] = delays[len(delays) // 2]
+         sample["delay_p99"] = delays[int(len(delays) * 0.99)]
+         sample["delay_max"] = delays[-1]
+      if previous:
+         elapsed = sample["t"] - previous["t"]
+         sample["rate"] = (sample["received"] - previous["received"]) / \
+            elapsed
+      self.out.write(json.dumps(sample) + "\n")
+      self.out.flush()
+      return sample, counts
+
+   def run(self):
+      args = self.args
+      flood = threading.Thread(target=self.flood)
+      started = time.monotonic()
+      flood.start()
+
+      baseline = None
+      previous = None
+      next_sample = started + args.interval
+      try:
+         while not self.stop.is_set():
+            now = time.monotonic()
+            if now - started >= args.duration:
+               break
+            self.exercise()
+            if now >= next_sample:
+               previous, counts = self.sample(started, previous)
+               next_sample += args.interval
+               if now - started >= args.warmup:
+                  if baseline is None:
+                     baseline = (previous, counts)
+                  self.check_progress(previous)
+            time.sleep(args.call_interval)
+      finally:
+         self.stop.set()
+         flood.join()
+
+      # let the bus drain before counting what is missing
+      deadline = time.monotonic() + args.max_delay
+      while self.tracker.sent and time.monotonic() < deadline:
+         time.sleep(0.05)
+      final, counts = self.sample(started, previous)
+      # the flood stopped part way through this interval
+      self.check_progress(final, throughput=False)
+      if baseline:
+         self.check_growth(baseline, (final, counts))
+      else:
+         self.errors.append("no samples after the warmup; increase "
+               "--duration or reduce --warmup")
+      self.adapter.close()
+      for call, seconds in cec.gil_reports():
+         self.errors.append("%s took %.3f ms with the GIL held"%(call,
+            seconds * 1000))
+      return self.errors
+
+   def check_progress(self, sample, throughput=True):
+      if sample["lost"]:
+         self.errors.append("%d events lost at %.0fs"%(sample["lost"],
+            sample["t"]))
+      if sample.get("delay_max", 0) > self.args.max_delay:
+         self.errors.append("events delayed up to %.3fs at %.0fs"%(
+            sample["delay_max"], sample["t"]))
+      if throughput and sample.get("rate") is not None and \
+            sample["rate"] < self.args.rate * 0.8 * self.args.min_throughput:
+         # 80% of the flood are numbered frames
+         self.errors.append("throughput fell to %.0f/s at %.0fs"%(
+            sample["rate"], sample["t"]))
+
+   def check_growth(self, baseline, final):
+      (first, first_counts), (last, last_counts) = baseline, final
+      growth = (last["rss"] - first["rss"]) / 1048576.0
+      if growth > self.args.max_rss_growth:
+         self.errors.append("RSS grew by %.1f MiB"%(growth))
+      growth = last["blocks"] - first["blocks"]
+      if growth > self.args.max_block_growth:
+         self.errors.append("allocated blocks grew by %d"%(growth))
+      if "refcount" in first:
+         growth = last["refcount"] - first["refcount"]
+         if growth > self.args.max_block_growth:
+            self.errors.append("total refcount grew by %d"%(growth))
+      for name, count in last_counts.items():
+         growth = count - first_counts.get(name, 0)
+         if growth > self.args.max_object_growth:
+            self.errors.append("%s objects grew by %d"%(name, growth))
+
+def main():
+   parser = argparse.ArgumentParser(description=__doc__,
+         formatter_class=argparse.RawDescriptionHelpFormatter)
+   parser.add_argument("-d", "--duration", type=duration, default="10m",
+         help="how long to run, e.g. 90s, 30m, 4h (default 10m)")
+   parser.add_argument("-r", "--rate", type=float, default=200,
+         help="frames per second sent by the virtual devices (default 200)")
+   parser.add_argument("-i", "--interval", type=duration, default="30s",
+         help="time between samples (default 30s)")
+   parser.add_argument("-w", "--warmup", type=duration, default="1m",
+         help="samples before this are not compared (default 1m)")
+   parser.add_argument("--call-interval", type=float, default=0.01,
+         help="seconds between rounds of API calls (default 0.01)")
+   parser.add_argument("--max-rss-growth", type=float, default=8,
+         help="MiB the RSS may grow after the warmup (default 8)")
+   parser.add_argument("--max-block-growth", type=int, default=20000,
+         help="allocated blocks or total refcount growth allowed "
+         "(default 20000)")
+   parser.add_argument("--max-object-growth", type=int, default=1000,
+         help="growth allowed in the live objects of any type "
+         "(default 1000)")
+   parser.add_argument("--max-delay", type=float, default=2.0,
+         help="seconds before an event counts as lost (default 2)")
+   parser.add_argument("--min-throughput", type=float, default=0.9,
+         help="fraction of the rate that must be delivered (default 0.9)")
+   parser.add_argument("--gil-threshold", type=float, default=0,
+         help="seconds a bus call may hold the GIL (default 0)")
+   parser.add_argument("-o", "--output", help="write samples to a file")
+   args = parser.parse_args()
+
+   errors = Soak(args).run()
+   for error in errors:
+      sys.stderr.write("FAIL: %s\n"%(error))
+   sys.exit(1 if errors else 0)
+
+if __name__ == "__main__":
+   main()
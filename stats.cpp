@@ -0,0 +1,367 @@
+/* stats.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the bus health counters and their exporter
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "stats.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace CEC;
+
+#define UNIX_PREFIX "unix://"
+
+#if !defined(_WIN32) && !defined(MSG_NOSIGNAL)
+// macOS; SO_NOSIGPIPE is set on each client instead
+#define MSG_NOSIGNAL 0
+#endif
+
+const char * const stats_event_names[STATS_EVENTS] = {
+   "log", "keypress", "command", "config_change", "alert", "menu_changed",
+   "activated", "reconnected",
+};
+
+int StatsEventIndex(long int event) {
+   for( int i=0; i<STATS_EVENTS; i++ ) {
+      if( event & (1 << i) ) return i;
+   }
+   return 0;
+}
+
+Stats::Stats() : rx_polls(0), tx_queued(0), gil_waits(0), gil_wait_ns(0),
+      gil_wait_max_ns(0), scheduled(0), scheduled_late_ns(0),
+      scheduled_late_max_ns(0), callbacks(0) {
+   for( int i=0; i<256; i++ ) {
+      rx_frames[i] = 0;
+   }
+   for( int i=0; i<16; i++ ) {
+      tx_acked[i] = 0;
+      tx_failed[i] = 0;
+   }
+   for( int i=0; i<STATS_EVENTS; i++ ) {
+      handler_calls[i] = 0;
+      handler_errors[i] = 0;
+   }
+}
+
+void Stats::Received(const cec_command & cmd) {
+   if( cmd.opcode_set ) {
+      rx_frames[cmd.opcode & 0xFF].fetch_add(1, std::memory_order_relaxed);
+   } else {
+      rx_polls.fetch_add(1, std::memory_order_relaxed);
+   }
+}
+
+void Stats::Transmitted(cec_logical_address destination, bool acked) {
+   std::atomic<uint64_t> * counter = acked ? tx_acked : tx_failed;
+   counter[destination & 0xF].fetch_add(1, std::memory_order_relaxed);
+}
+
+void Stats::Queued() {
+   tx_queued.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Stats::Handler(long int event, bool ok) {
+   int i = StatsEventIndex(event);
+   handler_calls[i].fetch_add(1, std::memory_order_relaxed);
+   if( !ok ) {
+      handler_errors[i].fetch_add(1, std::memory_order_relaxed);
+   }
+}
+
+void Stats::GilWait(uint64_t ns) {
+   gil_waits.fetch_add(1, std::memory_order_relaxed);
+   gil_wait_ns.fetch_add(ns, std::memory_order_relaxed);
+   uint64_t max = gil_wait_max_ns.load(std::memory_order_relaxed);
+   while( ns > max && !gil_wait_max_ns.compare_exchange_weak(max, ns,
+            std::memory_order_relaxed) ) {
+   }
+}
+
+void Stats::Scheduled(uint64_t late_ns) {
+   scheduled.fetch_add(1, std::memory_order_relaxed);
+   scheduled_late_ns.fetch_add(late_ns, std::memory_order_relaxed);
+   uint64_t max = scheduled_late_max_ns.load(std::memory_order_relaxed);
+   while( late_ns > max && !scheduled_late_max_ns.compare_exchange_weak(max,
+            late_ns, std::memory_order_relaxed) ) {
+   }
+}
+
+void Stats::SetCallbacks(size_t count) {
+   callbacks.store(count, std::memory_order_relaxed);
+}
+
+static void metric_header(std::string & out, const char * name,
+      const char * type, const char * help) {
+   out += "# HELP ";
+   out += name;
+   out += " ";
+   out += help;
+   out += "\n# TYPE ";
+   out += name;
+   out += " ";
+   out += type;
+   out += "\n";
+}
+
+static void metric(std::string & out, const char * name, const char * labels,
+      double value) {
+   char line[256];
+   snprintf(line, sizeof(line), "%s%s %.17g\n", name, labels, value);
+   out += line;
+}
+
+std::string Stats::Prometheus(size_t reconnect_queue) const {
+   std::string out;
+   char labels[64];
+
+   metric_header(out, "cec_rx_frames_total", "counter",
+         "Frames received from the bus, by opcode");
+   for( int i=0; i<256; i++ ) {
+      uint64_t count = rx_frames[i].load(std::memory_order_relaxed);
+      if( !count ) continue;
+      snprintf(labels, sizeof(labels), "{opcode=\"0x%02X\"}", i);
+      metric(out, "cec_rx_frames_total", labels, count);
+   }
+   metric_header(out, "cec_rx_polls_total", "counter",
+         "Polls received from the bus");
+   metric(out, "cec_rx_polls_total", "", rx_polls.load());
+
+   metric_header(out, "cec_tx_frames_total", "counter",
+         "Frames transmitted, by destination and result");
+   for( int i=0; i<16; i++ ) {
+      uint64_t acked = tx_acked[i].load(std::memory_order_relaxed);
+      uint64_t failed = tx_failed[i].load(std::memory_order_relaxed);
+      if( !acked && !failed ) continue;
+      snprintf(labels, sizeof(labels),
+            "{destination=\"%d\",result=\"acked\"}", i);
+      metric(out, "cec_tx_frames_total", labels, acked);
+      snprintf(labels, sizeof(labels),
+            "{destination=\"%d\",result=\"failed\"}", i);
+      metric(out, "cec_tx_frames_total", labels, failed);
+   }
+   metric_header(out, "cec_tx_queued_total", "counter",
+         "Frames queued while the adapter was reconnecting");
+   metric(out, "cec_tx_queued_total", "", tx_queued.load());
+
+   metric_header(out, "cec_handler_calls_total", "counter",
+         "Python callback invocations, by event");
+   for( int i=0; i<STATS_EVENTS; i++ ) {
+      snprintf(labels, sizeof(labels), "{event=\"%s\"}",
+            stats_event_names[i]);
+      metric(out, "cec_handler_calls_total", labels, handler_calls[i].load());
+   }
+   metric_header(out, "cec_handler_errors_total", "counter",
+         "Python callbacks that raised, by event");
+   for( int i=0; i<STATS_EVENTS; i++ ) {
+      snprintf(labels, sizeof(labels), "{event=\"%s\"}",
+            stats_event_names[i]);
+      metric(out, "cec_handler_errors_total", labels,
+            handler_errors[i].load());
+   }
+
+   metric_header(out, "cec_gil_waits_total", "counter",
+         "Times a libcec thread acquired the GIL");
+   metric(out, "cec_gil_waits_total", "", gil_waits.load());
+   metric_header(out, "cec_gil_wait_seconds_total", "counter",
+         "Time libcec threads spent waiting for the GIL");
+   metric(out, "cec_gil_wait_seconds_total", "", gil_wait_ns.load() / 1e9);
+   metric_header(out, "cec_gil_wait_max_seconds", "gauge",
+         "Longest wait for the GIL by a libcec thread");
+   metric(out, "cec_gil_wait_max_seconds", "", gil_wait_max_ns.load() / 1e9);
+
+   metric_header(out, "cec_scheduled_total", "counter",
+         "Scheduled transmits fired");
+   metric(out, "cec_scheduled_total", "", scheduled.load());
+   metric_header(out, "cec_scheduled_late_seconds_total", "counter",
+         "Time scheduled transmits fired after their due time");
+   metric(out, "cec_scheduled_late_seconds_total", "",
+         scheduled_late_ns.load() / 1e9);
+   metric_header(out, "cec_scheduled_late_max_seconds", "gauge",
+         "Latest a scheduled transmit fired after its due time");
+   metric(out, "cec_scheduled_late_max_seconds", "",
+         scheduled_late_max_ns.load() / 1e9);
+
+   metric_header(out, "cec_reconnect_queue_depth", "gauge",
+         "Frames waiting for the adapter to reconnect");
+   metric(out, "cec_reconnect_queue_depth", "", reconnect_queue);
+   metric_header(out, "cec_callbacks", "gauge",
+         "Registered Python callbacks");
+   metric(out, "cec_callbacks", "", callbacks.load());
+   return out;
+}
+
+StatsExporter::StatsExporter(Render r) : render(r), stopping(false),
+      listener(-1), interval(0) {
+}
+
+StatsExporter::~StatsExporter() {
+   Stop();
+}
+
+std::string StatsExporter::Start(const std::string & target, double i) {
+   Stop();
+   interval = i;
+   path = target;
+   if( target.compare(0, strlen(UNIX_PREFIX), UNIX_PREFIX) == 0 ) {
+#ifdef _WIN32
+      return "UNIX sockets are not supported on this platform";
+#else
+      path = target.substr(strlen(UNIX_PREFIX));
+      struct sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      if( path.empty() || path.size() >= sizeof(addr.sun_path) ) {
+         return "invalid socket path";
+      }
+      memcpy(addr.sun_path, path.c_str(), path.size());
+      listener = socket(AF_UNIX, SOCK_STREAM, 0);
+      if( listener < 0 ) {
+         return strerror(errno);
+      }
+      fcntl(listener, F_SETFD, FD_CLOEXEC);
+      // a socket left behind by an earlier process
+      unlink(path.c_str());
+      if( bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+            listen(listener, 8) < 0 ) {
+         std::string error = strerror(errno);
+         close(listener);
+         listener = -1;
+         return error;
+      }
+#endif
+   } else if( !Publish() ) {
+      return strerror(errno);
+   }
+   stopping = false;
+   thread = std::thread(&StatsExporter::Run, this);
+   return "";
+}
+
+void StatsExporter::Stop() {
+   if( !thread.joinable() ) return;
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+   }
+   cond.notify_all();
+   thread.join();
+#ifndef _WIN32
+   if( listener >= 0 ) {
+      close(listener);
+      listener = -1;
+      unlink(path.c_str());
+   }
+#endif
+}
+
+// write a rendering to the file, replacing it atomically
+bool StatsExporter::Publish() {
+   std::string text = render();
+   std::string tmp = path + ".tmp";
+   FILE * f = fopen(tmp.c_str(), "w");
+   if( f == NULL ) return false;
+   bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+   ok = (fclose(f) == 0) && ok;
+#ifdef _WIN32
+   remove(path.c_str());
+#endif
+   ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+   if( !ok ) remove(tmp.c_str());
+   return ok;
+}
+
+void StatsExporter::Run() {
+   typedef std::chrono::steady_clock clock;
+   clock::duration period = std::chrono::duration_cast<clock::duration>(
+         std::chrono::duration<double>(interval));
+   clock::time_point next = clock::now() + period;
+   std::string text = render();
+
+   std::unique_lock<std::mutex> guard(lock);
+   while( !stopping ) {
+      if( listener < 0 ) {
+         if( cond.wait_until(guard, next) == std::cv_status::timeout ) {
+            guard.unlock();
+            Publish();
+            guard.lock();
+            next = clock::now() + period;
+         }
+         continue;
+      }
+#ifndef _WIN32
+      // wake up regularly to notice Stop(); connections are served between
+      guard.unlock();
+      struct pollfd fd = { listener, POLLIN, 0 };
+      if( poll(&fd, 1, 100) > 0 ) {
+         int client = accept(listener, NULL, NULL);
+         if( client >= 0 ) {
+#ifdef SO_NOSIGPIPE
+            int one = 1;
+            setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+            // answer HTTP requests, so curl --unix-socket works, and send
+            // plain text to anything else
+            std::string reply = text;
+            struct pollfd request = { client, POLLIN, 0 };
+            char buf[4];
+            if( poll(&request, 1, 100) > 0 &&
+                  recv(client, buf, sizeof(buf), MSG_PEEK) == 4 &&
+                  memcmp(buf, "GET ", 4) == 0 ) {
+               reply = "HTTP/1.0 200 OK\r\n"
+                  "Content-Type: text/plain; version=0.0.4\r\n\r\n" + text;
+            }
+            // closing with the request unread would reset the connection
+            char discard[1024];
+            while( recv(client, discard, sizeof(discard), MSG_DONTWAIT) > 0 ) {
+            }
+            const char * p = reply.data();
+            size_t left = reply.size();
+            while( left > 0 ) {
+               ssize_t n = send(client, p, left, MSG_NOSIGNAL);
+               if( n <= 0 ) break;
+               p += n;
+               left -= n;
+            }
+            shutdown(client, SHUT_WR);
+            close(client);
+         }
+      }
+      if( clock::now() >= next ) {
+         text = render();
+         next = clock::now() + period;
+      }
+      guard.lock();
+#endif
+   }
+}
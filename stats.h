@@ -0,0 +1,117 @@
+/* stats.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Bus health counters for an adapter, updated lock-free from libcec's
+ * threads and the Python entry points, and an exporter that publishes them
+ * in the Prometheus text format.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <libcec/cec.h>
+
+// one slot per EVENT_* bit
+#define STATS_EVENTS 8
+
+extern const char * const stats_event_names[STATS_EVENTS];
+
+class Stats {
+   public:
+      Stats();
+
+      // a frame from libcec's commandReceived callback
+      void Received(const CEC::cec_command & cmd);
+      void Transmitted(CEC::cec_logical_address destination, bool acked);
+      // a frame held back while the adapter reconnects
+      void Queued();
+      // a Python handler ran for event; ok is false if it raised
+      void Handler(long int event, bool ok);
+      // a libcec thread waited this long for the GIL
+      void GilWait(uint64_t ns);
+      // a scheduled transmit went out this long after its due time
+      void Scheduled(uint64_t late_ns);
+      void SetCallbacks(size_t count);
+
+      // the text exposition format; gauges the adapter keeps elsewhere are
+      // passed in
+      std::string Prometheus(size_t reconnect_queue) const;
+
+      std::atomic<uint64_t> rx_frames[256];
+      std::atomic<uint64_t> rx_polls;
+      std::atomic<uint64_t> tx_acked[16];
+      std::atomic<uint64_t> tx_failed[16];
+      std::atomic<uint64_t> tx_queued;
+      std::atomic<uint64_t> handler_calls[STATS_EVENTS];
+      std::atomic<uint64_t> handler_errors[STATS_EVENTS];
+      std::atomic<uint64_t> gil_waits;
+      std::atomic<uint64_t> gil_wait_ns;
+      std::atomic<uint64_t> gil_wait_max_ns;
+      std::atomic<uint64_t> scheduled;
+      std::atomic<uint64_t> scheduled_late_ns;
+      std::atomic<uint64_t> scheduled_late_max_ns;
+      std::atomic<uint64_t> callbacks;
+};
+
+// index into the per-event counters for an EVENT_* bit
+int StatsEventIndex(long int event);
+
+// publishes a rendering of the stats every interval, to a file (replaced
+// atomically) or to a UNIX socket given as unix:///path, which serves the
+// latest rendering to each client that connects
+class StatsExporter {
+   public:
+      typedef std::function<std::string()> Render;
+
+      StatsExporter(Render render);
+      ~StatsExporter();
+
+      // returns an empty string on success, else the reason for failure.
+      // Must be called without the GIL held.
+      std::string Start(const std::string & target, double interval);
+      // Must be called without the GIL held.
+      void Stop();
+
+   private:
+      void Run();
+      bool Publish();
+
+      Render render;
+
+      std::mutex lock;
+      std::condition_variable cond;
+      std::thread thread;
+      bool stopping;
+
+      std::string path;
+      int listener;
+      double interval;
+};
+
+#endif
@@ -0,0 +1,137 @@
+/* supervisor.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the connection supervisor
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "supervisor.h"
+
+#include <algorithm>
+
+using namespace CEC;
+
+Supervisor::Supervisor(ReconnectHandler handler, Sender sender) :
+      on_reconnect(handler), send(sender), lib(NULL), initial_delay(0),
+      max_delay(0), running(false), stopping(false), lost(false) {
+}
+
+Supervisor::~Supervisor() {
+   Stop();
+}
+
+void Supervisor::Start(Backend * l, const std::string & p,
+      double initial, double max) {
+   Stop();
+   std::lock_guard<std::mutex> guard(lock);
+   lib = l;
+   port = p;
+   initial_delay = initial;
+   max_delay = max;
+   running = true;
+   thread = std::thread(&Supervisor::Run, this);
+}
+
+void Supervisor::Stop() {
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if( !running ) return;
+      stopping = true;
+      pending.clear();
+   }
+   cond.notify_all();
+   thread.join();
+
+   std::lock_guard<std::mutex> guard(lock);
+   running = false;
+   stopping = false;
+   lost = false;
+}
+
+void Supervisor::ConnectionLost() {
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if( !running || lost ) return;
+      lost = true;
+      lost_at = std::chrono::steady_clock::now();
+   }
+   cond.notify_all();
+}
+
+Supervisor::QueueResult Supervisor::Queue(const cec_command & cmd) {
+   std::lock_guard<std::mutex> guard(lock);
+   if( !lost ) return NOT_QUEUED;
+   if( pending.size() >= SUPERVISOR_MAX_QUEUE ) return QUEUE_FULL;
+   pending.push_back(cmd);
+   return QUEUED;
+}
+
+size_t Supervisor::Pending() {
+   std::lock_guard<std::mutex> guard(lock);
+   return pending.size();
+}
+
+void Supervisor::Run() {
+   std::unique_lock<std::mutex> guard(lock);
+   while( !stopping ) {
+      cond.wait(guard, [this] { return stopping || lost; });
+      if( stopping ) break;
+
+      // libcec must be closed before it can be reopened; neither call is
+      // made with the lock held so that libcec's threads can still report
+      // alerts and queue frames. The backend fails calls from other
+      // threads while they run
+      double delay = initial_delay;
+      bool open = false;
+      while( !open ) {
+         guard.unlock();
+         lib->Close();
+         guard.lock();
+         cond.wait_for(guard, std::chrono::duration<double>(delay),
+               [this] { return stopping; });
+         if( stopping ) break;
+
+         guard.unlock();
+         open = lib->Open(port.c_str());
+         guard.lock();
+         delay = std::min(delay * 2, max_delay);
+      }
+      if( !open ) break;
+
+      // send what was queued during the outage, in order; new frames keep
+      // queueing behind it until the queue is drained
+      while( !pending.empty() && !stopping ) {
+         std::deque<cec_command> frames;
+         frames.swap(pending);
+         guard.unlock();
+         for( size_t i=0; i<frames.size(); i++ ) {
+            send(frames[i]);
+         }
+         guard.lock();
+      }
+      lost = false;
+      double outage = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - lost_at).count();
+
+      guard.unlock();
+      on_reconnect(outage);
+      guard.lock();
+   }
+}
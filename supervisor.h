@@ -0,0 +1,101 @@
+/* supervisor.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Connection supervisor. When libcec reports that the connection to the
+ * adapter was lost, a background thread reopens it with exponential
+ * backoff. Frames transmitted while the adapter is away are queued and
+ * sent once it is back.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <libcec/cec.h>
+
+#include "backend.h"
+
+// frames queued while reconnecting; further transmits fail
+#define SUPERVISOR_MAX_QUEUE 64
+
+class Supervisor {
+   public:
+      // called on the supervisor thread once the adapter is reopened, with
+      // the length of the outage in seconds
+      typedef std::function<void(double)> ReconnectHandler;
+      // sends a frame queued during the outage, on the supervisor thread
+      typedef std::function<bool(const CEC::cec_command &)> Sender;
+
+      enum QueueResult {
+         NOT_QUEUED,    // connected; the caller should transmit directly
+         QUEUED,
+         QUEUE_FULL,
+      };
+
+      Supervisor(ReconnectHandler on_reconnect, Sender send);
+      ~Supervisor();
+
+      // supervise the connection to port, retrying after initial_delay
+      // seconds and doubling the delay up to max_delay. Must be called
+      // without the GIL held.
+      void Start(Backend * lib, const std::string & port,
+            double initial_delay, double max_delay);
+      // stop supervising and drop any queued frames. Must be called
+      // without the GIL held.
+      void Stop();
+
+      // called from libcec's alert callback; never blocks on libcec
+      void ConnectionLost();
+
+      QueueResult Queue(const CEC::cec_command & cmd);
+      // the number of frames waiting to be sent
+      size_t Pending();
+
+   private:
+      void Run();
+
+      ReconnectHandler on_reconnect;
+      Sender send;
+
+      std::mutex lock;
+      std::condition_variable cond;
+      std::thread thread;
+
+      Backend * lib;
+      std::string port;
+      double initial_delay;
+      double max_delay;
+
+      bool running;
+      bool stopping;
+      bool lost;
+      std::chrono::steady_clock::time_point lost_at;
+      std::deque<CEC::cec_command> pending;
+};
+
+#endif
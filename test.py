@@ -1,6 +1,11 @@
 #!/usr/bin/env python
 
+import os
+import sys
+import tempfile
+import threading
 import time
+
 import cec
 
 adapters = cec.list_adapters()
@@ -32,14 +37,47 @@ if len(adapters) > 0:
    if test_power:
       print("Powering device on")
       print(d.power_on())
-      print("Sleeping to allow device to power on")
-      time.sleep(30)
+      print("Waiting for device to power on")
+      print(cec.wait_for(d.address, power="on", timeout=30))
       print(d.is_on())
       
       print("Powering device off")
       print(d.standby())
-      print("Sleeping to allow device to power off")
-      time.sleep(30)
+      print("Waiting for device to power off")
+      print(cec.wait_for(d.address, power="standby", timeout=30))
       print(d.is_on())
 
    print("Success!")
+
+# a frame queued while the adapter is away goes out from the primary address
+# once it is back, like one sent directly. The outage is made by serving a
+# simulated bus over a UNIX socket and stopping the server for a while
+if sys.platform != "win32":
+   path = os.path.join(tempfile.mkdtemp(), "cec.sock")
+   server = cec.Adapter()
+   server.init("sim://?devices=0,4")
+   sent = []
+   def log(event, level, t, message):
+      if message.startswith("<< ") and message.endswith(":46"):
+         sent.append(message)
+   server.add_callback(log, cec.EVENT_LOG)
+   server.serve(path)
+
+   client = cec.Adapter()
+   back = threading.Event()
+   client.add_callback(lambda *args: back.set(), cec.EVENT_RECONNECTED)
+   client.init("unix://" + path, reconnect=True)
+   print("Direct:", client.transmit(4, cec.CEC_OPCODE_GIVE_OSD_NAME))
+   server.serve(None)
+   time.sleep(0.5)
+   print("Queued:", client.transmit(4, cec.CEC_OPCODE_GIVE_OSD_NAME),
+         cec.Device(4, client).transmit(cec.CEC_OPCODE_GIVE_OSD_NAME))
+   server.serve(path)
+   assert back.wait(10), "no reconnect"
+   time.sleep(0.5)
+   client.close()
+   server.close()
+   print("Sent:", sent)
+   assert len(sent) == 3 and len(set(sent)) == 1, \
+      "replayed from another address"
+   print("Replay Success!")
@@ -0,0 +1,205 @@
+/* topology.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implementation of the HDMI topology tree and routing state machine
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "topology.h"
+
+using namespace CEC;
+
+static bool valid_addr(cec_logical_address addr) {
+   return addr >= CECDEVICE_TV && addr < CECDEVICE_BROADCAST;
+}
+
+static uint16_t param_physical_addr(const cec_command & cmd, uint8_t pos) {
+   if( cmd.parameters.size < pos + 2 ) return PHYSICAL_ADDR_INVALID;
+   return (cmd.parameters[pos] << 8) | cmd.parameters[pos + 1];
+}
+
+Topology::Topology() {
+   Clear();
+}
+
+void Topology::Clear() {
+   std::lock_guard<std::mutex> guard(lock);
+   for( int i=0; i<16; i++ ) {
+      physical[i] = PHYSICAL_ADDR_INVALID;
+   }
+   devices.clear();
+   active = CECDEVICE_UNKNOWN;
+   route = PHYSICAL_ADDR_INVALID;
+}
+
+void Topology::SetPhysicalAddressLocked(cec_logical_address addr,
+      uint16_t pa) {
+   if( !valid_addr(addr) ) return;
+   uint16_t old = physical[addr];
+   if( old == pa ) return;
+   if( old != PHYSICAL_ADDR_INVALID ) {
+      auto itr = devices.find(old);
+      if( itr != devices.end() && itr->second == addr ) {
+         devices.erase(itr);
+      }
+   }
+   physical[addr] = pa;
+   if( pa != PHYSICAL_ADDR_INVALID ) {
+      // a physical address belongs to exactly one device; if some other
+      // logical address claimed it before, that claim is stale
+      auto itr = devices.find(pa);
+      if( itr != devices.end() && itr->second != addr ) {
+         physical[itr->second] = PHYSICAL_ADDR_INVALID;
+      }
+      devices[pa] = addr;
+   }
+}
+
+void Topology::SetRouteLocked(uint16_t pa) {
+   route = pa;
+   // the device at the end of the route becomes the active source; if we
+   // don't know it yet it will announce itself with <Active Source>
+   auto itr = devices.find(pa);
+   active = (itr != devices.end()) ? itr->second : CECDEVICE_UNKNOWN;
+}
+
+void Topology::Update(const cec_command & cmd) {
+   if( !cmd.opcode_set ) return;
+
+   std::lock_guard<std::mutex> guard(lock);
+   uint16_t pa;
+   switch( cmd.opcode ) {
+      case CEC_OPCODE_REPORT_PHYSICAL_ADDRESS:
+         pa = param_physical_addr(cmd, 0);
+         if( pa != PHYSICAL_ADDR_INVALID ) {
+            SetPhysicalAddressLocked(cmd.initiator, pa);
+         }
+         break;
+      case CEC_OPCODE_ACTIVE_SOURCE:
+         pa = param_physical_addr(cmd, 0);
+         if( pa != PHYSICAL_ADDR_INVALID ) {
+            SetPhysicalAddressLocked(cmd.initiator, pa);
+            route = pa;
+         }
+         if( valid_addr(cmd.initiator) ) {
+            active = cmd.initiator;
+         }
+         break;
+      case CEC_OPCODE_INACTIVE_SOURCE:
+         pa = param_physical_addr(cmd, 0);
+         if( pa != PHYSICAL_ADDR_INVALID ) {
+            SetPhysicalAddressLocked(cmd.initiator, pa);
+         }
+         if( active == cmd.initiator ) {
+            active = CECDEVICE_UNKNOWN;
+         }
+         break;
+      case CEC_OPCODE_ROUTING_CHANGE:
+         // [original address] [new address]
+         pa = param_physical_addr(cmd, 2);
+         if( pa != PHYSICAL_ADDR_INVALID ) {
+            SetRouteLocked(pa);
+         }
+         break;
+      case CEC_OPCODE_ROUTING_INFORMATION:
+      case CEC_OPCODE_SET_STREAM_PATH:
+         pa = param_physical_addr(cmd, 0);
+         if( pa != PHYSICAL_ADDR_INVALID ) {
+            SetRouteLocked(pa);
+         }
+         break;
+      default:
+         break;
+   }
+}
+
+void Topology::SetPhysicalAddress(cec_logical_address addr, uint16_t pa) {
+   std::lock_guard<std::mutex> guard(lock);
+   SetPhysicalAddressLocked(addr, pa);
+}
+
+void Topology::SetActiveSource(cec_logical_address addr, bool is_active) {
+   std::lock_guard<std::mutex> guard(lock);
+   if( !valid_addr(addr) ) return;
+   if( is_active ) {
+      active = addr;
+      if( physical[addr] != PHYSICAL_ADDR_INVALID ) {
+         route = physical[addr];
+      }
+   } else if( active == addr ) {
+      active = CECDEVICE_UNKNOWN;
+   }
+}
+
+void Topology::SetRoute(uint16_t pa) {
+   std::lock_guard<std::mutex> guard(lock);
+   SetRouteLocked(pa);
+}
+
+cec_logical_address Topology::ActiveSource() const {
+   std::lock_guard<std::mutex> guard(lock);
+   return active;
+}
+
+uint16_t Topology::Route() const {
+   std::lock_guard<std::mutex> guard(lock);
+   return route;
+}
+
+uint16_t Topology::PhysicalAddress(cec_logical_address addr) const {
+   if( !valid_addr(addr) ) return PHYSICAL_ADDR_INVALID;
+   std::lock_guard<std::mutex> guard(lock);
+   return physical[addr];
+}
+
+cec_logical_address Topology::DeviceAt(uint16_t pa) const {
+   std::lock_guard<std::mutex> guard(lock);
+   auto itr = devices.find(pa);
+   return (itr != devices.end()) ? itr->second : CECDEVICE_UNKNOWN;
+}
+
+cec_logical_address Topology::DeviceBehindPort(uint16_t parent,
+      uint8_t port) const {
+   if( port < 1 || port > 15 ) return CECDEVICE_UNKNOWN;
+   // the child address replaces the first zero nibble of the parent
+   for( int shift = 12; shift >= 0; shift -= 4 ) {
+      if( ((parent >> shift) & 0xF) == 0 ) {
+         return DeviceAt(parent | (port << shift));
+      }
+   }
+   // parent is a leaf at the maximum depth
+   return CECDEVICE_UNKNOWN;
+}
+
+int Topology::PathTo(cec_logical_address addr,
+      uint16_t path[TOPOLOGY_MAX_DEPTH]) const {
+   uint16_t pa = PhysicalAddress(addr);
+   if( pa == PHYSICAL_ADDR_INVALID ) return 0;
+
+   int hops = 0;
+   uint16_t mask = 0;
+   path[hops++] = 0x0000;
+   for( int shift = 12; shift >= 0; shift -= 4 ) {
+      if( ((pa >> shift) & 0xF) == 0 ) break;
+      mask |= 0xF << shift;
+      path[hops++] = pa & mask;
+   }
+   return hops;
+}
@@ -0,0 +1,83 @@
+/* topology.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * HDMI topology and active source/routing state, built from the frames we
+ * observe on the bus. All queries are answered locally without touching
+ * libcec.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stdint.h>
+#include <mutex>
+#include <unordered_map>
+
+#include <libcec/cec.h>
+
+#define PHYSICAL_ADDR_INVALID 0xFFFF
+
+// the path from the root (the TV at 0.0.0.0) to a device is at most 5 hops
+#define TOPOLOGY_MAX_DEPTH 5
+
+class Topology {
+   public:
+      Topology();
+
+      void Clear();
+
+      // update the tree and routing state from a frame seen on the bus
+      void Update(const CEC::cec_command & cmd);
+
+      void SetPhysicalAddress(CEC::cec_logical_address addr, uint16_t pa);
+      void SetActiveSource(CEC::cec_logical_address addr, bool active);
+      void SetRoute(uint16_t pa);
+
+      // CECDEVICE_UNKNOWN if the active source has not been observed
+      CEC::cec_logical_address ActiveSource() const;
+      // PHYSICAL_ADDR_INVALID if no routing frame has been observed
+      uint16_t Route() const;
+
+      uint16_t PhysicalAddress(CEC::cec_logical_address addr) const;
+      CEC::cec_logical_address DeviceAt(uint16_t pa) const;
+      CEC::cec_logical_address DeviceBehindPort(uint16_t parent,
+            uint8_t port) const;
+
+      // fill path with the physical addresses from the root to addr;
+      // returns the number of hops, or 0 if addr has no known address
+      int PathTo(CEC::cec_logical_address addr,
+            uint16_t path[TOPOLOGY_MAX_DEPTH]) const;
+
+   private:
+      void SetPhysicalAddressLocked(CEC::cec_logical_address addr,
+            uint16_t pa);
+      void SetRouteLocked(uint16_t pa);
+
+      mutable std::mutex lock;
+
+      uint16_t physical[16];
+      std::unordered_map<uint16_t, CEC::cec_logical_address> devices;
+
+      CEC::cec_logical_address active;
+      uint16_t route;
+};
+
+#endif
@@ -0,0 +1,227 @@
+/* wire.cpp
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Framing and encoding for the cec server protocol
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#include "wire.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/types.h>
+#endif
+
+using namespace CEC;
+
+WireFilter::WireFilter() : events(WIRE_EVENTS_ALL), initiators(0xFFFF) {
+   memset(opcodes, 0xFF, sizeof(opcodes));
+}
+
+bool WireFilter::All() const {
+   for( size_t i=0; i<sizeof(opcodes); i++ ) {
+      if( opcodes[i] != 0xFF ) return false;
+   }
+   return true;
+}
+
+bool WireFilter::Passes(const cec_command & cmd) const {
+   if( !(events & WIRE_EVENT_BIT(WIRE_EVENT_COMMAND)) ) return false;
+   if( !(initiators & (1 << (cmd.initiator & 0xF))) ) return false;
+   if( !cmd.opcode_set ) return All();
+   uint8_t opcode = (uint8_t)cmd.opcode;
+   return (opcodes[opcode >> 3] >> (opcode & 7)) & 1;
+}
+
+void WireWriter::Put(const void * value, size_t size) {
+   data.append((const char *)value, size);
+}
+
+void WireWriter::PutString(const std::string & value) {
+   size_t size = value.size() < 0xFFFF ? value.size() : 0xFFFF;
+   Put16((uint16_t)size);
+   Put(value.data(), size);
+}
+
+void WireWriter::PutCommand(const cec_command & cmd) {
+   Put8((uint8_t)cmd.initiator);
+   Put8((uint8_t)cmd.destination);
+   Put8(cmd.ack);
+   Put8(cmd.eom);
+   Put8((uint8_t)cmd.opcode);
+   Put8(cmd.opcode_set);
+   Put32((uint32_t)cmd.transmit_timeout);
+   Put8(cmd.parameters.size);
+   Put(cmd.parameters.data, cmd.parameters.size);
+}
+
+void WireWriter::PutFilter(const WireFilter & filter) {
+   Put32(filter.events);
+   Put16(filter.initiators);
+   Put(filter.opcodes, sizeof(filter.opcodes));
+}
+
+WireReader::WireReader(const std::string & data) : ok(true),
+      pos(data.data()), left(data.size()) {
+}
+
+void WireReader::Get(void * value, size_t size) {
+   if( size > left ) {
+      ok = false;
+      left = 0;
+      memset(value, 0, size);
+      return;
+   }
+   memcpy(value, pos, size);
+   pos += size;
+   left -= size;
+}
+
+uint8_t WireReader::Get8() {
+   uint8_t value;
+   Get(&value, 1);
+   return value;
+}
+
+uint16_t WireReader::Get16() {
+   uint16_t value;
+   Get(&value, 2);
+   return value;
+}
+
+uint32_t WireReader::Get32() {
+   uint32_t value;
+   Get(&value, 4);
+   return value;
+}
+
+uint64_t WireReader::Get64() {
+   uint64_t value;
+   Get(&value, 8);
+   return value;
+}
+
+std::string WireReader::GetString() {
+   uint16_t size = Get16();
+   if( size > left ) {
+      ok = false;
+      left = 0;
+      return std::string();
+   }
+   std::string value(pos, size);
+   pos += size;
+   left -= size;
+   return value;
+}
+
+cec_command WireReader::GetCommand() {
+   cec_command cmd;
+   cmd.initiator = (cec_logical_address)Get8();
+   cmd.destination = (cec_logical_address)Get8();
+   cmd.ack = Get8();
+   cmd.eom = Get8();
+   cmd.opcode = (cec_opcode)Get8();
+   cmd.opcode_set = Get8();
+   cmd.transmit_timeout = (int32_t)Get32();
+   uint8_t size = Get8();
+   if( size > CEC_MAX_DATA_PACKET_SIZE ) {
+      ok = false;
+      size = 0;
+   }
+   cmd.parameters.Clear();
+   Get(cmd.parameters.data, size);
+   cmd.parameters.size = size;
+   return cmd;
+}
+
+WireFilter WireReader::GetFilter() {
+   WireFilter filter;
+   filter.events = Get32();
+   filter.initiators = Get16();
+   Get(filter.opcodes, sizeof(filter.opcodes));
+   return filter;
+}
+
+std::string WireFrame(uint16_t type, uint32_t id,
+      const std::string & payload) {
+   WireHeader header;
+   header.size = (uint32_t)payload.size();
+   header.type = type;
+   header.reserved = 0;
+   header.id = id;
+   std::string frame((const char *)&header, sizeof(header));
+   frame += payload;
+   return frame;
+}
+
+#ifndef _WIN32
+
+// don't let a client that went away kill the server with SIGPIPE
+#ifdef MSG_NOSIGNAL
+#define WIRE_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define WIRE_SEND_FLAGS 0
+#endif
+
+bool WireWrite(int fd, const std::string & data) {
+   const char * pos = data.data();
+   size_t left = data.size();
+   while( left > 0 ) {
+      ssize_t n = send(fd, pos, left, WIRE_SEND_FLAGS);
+      if( n < 0 && errno == EINTR ) continue;
+      if( n <= 0 ) return false;
+      pos += n;
+      left -= n;
+   }
+   return true;
+}
+
+static bool read_all(int fd, char * pos, size_t left) {
+   while( left > 0 ) {
+      ssize_t n = recv(fd, pos, left, 0);
+      if( n < 0 && errno == EINTR ) continue;
+      if( n <= 0 ) return false;
+      pos += n;
+      left -= n;
+   }
+   return true;
+}
+
+bool WireRead(int fd, WireHeader * header, std::string * payload) {
+   if( !read_all(fd, (char *)header, sizeof(*header)) ) return false;
+   if( header->size > WIRE_MAX_PAYLOAD ) return false;
+   payload->resize(header->size);
+   return header->size == 0 || read_all(fd, &(*payload)[0], header->size);
+}
+
+#else
+
+bool WireWrite(int fd, const std::string & data) {
+   return false;
+}
+
+bool WireRead(int fd, WireHeader * header, std::string * payload) {
+   return false;
+}
+
+#endif
@@ -0,0 +1,163 @@
+/* wire.h
+ *
+ * Copyright (C) 2013 Austin Hendrix <namniart@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The protocol between a cec server (Adapter.serve) and its clients
+ * (init("unix://...")), over a UNIX socket. Every message is a header
+ * followed by a payload of fixed size fields in host byte order, since
+ * both ends are on the same host. A client sends requests, one per
+ * Backend call, and the server answers each with a message of the same
+ * type and id; events from the bus are sent by the server with id 0.
+ *
+ * Author: Austin Hendrix <namniart@gmail.com>
+ */
+
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#include <libcec/cec.h>
+
+// the server and its clients deliver events through the callbacks in the
+// shape libcec 4 has them, and need UNIX sockets
+#if CEC_LIB_VERSION_MAJOR >= 4 && !defined(_WIN32)
+#define HAVE_CEC_SERVER 1
+#else
+#define HAVE_CEC_SERVER 0
+#endif
+
+// the server and its clients are separate processes and may be separate
+// builds; they must agree on this and on the size of the structures sent
+// whole
+#define WIRE_VERSION 1
+
+// a larger payload is a protocol error
+#define WIRE_MAX_PAYLOAD 65536
+
+struct WireHeader {
+   uint32_t size;    // of the payload that follows
+   uint16_t type;
+   uint16_t reserved;
+   uint32_t id;
+};
+
+enum WireType {
+   // requests, answered with the same type and id
+   WIRE_HELLO = 1,
+   WIRE_TRANSMIT,
+   WIRE_LOGICAL_ADDRESSES,
+   WIRE_ACTIVE_DEVICES,
+   WIRE_IS_ACTIVE_SOURCE,
+   WIRE_SET_ACTIVE_SOURCE,
+   WIRE_STREAM_PATH_ADDR,
+   WIRE_STREAM_PATH_PA,
+   WIRE_SET_PHYSICAL_ADDRESS,
+   WIRE_SET_HDMI_PORT,
+   WIRE_VOLUME_UP,
+   WIRE_VOLUME_DOWN,
+   WIRE_TOGGLE_MUTE,
+   WIRE_GET_CONFIGURATION,
+   WIRE_SET_CONFIGURATION,
+   WIRE_CAN_PERSIST,
+   WIRE_PERSIST,
+   WIRE_POWER_ON,
+   WIRE_STANDBY,
+   WIRE_POWER_STATUS,
+   WIRE_VENDOR_ID,
+   WIRE_PHYSICAL_ADDRESS,
+   WIRE_CEC_VERSION,
+   WIRE_OSD_NAME,
+   WIRE_MENU_LANGUAGE,
+   WIRE_DETECT_ADAPTERS,
+
+   // events, in the order of the cec.EVENT_* bits so that a subscription
+   // is a mask of those
+   WIRE_EVENT_LOG = 0x100,
+   WIRE_EVENT_KEYPRESS,
+   WIRE_EVENT_COMMAND,
+   WIRE_EVENT_CONFIG,
+   WIRE_EVENT_ALERT,
+   WIRE_EVENT_MENU,
+   WIRE_EVENT_ACTIVATED,
+};
+
+#define WIRE_EVENT_BIT(type) (1u << ((type) - WIRE_EVENT_LOG))
+#define WIRE_EVENTS_ALL 0x7F
+
+// the events a client wants; the server only sends those. Commands must
+// also come from an address in initiators and carry an opcode in
+// opcodes; polls, which have no opcode, only pass if every opcode does
+struct WireFilter {
+   uint32_t events;
+   uint16_t initiators;
+   uint8_t opcodes[32];
+
+   WireFilter();
+   bool All() const;
+   bool Passes(const CEC::cec_command & cmd) const;
+};
+
+// builds a payload
+class WireWriter {
+   public:
+      void Put8(uint8_t value) { Put(&value, 1); }
+      void Put16(uint16_t value) { Put(&value, 2); }
+      void Put32(uint32_t value) { Put(&value, 4); }
+      void Put64(uint64_t value) { Put(&value, 8); }
+      void Put(const void * data, size_t size);
+      // 16 bit length, then the bytes
+      void PutString(const std::string & value);
+      void PutCommand(const CEC::cec_command & cmd);
+      void PutFilter(const WireFilter & filter);
+
+      std::string data;
+};
+
+// reads a payload; a read past the end returns zeros and clears ok
+class WireReader {
+   public:
+      WireReader(const std::string & data);
+
+      uint8_t Get8();
+      uint16_t Get16();
+      uint32_t Get32();
+      uint64_t Get64();
+      void Get(void * data, size_t size);
+      std::string GetString();
+      CEC::cec_command GetCommand();
+      WireFilter GetFilter();
+
+      bool ok;
+
+   private:
+      const char * pos;
+      size_t left;
+};
+
+// a header and payload, ready to write
+std::string WireFrame(uint16_t type, uint32_t id, const std::string & payload);
+
+// write all of data to fd, or read one message from it. Both return false
+// if the connection is closed or broken, or on a protocol error
+bool WireWrite(int fd, const std::string & data);
+bool WireRead(int fd, WireHeader * header, std::string * payload);
+
+#endif